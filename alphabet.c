@@ -74,6 +74,7 @@ int alpha_reduce(int c)
 
 int alpha_enlarge(int c)
 {
+  c = ktuple_last(c);  // for k-tuples the BWT symbol is the last one
   assert(restricted_unmap[c]!= ILLEGAL_SYMBOL);
   return restricted_unmap[c];
 }
@@ -117,3 +118,192 @@ void remap_bwts(g_data *g)
   g->sizeOfAlpha = sizeOfAlphabet;
 }
 
+
+
+// ===== k-tuple squeezing (option -k)
+// Each symbol of the remapped BWTs is replaced by the k symbols preceding its
+// suffix, so that each Gap iteration extends the prefixes by k symbols.
+// A tuple c_k ... c_1 (c_1 is the BWT symbol, c_k the first symbol of the
+// suffix k positions before) is encoded as the base-a number with most
+// significant digit c_k, hence numerical order is lexicographic order.
+// Since the 0 symbols are all different and are not propagated, a tuple
+// containing a 0 is replaced by its last symbol c_1 (as a tuple it starts
+// with a 0): these are never propagated and only their last symbol is used.
+// The k-prefixes of the suffixes containing a 0 have all the symbols after
+// the 0 set to 0 so that each one defines a region of Z which is fixed as
+// the one of 0 (see init_arrays_ktuple in mergegap.c)
+
+static int ktuple_a = 0;   // size of the alphabet of single symbols
+static int ktuple_k = 1;   // number of symbols in a tuple
+static bool ktuple_zero[SIZE_OF_ALPHABET]; // ktuple_zero[s] is true if s contains a 0
+
+int intpow(int b, int e)
+{
+  int p = 1;
+  for(int i=0;i<e;i++) p *= b;
+  return p;
+}
+
+// largest k such that n^k tuples fit in a symbol (k=1 if n is too large)
+int squeezable(int n)
+{
+  int k = 1;
+  while(intpow(n,k+1) <= SIZE_OF_ALPHABET) k++;
+  return k;
+}
+
+void ktuple_init(int a, int k)
+{
+  assert(a>1 && k>0 && intpow(a,k) <= SIZE_OF_ALPHABET);
+  ktuple_a = a;
+  ktuple_k = k;
+  for(int s=0;s<intpow(a,k);s++) {
+    ktuple_zero[s] = false;
+    for(int i=0, t=s;i<k;i++, t/=a)
+      if(t%a==0) ktuple_zero[s] = true;
+  }
+}
+
+bool ktuple_has0(int s)
+{
+  return ktuple_zero[s];
+}
+
+// number of symbols before the first 0 (k if there is no 0)
+int ktuple_headlen(int s)
+{
+  int h = 0;
+  for(int p=intpow(ktuple_a,ktuple_k-1); p>0 && (s/p)%ktuple_a!=0; p/=ktuple_a)
+    h++;
+  return h;
+}
+
+// tuple with all symbols after the first 0 set to 0
+int ktuple_decode0(int s)
+{
+  int h = ktuple_headlen(s);
+  int p = intpow(ktuple_a,ktuple_k-h);
+  return (s/p)*p;
+}
+
+// true if s contains a 0 and all the following symbols are 0
+bool ktuple_tail0(int s)
+{
+  return ktuple_has0(s) && ktuple_decode0(s)==s;
+}
+
+// last symbol of the tuple, that is the BWT symbol (identity without squeezing)
+int ktuple_last(int s)
+{
+  return ktuple_k>1 ? s%ktuple_a : s;
+}
+
+// lcp of two tuples: 0 symbols are all different
+int ktuple_lcp(int x, int y)
+{
+  int l = 0;
+  for(int p=intpow(ktuple_a,ktuple_k-1); p>0; p/=ktuple_a, l++) {
+    int cx = (x/p)%ktuple_a, cy = (y/p)%ktuple_a;
+    if(cx==0 || cx!=cy) break;
+  }
+  return l;
+}
+
+void ktuple_info(FILE *f)
+{
+  fprintf(f,"Squeezing: %d-tuples over an alphabet of size %d, %d tuples\n",
+          ktuple_k,ktuple_a,intpow(ktuple_a,ktuple_k));
+}
+
+// print tuple s using the original symbols (0 is printed as $)
+void ktuple_print(FILE *f, int s)
+{
+  for(int p=intpow(ktuple_a,ktuple_k-1); p>0; p/=ktuple_a) {
+    int c = (s/p)%ktuple_a;
+    fputc(c==0 ? '$' : alpha_enlarge(c),f);
+  }
+}
+
+// frequencies of the k-prefixes of the suffixes of the BWT b[n] as used by
+// init_arrays_ktuple; freq should be of len a^k and it is not cleared
+void ktuple_init_freq(symbol *b, customInt n, customInt *freq)
+{
+  int a = ktuple_a;
+  symbol *p = malloc(n*sizeof(symbol)), *q = malloc(n*sizeof(symbol));
+  customInt C[SIZE_OF_ALPHABET], cnt[SIZE_OF_ALPHABET];
+  if(!p || !q) die(__func__);
+  init_freq(b,n,cnt);
+  for(int c=0, t=0;c<a;t+=cnt[c++]) C[c] = t;
+  // p[x] = first symbol of the suffix in row x
+  for(int c=0;c<a;c++)
+    for(customInt x=C[c]; x<C[c]+cnt[c]; x++) p[x] = c;
+  // q[LF(y)] = b[y] followed by the j-prefix p[y], stop at 0
+  for(int j=1, pw=a; j<ktuple_k; j++, pw*=a) {
+    for(int c=0;c<a;c++) cnt[c] = C[c];
+    for(customInt x=0;x<C[1];x++) q[x] = 0;
+    for(customInt y=0;y<n;y++) {
+      int c = b[y];
+      if(c!=0) q[cnt[c]++] = c*pw + p[y];
+    }
+    symbol *t = p; p = q; q = t;
+  }
+  for(customInt x=0;x<n;x++) freq[p[x]]++;
+  free(q);
+  free(p);
+}
+
+// replace each symbol of b[n] with the k-tuple preceding its suffix, or with
+// itself if the tuple contains a 0
+void ktuple_remap_string(symbol *b, customInt n)
+{
+  int a = ktuple_a;
+  symbol *orig = malloc(n*sizeof(symbol)), *prev = malloc(n*sizeof(symbol));
+  customInt C[SIZE_OF_ALPHABET], cnt[SIZE_OF_ALPHABET];
+  if(!orig || !prev) die(__func__);
+  memcpy(orig,b,n*sizeof(symbol));
+  init_freq(b,n,cnt);
+  for(int c=0, t=0;c<a;t+=cnt[c++]) C[c] = t;
+  // b[i] becomes prev[LF(i)] followed by orig[i]: j+1 symbols
+  for(int j=1, pw=1; j<ktuple_k; j++, pw*=a) {
+    memcpy(prev,b,n*sizeof(symbol));
+    for(int c=0;c<a;c++) cnt[c] = C[c];
+    for(customInt i=0;i<n;i++) {
+      int c = orig[i];
+      int t = prev[cnt[c]++];    // j symbols without 0 iff t>=a^(j-1) 
+      b[i] = (c!=0 && t>=pw) ? t*a+c : c;
+    }
+  }
+  free(prev);
+  free(orig);
+}
+
+// squeeze the remapped BWTs in g to g->ktuple-tuples: init g->sizeOfAlpha,
+// g->ktuple0 and g->bwtOcc (which must be used since it contains the number
+// of k-prefixes of each kind, not the frequencies of the tuples)
+void ktuple_remap_bwts(g_data *g)
+{
+  assert(g->smallAlpha && g->ktuple>1);
+  int a = g->sizeOfAlpha;
+  int kmax = squeezable(a);
+  if(kmax<2) {
+    printf("Alphabet too large for squeezing: option -k ignored\n");
+    g->ktuple = 1;
+    return;
+  }
+  if(g->ktuple>kmax) {
+    printf("Alphabet size %d: using %d-tuples\n",a,kmax);
+    g->ktuple = kmax;
+  }
+  ktuple_init(a,g->ktuple);
+  if(g->verbose>0) ktuple_info(stdout);
+  g->sizeOfAlpha = intpow(a,g->ktuple);
+  free(g->bwtOcc[0]);
+  g->bwtOcc[0] = calloc(g->numBwt*g->sizeOfAlpha,sizeof(customInt));
+  if(!g->bwtOcc[0]) die(__func__);
+  for(int i=0;i<g->numBwt;i++) {
+    if(i>0) g->bwtOcc[i] = g->bwtOcc[i-1] + g->sizeOfAlpha;
+    ktuple_init_freq(g->bws[i],g->bwtLen[i],g->bwtOcc[i]);
+    ktuple_remap_string(g->bws[i],g->bwtLen[i]);
+  }
+  g->ktuple0 = ktuple_zero;
+}
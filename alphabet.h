@@ -23,5 +23,6 @@ int ktuple_last(int s);
 void ktuple_info(FILE *f);
 void ktuple_print(FILE *f, int s);
 int ktuple_lcp(int x, int y);
-// void ktuple_remap_string(symbol *bwt, customInt n, customInt *freq, int a, int k);
+void ktuple_remap_string(symbol *b, customInt n);
+void ktuple_remap_bwts(g_data *g);
 #endif
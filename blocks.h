@@ -17,6 +17,11 @@
  * The proto block consists of the last seen characters, it can become part
  * of a liquid block if it turns out to be monochrome. 
  *
+ * On file solid blocks are stored in a compact format, see writeBlock()
+ * In internal memory the solid block lists are kept in RAM using the same 
+ * format, and moved to a file only if they exceed the memory allowed by 
+ * mem_plan(), see ibHead_open_out()
+ *
  */
 
 // irrelevant solid block to be skipped at each occurrence
@@ -65,6 +70,19 @@ typedef struct {
   solidBlock *solidList;
   customInt *occList;
   smallSolidInt *smallOccList;
+  uint8_t *vbuf;        // encoding buffer used by readBlock and writeBlock
+  customInt rlast;      // end of the last block read from fin, and of the last one  
+  customInt wlast;      // written to fout: positions are delta encoded (see readFirstBlock)
+  uint64_t bytes;       // bytes written to fout in the current pass, and bytes taken by the  
+  uint64_t rawBytes;    // same blocks with the fixed size format of smallOcc/POS_SIZE counters
+  // in-memory lists: mem[0] replaces fin if inMem, mem[1] replaces fout if outMem
+  uint8_t *mem[2];
+  size_t memLen[2];     // bytes in each list
+  size_t memSize[2];    // bytes allocated for each list
+  size_t memPos;        // read position inside mem[0]
+  size_t memCap;        // max bytes of the two lists together, 0 to use only files 
+  bool inMem, outMem;
+  char *path;           // directory of the files 
 } solidBlockFile;
 
 
@@ -133,6 +151,18 @@ solidBlockFile *ibHead_new(g_data *g) {
   if(ibList==NULL) die("Out of mem in inHead_new");
   ibList->fin = ibList->fout = NULL;
   ibList->occ_size = g->sizeOfAlpha + g->numBwt;
+  // max size of an encoded block: size, beginsAt, length, #counters and a pair for each counter 
+  ibList->vbuf = malloc((2*ibList->occ_size+4)*VARINT_MAX_BYTES);
+  if(ibList->vbuf==NULL) die("Out of mem in inHead_new");
+  ibList->rlast = ibList->wlast = 0;
+  ibList->bytes = ibList->rawBytes = 0;
+  ibList->mem[0] = ibList->mem[1] = NULL;
+  ibList->memLen[0] = ibList->memLen[1] = 0;
+  ibList->memSize[0] = ibList->memSize[1] = 0;
+  ibList->memPos = 0;
+  ibList->memCap = g->buf.solidStore;
+  ibList->inMem = ibList->outMem = false;
+  ibList->path = g->outPath;
   ibList->solidList = NULL;
   ibList->occList = NULL;
   ibList->smallOccList = NULL;
@@ -166,6 +196,9 @@ void ibHead_free(solidBlockFile *b)
     smallSolidInt *tmp = n[0];
     free(next); next = tmp;
   }}
+  free(b->vbuf);
+  free(b->mem[0]);
+  free(b->mem[1]);
   free(b);
 }  
   
@@ -297,6 +330,13 @@ static solidBlock *liquidToSolid(liquidBlock *s, solidBlockFile *sf) {
 
 // --------- single block functions
 
+// i-th entry of the occ array of a solid block
+static customInt block_occ(solidBlock *b, int i)
+{
+  if(b->endsAt - b->beginsAt <= SMALLSOLID_LIMIT) return b->smallOcc[i];
+  return b->occ[i];
+}
+
 
 /* * skip an irrelevant block
  * \param this  pointer to block to be skipped
@@ -305,15 +345,15 @@ static solidBlock *liquidToSolid(liquidBlock *s, solidBlockFile *sf) {
 static void skip(solidBlock *this, g_data *g)
 {
   if(g->extMem && g->fmergeColor!=NULL) {// this is because merge8 supports extMem but not extMem colors 
-    fseek(g->fmergeColor,(this->endsAt-this->beginsAt)*sizeof(palette),SEEK_CUR);
-    assert(ftell(g->fmergeColor)==this->endsAt*sizeof(palette));
+    zreader_skip(g->fmergeColor,(this->endsAt-this->beginsAt)*g->zBytes);
+    assert(zreader_tell(g->fmergeColor)==this->endsAt*g->zBytes);
   }
   if(this->endsAt - this->beginsAt <= SMALLSOLID_LIMIT){
     // skip in bwt array 
     for (int col = 0; col < g->numBwt; col++) 
       if(this->smallOcc[col]>0) {
         g->inCnt[col] += this->smallOcc[col];    //skipping this
-        if(g->extMem) fseek(g->bwf[col], this->smallOcc[col]*sizeof(symbol), SEEK_CUR);
+        if(g->extMem) breader_skip(&g->bwf[col], this->smallOcc[col]*sizeof(symbol));
       }
     // skip in new_merge array  
     for (int c = 0; c < g->sizeOfAlpha; ++c)
@@ -321,7 +361,7 @@ static void skip(solidBlock *this, g_data *g)
         g->F[c]+= this->smallOcc[g->numBwt+c];
         if(g->extMem && c>0 && g->fnewMergeColor!=NULL) {
           cwriter_skip(&g->fnewMergeColor[c],this->smallOcc[g->numBwt+c]);
-          assert(cwriter_tell(&g->fnewMergeColor[c])==g->F[c]*sizeof(palette));
+          assert(cwriter_tell(&g->fnewMergeColor[c])==g->F[c]*g->zBytes);
         }
       }
   } 
@@ -329,14 +369,14 @@ static void skip(solidBlock *this, g_data *g)
     for (int col = 0; col < g->numBwt; col++) 
       if(this->occ[col]>0) {
         g->inCnt[col] += this->occ[col];        //skipping this
-        if(g->extMem) fseek(g->bwf[col], this->occ[col]*sizeof(symbol), SEEK_CUR);
+        if(g->extMem) breader_skip(&g->bwf[col], this->occ[col]*sizeof(symbol));
       }
     for (int c = 0; c < g->sizeOfAlpha; ++c) 
       if(this->occ[g->numBwt+c]>0) {
         g->F[c] += this->occ[g->numBwt+c];
         if(g->extMem && c>0 && g->fnewMergeColor!=NULL) {
           cwriter_skip(&g->fnewMergeColor[c],this->occ[g->numBwt+c]);
-          assert(cwriter_tell(&g->fnewMergeColor[c])==g->F[c]*sizeof(palette));
+          assert(cwriter_tell(&g->fnewMergeColor[c])==g->F[c]*g->zBytes);
         }
       }
   }
@@ -345,15 +385,15 @@ static void skip(solidBlock *this, g_data *g)
 static void skip128ext(solidBlock *this, bitfile *b, g_data *g)
 {
   // we have already read the color at position this->beginsAt (we needed the bit value) 
-  fseek(g->fmergeColor,((this->endsAt-this->beginsAt)-1)*sizeof(palette),SEEK_CUR);
-  assert(ftell(g->fmergeColor)==this->endsAt*sizeof(palette));
+  zreader_skip(g->fmergeColor,((this->endsAt-this->beginsAt)-1)*g->zBytes);
+  assert(zreader_tell(g->fmergeColor)==this->endsAt*g->zBytes);
   
   if(this->endsAt - this->beginsAt <= SMALLSOLID_LIMIT){
     // skip in bwt array 
     for (int col = 0; col < g->numBwt; col++) 
       if(this->smallOcc[col]>0) {
         g->inCnt[col] += this->smallOcc[col];    //skipping this
-        fseek(g->bwf[col], this->smallOcc[col]*sizeof(symbol), SEEK_CUR);
+        breader_skip(&g->bwf[col], this->smallOcc[col]*sizeof(symbol));
       }
     // skip in new_merge array  
     for (int c = 0; c < g->sizeOfAlpha; ++c)
@@ -361,7 +401,7 @@ static void skip128ext(solidBlock *this, bitfile *b, g_data *g)
         g->F[c]+= this->smallOcc[g->numBwt+c];
         if(c>0) {
           cwriter_skip(&g->fnewMergeColor[c],this->smallOcc[g->numBwt+c]);
-          assert(cwriter_tell(&g->fnewMergeColor[c])==g->F[c]*sizeof(palette));
+          assert(cwriter_tell(&g->fnewMergeColor[c])==g->F[c]*g->zBytes);
         }
       }
   } 
@@ -369,14 +409,14 @@ static void skip128ext(solidBlock *this, bitfile *b, g_data *g)
     for (int col = 0; col < g->numBwt; col++) 
       if(this->occ[col]>0) {
         g->inCnt[col] += this->occ[col];        //skipping this
-        fseek(g->bwf[col], this->occ[col]*sizeof(symbol), SEEK_CUR);
+        breader_skip(&g->bwf[col], this->occ[col]*sizeof(symbol));
       }
     for (int c = 0; c < g->sizeOfAlpha; ++c) 
       if(this->occ[g->numBwt+c]>0) {
         g->F[c] += this->occ[g->numBwt+c];
         if(c>0) {
           cwriter_skip(&g->fnewMergeColor[c],this->occ[g->numBwt+c]);
-          assert(cwriter_tell(&g->fnewMergeColor[c])==g->F[c]*sizeof(palette));
+          assert(cwriter_tell(&g->fnewMergeColor[c])==g->F[c]*g->zBytes);
         }
       }
   }
@@ -568,13 +608,17 @@ static inline void tba_or_m(uint64_t *a, customInt i, uint64_t m)
   customInt r = i%32;
   a[q] = a[q] | (m<< (2*r));
 }
-static inline void tba_mark_if0(uint64_t *a, customInt i, uint64_t m)
+// set a[i] = m if a[i]==0, return true if a[i] has been changed
+static inline bool tba_mark_if0(uint64_t *a, customInt i, uint64_t m)
 {
   assert(m==1 || m==2);
   customInt q = i/32;
   customInt r = i%32;
-  if( ((a[q]>> (2*r)) & 3) == 0)
+  if( ((a[q]>> (2*r)) & 3) == 0) {
     a[q] = a[q] | (m<< (2*r));
+    return true;
+  }
+  return false;
 }
 // return true if we are at the begining of a block 
 // that is if a[i]==11 || a[i]== ~m   (note: m is 01 or 10)
@@ -596,8 +640,119 @@ static inline bool tba_block_test_set(uint64_t *a,customInt i, int m, bool *rece
     *recent = false;
     return true;
   }
-  return false; // do not change recent 
-} 
+  return false; // do not change recent
+}
+
+// multithread versions of the above two functions: entries in the same 64 bit word
+// can be updated simultaneously by different threads, so words are modified with an atomic or.
+// Since an entry only changes from 00 to m (mark) or from ~m to 11 (test) the outcome
+// does not depend on the order in which the threads access the word
+static inline void tba_mark_if0_mt(uint64_t *a, customInt i, uint64_t m)
+{
+  assert(m==1 || m==2);
+  customInt q = i/32;
+  customInt r = i%32;
+  if( ((__atomic_load_n(&a[q],__ATOMIC_RELAXED)>> (2*r)) & 3) == 0)
+    __atomic_fetch_or(&a[q], m<< (2*r), __ATOMIC_RELAXED);
+}
+static inline bool tba_block_test_set_mt(uint64_t *a,customInt i, int m, bool *recent)
+{
+  assert(m==1 || m==2);
+  customInt q = i/32;
+  customInt r = i%32;
+  int b2 = (__atomic_load_n(&a[q],__ATOMIC_RELAXED) >> (2*r)) & 3;
+  if(b2==3-m) {
+    *recent = true;
+    __atomic_fetch_or(&a[q], (uint64_t) 3 << (2*r), __ATOMIC_RELAXED); // make the block not recent
+    return true;
+  }
+  else if(b2==3) {
+    *recent = false;
+    return true;
+  }
+  return false; // do not change recent
+}
+
+// ---- search of the next block boundary, used to skip the test of B inside blocks
+// During an iteration an entry only changes from 00 to m (tba_mark_if0) or from ~m to 11
+// (tba_block_test_set) so the positions where a block starts, i.e. those where the
+// bit ~m of the entry is set, do not change until the end of the iteration.
+// Hence we can look for the next such position testing whole words
+// (32 entries per uint64_t, 128 per AVX2 vector) and then scan the block interior
+// without accessing B. Most blocks are short, so the kernels only do this after
+// Block_search_min positions of the current block have been tested one at a time.
+// The binaries are not compiled with -mavx2: the AVX2 loop is the only code using
+// those instructions and it is selected at runtime if the cpu supports them
+
+#if defined(__x86_64__) || defined(__i386__)
+// skip the groups of 4 words starting at a[i*esize] with an empty intersection
+// with mask, return the index of the first entry of the first group not skipped
+static __attribute__((target("avx2"),noinline)) customInt bytes_skip_zero_avx2(const uint8_t *a, customInt i, customInt end, int esize, uint64_t mask)
+{
+  const int epw = 8/esize;  // entries per word
+  const __m256i vmask = _mm256_set1_epi64x(mask);
+  while(i+4*epw<=end && _mm256_testz_si256(_mm256_loadu_si256((const __m256i *)(a+i*esize)),vmask))
+    i += 4*epw;
+  return i;
+}
+#endif
+
+// return the first j in [i,end) such that the entries of size esize bytes
+// starting at a[j*esize] have a nonzero intersection with mask (replicated
+// over a word); return end if there is no such j
+static __attribute__((noinline)) customInt bytes_next_nonzero(const uint8_t *a, customInt i, customInt end, int esize, uint64_t mask)
+{
+  uint64_t w;
+  const int epw = 8/esize;  // entries per word
+  #if defined(__x86_64__) || defined(__i386__)
+  if(__builtin_cpu_supports("avx2"))
+    i = bytes_skip_zero_avx2(a,i,end,esize,mask);
+  #endif
+  for( ; i+epw<=end; i+=epw) {
+    memcpy(&w,a+i*esize,sizeof(w));
+    if((w &= mask)!=0) return i + __builtin_ctzll(w)/(8*esize);
+  }
+  for( ; i<end; i++) { // last entries one at a time
+    w=0; memcpy(&w,a+i*esize,esize);
+    if((w & mask)!=0) return i;
+  }
+  return end;
+}
+
+// return the first j in [i,end) where a block starts (a[j]==11 || a[j]==~m), or end
+static inline customInt tba_next_block(const uint64_t *a, customInt i, customInt end, int m)
+{
+  assert(m==1 || m==2);
+  if(i>=end) return end;
+  uint64_t mask = (m==1) ? 0xAAAAAAAAAAAAAAAAULL : 0x5555555555555555ULL; // bit ~m of each entry
+  customInt q = i/32;
+  uint64_t w = a[q] & mask & (~(uint64_t)0 << (2*(i%32))); // first word: ignore entries before i
+  if(w==0) {
+    customInt j = bytes_next_nonzero((const uint8_t *) a, q+1, (end+31)/32, 8, mask);
+    if(j==(end+31)/32) return end;
+    w = a[j] & mask; q = j;
+  }
+  customInt j = q*32 + __builtin_ctzll(w)/2;
+  return j<end ? j : end;
+}
+
+// multithread version of the above function: other threads can mark entries of the same words
+// (changing bit m but not bit ~m) so words are read with atomic loads
+static inline customInt tba_next_block_mt(uint64_t *a, customInt i, customInt end, int m)
+{
+  assert(m==1 || m==2);
+  uint64_t mask = (m==1) ? 0xAAAAAAAAAAAAAAAAULL : 0x5555555555555555ULL; // bit ~m of each entry
+  for(customInt q=i/32; q*32<end; q++) {
+    uint64_t w = __atomic_load_n(&a[q],__ATOMIC_RELAXED) & mask;
+    if(q==i/32) w &= ~(uint64_t)0 << (2*(i%32));  // ignore entries before i
+    if(w!=0) {
+      customInt j = q*32 + __builtin_ctzll(w)/2;
+      return j<end ? j : end;
+    }
+  }
+  return end;
+}
+
 // report value
 int tba_get(uint64_t *a,customInt i)
 {
@@ -644,6 +799,14 @@ static inline bool tba_block_test_set8(uint8_t *a,customInt i, int m, bool *rece
 } 
 
 
+// return the first j in [i,end) where a block starts (a[j]>>6 == 11 or ~m), or end
+static inline customInt tba_next_block8(const uint8_t *a, customInt i, customInt end, int m)
+{
+  assert(m==1 || m==2);
+  return bytes_next_nonzero(a,i,end,1,(m==1) ? 0x8080808080808080ULL : 0x4040404040404040ULL);
+}
+
+
 // ---- same tba functions for the case the B array id stored in the two most signficant bits 
 // of the merge array (each entry now 16 bits)
 
@@ -685,74 +848,301 @@ static inline bool tba_block_test_set16(uint16_t *a,customInt i, int m, bool *re
 
 
 
+// return the first j in [i,end) where a block starts (a[j]>>14 == 11 or ~m), or end
+static inline customInt tba_next_block16(const uint16_t *a, customInt i, customInt end, int m)
+{
+  assert(m==1 || m==2);
+  return bytes_next_nonzero((const uint8_t *) a,i,end,2,(m==1) ? 0x8000800080008000ULL : 0x4000400040004000ULL);
+}
+
+
 // ===== handle blocks on file ===== 
+// Each solid block is stored as a varint with the number of bytes that follow it, 
+// so that the block can be read with a single fread, and then the varints:
+//   beginsAt - (endsAt of the previous block in the file), endsAt - beginsAt, 
+//   2*(number of nonzero counters) + dense,
+// followed, if !dense, by a pair (index - index of the previous nonzero counter, counter) 
+// for each nonzero counter, otherwise by all the occ_size counters. Usually a block 
+// contains few BWTs and symbols so most counters are zero and are not stored at all; 
+// when more than half of them are nonzero the pairs would take more space than the 
+// dense format, which costs about one byte per counter
+
+// store x in p using 7 bits per byte, least significant first, 
+// return the first byte after x 
+static inline uint8_t *varint_put(uint8_t *p, uint64_t x)
+{
+  while(x>=0x80) {
+    *p++ = (uint8_t) (x | 0x80);
+    x >>= 7;
+  }
+  *p++ = (uint8_t) x;
+  return p;
+}
+
+// decode the varint starting at *p advancing *p, end is the end of the buffer
+static inline uint64_t varint_get(const uint8_t **p, const uint8_t *end)
+{
+  if(*p<end && **p<0x80) return *(*p)++; // most counters fit in one byte
+  uint64_t x = 0;
+  for(int shift=0; shift<64 && *p<end; shift+=7) {
+    uint8_t c = *(*p)++;
+    x |= ((uint64_t) (c & 0x7F)) << shift;
+    if(c<0x80) return x;
+  }
+  die("corrupted tmp file in varint_get");
+  return 0;
+}
+
+// dense format for smallOcc: store the n counters in a[] as varints starting at p,
+// return the first byte after them. Groups of 8 counters < 0x80 are copied as bytes 
+static inline uint8_t *varint_put_small(uint8_t *p, const smallSolidInt *a, int n)
+{
+  int j=0;
+  while(j<n) {
+    if(j+8<=n) {
+      smallSolidInt o = 0;
+      for(int k=0;k<8;k++) o |= a[j+k];
+      if(o<0x80) {
+        for(int k=0;k<8;k++) p[k] = (uint8_t) a[j+k];
+        p+=8; j+=8;
+        continue;
+      }
+    }
+    p = varint_put(p,a[j++]);
+  }
+  return p;
+}
+
+// inverse of varint_put_small: decode n counters to a[] from p, advancing p 
+static inline void varint_get_small(smallSolidInt *a, int n, const uint8_t **p, const uint8_t *end)
+{
+  int j=0;
+  while(j<n) {
+    if(j+8<=n && *p+8<=end) {
+      uint64_t w;
+      memcpy(&w,*p,8);
+      if((w & 0x8080808080808080ULL)==0) {
+        for(int k=0;k<8;k++) a[j+k] = (*p)[k];
+        *p+=8; j+=8;
+        continue;
+      }
+    }
+    a[j++] = (smallSolidInt) varint_get(p,end);
+  }
+}
+
+// ----- handle the input and output lists of a pass  
+// An iteration reads the solid blocks from the input list and writes the new 
+// ones to the output list, which becomes the input list of the next iteration.
+// When memCap>0 the lists are kept in RAM: if the two lists together would exceed 
+// memCap the output list is moved to a file and the pass goes on there 
+
+// start writing a new output list 
+static void ibHead_open_out(solidBlockFile *sf)
+{
+  assert(sf->fout==NULL && !sf->outMem);
+  if(sf->memCap>0) {
+    sf->outMem = true;
+    sf->memLen[1] = 0;
+  }
+  else sf->fout = gap_tmpfile(sf->path);
+  sf->bytes = 0;
+}
+
+// bytes written to the output list
+static inline uint64_t ibHead_out_size(solidBlockFile *sf)
+{
+  return sf->bytes;
+}
+
+// close the input list
+static void ibHead_close_in(solidBlockFile *sf)
+{
+  if(sf->fin!=NULL) fclose(sf->fin);
+  sf->fin = NULL;
+  sf->inMem = false;
+  sf->memLen[0] = 0;
+}
+
+// close the output list without reading it
+static void ibHead_close_out(solidBlockFile *sf)
+{
+  if(sf->fout!=NULL) fclose(sf->fout);
+  sf->fout = NULL;
+  sf->outMem = false;
+}
+
+// the output list becomes the input list for the next pass
+static void ibHead_rotate(solidBlockFile *sf)
+{
+  ibHead_close_in(sf);
+  if(sf->outMem) { // swap the buffers, the old input one will get the next output list 
+    uint8_t *m = sf->mem[0]; sf->mem[0] = sf->mem[1]; sf->mem[1] = m;
+    size_t s = sf->memSize[0]; sf->memSize[0] = sf->memSize[1]; sf->memSize[1] = s;
+    sf->memLen[0] = sf->memLen[1]; sf->memLen[1] = 0;
+    sf->memPos = 0;
+    sf->inMem = true;
+    sf->outMem = false;
+  }
+  else {
+    rewind(sf->fout);
+    sf->fin = sf->fout;
+    sf->fout = NULL;
+  }
+}
+
+// append the n bytes in b to the output list 
+static inline void ibHead_write(solidBlockFile *sf, const uint8_t *b, size_t n)
+{
+  if(sf->outMem) {
+    size_t len = sf->memLen[1] + n;
+    if(len + sf->memLen[0] > sf->memCap) { // no more room: continue on file 
+      sf->fout = gap_tmpfile(sf->path);
+      if(fwrite(sf->mem[1],1,sf->memLen[1],sf->fout)!=sf->memLen[1]) die("tmp file write error in ibHead_write");
+      tmp_fdrop_behind(sf->fout,sf->memLen[1],true);
+      sf->outMem = false;
+    }
+    else {
+      if(len>sf->memSize[1]) {
+        size_t size = max(2*sf->memSize[1],len);
+        size = min(size,sf->memCap);
+        sf->mem[1] = realloc(sf->mem[1],size);
+        if(sf->mem[1]==NULL) die("Out of mem in ibHead_write");
+        sf->memSize[1] = size;
+      }
+      memcpy(sf->mem[1]+sf->memLen[1],b,n);
+      sf->memLen[1] = len;
+      return;
+    }
+  }
+  if(fwrite(b,1,n,sf->fout)!=n) die("tmp file write error in writeBlock");
+  tmp_fdrop_behind(sf->fout,n,true);
+}
 
 // read a solid block from file 
 // the liquid block s is used only to access the local heap and for occ_size
 static solidBlock *readBlock(solidBlockFile *sf) 
 {
-  if(sf->fin==NULL) return NULL;
-  // read size of block
-  customInt buffer[SIZE_OF_ALPHABET+MAX_NUMBER_OF_BWTS];
-  int e = fread(buffer,sizeof(customInt),2,sf->fin);
-  if(e==0) return NULL; // no more blocks
-  if(e!=2) die("tmp file read error in readBlock (1)");
+  const uint8_t *p, *end;
+  if(sf->inMem) { // the block is decoded in place 
+    if(sf->memPos==sf->memLen[0]) return NULL; // no more blocks
+    p = sf->mem[0] + sf->memPos;
+    end = sf->mem[0] + sf->memLen[0];
+    size_t n = varint_get(&p,end);
+    if(n > (size_t) (end-p)) die("corrupted tmp list in readBlock (1)");
+    end = p + n;
+    sf->memPos = end - sf->mem[0];
+  }
+  else {
+    if(sf->fin==NULL) return NULL;
+    // read the size of the encoded block 
+    size_t n = 0, h = 0;
+    for(int shift=0; ; shift+=7) {
+      int c = getc_unlocked(sf->fin);
+      if(c==EOF) {
+        if(h==0) return NULL; // no more blocks
+        die("tmp file read error in readBlock (1)");
+      }
+      n |= ((size_t) (c & 0x7F)) << shift;
+      h++;
+      if(c<0x80) break;
+      if(h==VARINT_MAX_BYTES) die("corrupted tmp file in readBlock (1)");
+    }
+    if(n > (size_t) (2*sf->occ_size+3)*VARINT_MAX_BYTES) die("corrupted tmp file in readBlock (1)");
+    if(fread(sf->vbuf,1,n,sf->fin)!=n) die("tmp file read error in readBlock (2)");
+    tmp_fdrop_behind(sf->fin,h+n,false);
+    p = sf->vbuf; end = sf->vbuf + n;
+  }
   // ----- get solid block from s->solidList or malloc
   solidBlock *newB = get_block(sf);  
-  newB->beginsAt = buffer[0];
-  newB->endsAt = buffer[1];
-  // printf("Reading [%ld %ld]\n",newB->beginsAt,newB->endsAt); //!!!!!!
+  newB->beginsAt = sf->rlast + varint_get(&p,end);
+  newB->endsAt = newB->beginsAt + varint_get(&p,end);
+  sf->rlast = newB->endsAt;
+  uint64_t nz = varint_get(&p,end);
+  bool dense = nz&1;
+  nz >>= 1;
+  if(nz>sf->occ_size) die("corrupted tmp file in readBlock (2)");
   // --- get and init occ/smallOcc array
-  if (newB->endsAt - newB->beginsAt <= SMALLSOLID_LIMIT) {
+  if(newB->endsAt - newB->beginsAt <= SMALLSOLID_LIMIT) {
     // small solid block
     newB->smallOcc = get_smallocc(sf);
-    e = fread(newB->smallOcc,sizeof(smallSolidInt),sf->occ_size,sf->fin);
-    if(e!=sf->occ_size) die("tmp file read error in readBlock (2)");
+    if(dense) varint_get_small(newB->smallOcc,sf->occ_size,&p,end);
+    else {
+      memset(newB->smallOcc,0,sf->occ_size*sizeof(smallSolidInt));
+      for(uint64_t i=0,j=0;i<nz;i++) {
+        j += varint_get(&p,end);
+        if(j>=sf->occ_size) die("corrupted tmp file in readBlock (3)");
+        newB->smallOcc[j] = (smallSolidInt) varint_get(&p,end);
+      }
+    }
   }
   else { // large solid block 
     newB->occ = get_occ(sf);
-    memset(newB->occ,0,sf->occ_size*sizeof(customInt));// zero all values
-    uint8_t *byteBuffer = (uint8_t *) buffer; // transform to an uint8_t buffer
-    e = fread(byteBuffer,POS_SIZE,sf->occ_size,sf->fin); // read POS_SIZE bytes for customInt
-    if(e!=sf->occ_size) die("tmp file read error in readBlock (3)");
-    // fill newB->occ using five bytes for entry
-    for(int j=0;j<sf->occ_size;j++) {
-      for(int i=0;i<POS_SIZE;i++) 
-        newB->occ[j] |= ((customInt) byteBuffer[j*POS_SIZE+i]) << (8*i);  
+    if(dense) 
+      for(int j=0;j<sf->occ_size;j++) newB->occ[j] = varint_get(&p,end);
+    else {
+      memset(newB->occ,0,sf->occ_size*sizeof(customInt));
+      for(uint64_t i=0,j=0;i<nz;i++) {
+        j += varint_get(&p,end);
+        if(j>=sf->occ_size) die("corrupted tmp file in readBlock (3)");
+        newB->occ[j] = varint_get(&p,end);
+      }
     }
   }
+  if(p!=end) die("corrupted tmp file in readBlock (4)");
   newB->nextBlock=NULL;
   return newB;
 }    
 
-// write solid block s to file and deallocate it
+// read the first block of a pass over the solid blocks: the pass also writes 
+// the new list from its beginning, so the delta encoding restarts in both files
+static solidBlock *readFirstBlock(solidBlockFile *sf) 
+{
+  sf->rlast = sf->wlast = 0;
+  sf->bytes = sf->rawBytes = 0;
+  sf->memPos = 0;
+  return readBlock(sf);
+}
+
+// write solid block s to the output list and deallocate it
 static void writeBlock(solidBlock *s, solidBlockFile *sf)
 {
   assert(s!=NULL);
-  assert(sf!=NULL && sf->fout!=NULL);
-  customInt buffer[SIZE_OF_ALPHABET+MAX_NUMBER_OF_BWTS];
-  buffer[0] = s->beginsAt;
-  buffer[1] = s->endsAt;
-  int e = fwrite(buffer,sizeof(customInt),2,sf->fout);
-  if(e!=2) die("tmp file write in writeBlock (1)");
-  if (s->endsAt - s->beginsAt <= SMALLSOLID_LIMIT) {
-    // small solid block
-    e = fwrite(s->smallOcc,sizeof(smallSolidInt),sf->occ_size,sf->fout);
-    if(e!=sf->occ_size) die("tmp file write error in writeBlock (2)");
-  }  
-  else { // large solid block 
-    uint8_t *byteBuffer = (uint8_t *) buffer;
-    // fill newB->occ using five bytes for entry
-    for(int j=0;j<sf->occ_size;j++) {
-      if(s->occ[j]>= (1Ull<<(8*POS_SIZE))) {
-        fprintf(stderr,"%d bytes per position are not enough. Increase POS_SIZE and recompile\n",POS_SIZE); 
-        exit(EXIT_FAILURE);
-      }
-      for(int i=0;i<POS_SIZE;i++)
-        byteBuffer[j*POS_SIZE+i] = (s->occ[j]>>(8*i)) & 0xFF;  
-    }
-    e= fwrite(byteBuffer,POS_SIZE,sf->occ_size,sf->fout); // read POS_SIZE bytes for customInt
-    if(e!=sf->occ_size) die("tmp file write error in writeBlock (3)");
+  assert(sf!=NULL && (sf->fout!=NULL || sf->outMem));
+  assert(s->beginsAt>=sf->wlast);  // blocks are written in order 
+  bool small = s->endsAt - s->beginsAt <= SMALLSOLID_LIMIT;
+  int nz = 0;
+  if(small) 
+    for(int j=0;j<sf->occ_size;j++) nz += s->smallOcc[j]!=0;
+  else 
+    for(int j=0;j<sf->occ_size;j++) nz += s->occ[j]!=0;
+  bool dense = 2*nz > sf->occ_size;
+  // the block is encoded after the space reserved for its size
+  uint8_t *q = sf->vbuf + VARINT_MAX_BYTES;
+  uint8_t *p = varint_put(q,s->beginsAt - sf->wlast);
+  p = varint_put(p,s->endsAt - s->beginsAt);
+  p = varint_put(p,2*(uint64_t)nz + dense);
+  sf->wlast = s->endsAt;
+  if(dense) {
+    if(small) p = varint_put_small(p,s->smallOcc,sf->occ_size);
+    else for(int j=0;j<sf->occ_size;j++) p = varint_put(p,s->occ[j]);
+  }
+  else for(int j=0,last=0;j<sf->occ_size;j++) {
+    customInt x = small ? s->smallOcc[j] : s->occ[j];
+    if(x==0) continue;
+    p = varint_put(p,j-last);
+    p = varint_put(p,x);
+    last = j;
   }
+  assert(p <= sf->vbuf + (2*sf->occ_size+4)*VARINT_MAX_BYTES);
+  // prepend the size 
+  uint8_t size[VARINT_MAX_BYTES];
+  uint8_t *e = varint_put(size,p-q);
+  q -= e-size;
+  memcpy(q,size,e-size);
+  size_t n = p - q;
+  ibHead_write(sf,q,n);
+  sf->bytes += n;
+  sf->rawBytes += 2*sizeof(customInt) + sf->occ_size*(small ? sizeof(smallSolidInt) : POS_SIZE);
   block_free(s,sf);
 }
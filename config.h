@@ -13,11 +13,14 @@
 #include <fcntl.h>
 #include <time.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <limits.h>
 #include <inttypes.h>
 #ifdef __linux__
 #include <linux/limits.h>
+#include <sys/sysmacros.h>   // major/minor of the scratch devices (see scratch_init)
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>   // vectorized search of block boundaries, non-temporal stores of newZ
 #endif
 
 // comment to prevent the use of madvise
@@ -29,10 +32,57 @@
 #endif
 #define Filename_size PATH_MAX
 
-// size of all buffers for producer/consumer threads
-#define Threads_buf_size 20
 // size of each buffer for external memory newMerge array
 #define COLOR_WBUFFER_SIZE (1024*1024)
+// size of the read buffer for the external memory merge array (bytes)
+#define COLOR_RBUFFER_SIZE (4*1024*1024)
+// total size of the read buffers of the input BWTs in external memory, and
+// min/max size of the buffer of a single BWT (see open_bw_files)
+#define BWT_RBUFFER_TOTAL (64*1024*1024)
+#define BWT_RBUFFER_MIN   (4*1024)
+#define BWT_RBUFFER_MAX   (1024*1024)
+// in external memory without a budget the buffers of each kind (BWT readers, merge
+// file reader and writers, lcp buffer) take at most 1/EXT_BUFFER_FRACTION of the
+// data they are for, so that small merges use little memory (see mem_plan) 
+#define EXT_BUFFER_FRACTION 16
+// alignment of the read buffers (and of their sizes) 
+#define BREADER_ALIGN 4096
+// asynchronous I/O (option -y): write buffers of each cwriter, size of the chunks 
+// and max number of chunks in flight for huge_pread/huge_pwrite  
+#define AIO_WBUFFERS 3
+#define AIO_CHUNK_SIZE (16*1024*1024)
+#define AIO_HUGE_INFLIGHT 8
+// with option -U sequentially accessed temporary files are dropped from the page cache 
+// in windows of this size (see tmp_fdrop_behind)
+#define TMP_DROP_SIZE (64*1024*1024)
+// with a memory budget (option -M) the buffers get a share of the memory left by the 
+// data structures (see mem_plan), up to these sizes: larger read buffers do not help 
+// since after a skip a reader refills its whole buffer
+#define MEM_BWT_RBUFFER_MAX   (4*1024*1024)
+#define MEM_COLOR_RBUFFER_MAX (64*1024*1024)
+#define MEM_COLOR_WBUFFER_MAX (16*1024*1024)
+#define MEM_BITFILE_MAX       (1024*1024)
+#define MEM_LCP_ARENA_MAX     (1024*1024*1024)
+// bytes of the buffer collecting the lcp/position pairs without a memory budget (see writeLcp)
+#define LCP_ARENA_SIZE (64*1024*1024)
+// max pairs in the output buffer used when merging the runs of the above buffer 
+#define LCP_OUT_PAIRS (16*BUFSIZ)
+// colors in each chunk of the run-length coded merge files (external memory), and 
+// min average length of the runs of an iteration to start coding the chunks 
+#define ZRLE_CHUNK (16*1024)
+#define ZRLE_MIN_RUN 4
+// max number of scratch directories for the temporary files (option -X)
+#define MAX_SCRATCH_DIRS 64
+// classes of temporary files, each one placed in its own scratch directory (see tmp_template)
+enum {TMP_MERGE, TMP_NEWMERGE, TMP_LIST, TMP_BITFILE};
+// size of each write-combining buffer for the internal memory newMerge array (see cbuffer_put)
+#define COLOR_WC_SIZE 64
+// number of segments of Z assigned to each thread in the multithread gap iterations
+#define Gap_segments_per_thread 4
+// positions inside a block tested one at a time before searching the next block start in B
+#define Block_search_min 32
+// max number of symbols in a tuple with -k (the lcp offsets inside a tuple take 4 bits)
+#define Ktuple_max 15
 
 
 // type used to represent an input symbol
@@ -46,6 +96,9 @@ typedef uint16_t smallSolidInt;
 #define SMALLSOLID_FORMAT "%"PRIu16
 #define SMALLSOLID_LIMIT UINT16_MAX
 
+// max bytes of a varint encoding a 64 bit value (solid blocks on file, see writeBlock)
+#define VARINT_MAX_BYTES 10
+
 // type used to represent positions in the BWT's 
 // define the maximum (merged) BWT size 
 typedef uint64_t customInt;
@@ -80,24 +133,18 @@ typedef uint32_t lcpInt;
 #endif
 
 // type used to represent the Merge (aka Z) array
-// defines the maximum number of input BWTs for a single round
+// the size of its entries is chosen at runtime for each merge (see g->zBytes):
+// palette when merging at most MAX_NARROW_BWTS BWTs (all merge procedures),
+// palette2 when merging more BWTs (gap only), so MAX_NUMBER_OF_BWTS BWTs can be
+// merged in a single round. 
 // Note that, for LCP computation, we need an open file for each BWT, 
 // so the max number of BWTs can be limited in practice by the maximum 
 // number of open files allowed by the system  (eg 1024 on my linux box)
-#define ZSIZE 1
-#if ZSIZE==1
 typedef uint8_t palette;
+typedef uint16_t palette2;
 #define PALETTE_FORMAT "%"PRIu8
-#define MAX_NUMBER_OF_BWTS 0x100ULL
-#elif ZSIZE==2
-typedef uint16_t palette;
-#define PALETTE_FORMAT "%"PRIu16
+#define MAX_NARROW_BWTS 0x100ULL
 #define MAX_NUMBER_OF_BWTS 0x10000ULL
-#else
-typedef uint32_t palette;
-#define PALETTE_FORMAT "%"PRIu32
-#define MAX_NUMBER_OF_BWTS 0x100000000ULL
-#endif
 
 
 #define BWT_EXT "bwt"
@@ -111,17 +158,135 @@ typedef uint32_t palette;
 #define QS_EXT "bwt.qs"
 #define QS_BL_EXT "bwt.qs_bl"
 
+// a pread/pwrite request executed by the asynchronous I/O threads (see io.c) 
+typedef struct aioReq {
+  int fd;            // file descriptor
+  bool write;        // pwrite or pread
+  bool full;         // the whole count bytes must be transferred 
+  void *buf;         
+  size_t count;      // bytes to transfer
+  off_t offset;      // offset inside the file
+  ssize_t res;       // bytes transferred  
+  bool tmp;          // temporary file: with -U the bytes are dropped from the page cache
+  bool done;         // request completed, buf can be reused
+  struct aioReq *next; // next request in queue
+} aioReq;
+
+// run-length coded merge files in external memory (see zrle_new in io.c)
+// The files are split in chunks of ZRLE_CHUNK colors, each one stored at the 
+// offset of its first color either raw or, if shorter, as (color, run length) pairs
+typedef struct {
+  uint32_t *len[2];     // bytes used by each chunk of the merge [0] and newmerge [1] file 
+  uint64_t bytes[2];    // bytes used by all the chunks of each file
+  uint64_t coded[2];    // number of RLE chunks in each file
+  bool *shared;         // chunks containing the segments of two cwriters: always raw 
+  size_t chunks;        // number of chunks
+  uint64_t n;           // number of colors in each file
+  int width;            // bytes per color
+  bool on;              // the cwriters code the chunks they write
+  uint64_t colors;      // colors written by the cwriters in the current iteration
+  uint64_t runs;        // and the number of runs they form 
+  uint8_t *tmp;         // chunk being updated (see cwriter_chunk_end)
+  uint8_t *out[AIO_WBUFFERS]; // chunks being written, shared by the cwriters 
+  aioReq req[AIO_WBUFFERS];   // write of out[i]
+  int next;             // next buffer to use 
+} zrle;
+
 // structure for writing in a segment of a newMergeColor
 typedef struct{
   int fd;  // file descriptor
   off_t offset; // offset inside file descriptor (in bytes)
-  palette *buffer; 
-  int size; // buffer size  (in palette units)
-  int cur;  // current position (in palette units)
+  palette *buffer; // current buffer
+  int width; // bytes per color: sizeof(palette) or sizeof(palette2)
+  int size; // buffer size  (in colors)
+  int cur;  // current position (in colors)
+  int nbuf; // number of buffers: with asynchronous I/O buffers not in use are being written 
+  int next; // index of the current buffer in bufs[]
+  bool tmp; // temporary file (see tmp_uncached)
+  palette *bufs[AIO_WBUFFERS];
+  aioReq req[AIO_WBUFFERS]; // write of bufs[i]
+  // RLE chunks (used if z!=NULL && z->on): the colors are collected in cbuf and 
+  // each chunk is written when the writer leaves it (see cwriter_chunk_end) 
+  zrle *z;
+  bool chunked;      // z!=NULL && z->on when the writer was created 
+  int last;          // last color written, to count the runs 
+  uint64_t colors;   // colors written 
+  uint64_t runs;     // runs of equal colors written 
+  uint64_t pos;      // position of the next color 
+  size_t chunk;      // chunk in cbuf, SIZE_MAX if none 
+  palette *cbuf;     // colors of the chunk, valid only where mask is set
+  uint64_t *mask;    // positions of the chunk written so far 
+  uint32_t filled;   // number of positions written 
 } cwriter;
 
+// structure for reading sequentially a file: reads are done with pread so that
+// several breaders can share the same file descriptor (see open_bw_files) 
+typedef struct{
+  int fd;          // file descriptor
+  off_t offset;    // offset inside file descriptor of buffer[0] (in bytes)
+  uint8_t *buffer; // BREADER_ALIGN aligned buffer inside mem
+  uint8_t *next;   // with asynchronous I/O buffer prefetching the data following buffer[] 
+  uint8_t *mem;    // allocated memory 
+  aioReq req;      // prefetch read
+  bool tmp;        // temporary file (see tmp_uncached)
+  size_t size;     // buffer size (in bytes)
+  size_t len;      // bytes currently in buffer
+  size_t cur;      // current position in buffer (in bytes)
+} breader;
+
+// structure for reading sequentially the merge file: a breader if the file 
+// contains only raw chunks, otherwise chunks are read and decoded one at a time
+typedef struct{
+  breader b;       // used if z==NULL 
+  zrle *z;
+  int fd;
+  int width;
+  uint64_t pos;    // position of the next color
+  size_t chunk;    // chunk in buf, SIZE_MAX if none 
+  uint8_t *buf;    // decoded chunk
+  uint8_t *in;     // chunk read from file 
+  uint8_t *next;   // with asynchronous I/O the following chunk is prefetched here
+  size_t nextChunk;// chunk being prefetched, SIZE_MAX if none
+  aioReq req;      // read of next
+} zreader;
+
+// structure for buffering the writes in a segment of newMergeColor in internal memory
+typedef struct{
+  customInt begin;  // position in newMergeColor of the first buffered color
+  customInt end;    // position following the last buffered color
+  palette buffer[COLOR_WC_SIZE]; // color for position p is in buffer[p%COLOR_WC_SIZE]
+} cbuffer;
+
 
  
+// lcp/position pairs of the last iterations, in the .pair.lcp format (see writeLcp in util.c)
+// Each iteration produces a run of pairs sorted by position: the complete runs are 
+// merged in RAM and written to the .pair.lcp file as a single run when the buffer is full
+typedef struct {
+  uint8_t *pairs;   // the pairs, POS_SIZE+BSIZE bytes each 
+  size_t size;      // capacity of pairs, in pairs 
+  size_t used;      // pairs in the buffer 
+  size_t start;     // first pair of the run being collected
+  size_t *runs;     // runs[i] first pair of the i-th complete run 
+  int nruns;        // number of complete runs 
+  int maxruns;      // size of runs[] 
+  uint8_t *out;     // output buffer for the merge of the runs 
+  size_t outSize;   // capacity of out, in pairs: at most LCP_OUT_PAIRS and size 
+  uint64_t open;    // pairs of the current run already written to the .pair.lcp file
+  uint64_t flushed; // pairs (including EOFs) of the closed runs in the .pair.lcp file 
+  uint64_t written; // runs written to the .pair.lcp file 
+} lcpArena;
+
+// sizes of the I/O buffers of a single merge (see mem_plan in io.c)
+typedef struct {
+  size_t bwtRead;          // bytes in the read buffer of each input BWT (external memory)
+  size_t colorRead;        // bytes in the read buffer of the merge file (external memory)
+  size_t colorWrite;       // colors in each write buffer of the newmerge cwriters (external memory)
+  size_t bitfile;          // bytes in each buffer of the B bitfile (gap128ext)
+  size_t lcpWrite;         // bytes of the buffer collecting the lcp/position pairs (see lcpArena)
+  size_t solidStore;       // max bytes of the solid block lists kept in RAM, 0 to keep them on file
+} ioBuffers;
+
 typedef struct {
   // input: shared among threads
   symbol **bws;            // bws[0] ... bws[numBwt-1] are input bwt
@@ -142,16 +307,25 @@ typedef struct {
   int outputQS;            // if 1 output Merge array (=QS) for last iteration using 1 bytes per symbol
   FILE *unsortedLcp;       // if !NULL file containing unsorted LCP values
   FILE *unsortedLcp_size;  // if !NULL file containing the size of sorted blocks in unsorted_Lcp
+  lcpArena *lcpRuns;       // if !NULL lcp pairs are collected here before going to unsortedLcp 
+  bool lcpDirect;           // write the computed lcp values straight to the output file (no pair files)
+  lcpInt *lcpOut;           // if !NULL the output lcp file mmapped (lcpDirect) 
   bool smallAlpha;         // the alphabet is small
   bool extMem;             // if true run in external memory
-  int algorithm;           // preferred algorithm to use: gap8 gap16 gap128 gap256, if!=8,16,128,256 then use gap  
+  int algorithm;           // preferred algorithm to use: gap8 gap16 gap128 gap256, if!=8,16,128,256 then use gap
+  int gapThreads;          // threads used inside each iteration of the last round (gap in internal memory only)
   bool mmapZ;              // mmap Z arrays
   bool mmapB;              // mmap B array
   bool mmapBWT;            // mmap BWT arrays
+  bool wcColors;           // buffer the writes to newZ in internal memory (write-combining)
+  int ktuple;              // number of symbols in each BWT symbol: prefixes grow by ktuple symbols per iteration
+  bool *ktuple0;           // if ktuple>1, ktuple0[s] is true if tuple s contains a 0 (see alphabet.c) 
+  uint8_t *ktupleLcp;      // if ktuple>1 and lcpCompute, lcp offset of each block start in 4 bits
   char *lcpinPath;         // base path for lcp files
   char *outPath;           // path for output and  temporary files 
   lcpInt **lcps;           // if lcpMem, lcps[0] ... lcps[numBwt-1] are input lcp values
   int solid_limit;         // irrelevant blocks become solid after this size
+  ioBuffers buf;           // buffer sizes for the current merge (see mem_plan)
   int verbose;
   union {                   // in Gap use one or the other according to bwtOnly 
     lcpInt *blockBeginsAt;  // B array and then merged LCP. output but allocatd by caller  (shared as well)
@@ -162,19 +336,22 @@ typedef struct {
   char dafname[Filename_size];   // filename of the input DA file 
   char safname[Filename_size];   // filename of the input SA file 
   char qsfname[Filename_size];   // filename of the input QS file 
-  FILE **bwf;              // bwf[0] ... bwf[numBwt-1] are pointer inside the input bwt file  
+  breader *bwf;            // bwf[0] ... bwf[numBwt-1] are readers inside the input bwt file  
   FILE **daf;              // daf[0] ... daf[numBwt-1] are pointer inside the input DA file  
   FILE **saf;              // saf[0] ... saf[numBwt-1] are pointer inside the input SA file  
   FILE **qsf;              // qsf[0] ... qsf[numBwt-1] are pointer inside the input QS file  
-  FILE *fmergeColor;       // mergecolor file   
+  zreader *fmergeColor;    // mergecolor file reader  
   cwriter *fnewMergeColor; // newmergecolor files (one per symbol) 
   char *merge_fname;       // name of merge file
   char *newmerge_fname;    // name of new merge file  
+  zrle *zrle;              // chunks of the merge files
   // glocal private
-  palette *mergeColor;     // Z
+  int zBytes;              // bytes for each entry of Z and newZ: sizeof(palette) or sizeof(palette2) (gap only)
+  palette *mergeColor;     // Z (access with z_get/z_set if zBytes can be >1)
   palette *newMergeColor;  // newZ 
   uint16_t *mergeColor16;  // Z and newZ + 2 bits array combined in a single uint16_t 
   uint32_t *array32;       // Z and newZ + B array combined in a single uint32_t 
+  uint64_t *bitZ;          // Z and newZ as two bit arrays (only for numBwt<=2)
   customInt *firstColumn;  // compact first column array
   customInt *F;            // positions inside the newMerge (array F in the pseudocode)   
   customInt *inCnt;        // counters inside each bwt (k_i in the pseudo code)
@@ -182,24 +359,32 @@ typedef struct {
 
 
 
-// generic data structure for a  1 producer N consumers scheme
+// a merge of consecutive (possibly already merged) BWTs done before the last round
+// the merged BWTs are identified by the index of their first input BWT (see multiround.c)
+typedef struct mergeTask {
+  int round;               // round of the merge
+  int numBwt;              // number of BWTs merged 
+  int *bwt;                // bwt[i] is the index of the first input BWT of the i-th merged BWT
+  customInt offset;        // total length of the BWTs preceding the merged ones
+  customInt len;           // total length of the merged BWTs
+  int waiting;             // merges producing the BWTs of this merge not yet completed
+  struct mergeTask *parent;// merge using the output of this one, NULL if used in the last round
+  bool started;            // merge assigned to a thread
+  double secs;             // wall clock time of the merge
+} mergeTask;
+
+// merges to be done by the merger threads: a merge is started when all its input BWTs
+// are available, and among those available the longest merge is started first
 typedef struct {
-  int pindex;             // index in buffer for producer
-  int cindex;             // index in buffer for consumers  
-  pthread_mutex_t cmutex; // consumer mutex 
-  sem_t *free_slots;       // free slots in the buffer
-  sem_t *ready;            // data ready to be processed
-  void *buffer;           // generic data buffer
-  int buf_size;           // size of buffer
-  // from here fields are more or less specific for merge 
-  int remaining;          // remaining jobs before a sincronization 
-  pthread_mutex_t remutex;// mutex for access to remaining
-  pthread_cond_t recond;  // condition variable for remaining 
-  union {
-    bool hm;                // used for hm vs gap
-    g_data *data;
-  };
-} pc_system;
+  mergeTask *task;         // merges in order of round 
+  int num;                 // number of merges
+  int started;             // number of merges assigned to a thread 
+  int completed;           // number of merges completed
+  bool hm;                 // use hm instead of gap
+  g_data *input;           // input BWTs: lengths and occ of merged BWTs are updated here
+  pthread_mutex_t mutex;   // mutex for access to the above fields
+  pthread_cond_t ready;    // signaled when a merge becomes ready or all merges have been started
+} mergeSchedule;
 
 
 #endif
@@ -0,0 +1,761 @@
+/* *********************************************************************
+   eGap: BWT and LCP computation for sequence collections in external memory
+
+   Driver for the three phases of the computation:
+     phase 1: compute the BWTs of the input (gSACAK) or concatenate
+              the input BWTs (option -b); with --pipeline the groups
+              of BWTs completed by gSACAK are merged while it computes
+              the next ones
+     phase 2: merge the BWTs computing the LCP/DA/SA arrays (gap)
+     phase 3: merge the LCP values (mergelcp, skipped if gap writes
+              them directly to the output file)
+   The phases are executed as child processes of this program, sharing
+   the same memory budget (-m), log file and timer.
+
+   ********************************************************************* */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define VERSION "v2.1"
+
+#define GSACAK_EXE "tools/gsacak"
+#define GSACAK64_EXE "tools/gsacak-64"
+#define GAP_EXE "gap"
+#define MERGELCP_EXE "tools/mergelcp"
+#define SHASUM_EXE "sha1sum"
+#define POS_SIZE 5    // must be equal to POS_SIZE in config.h
+
+#define MAX_ARGS 64
+#define CMD_SIZE 4096
+
+// command line options
+typedef struct {
+  char **input; int ninput;
+  long mem;
+  char *out, *basename;
+  bool bwt, lcp, da, sa, qs, rev;
+  int lbytes, dbytes, sbytes;
+  int threads, ktuple, aio;
+  char *scratch;
+  bool uncached;
+  int trlcp, deB;
+  bool sum, delete, em, se, im, phase1, phase2, v;
+  int pipe;             // chunks x group merged during phase 1 (0 = no pipeline)
+  // set by the driver
+  char dir[PATH_MAX];   // directory of the executables
+  char log[PATH_MAX];   // log file name
+  bool lcpdirect;       // lcp values written by gap (phase3 skipped)
+} egap_args;
+
+
+static void die(const char *s) {
+  fprintf(stderr,"%s\n",s);
+  exit(1);
+}
+
+// snprintf to a buffer of size bytes, stop if the output does not fit
+static void format(char *dest, size_t size, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap,fmt);
+  int n = vsnprintf(dest,size,fmt,ap);
+  va_end(ap);
+  if(n<0 || (size_t)n>=size) die("Command line too long");
+}
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec/1e9;
+}
+
+static void usage(char *name) {
+  printf("Usage:\n\t%s [options] input [input ...]\n\n", name);
+  puts("Tool to build the BWT and optionally the LCP and DA array for a collection");
+  puts("of sequences in external memory. There are two different usages depending");
+  puts("on whether you already have the BWT of the input files:\n");
+  puts("If you do have the BWTs use option -b: you must specify the file names on");
+  puts("the command line and use the option -o to specify an output basename.");
+  puts("For example");
+  printf("  %s -bl -o merge  file1.bwt file2.bwt\n", name);
+  puts("will produce the output files merge.bwt, merge.2.lcp, merge.da\n");
+  puts("If you don't have the BWTs then your input must consists of a single file");
+  puts("with extension");
+  puts("  .fasta/.fa (one input document per sequence)");
+  puts("  .fastq/.fq (one input document per sequence)");
+  puts("  .txt       (one input document per line)");
+  puts("and it is not mandatory to specify the output basename. For example:");
+  printf("  %s -l  file.fasta\n", name);
+  puts("this will produce the output files file.fasta.bwt, file.fasta.2.lcp\n");
+  puts("All input and output files are uncompressed!\n");
+  puts("Command line options:");
+  puts("  -m, --mem M      use at most M MBs (def. 95% of available RAM)");
+  puts("  -o, --out NAME   output base name (def. input base name)");
+  puts("  -b, --bwt        inputs are bwt files");
+  puts("  -l, --lcp        compute LCP Array");
+  puts("  -d, --da         compute Document Array");
+  puts("  -s, --sa         output SA (ext: .sa)");
+  puts("  -q, --qs         output (only for FASTQ) the quality score QS sequences permuted according to the BWT (ext: .qs)");
+  puts("  -r, --rev        compute data structures for the reversed string");
+  puts("  --lbytes N       bytes x LCP entry (def. 2)");
+  puts("  --dbytes N       bytes x DA entry (def. 4)");
+  puts("  --sbytes N       bytes x SA entry (def. 4)");
+  puts("  -t, --threads T  chunks computed in parallel in phase 1 (not with -d, --trlcp, --deB), threads used inside each phase 2 iteration (internal memory only) and by the phase 3 merge (def. 1)");
+  puts("  -k, --ktuple K   phase 2 squeezes K symbols per BWT symbol (small alphabets only, not with -t, def. 1)");
+  puts("  --aio A          threads for asynchronous I/O in phase 2 (external memory only, def. 0)");
+  puts("  --scratch DIRS   colon separated list of directories for the temporary files (phases 2 and 3)");
+  puts("  --uncached       drop temporary files from the page cache after each pass (phase 2)");
+  puts("  --pipeline G     merge each group of G BWTs computed by gSACAK while it computes the next ones,");
+  puts("                   the RAM is split between the two (not with -b, -d, -s, -q, --trlcp, --deB)");
+  puts("  --trlcp K        compute LCP values only up to K (truncated LCP)");
+  puts("  --deB K          compute info for building a deBruijn graph of order K");
+  puts("  --sum            compute output files shasum");
+  puts("  --delete         delete output files (only with --sum)");
+  puts("  --em             force external memory mode");
+  puts("  --se             force semi-external memory mode");
+  puts("  --im             force internal memory mode");
+  puts("  -1, --phase1     stop after phase 1 (debug only)");
+  puts("  -2, --phase2     stop after phase 2 (debug only)");
+  puts("  -v               verbose: extra info in the log file");
+  puts("  -h, --help       show this help message");
+  exit(1);
+}
+
+/* ************************************************************
+ * execution of the phases
+ * ************************************************************ */
+
+// split the space separated command line cmd in argv[] (modifies cmd)
+static void split_command(char *cmd, char *argv[]) {
+  int n=0;
+  for(char *s=strtok(cmd," "); s!=NULL; s=strtok(NULL," ")) {
+    if(n==MAX_ARGS-1) die("Too many arguments");
+    argv[n++]=s;
+  }
+  argv[n]=NULL;
+}
+
+// start command with stdout and stderr appended to the log file
+// return the pid of the child process, -1 on failure
+static pid_t spawn_command(const char *command, FILE *logfile) {
+  char cmd[CMD_SIZE], *argv[MAX_ARGS];
+  format(cmd,CMD_SIZE,"%s",command);
+  split_command(cmd,argv);
+  fflush(logfile);
+  pid_t pid = fork();
+  if(pid<0) {perror("fork"); return -1;}
+  if(pid==0) {
+    int fd = fileno(logfile);
+    if(dup2(fd,STDOUT_FILENO)<0 || dup2(fd,STDERR_FILENO)<0) _exit(127);
+    if(strchr(argv[0],'/')) execv(argv[0],argv);
+    else execvp(argv[0],argv);
+    perror(argv[0]);
+    _exit(127);
+  }
+  return pid;
+}
+
+// check the exit status of command, return true if everything OK
+static bool command_ok(int status, const char *command, egap_args *a) {
+  if(WIFEXITED(status) && WEXITSTATUS(status)==0) return true;
+  printf("Error executing command line:\n");
+  printf("\t%s\n", command);
+  printf("Check log file: %s\n", a->log);
+  return false;
+}
+
+// execute command with stdout and stderr appended to the log file
+// return true if everything OK, false otherwise
+static bool execute_command(const char *command, egap_args *a, FILE *logfile) {
+  pid_t pid = spawn_command(command,logfile);
+  if(pid<0) return false;
+  int status;
+  while(waitpid(pid,&status,0)<0)
+    if(errno!=EINTR) {perror("waitpid"); return false;}
+  return command_ok(status,command,a);
+}
+
+// name of the executable exe in the eGap directory
+static void exe_name(char *dest, egap_args *a, const char *exe) {
+  if(a->dir[0]) format(dest,PATH_MAX,"%s/%s",a->dir,exe);
+  else format(dest,PATH_MAX,"%s",exe);
+}
+
+// concatenate src to the open file dest, the copy is done by the kernel
+static void append_file(int dest, const char *src) {
+  int fd = open(src,O_RDONLY);
+  if(fd<0) {perror(src); exit(1);}
+  struct stat st;
+  if(fstat(fd,&st)!=0) {perror(src); exit(1);}
+  off_t left = st.st_size;
+  while(left>0) {
+    ssize_t e = copy_file_range(fd,NULL,dest,NULL,left,0);
+    if(e<0 && (errno==ENOSYS || errno==EXDEV || errno==EINVAL)) break; // fallback to read/write
+    if(e<=0) {perror(src); exit(1);}
+    left -= e;
+  }
+  if(left>0) {
+    static char buf[1<<20];
+    ssize_t r;
+    while((r=read(fd,buf,sizeof(buf)))>0)
+      if(write(dest,buf,r)!=r) {perror(src); exit(1);}
+    if(r<0) {perror(src); exit(1);}
+  }
+  close(fd);
+}
+
+// concatenate in the file name the input files with extension ext
+// replacing the last one of their names (if ext!=NULL)
+static void concat_files(egap_args *a, const char *name, const char *ext) {
+  int fd = open(name,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  if(fd<0) {perror(name); exit(1);}
+  for(int i=0;i<a->ninput;i++) {
+    char src[PATH_MAX];
+    snprintf(src,PATH_MAX,"%s",a->input[i]);
+    if(ext) {
+      char *dot = strrchr(src,'.'), *slash = strrchr(src,'/');
+      if(dot && (!slash || dot>slash)) *dot = 0;
+      strncat(src,ext,PATH_MAX-strlen(src)-1);
+    }
+    append_file(fd,src);
+  }
+  if(close(fd)!=0) {perror(name); exit(1);}
+}
+
+// command line options of gap for merging bwts BWTs of total size bwt_size
+// using mb MBs of RAM: the last merge (phase 2) computes the LCP/DA/SA
+// arrays, the merges of the parts done during phase 1 only the BWT
+// return the memory model used by gap
+static char *gap_options(egap_args *a, uint64_t bwt_size, long bwts, long mb, bool last, char *opts) {
+  char *mode;
+  uint64_t mem = (uint64_t) mb<<20;
+  if((bwt_size > mem || a->deB>0 || a->trlcp>0 || a->em) && !a->se && !a->im) {
+    // input larger than assigned ram, or dbgraph/truncated LCP: external algorithm
+    // more than 128 BWTs are merged in a single round by gap with a 2-byte Z
+    strcpy(opts,"-A128 -vaE");
+    mode = "external memory";
+  }
+  else if((3*bwt_size > mem || a->se) && !a->im) {
+    // input fits in ram but not too small: semi-external algorithm
+    // DA/SA/QS are computed only in a single round: more than 8 BWTs (with -t gSACAK 
+    // splits the RAM among the threads and writes more chunks) are merged as in external memory
+    if(last && (a->da || a->sa || a->qs) && bwts>8) {
+      strcpy(opts,"-A128 -vaE");
+      mode = "external memory, single round for DA/SA/QS";
+    }
+    else {
+      strcpy(opts,"-A8 -g8 -vaE");
+      mode = "semi-external memory";
+    }
+  }
+  else {
+    // input 3 times smaller than assigned ram: internal algorithm
+    strcpy(opts,"-vaT");
+    mode = "internal memory";
+  }
+  bool internal = strcmp(mode,"internal memory")==0;
+  char *o = opts+strlen(opts);
+  if(a->v) o += sprintf(o,"v");                              // increase verbosity level
+  if(last) {
+    if(a->lcp || a->trlcp>0) o += sprintf(o,"l");            // generate (truncated) lcp
+    // write the lcp values directly to the output file if it fits in the RAM left by gap
+    uint64_t lcp_size = bwt_size*a->lbytes;
+    if(internal) a->lcpdirect = 3*bwt_size + lcp_size <= mem;
+    else a->lcpdirect = 2*lcp_size <= mem;
+    a->lcpdirect = a->lcpdirect && (a->lcp || a->trlcp>0);
+    if(a->lcpdirect) o += sprintf(o," -L");                  // phase3 is skipped
+    if(a->da) o += sprintf(o," -d%d",a->dbytes);             // output DA (ext: .da)
+    if(a->sa) o += sprintf(o," -S%d",a->sbytes);             // output SA (ext: .sa)
+    if(a->qs) o += sprintf(o," -q");                         // output QS (ext: .qs)
+  }
+  if(a->threads>1 && internal) o += sprintf(o," -t%d",a->threads);  // multithread iterations
+  if(a->aio>0 && !internal) o += sprintf(o," -y%d",a->aio);  // asynchronous I/O
+  if(a->uncached) o += sprintf(o," -U");                     // keep temporary files out of the page cache
+  o += sprintf(o," -M%ld",mb);                               // buffers use the RAM left by the data structures
+  if(a->scratch) o += snprintf(o,CMD_SIZE/2," -X%s",a->scratch);     // temporary files on several devices
+  if(a->ktuple>1 && a->threads<=1 && a->deB==0 && a->trlcp==0) o += sprintf(o," -k%d",a->ktuple); // k-tuple squeezing
+  if(last) {
+    if(a->deB>0) o += sprintf(o," -D%d",a->deB);             // info for order-k de Brujin graph
+    if(a->trlcp>0) o += sprintf(o," -D%d",a->trlcp);         // info for truncated LCP
+    if(a->deB>0 || a->trlcp>0) o += sprintf(o," -g128");     // -D is supported only by gap128ext
+  }
+  return mode;
+}
+
+// name of the file with extension ext of part j written by gSACAK -P
+static void part_name(char *dest, egap_args *a, int j, const char *ext) {
+  format(dest,PATH_MAX,"%s.part%d%s",a->basename,j,ext);
+}
+
+// number of BWTs in part j
+static long part_bwts(egap_args *a, int j) {
+  char name[PATH_MAX];
+  part_name(name,a,j,".size");
+  struct stat st;
+  if(stat(name,&st)!=0) {perror(name); exit(1);}
+  return st.st_size/8;
+}
+
+// merge the BWTs of part j using mb MBs of RAM: as in the rounds of
+// gap's multiround merge preceding the last one only the BWT is computed,
+// the LCP values are computed from scratch in phase 2
+static bool merge_part(egap_args *a, int j, long mb, FILE *logfile) {
+  char name[PATH_MAX], cmd[CMD_SIZE], opts[CMD_SIZE];
+  part_name(name,a,j,".bwt");
+  struct stat st;
+  if(stat(name,&st)!=0) {perror(name); return false;}
+  char *mode = gap_options(a,st.st_size,part_bwts(a,j),mb,false,opts);
+  char exe[PATH_MAX];
+  exe_name(exe,a,GAP_EXE);
+  part_name(name,a,j,"");
+  format(cmd,CMD_SIZE,"%s%d %s %s",exe,a->lbytes,opts,name);
+  printf("==== gap on part %d (%s)\n Command: %s\n",j,mode,cmd);
+  return execute_command(cmd,a,logfile);
+}
+
+// concatenate the parts in the .bwt/.size input files of phase 2:
+// each of the first merged parts is a single BWT, the others consist
+// of the BWTs listed in their .size file
+static bool join_parts(egap_args *a, int parts, int merged) {
+  char name[PATH_MAX];
+  snprintf(name,PATH_MAX,"%s.bwt",a->basename);
+  int fd = open(name,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  if(fd<0) {perror(name); return false;}
+  snprintf(name,PATH_MAX,"%s.size",a->basename);
+  FILE *f = fopen(name,"wb");
+  if(!f) {perror(name); return false;}
+  for(int j=0;j<parts;j++) {
+    char bwt[PATH_MAX], size[PATH_MAX];
+    part_name(bwt,a,j,".bwt");
+    part_name(size,a,j,".size");
+    FILE *g = fopen(size,"rb");
+    if(!g) {perror(size); return false;}
+    uint64_t len, tot=0;
+    while(fread(&len,8,1,g)==1) {
+      tot += len;
+      if(j>=merged && fwrite(&len,8,1,f)!=1) {perror(name); return false;}
+    }
+    fclose(g);
+    if(j<merged && fwrite(&tot,8,1,f)!=1) {perror(name); return false;}
+    append_file(fd,bwt);
+    if(remove(bwt)!=0 || remove(size)!=0) {perror(bwt); return false;}
+  }
+  if(fclose(f)!=0) {perror(name); return false;}
+  if(close(fd)!=0) {perror(a->basename); return false;}
+  return true;
+}
+
+// phase1 with --pipeline:
+// gSACAK (command cmd) writes the BWTs of each group of a->pipe chunks in
+// a separate part; while it computes the following chunks the parts already
+// completed are merged one at a time using mb MBs of RAM. The parts completed
+// after the termination of gSACAK are left to phase 2
+static bool phase1_pipeline(egap_args *a, const char *cmd, long mb, FILE *logfile) {
+  pid_t pid = spawn_command(cmd,logfile);
+  if(pid<0) return false;
+  bool running = true;
+  int parts = 0, merged = 0;   // parts completed by gSACAK, merged during phase 1
+  for(;;) {
+    char name[PATH_MAX];
+    part_name(name,a,parts,".size");
+    if(access(name,F_OK)==0) {  // part completed: merge it if gSACAK is still running
+      if(running && merged==parts) {
+        if(part_bwts(a,parts)>1 && !merge_part(a,parts,mb,logfile)) {
+          kill(pid,SIGTERM); waitpid(pid,NULL,0);
+          return false;
+        }
+        merged++;
+      }
+      parts++;
+      continue;
+    }
+    if(!running) break;
+    int status;
+    pid_t e = waitpid(pid,&status,WNOHANG);
+    if(e<0 && errno!=EINTR) {perror("waitpid"); return false;}
+    if(e==pid) {  // look again for the parts completed before the termination
+      if(!command_ok(status,cmd,a)) return false;
+      running = false;
+    }
+    else if(e==0) sleep(1);
+  }
+  printf("==== %d parts, %d merged during phase 1\n",parts,merged);
+  return join_parts(a,parts,merged);
+}
+
+// phase1:
+// concatenation or computation of bwts
+// this version never computes the LCPs:
+// if required they are computed from scratch in phases 2 and 3
+static bool phase1(egap_args *a, FILE *logfile) {
+  char name[PATH_MAX], cmd[CMD_SIZE];
+  fprintf(logfile,"--- Phase 1 ---\n"); fflush(logfile);
+  if(a->bwt) {
+    puts("==== creating .size file");
+    snprintf(name,PATH_MAX,"%s.size",a->basename);
+    FILE *f = fopen(name,"wb");
+    if(!f) {perror(name); return false;}
+    for(int i=0;i<a->ninput;i++) {
+      struct stat st;
+      if(stat(a->input[i],&st)!=0) {perror(a->input[i]); return false;}
+      uint64_t size = st.st_size;
+      if(fwrite(&size,8,1,f)!=1) {perror(name); return false;}
+    }
+    if(fclose(f)!=0) {perror(name); return false;}
+    puts("==== concatenating BWT files");
+    snprintf(name,PATH_MAX,"%s.bwt",a->basename);
+    concat_files(a,name,NULL);
+    // if da requested we must have partial docs files: we concatenate them in a new .docs file
+    if(a->da) {
+      puts("==== creating .docs file");
+      snprintf(name,PATH_MAX,"%s.docs",a->basename);
+      concat_files(a,name,".docs");
+      // concatenate .da files in a single .da_bl file
+      puts("==== creating .da_bl file");
+      char ext[32];
+      snprintf(ext,32,".%d.da",a->dbytes);
+      snprintf(name,PATH_MAX,"%s.%d.da_bl",a->basename,a->dbytes);
+      concat_files(a,name,ext);
+    }
+    return true; // everything fine
+  }
+  // ---- gSACAK
+  // We must compute BWTs. Shall we use gsaka or gsaka64?
+  // with --pipeline gSACAK leaves half of the RAM to the merges of the parts
+  long mem = a->pipe>0 ? a->mem/2 : a->mem;
+  char exe[PATH_MAX];
+  if(mem/5 < 2020)           // less than 10GB: OK 32 bit
+    exe_name(exe,a,GSACAK_EXE);
+  else if(mem/9 < 2020) {    // less than 18GB: use 32bit with RAM = 10GB
+    mem = 2020*5;
+    if(a->pipe==0) a->mem = mem;
+    exe_name(exe,a,GSACAK_EXE);
+  }
+  else                       // more than 18GB: use 64bit version
+    exe_name(exe,a,GSACAK64_EXE);
+  char opts[256] = "-b";
+  if(a->v)   strcat(opts,"v");    // increase verbosity level
+  if(a->rev) strcat(opts,"R");    // reverse string as input
+  if(a->sa)  sprintf(opts+strlen(opts)," -s%d",a->sbytes); // output SA (ext: .sa)
+  if(a->da)  sprintf(opts+strlen(opts)," -d%d",a->dbytes); // output DA (ext: .da)
+  if(a->qs)  strcat(opts," -q");  // output QS (ext: .qs)
+  if(a->pipe>0) sprintf(opts+strlen(opts)," -P%d",a->pipe); // output BWTs in parts
+  // chunks computed in parallel: not with -d, --trlcp and --deB, since the DA values are 
+  // the chunk numbers and the truncated merge depends on the chunks: they must not 
+  // depend on the number of threads
+  if(a->threads>1 && !a->da && a->trlcp==0 && a->deB==0) sprintf(opts+strlen(opts)," -t%d",a->threads);
+  // specify output base name
+  char outopt[PATH_MAX+4] = "";
+  if(a->out) snprintf(outopt,sizeof(outopt)," -o %s",a->basename);
+  format(cmd,CMD_SIZE,"%s %s -m %ld%s %s 0",exe,opts,mem,outopt,a->input[0]);
+  // execute choosen algorithm
+  printf("==== gSACAK\n Command: %s\n",cmd);
+  if(a->pipe>0) return phase1_pipeline(a,cmd,a->mem-mem,logfile);
+  return execute_command(cmd,a,logfile);
+}
+
+// phase2:
+// merging of BWTs and computation of LCP and/or DA/SA arrays
+static bool phase2(egap_args *a, FILE *logfile) {
+  char name[PATH_MAX], cmd[CMD_SIZE], opts[CMD_SIZE];
+  fprintf(logfile,"--- Phase 2 ---\n"); fflush(logfile);
+  snprintf(name,PATH_MAX,"%s.bwt",a->basename);
+  struct stat st;
+  if(stat(name,&st)!=0) {perror(name); return false;}
+  snprintf(name,PATH_MAX,"%s.size",a->basename);
+  struct stat ss;
+  if(stat(name,&ss)!=0) {perror(name); return false;}
+  char *mode = gap_options(a,st.st_size,ss.st_size/8,a->mem,true,opts);
+  char exe[PATH_MAX];
+  exe_name(exe,a,GAP_EXE);
+  format(cmd,CMD_SIZE,"%s%d %s %s",exe,a->lbytes,opts,a->basename);
+  printf("==== gap (%s)\n Command: %s\n",mode,cmd);
+  return execute_command(cmd,a,logfile);
+}
+
+// phase3:
+// merging of LCP values
+static bool phase3(egap_args *a, FILE *logfile) {
+  char cmd[CMD_SIZE], scratch[PATH_MAX+4] = "", par[32] = "";
+  fprintf(logfile,"--- Phase 3 ---\n"); fflush(logfile);
+  int k = 0;
+  if(a->deB>0) k = a->deB;      // info for order-k de Brujin graph
+  if(a->trlcp>0) k = a->trlcp;  // info for truncated LCP
+  if(a->scratch) snprintf(scratch,sizeof(scratch),"-X%s ",a->scratch);  // intermediate levels on several devices
+  if(a->threads>1) snprintf(par,sizeof(par),"-p%d ",a->threads);       // last level split among threads
+  char exe[PATH_MAX];
+  exe_name(exe,a,MERGELCP_EXE);
+  format(cmd,CMD_SIZE,"%s -t -v -m %ld %s%s-k %d %s %d %d",exe,a->mem,scratch,par,k,a->basename,POS_SIZE,a->lbytes);
+  printf("==== mergeLcp\n Command: %s\n",cmd);
+  return execute_command(cmd,a,logfile);
+}
+
+/* ************************************************************
+ * final report
+ * ************************************************************ */
+
+// compute hash digest for a file
+static void file_digest(const char *label, const char *name, FILE *logfile) {
+  char digest[256] = "Error!";
+  int p[2];
+  if(pipe(p)==0) {
+    fflush(logfile);
+    pid_t pid = fork();
+    if(pid==0) {
+      dup2(p[1],STDOUT_FILENO); dup2(fileno(logfile),STDERR_FILENO);
+      close(p[0]); close(p[1]);
+      execlp(SHASUM_EXE,SHASUM_EXE,name,(char *)NULL);
+      _exit(127);
+    }
+    close(p[1]);
+    ssize_t r = pid>0 ? read(p[0],digest,sizeof(digest)-1) : -1;
+    close(p[0]);
+    int status;
+    if(pid>0) waitpid(pid,&status,0);
+    if(r>0 && pid>0 && WIFEXITED(status) && WEXITSTATUS(status)==0) {
+      digest[r] = 0;
+      digest[strcspn(digest," \n")] = 0;
+    }
+    else strcpy(digest,"Error!");
+  }
+  printf("%s %s: %s\n",label,SHASUM_EXE,digest);
+}
+
+static void remove_output(const char *name) {
+  if(remove(name)!=0) printf("Error: %s - %s.\n",name,strerror(errno));
+}
+
+/* ************************************************************
+ * command line
+ * ************************************************************ */
+
+static bool valid_bytes(int b) {
+  return b==1 || b==2 || b==4;
+}
+
+// check correctness of number of input file and define basename for output
+static void check_input(egap_args *a) {
+  // ---- if the inputs are bwt there must be at least 2 of them
+  if(a->bwt) {
+    if(a->ninput<2) die("You must supply at least 2 input BWT files!");
+    if(!a->out) die("Please use option -o to specify an output basename!");
+    if(a->sa) die("SA construction not supported for merging BWT files!");
+    a->basename = a->out;
+  }
+  // ---- if the input are concatenated texts there is a single file
+  else {
+    if(a->ninput!=1) die("You must supply a single file containing the concatenation of the input texts!");
+    a->basename = a->out ? a->out : a->input[0];  // specify basename for input files gap+merge
+  }
+  // tests common to the two operation modes
+  if(!valid_bytes(a->lbytes)) die("The number of bytes for LCP entry must be 1, 2 or 4");
+  if(!valid_bytes(a->dbytes)) die("The number of bytes for DA entry must be 1, 2 or 4");
+  if(!valid_bytes(a->sbytes)) die("The number of bytes for SA entry must be 1, 2 or 4");
+  if(a->delete && !a->sum) die("Option --delete can only be used with --sum");
+  if(a->pipe<0) die("Option --pipeline requires a positive number of BWTs");
+  if(a->pipe>0 && (a->bwt || a->da || a->sa || a->qs || a->trlcp>0 || a->deB>0))
+    die("Option --pipeline can only be used to compute the BWT and LCP array of a single input file");
+  if(a->lcp && a->trlcp>0) die("You can compute either the true LCP values of the truncated values, not both!");
+  if((a->lcp || a->trlcp>0) && a->deB>0) die("You can compute either the LCP values or the de Bruijn graph info, not both!");
+  if((a->deB>0 && a->deB<2) || (a->trlcp>0 && a->trlcp<2)) die("Options --deB/--trlcp requires a parameter larger than one");
+  // warning if deBruijn graph construction is used
+  if(a->deB>0 || a->trlcp>0) {
+    puts("!! Warning: options --deB/--trlcp k only consider the leading k symbols");
+    puts("!!          of each suffix: the resulting BWT is not the standard one");
+  }
+  if(a->qs) {
+    char *ext = strrchr(a->input[0],'.');
+    if(!ext || (strcmp(ext,".fastq")!=0 && strcmp(ext,".fq")!=0)) die("You can use --qs only for FASTQ files");
+  }
+}
+
+enum {OPT_LBYTES=256, OPT_DBYTES, OPT_SBYTES, OPT_AIO, OPT_SCRATCH, OPT_UNCACHED, OPT_TRLCP, OPT_DEB,
+      OPT_SUM, OPT_DELETE, OPT_EM, OPT_SE, OPT_IM, OPT_PIPELINE};
+
+static struct option long_options[] = {
+  {"mem",      required_argument, NULL, 'm'},
+  {"out",      required_argument, NULL, 'o'},
+  {"bwt",      no_argument,       NULL, 'b'},
+  {"lcp",      no_argument,       NULL, 'l'},
+  {"da",       no_argument,       NULL, 'd'},
+  {"sa",       no_argument,       NULL, 's'},
+  {"qs",       no_argument,       NULL, 'q'},
+  {"rev",      no_argument,       NULL, 'r'},
+  {"lbytes",   required_argument, NULL, OPT_LBYTES},
+  {"dbytes",   required_argument, NULL, OPT_DBYTES},
+  {"sbytes",   required_argument, NULL, OPT_SBYTES},
+  {"threads",  required_argument, NULL, 't'},
+  {"ktuple",   required_argument, NULL, 'k'},
+  {"aio",      required_argument, NULL, OPT_AIO},
+  {"scratch",  required_argument, NULL, OPT_SCRATCH},
+  {"uncached", no_argument,       NULL, OPT_UNCACHED},
+  {"pipeline", required_argument, NULL, OPT_PIPELINE},
+  {"trlcp",    required_argument, NULL, OPT_TRLCP},
+  {"deB",      required_argument, NULL, OPT_DEB},
+  {"sum",      no_argument,       NULL, OPT_SUM},
+  {"delete",   no_argument,       NULL, OPT_DELETE},
+  {"em",       no_argument,       NULL, OPT_EM},
+  {"se",       no_argument,       NULL, OPT_SE},
+  {"im",       no_argument,       NULL, OPT_IM},
+  {"phase1",   no_argument,       NULL, '1'},
+  {"phase2",   no_argument,       NULL, '2'},
+  {"help",     no_argument,       NULL, 'h'},
+  {NULL, 0, NULL, 0}
+};
+
+static void parse_args(int argc, char *argv[], egap_args *a) {
+  memset(a,0,sizeof(*a));
+  a->mem = -1;
+  a->lbytes = 2; a->dbytes = 4; a->sbytes = 4;
+  a->threads = 1; a->ktuple = 1;
+  int c;
+  while((c=getopt_long(argc,argv,"m:o:bldsqrt:k:12vh",long_options,NULL))!=-1) {
+    switch(c) {
+      case 'm': a->mem = atol(optarg); break;
+      case 'o': a->out = optarg; break;
+      case 'b': a->bwt = true; break;
+      case 'l': a->lcp = true; break;
+      case 'd': a->da = true; break;
+      case 's': a->sa = true; break;
+      case 'q': a->qs = true; break;
+      case 'r': a->rev = true; break;
+      case 't': a->threads = atoi(optarg); break;
+      case 'k': a->ktuple = atoi(optarg); break;
+      case '1': a->phase1 = true; break;
+      case '2': a->phase2 = true; break;
+      case 'v': a->v = true; break;
+      case OPT_LBYTES: a->lbytes = atoi(optarg); break;
+      case OPT_DBYTES: a->dbytes = atoi(optarg); break;
+      case OPT_SBYTES: a->sbytes = atoi(optarg); break;
+      case OPT_AIO: a->aio = atoi(optarg); break;
+      case OPT_SCRATCH: a->scratch = optarg[0] ? optarg : NULL; break;
+      case OPT_UNCACHED: a->uncached = true; break;
+      case OPT_PIPELINE: a->pipe = atoi(optarg); break;
+      case OPT_TRLCP: a->trlcp = atoi(optarg); break;
+      case OPT_DEB: a->deB = atoi(optarg); break;
+      case OPT_SUM: a->sum = true; break;
+      case OPT_DELETE: a->delete = true; break;
+      case OPT_EM: a->em = true; break;
+      case OPT_SE: a->se = true; break;
+      case OPT_IM: a->im = true; break;
+      default: usage(argv[0]);
+    }
+  }
+  if(optind>=argc) usage(argv[0]);
+  a->input = argv+optind;
+  a->ninput = argc-optind;
+  if(a->out && !a->out[0]) a->out = NULL;
+}
+
+int main(int argc, char *argv[]) {
+  egap_args a;
+  parse_args(argc,argv,&a);
+  // if no max RAM provided on command line uses 95% of total
+  if(a.mem<0) {
+    double mem = (double) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
+    a.mem = (long) (0.95*mem/(1<<20));
+    if(a.mem<16) a.mem = 16;  // avoid accidental 0
+    printf("Using %ld MBs of RAM\n",a.mem);
+  }
+  // ---- check number of input files and define basename
+  check_input(&a);
+  // ---- get main eGap directory
+  char *slash = strrchr(argv[0],'/');
+  if(slash) snprintf(a.dir,PATH_MAX,"%.*s",(int)(slash-argv[0]),argv[0]);
+  // ---- create and open log file
+  snprintf(a.log,PATH_MAX,"%s.eGap.log",a.basename);
+  printf("Sending logging messages to file: %s\n",a.log);
+  FILE *logfile = fopen(a.log,"a");
+  if(!logfile) {perror(a.log); exit(1);}
+
+  fprintf(logfile,">>> Begin computation\n");
+  fprintf(logfile,">>> eGap version " VERSION "\n");
+  fprintf(logfile,"Command line:");
+  for(int i=0;i<argc;i++) fprintf(logfile," %s",argv[i]);
+  fprintf(logfile,"\nUsing %ld MBs of RAM\n",a.mem);
+  fflush(logfile);
+
+  // ---- phase1: concatenate/compute BWTs
+  double start0, start;
+  start0 = start = now();
+  if(!phase1(&a,logfile)) exit(1);  // fatal error during phase 1
+  printf("Elapsed time: %.4f\n",now()-start);
+  if(a.phase1) {
+    puts("Exiting after phase 1 as requested");
+    return 0;
+  }
+
+  // ---- phase2: merging of BWTs and computation of LCP and DA arrays
+  start = now();
+  if(!phase2(&a,logfile)) exit(1);  // fatal error during phase 2
+  printf("Elapsed time: %.4f\n",now()-start);
+  char name[PATH_MAX];
+  snprintf(name,PATH_MAX,"%s.size",a.basename);
+  if(remove(name)!=0) {              // delete size file no longer useful
+    printf("Error: %s - %s.\n",name,strerror(errno));
+    exit(1);
+  }
+  if(a.phase2) {
+    puts("Exiting after phase 2 as requested");
+    return 0;
+  }
+
+  // ---- phase3: merging of LCP values (not needed if gap wrote them directly)
+  if((a.lcp || a.trlcp>0) && !a.lcpdirect) {
+    start = now();
+    if(!phase3(&a,logfile)) exit(1);  // fatal error during phase 3
+    printf("Elapsed time: %.4f\n",now()-start);
+  }
+
+  // ---- final report
+  double elapsed = now()-start0;
+  struct stat st;
+  snprintf(name,PATH_MAX,"%s.bwt",a.basename);
+  if(stat(name,&st)!=0) {perror(name); exit(1);}
+  double outsize = st.st_size>0 ? st.st_size : 1;
+  puts("==== Done");
+  printf("Total construction time: %.4f   usec/byte: %.4f (outsize: %jd)\n",elapsed,elapsed*1e6/outsize,(intmax_t)st.st_size);
+  // -------- compute hash sums using SHASUM_EXE
+  char lcpname[PATH_MAX], daname[PATH_MAX], saname[PATH_MAX];
+  snprintf(lcpname,PATH_MAX,"%s.%d.lcp",a.basename,a.lbytes);
+  snprintf(daname,PATH_MAX,"%s.%d.da",a.basename,a.dbytes);
+  snprintf(saname,PATH_MAX,"%s.%d.sa",a.basename,a.sbytes);
+  if(a.sum) {
+    file_digest("BWT",name,logfile);
+    if(a.lcp || a.trlcp) file_digest("LCP",lcpname,logfile);
+    if(a.deB) {
+      char bitname[PATH_MAX];
+      snprintf(bitname,PATH_MAX,"%s.%d.lcpbit0",a.basename,a.deB);
+      file_digest("LCP_0",bitname,logfile);
+      snprintf(bitname,PATH_MAX,"%s.%d.lcpbit1",a.basename,a.deB);
+      file_digest("LCP_1",bitname,logfile);
+    }
+    if(a.da) file_digest("DA ",daname,logfile);
+    if(a.sa) file_digest("SA ",saname,logfile);
+  }
+  // -------- delete output files if required
+  if(a.sum && a.delete) {
+    remove_output(name);
+    if(a.lcp) remove_output(lcpname);
+    if(a.da) remove_output(daname);
+    if(a.sa) remove_output(saname);
+  }
+  fprintf(logfile,">>> End test\n");
+  fclose(logfile);
+  return 0;
+}
@@ -4,11 +4,13 @@
 // External memory version:
 //  * solid blocks are kept in two external files:
 //    one for current blocks, the other for next iteration blocks
-//  * no squeezing: 1) it was not very effective in ram, 2) it increases
-//    alphabet size and therefore the number of access points to mmapped memory
-//    3) squeezing was still not working for multi-bwt inputs       
+//  * no squeezing by default: 1) it was not very effective in ram, 2) it increases
+//    alphabet size and therefore the number of access points to mmapped memory.
+//    Option -k replaces the symbols with k-tuples (see alphabet.c) so that
+//    each iteration extends the prefixes by k symbols: useful for DNA 
 #include "util.h"
 #include "alphabet.h"
+#include "io.h"
 #include "gap.h"
 #if MALLOC_COUNT_FLAG
   #include "malloc_count/malloc_count.h"
@@ -36,17 +38,25 @@ void usage(char *name, g_data *g){
   puts("\t-d D  create document array using D bytes per entry, ext: ."DA_EXT);
   puts("\t-S S  create suffix array using S bytes per entry, ext: ."SA_EXT);
   puts("\t-q    (only for fastq) create QS permuted according to the BWT, ext: ."QS_EXT);
+  puts("\t-L    with -l write the lcp values directly to the output file, ext: ."LCP_EXT" (mergelcp not needed)");
   puts("\t-x    compute lcp without external mergesort");
   puts("\t-a    assume alphabet is small");   
-  printf("\t-g G  max # BWTs merged simultaneously (def %llu)\n", MAX_NUMBER_OF_BWTS);   
+  printf("\t-g G  max # BWTs merged simultaneously (def %llu, %llu with -m or -k, 128 with -D)\n", MAX_NUMBER_OF_BWTS, MAX_NARROW_BWTS);   
   puts("\t-A a  preferred gap algorithm to use (see doc or leave it alone)");   
   puts("\t-m    use H&M algorithm");
   printf("\t-s S  minimum solid block size (def %d)\n",g->solid_limit);
   puts("\t-p P  use P parallel threads for merging (def 0)");
+  puts("\t-t T  use T threads inside each iteration of the last round (def 1, forces gap, not with -E)");
   puts("\t-E    run in external memory");
+  puts("\t-y Y  use Y threads for asynchronous I/O in external memory (def 0)");
+  puts("\t-U    drop temporary files from the page cache after each sequential pass (-vv reports its peak footprint)");
+  puts("\t-X L  colon separated list of scratch directories for the temporary files (def. output dir)");
+  puts("\t-M M  use at most M MBs of RAM, the buffers take what is left by the data structures (def. no limit)");
   puts("\t-T    mmap input BWT arrays (overwrite input BWTs)");
   puts("\t-Z    mmap merge arrays");
   puts("\t-B    mmap B array");
+  printf("\t-W    buffer the writes to the new Z array (internal memory, at most %llu BWTs)\n", MAX_NARROW_BWTS);
+  printf("\t-k K  squeeze K symbols per BWT symbol, small alphabets only (def 1, max %d)\n",Ktuple_max);
   puts("\t-D k  compute order-k deBruijn graph info (def No)");
   puts("\t-v    verbose output (more v's for more verbose)\n");
 }
@@ -55,6 +65,7 @@ int main(int argc, char *argv[]) {
   extern int optind, opterr, optopt;
   extern char *optarg;
   int c, group_size;
+  bool group_set = false;
   char *path;
   g_data g;
 
@@ -63,16 +74,22 @@ int main(int argc, char *argv[]) {
   group_size=MAX_NUMBER_OF_BWTS;      
   g.mwXMerge = g.bwtOnly = true;
   bool hm = false;
-  g.unsortedLcp = NULL;
+  g.unsortedLcp = NULL; g.lcpRuns = NULL;
+  g.lcpDirect = false; g.lcpOut = NULL;
   g.outPath = NULL;
   g.algorithm = 0;
+  g.gapThreads = 1;
   g.extMem = g.smallAlpha=g.mmapZ=g.mmapBWT=g.mmapB= g.lcpMerge = g.lcpCompute = false;
+  g.wcColors = false;
+  g.zBytes = sizeof(palette);
+  g.ktuple = 1; g.ktuple0 = NULL; g.ktupleLcp = NULL;
   g.outputDA = 0;
   g.outputSA = 0;
   g.outputQS = 0;
   g.dbOrder = 0;           // order for deBruijn graph 
-  int num_threads = 0;
-  while ((c=getopt(argc, argv, "vhalrxmd:p:g:A:s:o:EZTBD:S:q")) != -1) {
+  int num_threads = 0, aio_threads = 0;
+  long mem_mb = 0;
+  while ((c=getopt(argc, argv, "vhalLrxmd:p:t:g:A:s:o:EZTBWD:S:qk:y:UM:X:")) != -1) {
     switch (c) 
       {
       case 'v':
@@ -82,6 +99,8 @@ int main(int argc, char *argv[]) {
       case 'l':
         g.lcpCompute = true;        // compute lcp array from scratch 
         g.bwtOnly=false; break;  
+      case 'L':
+        g.lcpDirect = true; break;  // write lcp values to their final position
       case 'r':
         g.lcpMerge = true;          // merge lcp values 
         g.bwtOnly=false; break;  
@@ -99,6 +118,7 @@ int main(int argc, char *argv[]) {
         g.smallAlpha=true; break;       // assume alphabet is small and use bwtOcc[][]
       case 'g':
         group_size = atoi(optarg);      // size for multigroup algorithm 
+        group_set = true;
         break;      
       case 'A':
         g.algorithm = atoi(optarg);     // preferred algorithm 
@@ -112,14 +132,32 @@ int main(int argc, char *argv[]) {
       case 'p':
         num_threads = atoi(optarg);     // number of consumer threads 
         break;       
+      case 't':
+        g.gapThreads = atoi(optarg);    // threads inside a single gap iteration
+        break;
       case 'E':
         g.extMem=true; break;           // use external memory (see mergegap.c)
+      case 'y':
+        aio_threads = atoi(optarg);     // threads for asynchronous I/O (see io.c)
+        break;
+      case 'U':
+        tmp_uncached(true); break;      // keep temporary files out of the page cache (see io.c)
+      case 'X':
+        scratch_init(optarg); break;    // directories for the temporary files (see io.c)
+      case 'M':
+        mem_mb = atol(optarg);          // memory budget in MBs (see mem_plan in io.c)
+        break;
       case 'Z':
         g.mmapZ=true; break;      // mmap merge and newmerge
       case 'B':
         g.mmapB=true; break;      // mmap B array
+      case 'W':
+        g.wcColors=true; break;   // write-combining buffers for newZ
       case 'T':
         g.mmapBWT=true; break;    // mmap input BWTs
+      case 'k':
+        g.ktuple = atoi(optarg);  // symbols per tuple 
+        break;
       case 'h':                   // usage instruction 
       case '?':
         usage(argv[0],&g);
@@ -148,10 +186,29 @@ int main(int argc, char *argv[]) {
     printf("Invalid number of threads, must be non negative\n");
     exit(EXIT_FAILURE);
   }
+  if(aio_threads <0) {
+    printf("Invalid number of I/O threads, must be non negative\n");
+    exit(EXIT_FAILURE);
+  }
+  if(mem_mb <0) {
+    printf("Invalid memory budget, must be non negative\n");
+    exit(EXIT_FAILURE);
+  }
+  if(g.gapThreads <1) {
+    printf("Invalid number of iteration threads, must be positive\n");
+    exit(EXIT_FAILURE);
+  }
   if(group_size<2 || group_size>MAX_NUMBER_OF_BWTS) {
     printf("Invalid group size. Must be in range [2,%llu]\n",MAX_NUMBER_OF_BWTS);
     exit(EXIT_FAILURE);
   } 
+  // the wide Z needed for more than MAX_NARROW_BWTS BWTs is only supported by gap without -k,
+  // and -D is only supported by gap128ext
+  int max_group = g.dbOrder>0 ? 128 : ((hm || g.ktuple>1) ? MAX_NARROW_BWTS : MAX_NUMBER_OF_BWTS);
+  if(group_size>max_group) {
+    if(group_set) printf("Options -m, -k and -D force a group size of at most %d\n",max_group);
+    group_size = max_group;
+  }
   if(hm && g.lcpCompute) {// not sure this is required, maybe changing something inside holtMcMillan() will suffice 
     printf("You cannot compute lcp values with H&M (only merge)\n");
     exit(EXIT_FAILURE);
@@ -160,10 +217,28 @@ int main(int argc, char *argv[]) {
     printf("You can *either* merge *or* compute lcp values\n");
     exit(EXIT_FAILURE);
   }
+  if(g.lcpDirect && !g.lcpCompute) {
+    printf("Option -L can only be used with -l\n");
+    exit(EXIT_FAILURE);
+  }
   if(!g.mwXMerge && !g.lcpCompute) {
     printf("Option -x can only be used with -l\n");
     exit(EXIT_FAILURE);
   }
+  if(g.ktuple<1 || g.ktuple>Ktuple_max) {
+    printf("Invalid tuple size. Must be in range [1,%d]\n",Ktuple_max);
+    exit(EXIT_FAILURE);
+  }
+  if(g.ktuple>1) { // squeezing is supported only by the gap procedure
+    if(hm || g.lcpMerge || g.dbOrder>0 || g.gapThreads>1 || g.wcColors) {
+      printf("Option -k incompatible with -m, -r, -D, -t and -W\n");
+      exit(EXIT_FAILURE);
+    }
+    if(!g.smallAlpha) {
+      printf("Option -k forces option -a\n");
+      g.smallAlpha = true;
+    }
+  }
   if(g.extMem) {
     if(hm) {
       printf("You cannot run H&M in external memory\n");
@@ -185,6 +260,8 @@ int main(int argc, char *argv[]) {
     usage(argv[0],&g);
     exit(EXIT_FAILURE);
   }
+  if(aio_threads>0) aio_start(aio_threads);
+  mem_budget((size_t)mem_mb<<20, num_threads>0 ? num_threads : 1); // concurrent merges share the budget
 
   if(g.verbose>0) {
     puts("Command line:");
@@ -241,6 +318,9 @@ int main(int argc, char *argv[]) {
     // if requested allocate space for and read lcp Values (B array)
     if(g.lcpMerge)
        initLCPmem(&g); // init g.lcps. lcp values are stored in mmapped memory 
+    // input BWTs and LCPs in memory are shared by all merges 
+    if(!g.extMem && !g.mmapBWT) mem_reserve(g.mergeLen*sizeof(symbol));
+    if(g.lcpMerge) mem_reserve(g.mergeLen*sizeof(lcpInt));
           
     elapsed = (clock()-start)/(double)(CLOCKS_PER_SEC);
     elapsed_wc = difftime(time(NULL),start_wc);
@@ -279,6 +359,7 @@ int main(int argc, char *argv[]) {
       free(g.lcps);      
     }
   }
+  aio_stop();
   
   // report running times  
   elapsed = (clock()-start)/(double)(CLOCKS_PER_SEC);
@@ -298,6 +379,7 @@ int main(int argc, char *argv[]) {
            malloc_count_peak(), (double)malloc_count_peak()/g.mergeLen);
   #endif
   printf("##\n");
+  scratch_report(elapsed_wc);
 
   return 0; // Done!!!
 }
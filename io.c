@@ -2,33 +2,46 @@
 #include "util.h"
 #include "io.h"
 
-// open a file for each input BWT, file pointers are stored to bwf[] 
+// bytes allocated by breader_init for a reader with nbuf buffers of size bytes
+static size_t breader_mem(size_t size, int nbuf)
+{
+  size = ((size+BREADER_ALIGN-1)/BREADER_ALIGN)*BREADER_ALIGN;
+  return nbuf*size+BREADER_ALIGN;  // the alignment of the buffers takes up to BREADER_ALIGN bytes
+}
+
+// size of the buffer of the reader of bws[i]: a buffer larger than bws[i] would be wasted 
+static size_t bwt_rbuffer_size(g_data *g, int i)
+{
+  size_t len = (size_t) g->bwtLen[i]*sizeof(symbol);
+  return len>0 && len<g->buf.bwtRead ? len : g->buf.bwtRead;
+}
+
+// open a reader for each input BWT, readers are stored to bwf[] and share 
+// a single file descriptor. The size of their buffers is chosen by mem_plan() 
 void open_bw_files(g_data *g) {
-  assert(g->extMem);
-  g->bwf = malloc(g->numBwt*sizeof(FILE *));
+  assert(g->extMem && g->buf.bwtRead>0);
+  g->bwf = malloc(g->numBwt*sizeof(breader));
   if(g->bwf==NULL) die(__func__);
-  for(int i=0; i< g->numBwt; i++) {
-    g->bwf[i] = fopen(g->bwfname,"r");
-    if(!g->bwf[i]) die(__func__);
-  }
+  int fd = open(g->bwfname,O_RDONLY);
+  if(fd==-1) die(__func__);
+  for(int i=0; i< g->numBwt; i++)
+    breader_init(&g->bwf[i],fd,bwt_rbuffer_size(g,i),0,false);
 }
 
 // use bws[] to make bwf[i] point at the beginning of bws[i]  
 void rewind_bw_files(g_data *g) {
   assert(g->extMem);
-  for(int i=0; i< g->numBwt; i++) {
-    int e = fseek(g->bwf[i],sizeof(symbol)*(g->bws[i]-g->bws[0]+g->symb_offset),SEEK_SET);
-    if(e!=0) die(__func__);
-  }
+  for(int i=0; i< g->numBwt; i++)
+    breader_seek(&g->bwf[i],sizeof(symbol)*(g->bws[i]-g->bws[0]+g->symb_offset));
 }
 
-// close the files bwf[i]  
+// close the readers bwf[i] and the bwt file  
 void close_bw_files(g_data *g) {
   assert(g->extMem);
-  for(int i=0; i< g->numBwt; i++) {
-    int e = fclose(g->bwf[i]);
-    if(e!=0) die(__func__);
-  }
+  int fd = g->bwf[0].fd;
+  for(int i=0; i< g->numBwt; i++) 
+    breader_close(&g->bwf[i]);
+  if(close(fd)!=0) die(__func__);
   free(g->bwf);
 }
 
@@ -135,9 +148,7 @@ void close_da_files(g_data *g) {
 FILE *gap_tmpfile(char* path)
 {
   // create local copy of template
-  char s[strlen(path)+11];
-  sprintf(s,"%s.tmpXXXXXX",path);
-  assert(strlen(s)==strlen(path) + 10);
+  char *s = tmp_template(path,TMP_LIST,".tmpXXXXXX");
   // get file descriptor for tmp file 
   int fd = mkstemp(s);
   if(fd == -1) die("gap_tmpfile: Tempfile creation failed (1)");
@@ -147,76 +158,983 @@ FILE *gap_tmpfile(char* path)
   // unlink file so it is deleted as soon as it is closed
   int e = unlink(s);
   if(e!=0)     die("gap_tmpfile: Tempfile creation failed (3)");
+  free(s);
   return f;
 }
 
 
-// read/write huge blocks to file using multiple pread/pwrite calls 
+// ----- scratch directories (option -X)
+// The temporary files are spread over a list of directories, possibly on different
+// devices, so that files read and written together use different devices: 
+// Z is read from the merge file in the first directory while newZ is written to 
+// the newmerge file in the second one (the two files swap names at each iteration), 
+// consecutive solid block lists, one read and the other written, go round robin to 
+// the other directories, the bitfile to the last one. The amount of data 
+// transferred by each device is taken from /sys/dev/block (Linux only) 
+static struct {
+  int n;                          // number of scratch dirs, 0 if none 
+  char *dir[MAX_SCRATCH_DIRS];
+  dev_t dev[MAX_SCRATCH_DIRS];    // device of each dir
+  uint64_t rd[MAX_SCRATCH_DIRS];  // sectors read and written by the device at the start 
+  uint64_t wr[MAX_SCRATCH_DIRS];
+  unsigned next;                  // next solid block list  
+} Scratch;
 
-void huge_pwrite(int fd, const void *vbuf, size_t count, off_t offset)
+// read the sectors read and written so far by device d, false if not available 
+static bool scratch_sectors(dev_t d, uint64_t *rd, uint64_t *wr)
+{
+  #ifdef __linux__
+  char s[PATH_MAX];
+  snprintf(s,PATH_MAX,"/sys/dev/block/%u:%u/stat",major(d),minor(d));
+  FILE *f = fopen(s,"r");
+  if(f==NULL) return false;
+  int e = fscanf(f,"%*u %*u %"SCNu64" %*u %*u %*u %"SCNu64,rd,wr);
+  fclose(f);
+  return e==2;
+  #else
+  return false;
+  #endif
+}
+
+// init the scratch directories from a colon separated list 
+void scratch_init(char *dirs)
+{
+  char *list = strdup(dirs);
+  if(list==NULL) die(__func__);
+  for(char *d=strtok(list,":"); d!=NULL; d=strtok(NULL,":")) {
+    struct stat st;
+    if(stat(d,&st)!=0 || !S_ISDIR(st.st_mode)) {
+      fprintf(stderr,"Invalid scratch directory: %s\n",d); exit(EXIT_FAILURE);
+    }
+    if(Scratch.n==MAX_SCRATCH_DIRS) {
+      fprintf(stderr,"At most %d scratch directories\n",MAX_SCRATCH_DIRS); exit(EXIT_FAILURE);
+    }
+    Scratch.dir[Scratch.n] = d;
+    Scratch.dev[Scratch.n] = st.st_dev;
+    if(!scratch_sectors(st.st_dev,&Scratch.rd[Scratch.n],&Scratch.wr[Scratch.n]))
+      Scratch.rd[Scratch.n] = Scratch.wr[Scratch.n] = 0;
+    Scratch.n++;
+  }
+  if(Scratch.n==0) {fprintf(stderr,"Empty list of scratch directories\n"); exit(EXIT_FAILURE);}
+  // list is not freed: Scratch.dir[] points inside it 
+}
+
+// return a malloc'ed template for mkstemp for a temporary file of class c:
+// path+suffix or, with scratch directories, dir/basename(path)+suffix 
+char *tmp_template(char *path, int c, const char *suffix)
+{
+  char *s;
+  int e;
+  if(Scratch.n==0) e = asprintf(&s,"%s%s",path,suffix);
+  else {
+    int n = Scratch.n, d;
+    if(c==TMP_MERGE) d = 0;
+    else if(c==TMP_NEWMERGE) d = 1%n;
+    else if(c==TMP_BITFILE) d = n-1;
+    else { // solid block lists avoid the merge files devices if possible  
+      unsigned i = __atomic_fetch_add(&Scratch.next,1,__ATOMIC_RELAXED);
+      d = n>2 ? 2+i%(n-2) : i%n;
+    }
+    char *base = strrchr(path,'/');
+    e = asprintf(&s,"%s/%s%s",Scratch.dir[d],base ? base+1 : path,suffix);
+  }
+  if(e<0) die(__func__);
+  return s;
+}
+
+// report the data transferred by each device containing scratch directories
+void scratch_report(double secs)
+{
+  for(int i=0;i<Scratch.n;i++) {
+    bool first = true;  // report each device once, with all its dirs
+    for(int j=0;j<i;j++) 
+      if(Scratch.dev[j]==Scratch.dev[i]) first = false;
+    if(!first) continue;
+    printf("Scratch device %u:%u (%s",major(Scratch.dev[i]),minor(Scratch.dev[i]),Scratch.dir[i]);
+    for(int j=i+1;j<Scratch.n;j++) 
+      if(Scratch.dev[j]==Scratch.dev[i]) printf(", %s",Scratch.dir[j]);
+    uint64_t rd, wr;
+    if(!scratch_sectors(Scratch.dev[i],&rd,&wr)) {
+      puts("): no I/O statistics available");
+      continue;
+    }
+    double r = (rd-Scratch.rd[i])*512.0/(1<<20), w = (wr-Scratch.wr[i])*512.0/(1<<20);
+    if(secs<1) secs = 1;
+    printf("): read %.1lf MBs (%.1lf MB/s), written %.1lf MBs (%.1lf MB/s)\n",r,r/secs,w,w/secs);
+  }
+}
+
+
+// ----- memory budget (option -M)
+// The budget is shared by the merges running concurrently in a multiround 
+// computation: the memory used by all of them (e.g. the input BWTs in internal 
+// memory) is reserved with mem_reserve() and each merge gets an equal share of 
+// the rest, the last round all of it. mem_plan() subtracts from the share the 
+// data structures whose size is fixed and splits what is left among the I/O 
+// buffers, shrinking them if needed so that the memory they actually take fits. 
+// Without a budget the buffers have their default sizes 
+static struct {
+  size_t budget;   // bytes available, 0 if there is no budget
+  size_t reserved; // bytes used outside the merges
+  int shares;      // max number of merges running concurrently 
+} Mem = {0,0,1};
+
+void mem_budget(size_t bytes, int shares)
+{
+  assert(shares>0);
+  Mem.budget = bytes;
+  Mem.shares = shares;
+}
+
+void mem_reserve(size_t bytes)
+{
+  Mem.reserved += bytes;
+}
+
+// estimate of the memory used by the data structures of the merge described by g
+// that do not depend on the budget: Z, newZ, B and the counters (see gap() in mergegap.c)
+static size_t mem_fixed(g_data *g)
+{
+  size_t m = (g->numBwt+2)*(g->sizeOfAlpha+1)*sizeof(customInt);
+  if(!g->extMem)
+    m += 2*g->mergeLen*g->zBytes;
+  if(g->lcpMerge) m += g->mergeLen*sizeof(lcpInt);
+  else m += ((g->mergeLen+31)/32)*sizeof(uint64_t);
+  if(g->ktuple>1 && g->lcpCompute)
+    m += (g->mergeLen+1)/2;
+  if(g->lcpDirect && g->lcpCompute) // pages of the mmapped output lcp file 
+    m += g->mergeLen*sizeof(lcpInt);
+  if(g->extMem) { // BWT readers, buffers and chunk lengths of the merge files (see zrle_new)
+    m += g->numBwt*sizeof(breader);
+    m += (1+AIO_WBUFFERS)*ZRLE_CHUNK*g->zBytes + ((g->mergeLen+ZRLE_CHUNK-1)/ZRLE_CHUNK+1)*(2*sizeof(uint32_t)+1);
+  }
+  m += 4*BUFSIZ; // stdio buffers of the solid block lists and of the lcp files
+  return m;
+}
+
+// return x*num/den clamped to [min,max]: max is lowered to the size of the data 
+// the buffer is for, since a larger buffer would be wasted 
+static size_t mem_part(size_t x, int num, size_t den, size_t min, size_t max, size_t data)
+{
+  size_t s = (x/den)*num/100;
+  if(data<max) max = data;
+  return s>max ? max : (s<min ? min : s);
+}
+
+// bytes allocated for the buffers of size b by open_bw_files, zreader_init, cwriter_init, 
+// bitfile_create and open_unsortedLCP_files, including the alignment slack of the readers and the 
+// extra buffers of asynchronous I/O: nr for each reader and nw for each of the nc cwriters
+static size_t mem_buffers(g_data *g, int nr, int nw, int nc)
+{
+  ioBuffers *b = &g->buf;
+  size_t m = 0;
+  if(g->extMem) {
+    for(int i=0;i<g->numBwt;i++)
+      m += breader_mem(bwt_rbuffer_size(g,i),nr);
+    // merge file reader and cwriters: the run-length coded chunks use their own buffers 
+    size_t c = (size_t) ZRLE_CHUNK*g->zBytes;
+    size_t r = breader_mem(b->colorRead,nr), w = nw*b->colorWrite*g->zBytes;
+    m += r>(nr+1)*c ? r : (nr+1)*c;
+    m += nc*(w>c+ZRLE_CHUNK/8 ? w : c+ZRLE_CHUNK/8);
+    m += nr*b->bitfile;
+  }
+  if(g->lcpCompute && !g->lcpDirect) { // the pairs and the output buffer of the lcpArena
+    size_t p = b->lcpWrite/(POS_SIZE+BSIZE);
+    if(p==0) p = 1;
+    m += (p + (p<LCP_OUT_PAIRS ? p : LCP_OUT_PAIRS))*(POS_SIZE+BSIZE);
+  }
+  return m;
+}
+
+// s reduced by the factor f, but not below min 
+static size_t mem_scale(size_t s, double f, size_t min)
 {
-  const char *buf = (const char *) vbuf;
+  size_t t = s*f;
+  if(s<min) return s;
+  return t>min ? t : min;
+}
+
+// set the buffer sizes to the sizes in top reduced by the factor f, but not below
+// the minimum sizes of mem_part: smaller buffers would save little memory and 
+// cost a system call every few colors
+static void mem_shrink(g_data *g, const ioBuffers *top, double f)
+{
+  ioBuffers *b = &g->buf;
+  b->bwtRead    = mem_scale(top->bwtRead,f,BREADER_ALIGN);
+  b->colorRead  = mem_scale(top->colorRead,f,BREADER_ALIGN);
+  b->colorWrite = mem_scale(top->colorWrite,f,BREADER_ALIGN/g->zBytes);
+  b->bitfile    = mem_scale(top->bitfile,f,BUFSIZ);
+  b->lcpWrite   = mem_scale(top->lcpWrite,f,BUFSIZ);
+}
+
+// choose the sizes of the buffers of a merge and store them in g->buf
+void mem_plan(g_data *g, bool lastRound)
+{
+  ioBuffers *b = &g->buf;
+  int nr = aio_active() ? 2 : 1;                // with -y each reader has two buffers 
+  int nw = aio_active() ? AIO_WBUFFERS : 1;     // and each cwriter AIO_WBUFFERS 
+  int nc = g->sizeOfAlpha>1 ? g->sizeOfAlpha-1 : 1;  // number of cwriters 
+  customInt maxLen = 0;
+  for(int i=0;i<g->numBwt;i++)
+    if(g->bwtLen[i]>maxLen) maxLen = g->bwtLen[i];
+  // default sizes: BWT readers take BWT_RBUFFER_TOTAL bytes overall, in external memory 
+  // each kind of buffer takes at most 1/EXT_BUFFER_FRACTION of the data it is for
+  int f = g->extMem ? EXT_BUFFER_FRACTION : 1;
+  size_t bwtTotal = g->mergeLen*sizeof(symbol)/f;
+  b->bwtRead = mem_part(bwtTotal<BWT_RBUFFER_TOTAL ? bwtTotal : BWT_RBUFFER_TOTAL,100,(size_t)g->numBwt*nr,
+                        BWT_RBUFFER_MIN,BWT_RBUFFER_MAX,maxLen*sizeof(symbol));
+  b->colorRead = mem_part(g->mergeLen*g->zBytes/f,100,nr,BREADER_ALIGN,COLOR_RBUFFER_SIZE,SIZE_MAX);
+  b->colorWrite = mem_part(g->mergeLen/f,100,(size_t)nc*nw,BREADER_ALIGN/g->zBytes,COLOR_WBUFFER_SIZE,SIZE_MAX);
+  b->bitfile = Bitfile_bufsize_bytes;
+  b->lcpWrite = (g->lcpCompute && !g->lcpDirect) ? mem_part(g->mergeLen*(POS_SIZE+BSIZE)/f,100,1,BUFSIZ,LCP_ARENA_SIZE,SIZE_MAX) : 0;
+  // in internal memory the solid block lists stay in RAM up to about one byte per symbol 
+  b->solidStore = g->extMem ? 0 : g->mergeLen;
+  if(Mem.budget==0) return;
+  
+  size_t share = Mem.budget>Mem.reserved ? Mem.budget-Mem.reserved : 0;
+  if(!lastRound) share /= Mem.shares;
+  size_t fixed = mem_fixed(g);
+  size_t avail = share>fixed ? share-fixed : 0;
+  if(g->extMem) { // percentages of avail given to each buffer
+    b->bwtRead    = mem_part(avail,40,(size_t)g->numBwt*nr,BWT_RBUFFER_MIN,MEM_BWT_RBUFFER_MAX,maxLen*sizeof(symbol));
+    b->colorRead  = mem_part(avail,15,nr,BREADER_ALIGN,MEM_COLOR_RBUFFER_MAX,g->mergeLen*g->zBytes);
+    b->colorWrite = mem_part(avail,30,(size_t)nc*nw,BREADER_ALIGN,MEM_COLOR_WBUFFER_MAX,g->mergeLen*g->zBytes)/g->zBytes;
+    if(b->colorWrite==0) b->colorWrite = 1;
+    b->bitfile    = mem_part(avail,5,nr,BUFSIZ,MEM_BITFILE_MAX,(g->mergeLen+7)/8);
+  }
+  if(g->lcpCompute && !g->lcpDirect) // the rest, and half of avail in internal memory
+    b->lcpWrite = mem_part(avail,g->extMem ? 10 : 50,1,BUFSIZ,MEM_LCP_ARENA_MAX,g->mergeLen*(POS_SIZE+BSIZE));
+  // the minimum sizes, the alignment slack and the extra buffers of asynchronous I/O 
+  // can make the buffers exceed avail: find by bisection the largest factor by which 
+  // the sizes must be reduced to fit
+  size_t need = mem_buffers(g,nr,nw,nc);
+  if(need>avail) {
+    ioBuffers top = *b;
+    mem_shrink(g,&top,0); // minimum sizes
+    need = mem_buffers(g,nr,nw,nc);
+    if(need>avail)
+      fprintf(stderr,"Warning: the data structures of this merge take about %zu MBs and the smallest I/O buffers %zu KBs,"
+                     " but only %zu MBs of the budget are available: the budget will be exceeded\n", fixed>>20, need>>10, share>>20);
+    else {
+      double lo = 0, hi = 1;
+      for(int k=0;k<20;k++) {
+        double f = (lo+hi)/2;
+        mem_shrink(g,&top,f);
+        if(mem_buffers(g,nr,nw,nc)<=avail) lo = f;
+        else hi = f;
+      }
+      mem_shrink(g,&top,lo);
+      need = mem_buffers(g,nr,nw,nc);
+    }
+  }
+  if(!g->extMem) // the solid block lists get what is left 
+    b->solidStore = avail>need ? avail-need : 0;
+  if(g->verbose>0) 
+    printf("Memory share %zu MBs, data structures %zu MBs, buffers %zu KBs: bwt %zux%d, merge %zu, newmerge %zux%d, bitfile %zu, lcp %zu, solid blocks %zu\n",
+           share>>20, fixed>>20, need>>10, b->bwtRead, g->numBwt, b->colorRead, b->colorWrite*g->zBytes, nc, b->bitfile, b->lcpWrite, b->solidStore);
+}
+
+
+// ----- page cache control for temporary files (option -U)
+// The temporary files (merge files, solid block lists, bitfile, lcp runs) are 
+// accessed sequentially once per iteration: with -U after each transfer the bytes 
+// are written to disk and dropped from the page cache, so that the cache footprint
+// of the computation stays within the memory set by the user 
+static bool Tmp_uncached = false;
+
+void tmp_uncached(bool u)
+{
+  Tmp_uncached = u;
+}
+
+bool tmp_uncached_active(void)
+{
+  return Tmp_uncached;
+}
+
+// write to disk and drop from the page cache the bytes [offset,offset+len) of fd
+// if len==0 up to the end of the file. If !wait the writeback is only started 
+// and the dirty pages are dropped by a later call with wait==true 
+void tmp_dontneed(int fd, off_t offset, off_t len, bool wait)
+{
+  if(!Tmp_uncached) return;
+  #ifdef __linux__
+  int e = sync_file_range(fd,offset,len,wait ? 
+            SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER : SYNC_FILE_RANGE_WRITE);
+  #else
+  int e = wait ? fsync(fd) : 0;
+  #endif
+  if(e!=0) die(__func__);
+  e = posix_fadvise(fd,offset,len,POSIX_FADV_DONTNEED);
+  if(e!=0) die(__func__);
+}
+
+// drop the whole content of a temporary file accessed via stdio 
+void tmp_fdontneed(FILE *f)
+{
+  if(!Tmp_uncached) return;
+  if(fflush(f)!=0) die(__func__);
+  tmp_dontneed(fileno(f),0,0,true);
+}
+
+// drop behind a sequential pass over f: to be called after the transfer of 
+// bytes bytes. When the current position crosses a multiple of TMP_DROP_SIZE  
+// the preceding window of TMP_DROP_SIZE bytes is dropped. fflush() is used only for 
+// write streams: if the stream is read the window has already been consumed  
+void tmp_fdrop_behind(FILE *f, size_t bytes, bool write)
+{
+  if(!Tmp_uncached) return;
+  off_t pos = ftello(f);
+  if(pos<0) die(__func__);
+  off_t w = pos/TMP_DROP_SIZE;
+  if(w==0 || (pos-(off_t)bytes)/TMP_DROP_SIZE==w) return;
+  if(write && fflush(f)!=0) die(__func__);
+  tmp_dontneed(fileno(f),(w-1)*TMP_DROP_SIZE,TMP_DROP_SIZE,true);
+}
+
+// bytes of fd currently in the page cache (checked with mincore in 1GB windows)
+// write only files are reopened for reading via /proc 
+size_t tmp_cached(int fd)
+{
+  struct stat st;
+  if(fstat(fd,&st)!=0) die(__func__);
+  int flags = fcntl(fd,F_GETFL);
+  if(flags==-1) die(__func__);
+  if((flags&O_ACCMODE)==O_WRONLY) {
+    char s[64];
+    snprintf(s,sizeof(s),"/proc/self/fd/%d",fd);
+    int rfd = open(s,O_RDONLY);
+    if(rfd==-1) return 0; // not available, ignore the file
+    size_t tot = tmp_cached(rfd);
+    if(close(rfd)!=0) die(__func__);
+    return tot;
+  }
+  long page = sysconf(_SC_PAGESIZE);
+  off_t window = 1024*1024*1024;
+  if(st.st_size<window) window = st.st_size; // vec[] must not weigh on the memory budget
+  size_t tot = 0;
+  unsigned char *vec = malloc(window/page+1);
+  if(vec==NULL) die(__func__);
+  for(off_t o=0; o<st.st_size; o+=window) {
+    size_t len = st.st_size-o < window ? st.st_size-o : window;
+    void *m = mmap(NULL,len,PROT_READ,MAP_SHARED,fd,o);
+    if(m==MAP_FAILED) die(__func__);
+    if(mincore(m,len,vec)!=0) die(__func__);
+    for(size_t i=0;i<(len+page-1)/page;i++)
+      if(vec[i]&1) tot += page;
+    if(munmap(m,len)!=0) die(__func__);
+  }
+  free(vec);
+  return tot;
+}
+
+
+// ----- asynchronous I/O (option -y)
+// pread/pwrite requests are queued and executed in FIFO order by a pool of helper threads 
+// so that the scan does not stall when a buffer is written or read. The caller 
+// owns the aioReq and must aio_wait() for it before reusing its buffer.
+// With no helper threads requests are executed immediately by the caller.
+static struct {
+  int threads;           // number of helper threads, 0 for synchronous I/O 
+  pthread_t *t;
+  aioReq *head, *tail;   // queue of requests not yet started
+  bool stop;             // helper threads must terminate when the queue is empty
+  pthread_mutex_t mutex; // mutex for all the above and for the done field of requests  
+  pthread_cond_t todo;   // signaled when a request is queued
+  pthread_cond_t done;   // broadcast when a request is completed
+} Aio = {.threads = 0, .mutex = PTHREAD_MUTEX_INITIALIZER, 
+         .todo = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+// transfer count bytes, return the number of bytes transferred 
+// which is smaller than count only if a read reaches the end of file 
+static ssize_t aio_execute(aioReq *r)
+{
+  char *buf = (char *) r->buf;
+  size_t count = r->count;
+  off_t offset = r->offset;
   while(count>0) {
-    ssize_t w = pwrite(fd,buf,count,offset);
-    if(w==0) die(__func__);
+    ssize_t w = r->write ? pwrite(r->fd,buf,count,offset) : pread(r->fd,buf,count,offset);
+    if(w<0 || (w==0 && r->write)) die(__func__);
+    if(w==0) break; // end of file
     count -= w;
     buf += w;
     offset += w;
   }
+  if(r->full && count>0) die(__func__);
+  if(r->tmp) tmp_dontneed(r->fd,r->offset,r->count-count,false);
+  return r->count-count;
+}
+
+static void *aio_worker(void *v)
+{
+  (void) v;
+  if(pthread_mutex_lock(&Aio.mutex)) die(__func__);
+  while(true) {
+    while(Aio.head==NULL && !Aio.stop)
+      if(pthread_cond_wait(&Aio.todo,&Aio.mutex)) die(__func__);
+    if(Aio.head==NULL) break; // stop and nothing to do 
+    aioReq *r = Aio.head;
+    Aio.head = r->next;
+    if(Aio.head==NULL) Aio.tail = NULL;
+    if(pthread_mutex_unlock(&Aio.mutex)) die(__func__);
+    ssize_t res = aio_execute(r);
+    if(pthread_mutex_lock(&Aio.mutex)) die(__func__);
+    r->res = res;
+    r->done = true;
+    if(pthread_cond_broadcast(&Aio.done)) die(__func__);
+  }
+  if(pthread_mutex_unlock(&Aio.mutex)) die(__func__);
+  return NULL;
+}
+
+// start the helper threads 
+void aio_start(int threads)
+{
+  assert(Aio.threads==0 && threads>0);
+  Aio.t = malloc(threads*sizeof(pthread_t));
+  if(Aio.t==NULL) die(__func__);
+  Aio.head = Aio.tail = NULL;
+  Aio.stop = false;
+  Aio.threads = threads;
+  for(int i=0;i<threads;i++)
+    if(pthread_create(&Aio.t[i],NULL,aio_worker,NULL)) die(__func__);
+}
+
+// terminate the helper threads after all requests have been executed 
+void aio_stop(void)
+{
+  if(Aio.threads==0) return;
+  if(pthread_mutex_lock(&Aio.mutex)) die(__func__);
+  Aio.stop = true;
+  if(pthread_cond_broadcast(&Aio.todo)) die(__func__);
+  if(pthread_mutex_unlock(&Aio.mutex)) die(__func__);
+  for(int i=0;i<Aio.threads;i++)
+    if(pthread_join(Aio.t[i],NULL)) die(__func__);
+  free(Aio.t);
+  Aio.threads = 0;
+}
+
+bool aio_active(void)
+{
+  return Aio.threads>0;
+}
+
+// init a request as completed so that waiting for it returns immediately
+static void aio_init(aioReq *r)
+{
+  r->done = true;
+  r->offset = -1;
+  r->res = 0;
+}
+
+// submit the transfer of count bytes  
+static void aio_submit(aioReq *r, int fd, bool write, bool full, bool tmp, void *buf, size_t count, off_t offset)
+{
+  assert(r->done);
+  r->fd = fd; r->write = write; r->full = full; r->tmp = tmp;
+  r->buf = buf; r->count = count; r->offset = offset;
+  r->next = NULL;
+  if(Aio.threads==0) { // synchronous I/O
+    r->res = aio_execute(r);
+    return;
+  }
+  if(pthread_mutex_lock(&Aio.mutex)) die(__func__);
+  r->done = false;
+  if(Aio.tail==NULL) Aio.head = r;
+  else Aio.tail->next = r;
+  Aio.tail = r;
+  if(pthread_cond_signal(&Aio.todo)) die(__func__);
+  if(pthread_mutex_unlock(&Aio.mutex)) die(__func__);
+}
+
+// wait for the completion of a request
+static void aio_wait(aioReq *r)
+{
+  if(Aio.threads==0) {assert(r->done); return;}
+  if(pthread_mutex_lock(&Aio.mutex)) die(__func__);
+  while(!r->done)
+    if(pthread_cond_wait(&Aio.done,&Aio.mutex)) die(__func__);
+  if(pthread_mutex_unlock(&Aio.mutex)) die(__func__);
+}
+
+
+// read/write huge blocks to file using multiple pread/pwrite calls 
+// with asynchronous I/O the block is split in chunks transferred in parallel 
+static void huge_io(int fd, char *buf, size_t count, off_t offset, bool write)
+{
+  aioReq r[AIO_HUGE_INFLIGHT];
+  for(int i=0;i<AIO_HUGE_INFLIGHT;i++) aio_init(&r[i]);
+  for(int i=0;count>0;i=(i+1)%AIO_HUGE_INFLIGHT) {
+    size_t c = (Aio.threads==0 || count<AIO_CHUNK_SIZE) ? count : AIO_CHUNK_SIZE;
+    aio_wait(&r[i]);
+    aio_submit(&r[i],fd,write,true,false,buf,c,offset);
+    count -= c;
+    buf += c;
+    offset += c;
+  }
+  for(int i=0;i<AIO_HUGE_INFLIGHT;i++) aio_wait(&r[i]);
+}
+
+void huge_pwrite(int fd, const void *vbuf, size_t count, off_t offset)
+{
+  huge_io(fd,(char *) vbuf,count,offset,true);
 }
     
 void huge_pread(int fd, void *vbuf, size_t count, off_t offset)
 {
-  char *buf = (char *) vbuf;
-  while(count>0) {
-    ssize_t w = pread(fd,buf,count,offset);
-    if(w==0) die(__func__);
-    count -= w;
-    buf += w;
-    offset += w;
+  huge_io(fd,(char *) vbuf,count,offset,false);
+}
+
+
+// ----- run-length coded merge files (external memory)
+// In the late iterations Z consists mostly of long runs of the same color. The merge 
+// files are split in chunks of ZRLE_CHUNK colors, each one stored at the offset of its 
+// first color either raw or, if shorter, as a sequence of (color, run length-1) pairs 
+// with the color in width bytes and the length as a varint. The cwriters count the runs 
+// of the colors they write and when their average length reaches ZRLE_MIN_RUN the cwriters
+// of the following iterations code the chunks (see cwriter_chunk_end). Positions 
+// skipped by a cwriter keep the color of 2 iterations before, hence a chunk written 
+// only in part is read, updated and coded again. Chunks containing the first position 
+// of a cwriter are shared by two cwriters and are always raw.
+// The reading of the merge file is done with a zreader 
+
+// init the chunks of two files with n colors of width bytes, all raw
+// firstColumn[1..alpha-1] are the first positions of the cwriters
+zrle *zrle_new(uint64_t n, int width, customInt *firstColumn, int alpha)
+{
+  zrle *z = malloc(sizeof(*z));
+  if(z==NULL) die(__func__);
+  z->n = n;
+  z->width = width;
+  z->chunks = (n+ZRLE_CHUNK-1)/ZRLE_CHUNK;
+  z->shared = calloc(z->chunks+1,sizeof(bool));
+  if(z->shared==NULL) die(__func__);
+  for(int c=1;c<alpha;c++)
+    if(firstColumn[c]%ZRLE_CHUNK!=0) z->shared[firstColumn[c]/ZRLE_CHUNK] = true;
+  for(int i=0;i<2;i++) {
+    z->len[i] = malloc((z->chunks+1)*sizeof(uint32_t));
+    if(z->len[i]==NULL) die(__func__);
+    for(size_t ch=0;ch<z->chunks;ch++)
+      z->len[i][ch] = (ch+1<z->chunks ? ZRLE_CHUNK : n-ch*ZRLE_CHUNK)*width;
+    z->bytes[i] = n*width;
+    z->coded[i] = 0;
   }
+  z->on = false;
+  z->colors = z->runs = 0;
+  z->tmp = malloc(ZRLE_CHUNK*width);
+  if(z->tmp==NULL) die(__func__);
+  for(int i=0;i<AIO_WBUFFERS;i++) {
+    z->out[i] = malloc(ZRLE_CHUNK*width);
+    if(z->out[i]==NULL) die(__func__);
+    aio_init(&z->req[i]);
+  }
+  z->next = 0;
+  return z;
 }
 
+void zrle_free(zrle *z)
+{
+  for(int i=0;i<AIO_WBUFFERS;i++) {
+    aio_wait(&z->req[i]);
+    free(z->out[i]);
+  }
+  free(z->tmp);
+  free(z->len[0]); free(z->len[1]);
+  free(z->shared);
+  free(z);
+}
+
+// the newmerge file has been completely written and becomes the merge file:
+// decide if the cwriters of the next iteration must code the chunks; they must
+// if the file they write contains coded chunks, since raw writes would overlap them 
+void zrle_swap(zrle *z)
+{
+  for(int i=0;i<AIO_WBUFFERS;i++) aio_wait(&z->req[i]);
+  uint32_t *t = z->len[0]; z->len[0] = z->len[1]; z->len[1] = t;
+  uint64_t b = z->bytes[0]; z->bytes[0] = z->bytes[1]; z->bytes[1] = b;
+  b = z->coded[0]; z->coded[0] = z->coded[1]; z->coded[1] = b;
+  if(z->colors>0) z->on = z->colors >= ZRLE_MIN_RUN*z->runs;
+  if(z->coded[1]>0) z->on = true;
+  z->colors = z->runs = 0;
+}
+
+// number of colors in chunk ch
+static inline size_t zrle_colors(zrle *z, size_t ch)
+{
+  return ch+1<z->chunks ? ZRLE_CHUNK : z->n-ch*ZRLE_CHUNK;
+}
+
+// code the n colors in src to dst, return the length of the code 
+// or 0 if it would not be shorter than max bytes 
+static size_t zrle_encode(const uint8_t *src, size_t n, int width, uint8_t *dst, size_t max)
+{
+  size_t len = 0;
+  for(size_t i=0;i<n;) {
+    size_t j=i+1;
+    if(width==1) while(j<n && src[j]==src[i]) j++;
+    else while(j<n && ((const palette2 *) src)[j]==((const palette2 *) src)[i]) j++;
+    if(len+width+VARINT_MAX_BYTES>=max) return 0;
+    dst[len++] = src[i*width];
+    if(width>1) dst[len++] = src[i*width+1];
+    uint64_t r = j-i-1;
+    for(;r>=0x80;r>>=7) dst[len++] = (r&0x7F)|0x80;
+    dst[len++] = r;
+    i = j;
+  }
+  return len;
+}
+
+// decode the len bytes in src to the n colors of dst
+static void zrle_decode(const uint8_t *src, size_t len, int width, uint8_t *dst, size_t n)
+{
+  const uint8_t *end = src+len;
+  size_t i=0;
+  while(src<end) {
+    int c = *src++;
+    if(width>1) c |= (*src++)<<8;
+    uint64_t r=0;
+    for(int s=0;;s+=7) {
+      if(src>=end || s>=64) die(__func__);
+      uint8_t b = *src++;
+      r |= (uint64_t) (b&0x7F)<<s;
+      if(b<0x80) break;
+    }
+    if(i+r+1>n) die(__func__);
+    if(width==1) memset(dst+i,c,r+1);
+    else for(uint64_t k=0;k<=r;k++) ((palette2 *) dst)[i+k] = c;
+    i += r+1;
+  }
+  if(i!=n) die(__func__);
+}
+
+// rewrite raw the coded chunks of file fname, which becomes a plain array of colors 
+// as required by the final merge of the BWTs (see mergeBWT and extract_bitfile)  
+void zrle_expand(zrle *z, char *fname)
+{
+  if(z==NULL || z->coded[0]==0) return;
+  int fd = open(fname,O_RDWR);
+  if(fd==-1) die(__func__);
+  for(size_t ch=0;ch<z->chunks;ch++) {
+    size_t n = zrle_colors(z,ch);
+    if(z->len[0][ch]==n*z->width) continue;
+    off_t off = (off_t) ch*ZRLE_CHUNK*z->width;
+    huge_pread(fd,z->out[0],z->len[0][ch],off);
+    zrle_decode(z->out[0],z->len[0][ch],z->width,z->tmp,n);
+    huge_pwrite(fd,z->tmp,n*z->width,off);
+    z->bytes[0] += n*z->width - z->len[0][ch];
+    z->len[0][ch] = n*z->width;
+  }
+  z->coded[0] = 0;
+  if(close(fd)!=0) die(__func__);
+}
+
+
+// first position in [i,n) whose bit in mask is v, n if none 
+static size_t mask_scan(const uint64_t *mask, size_t i, size_t n, bool v)
+{
+  while(i<n) {
+    uint64_t m = v ? mask[i/64] : ~mask[i/64];
+    m >>= i%64;
+    if(m) { i += __builtin_ctzll(m); return i<n ? i : n; }
+    i = (i/64+1)*64;
+  }
+  return n;
+}
 
 // ----- color writer functions 
+// write the current buffer and switch to the next one
 static void cwriter_flush(cwriter *w)
 {
   if(w->cur>0) {
-    huge_pwrite(w->fd,w->buffer,w->cur*sizeof(palette),w->offset);
-    w->offset += w->cur*sizeof(palette);
+    aio_submit(&w->req[w->next],w->fd,true,true,w->tmp,w->buffer,w->cur*w->width,w->offset);
+    w->offset += w->cur*w->width;
     w->cur=0;
+    w->next = (w->next+1)%w->nbuf;
+    aio_wait(&w->req[w->next]); // the buffer could still being written
+    w->buffer = w->bufs[w->next];
+  }
+}
+
+// write to the newmerge file the positions of the current chunk set by w.  
+// A chunk written in full is coded if shorter; a chunk written in part is read,
+// updated and coded again if it is coded or if most of it has been written,
+// otherwise (and always for shared chunks) only the written ranges are stored 
+static void cwriter_chunk_end(cwriter *w)
+{
+  if(w->chunk==SIZE_MAX) return;
+  zrle *z = w->z;
+  size_t ch = w->chunk, n = zrle_colors(z,ch);
+  size_t raw = n*w->width, old = z->len[1][ch];
+  off_t off = (off_t) ch*ZRLE_CHUNK*w->width;
+  uint8_t *src = w->cbuf;
+  if(w->filled<n && (z->shared[ch] || (old==raw && 2*w->filled<n))) {
+    for(size_t i=mask_scan(w->mask,0,n,1); i<n; ) {
+      size_t j = mask_scan(w->mask,i,n,0);
+      huge_pwrite(w->fd,src+i*w->width,(j-i)*w->width,off+i*w->width);
+      tmp_dontneed(w->fd,off+i*w->width,(j-i)*w->width,false);
+      i = mask_scan(w->mask,j,n,1);
+    }
+  }
+  else {
+    aio_wait(&z->req[z->next]);
+    uint8_t *out = z->out[z->next];
+    if(w->filled<n) { // read the chunk and overlay the written ranges 
+      huge_pread(w->fd,out,old,off);
+      tmp_dontneed(w->fd,off,old,false);
+      if(old==raw) memcpy(z->tmp,out,raw);
+      else zrle_decode(out,old,w->width,z->tmp,n);
+      for(size_t i=mask_scan(w->mask,0,n,1); i<n; ) {
+        size_t j = mask_scan(w->mask,i,n,0);
+        memcpy(z->tmp+i*w->width,src+i*w->width,(j-i)*w->width);
+        i = mask_scan(w->mask,j,n,1);
+      }
+      src = z->tmp;
+    }
+    size_t len = zrle_encode(src,n,w->width,out,raw);
+    if(len==0) {
+      memcpy(out,src,raw);
+      len = raw;
+    }
+    aio_submit(&z->req[z->next],w->fd,true,true,w->tmp,out,len,off);
+    z->next = (z->next+1)%AIO_WBUFFERS;
+    z->bytes[1] += len - old;
+    z->coded[1] += (len<raw) - (old<raw);
+    z->len[1][ch] = len;
   }
+  memset(w->mask,0,(ZRLE_CHUNK+63)/64*sizeof(uint64_t));
+  w->filled = 0;
+  w->chunk = SIZE_MAX;
 }
 
-void cwriter_put(cwriter *w, palette c)
+void cwriter_put(cwriter *w, int c)
 {
+  w->colors++;
+  if(c!=w->last) {w->runs++; w->last = c;}
+  if(w->chunked) {
+    size_t ch = w->pos/ZRLE_CHUNK;
+    if(ch!=w->chunk) {
+      cwriter_chunk_end(w);
+      w->chunk = ch;
+    }
+    size_t i = w->pos++ - (uint64_t) ch*ZRLE_CHUNK;
+    z_set(w->cbuf,i,c,w->width);
+    w->mask[i/64] |= 1ULL<<(i%64);
+    w->filled++;
+    return;
+  }
   if(w->cur==w->size) cwriter_flush(w);
   assert(w->cur < w->size);
-  w->buffer[w->cur++] = c;
+  z_set(w->buffer,w->cur++,c,w->width);
 } 
 
 void cwriter_skip(cwriter *w, uint64_t s) {
+  if(w->chunked) {w->pos += s; return;}
   cwriter_flush(w);
-  w->offset += s*sizeof(palette); 
+  w->offset += s*w->width; 
 }
 
 void cwriter_close(cwriter *w) {
+  if(w->z) {
+    w->z->colors += w->colors;
+    w->z->runs += w->runs;
+  }
+  if(w->chunked) {
+    cwriter_chunk_end(w);
+    for(int i=0;i<AIO_WBUFFERS;i++) aio_wait(&w->z->req[i]);
+    free(w->cbuf);
+    free(w->mask);
+    return;
+  }
   cwriter_flush(w);
-  free(w->buffer);
+  for(int i=0;i<w->nbuf;i++) {
+    aio_wait(&w->req[i]);
+    free(w->bufs[i]);
+  }
 }
 
 off_t cwriter_tell(cwriter *w) {
-  return w->offset + (w->cur*sizeof(palette));
+  if(w->chunked) return w->pos*w->width;
+  return w->offset + (w->cur*w->width);
 }
 
-void cwriter_init(cwriter *w, int fd, size_t size, off_t o) {
+// colors take width bytes: sizeof(palette) or sizeof(palette2)
+// with asynchronous I/O there are AIO_WBUFFERS buffers of size colors 
+// if z!=NULL the runs are counted in z and if z->on the chunks are coded: 
+// the colors are collected in a single chunk buffer and size is not used 
+// fd must be open for reading and writing 
+void cwriter_init(cwriter *w, int fd, size_t size, off_t o, int width, zrle *z) {
   assert(size>0);
-  w->buffer = malloc(size*sizeof(palette));
-  if(!w->buffer) die(__func__);
+  assert(width==sizeof(palette) || width==sizeof(palette2));
+  w->z = z;
+  w->chunked = z!=NULL && z->on;
+  w->last = -1;
+  w->colors = w->runs = 0;
+  w->tmp = true; // cwriters are only used for the newMerge files
+  w->width = width;
+  w->fd = fd;
+  if(w->chunked) {
+    assert(o%width==0);
+    w->pos = o/width;
+    w->chunk = SIZE_MAX;
+    w->cbuf = malloc(ZRLE_CHUNK*width);
+    w->mask = calloc((ZRLE_CHUNK+63)/64,sizeof(uint64_t));
+    if(!w->cbuf || !w->mask) die(__func__);
+    w->filled = 0;
+    w->nbuf = 0;
+    return;
+  }
+  w->nbuf = (Aio.threads>0 && size>1) ? AIO_WBUFFERS : 1;
+  for(int i=0;i<w->nbuf;i++) {
+    w->bufs[i] = malloc(size*width);
+    if(!w->bufs[i]) die(__func__);
+    aio_init(&w->req[i]);
+  }
+  w->next = 0;
+  w->buffer = w->bufs[0];
   w->size = size;
   w->cur = 0;
   w->offset = o;
-  w->fd = fd;
+}
+
+
+// ----- merge file reader functions 
+
+// load the chunk containing the next color: with asynchronous I/O 
+// it is usually the one prefetched, and the following chunk is prefetched 
+void zreader_load(zreader *r)
+{
+  zrle *z = r->z;
+  size_t ch = r->pos/ZRLE_CHUNK, n = zrle_colors(z,ch);
+  size_t len = z->len[0][ch];
+  off_t off = (off_t) ch*ZRLE_CHUNK*r->width;
+  if(r->next) aio_wait(&r->req);
+  if(r->next && r->nextChunk==ch) {
+    uint8_t *t = r->in; r->in = r->next; r->next = t;
+  }
+  else {
+    huge_pread(r->fd,r->in,len,off);
+    tmp_dontneed(r->fd,off,len,false);
+  }
+  if(len==n*r->width) {
+    uint8_t *t = r->buf; r->buf = r->in; r->in = t;
+  }
+  else zrle_decode(r->in,len,r->width,r->buf,n);
+  r->chunk = ch;
+  r->nextChunk = SIZE_MAX;
+  if(r->next && ch+1<z->chunks) {
+    r->nextChunk = ch+1;
+    aio_submit(&r->req,r->fd,false,true,true,r->next,z->len[0][ch+1],off+ZRLE_CHUNK*r->width);
+  }
+}
+
+// read the merge file fd with colors of width bytes and chunks described by z[0]:
+// if there are no coded chunks it is read with a breader with a buffer of size bytes 
+void zreader_init(zreader *r, int fd, size_t size, int width, zrle *z)
+{
+  r->fd = fd;
+  r->width = width;
+  r->pos = 0;
+  r->chunk = r->nextChunk = SIZE_MAX;
+  r->buf = r->in = r->next = NULL;
+  r->z = (z!=NULL && z->coded[0]>0) ? z : NULL;
+  if(r->z==NULL) {
+    breader_init(&r->b,fd,size,0,true);
+    return;
+  }
+  r->buf = malloc(ZRLE_CHUNK*width);
+  r->in = malloc(ZRLE_CHUNK*width);
+  if(!r->buf || !r->in) die(__func__);
+  if(Aio.threads>0) {
+    r->next = malloc(ZRLE_CHUNK*width);
+    if(!r->next) die(__func__);
+  }
+  aio_init(&r->req);
+}
+
+// restart reading from the first color
+void zreader_rewind(zreader *r)
+{
+  if(r->z==NULL) breader_seek(&r->b,0);
+  else r->pos = 0;
+}
+
+void zreader_close(zreader *r)
+{
+  if(r->z==NULL) {
+    breader_close(&r->b);
+    return;
+  }
+  if(r->next) aio_wait(&r->req);
+  free(r->buf); free(r->in); free(r->next);
+  r->buf = r->in = r->next = NULL;
+}
+
+// ----- buffered reader functions 
+
+// refill the buffer with the bytes following the current one 
+// with asynchronous I/O they are usually in the prefetch buffer, and 
+// the bytes following them are prefetched 
+void breader_fill(breader *r)
+{
+  assert(r->cur==r->len);
+  r->offset += r->len;
+  r->cur = 0;
+  if(r->next==NULL) {
+    ssize_t n = pread(r->fd,r->buffer,r->size,r->offset);
+    if(n<=0) die(__func__);
+    r->len = n;
+    if(r->tmp) tmp_dontneed(r->fd,r->offset,n,false);
+    return;
+  }
+  aio_wait(&r->req);
+  if(r->req.offset==r->offset && r->req.res>0) { // prefetch was successful
+    uint8_t *tmp = r->buffer; r->buffer = r->next; r->next = tmp;
+    r->len = r->req.res;
+  }
+  else { // a skip or seek went past the prefetched data 
+    ssize_t n = pread(r->fd,r->buffer,r->size,r->offset);
+    if(n<=0) die(__func__);
+    r->len = n;
+    if(r->tmp) tmp_dontneed(r->fd,r->offset,n,false);
+  }
+  aio_submit(&r->req,r->fd,false,false,r->tmp,r->next,r->size,r->offset+r->len);
+}
+
+// set the position of the next byte to be read, the buffer is kept if it contains it 
+void breader_seek(breader *r, off_t o)
+{
+  if(o>=r->offset && o<=r->offset+(off_t) r->len)
+    r->cur = o-r->offset;
+  else {
+    r->offset = o;
+    r->cur = r->len = 0;
+  }
+}
+
+void breader_close(breader *r) {
+  if(r->next) aio_wait(&r->req);
+  free(r->mem);
+  r->buffer = r->next = r->mem = NULL;
+}
+
+// the buffer size is rounded up to a multiple of BREADER_ALIGN
+// with asynchronous I/O a second buffer of the same size is used for prefetching
+// no data is read until the first call to breader_getc 
+// if tmp is true fd is a temporary file (see tmp_uncached)
+void breader_init(breader *r, int fd, size_t size, off_t o, bool tmp) {
+  assert(size>0);
+  size = ((size+BREADER_ALIGN-1)/BREADER_ALIGN)*BREADER_ALIGN;
+  int nbuf = Aio.threads>0 ? 2 : 1;
+  r->mem = malloc(breader_mem(size,nbuf)); // not posix_memalign, which is not seen by malloc_count
+  if(r->mem==NULL) die(__func__);
+  r->buffer = r->mem + (BREADER_ALIGN - ((uintptr_t) r->mem)%BREADER_ALIGN)%BREADER_ALIGN;
+  r->next = nbuf>1 ? r->buffer + size : NULL;
+  r->tmp = tmp;
+  aio_init(&r->req);
+  r->size = size;
+  r->fd = fd;
+  r->offset = o;
+  r->cur = r->len = 0;
 }
 
 // --- bit file structure and related functions ---
@@ -228,9 +1146,19 @@ static void bitfile_save(bitfile *b, bool endfile)
     if(b->cur%8!=0 && !endfile) die("Illegal bitfile save");
     size_t bytes = (b->cur+7)/8;
     assert(bytes*8 <= b->size);
-    huge_pwrite(b->fd,b->buffer,bytes,b->offset);
+    aio_submit(&b->req[b->cb],b->fd,true,true,false,b->buffer,bytes,b->offset);
+    if(Aio.threads>0) { // switch buffer while this one is written
+      b->cb = 1-b->cb;
+      aio_wait(&b->req[b->cb]);
+      b->buffer = b->bufs[b->cb];
+    }
     b->offset += bytes;
     b->cur=b->size=0;
+    if(endfile || b->offset-b->dropped >= TMP_DROP_SIZE) { // the bits before offset have been read and written
+      for(int i=0;i<2;i++) aio_wait(&b->req[i]);
+      tmp_dontneed(b->fd,b->dropped,b->offset-b->dropped,true);
+      b->dropped = b->offset;
+    }
   }
 }
 
@@ -239,24 +1167,26 @@ static void bitfile_save(bitfile *b, bool endfile)
 void bitfile_flush(bitfile *b)
 {
   bitfile_save(b, true);
+  for(int i=0;i<2;i++) aio_wait(&b->req[i]);
   assert(b->offset==(b->filesize+7)/8); 
 }
 
-// init a bitfile: opening file and filling it with size zero bits
+// init a bitfile: opening file and filling it with size zero bits, bufsize is the buffer size in bytes
 // if order==0 the file is anonymous and immediately deleted, otherwise 
 // the file has .bitfile extension and maintained after the end of the computation   
-void bitfile_create(bitfile *b, size_t size, char *path, int order) {
+void bitfile_create(bitfile *b, size_t size, char *path, int order, size_t bufsize) {
   // create local copy of template
   char s[Filename_size];
   if(order==0) { // this is a temp file create unique name 
-    sprintf(s,"%s.bitXXXXXX",path);
+    char *t = tmp_template(path,TMP_BITFILE,".bitXXXXXX");
     // get file descriptor for tmp file fill it with 0s and delete file  
-    b->fd = mkstemp(s);
+    b->fd = mkstemp(t);
     if(b->fd == -1) die("bitfile_create: Tempfile creation failed");
     int e = ftruncate(b->fd,(size+7)/8); // fill with size 0 bits
     if(e!=0)        die("bitfile_create: Tempfile ftruncate failed");
-    e = unlink(s);
+    e = unlink(t);
     if(e!=0)        die("bitfile_create: Tempfile unlink failed");
+    free(t);
     }
   else { // we keep this file (to compute the DB-graph) 
     sprintf(s,"%s.%d.lcpbit1",path,order);
@@ -268,8 +1198,15 @@ void bitfile_create(bitfile *b, size_t size, char *path, int order) {
   }
   // initialization of other fields for b
   b->filesize = size;  // total size of the bitfile (in bits) 
-  b->buffer = malloc(Bitfile_bufsize_bytes);
-  if(!b->buffer)  die("bitfile_create: malloc error");
+  b->bufsize = bufsize;
+  for(int i=0;i<2;i++) {
+    b->bufs[i] = (i==0 || Aio.threads>0) ? malloc(bufsize) : NULL;
+    if(i==0 && !b->bufs[i])  die("bitfile_create: malloc error");
+    aio_init(&b->req[i]);
+  }
+  b->cb = 0;
+  b->buffer = b->bufs[0];
+  b->dropped = 0;
   b->size = 0;         // current size of the buffer in bits
   b->cur = 0;          // bit index inside buffer
   b->offset = 0;       // offset in bytes in the file 
@@ -277,7 +1214,10 @@ void bitfile_create(bitfile *b, size_t size, char *path, int order) {
 
 // destroy a bitfile closing the corresponding file and freeing the buffer 
 void bitfile_destroy(bitfile *b) {
-  free(b->buffer);
+  for(int i=0;i<2;i++) {
+    aio_wait(&b->req[i]);
+    free(b->bufs[i]);
+  }
   b->buffer= NULL;
   if(close(b->fd)!=0) die(__func__);
 }
@@ -285,9 +1225,11 @@ void bitfile_destroy(bitfile *b) {
 // set virtual pointer at the beginning of the file 
 void bitfile_rewind(bitfile *b)
 {
+  for(int i=0;i<2;i++) aio_wait(&b->req[i]); // the bits must be on disk before reading them again
   b->size = 0;         // current size of the buffer in bits
   b->cur = 0;          // bit index inside buffer
   b->offset = 0;       // offset in bytes in the file   
+  b->dropped = 0;
 }
 
 // read the next bit b from bitfile
@@ -300,7 +1242,7 @@ bool bitfile_read_or_write(bitfile *b, bool new)
     bitfile_save(b,false);
     assert(b->cur==0);
     assert(b->size==0);
-    ssize_t n = pread(b->fd,b->buffer,Bitfile_bufsize_bytes,b->offset);
+    ssize_t n = pread(b->fd,b->buffer,b->bufsize,b->offset);
     if(n<=0) die("Unable to read bitfile data (bitfile_read_or_write)");
     b->size = n*8; // number of bits available for reading
     // note we did not change offset since we are going to write at this offset 
@@ -329,7 +1271,7 @@ void bitfile_skip(bitfile *b, uint64_t s) {
   // skip as many full bytes as possible
   b->offset += s/8;       
   s = s%8;                // we are left with < 8 bits
-  ssize_t n = pread(b->fd,b->buffer,Bitfile_bufsize_bytes,b->offset); // read a full buffer 
+  ssize_t n = pread(b->fd,b->buffer,b->bufsize,b->offset); // read a full buffer 
   if(n<0 ) die("Error reading bitfile data (bitfile_skip)");
   else if(n==0 && s>0) die("Unable to read bitfile data (bitfile_skip)");
   b->size = n*8; // number of bits available for reading
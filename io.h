@@ -21,31 +21,117 @@ void open_qs_files(g_data *g);
 void rewind_qs_files(g_data *g);
 void close_qs_files(g_data *g);
 
+void mem_budget(size_t bytes, int shares);
+void mem_reserve(size_t bytes);
+void mem_plan(g_data *g, bool lastRound);
+void scratch_init(char *dirs);
+char *tmp_template(char *path, int c, const char *suffix);
+void scratch_report(double secs);
+void aio_start(int threads);
+void aio_stop(void);
+bool aio_active(void);
+void tmp_uncached(bool u);
+bool tmp_uncached_active(void);
+void tmp_dontneed(int fd, off_t offset, off_t len, bool wait);
+void tmp_fdontneed(FILE *f);
+void tmp_fdrop_behind(FILE *f, size_t bytes, bool write);
+size_t tmp_cached(int fd);
 FILE *gap_tmpfile(char* path);
 void huge_pwrite(int fd, const void *buf, size_t count, off_t offset);
 void huge_pread(int fd, void *buf, size_t count, off_t offset);
-void cwriter_put(cwriter *w, palette c);
+void cwriter_put(cwriter *w, int c);
 void cwriter_skip(cwriter *w, uint64_t s);
 void cwriter_close(cwriter *w);
 off_t cwriter_tell(cwriter *w);
-void cwriter_init(cwriter *w, int fd, size_t size, off_t o);
+void cwriter_init(cwriter *w, int fd, size_t size, off_t o, int width, zrle *z);
+zrle *zrle_new(uint64_t n, int width, customInt *firstColumn, int alpha);
+void zrle_free(zrle *z);
+void zrle_swap(zrle *z);
+void zrle_expand(zrle *z, char *fname);
+void zreader_init(zreader *r, int fd, size_t size, int width, zrle *z);
+void zreader_load(zreader *r);
+void zreader_rewind(zreader *r);
+void zreader_close(zreader *r);
+void breader_init(breader *r, int fd, size_t size, off_t o, bool tmp);
+void breader_fill(breader *r);
+void breader_seek(breader *r, off_t o);
+void breader_close(breader *r);
 
+// read the next byte 
+static inline int breader_getc(breader *r)
+{
+  if(r->cur==r->len) breader_fill(r);
+  return r->buffer[r->cur++];
+}
 
-// by default a bitfile buffer is 8 file buffers
+// read the next color of width bytes (stored in little endian order as in z_set)
+static inline int breader_get_color(breader *r, int width)
+{
+  int c = breader_getc(r);
+  if(width>1) c |= breader_getc(r)<<8;
+  return c;
+}
+
+// advance by s bytes without reading them: no system call is done
+// if we stay inside the buffer, otherwise the buffer is refilled only at the next read  
+static inline void breader_skip(breader *r, uint64_t s)
+{
+  if(r->cur+s <= r->len) r->cur += s;
+  else {
+    r->offset += r->cur+s;
+    r->cur = r->len = 0;
+  }
+}
+
+// return the offset of the next byte to be read
+static inline off_t breader_tell(breader *r)
+{
+  return r->offset + r->cur;
+}
+
+// read the next color from the merge file 
+static inline int zreader_get_color(zreader *r)
+{
+  if(r->z==NULL) return breader_get_color(&r->b,r->width);
+  if(r->pos/ZRLE_CHUNK!=r->chunk) zreader_load(r);
+  size_t i = r->pos++ % ZRLE_CHUNK;
+  return r->width>1 ? ((palette2 *) r->buf)[i] : r->buf[i];
+}
+
+// skip s bytes (s/width colors) of the merge file 
+static inline void zreader_skip(zreader *r, uint64_t s)
+{
+  if(r->z==NULL) breader_skip(&r->b,s);
+  else r->pos += s/r->width;
+}
+
+// return the offset of the next color in the uncoded merge file
+static inline off_t zreader_tell(zreader *r)
+{
+  return r->z==NULL ? breader_tell(&r->b) : (off_t) (r->pos*r->width);
+}
+
+
+// by default a bitfile buffer is 8 file buffers (see mem_plan)
 #define Bitfile_bufsize_bytes (8*BUFSIZ)
 
 // structure supporting sequential read&write on a file representing a sequence of bits
 typedef struct{
   int fd;       // file descriptor
   off_t offset; // offset inside file descriptor (in bytes)
-  uint8_t *buffer; 
+  uint8_t *buffer; // current buffer 
+  uint8_t *bufs[2];// with asynchronous I/O a buffer is saved while the other is in use
+  aioReq req[2];   // save of bufs[i]
+  int cb;          // index of the current buffer 
+  off_t dropped;   // bytes before this offset have been dropped from the page cache (see tmp_uncached)
   size_t filesize;  // max number of bits stored in file
+  size_t bufsize;   // size of each buffer (in bytes)
   int size;         // actual buffer size  (in bits)
   int cur;          // current position (in bits)
 } bitfile;
 
 void bitfile_flush(bitfile *b);
-void bitfile_create(bitfile *b, size_t size, char *path, int);
+void bitfile_create(bitfile *b, size_t size, char *path, int, size_t bufsize);
 void bitfile_destroy(bitfile *b);
 void bitfile_rewind(bitfile *b);
 bool bitfile_read_or_write(bitfile *b, bool new);
@@ -49,10 +49,10 @@ static void init_arrays128ext(g_data *g)
       for(customInt t=0;t<g->bwtOcc[b][j];t++) { 
         if(j==0) { // zero chars are all different, Z, Znew never change 
           bit=1;
-          fwrite_color(b,fnewmerge); //for 0-chars write b also to newmerge aka newZ 
+          fwrite_color(b,sizeof(palette),fnewmerge); //for 0-chars write b also to newmerge aka newZ 
         }
         // all colors are written to merge aka Z
-        fwrite_color(b|(bit<<7),fmerge);
+        fwrite_color(b|(bit<<7),sizeof(palette),fmerge);
         i++; bit=0;
       } // end for t
     } // end for b 
@@ -88,14 +88,14 @@ static bool addCharToPrefix128ext(solidBlockFile *solidHead, liquidBlock *liquid
   uint64_t lcpWritten =0;
 
   protoBlock cblock = {.beginsAt = 0};
-  solidBlock *next = readBlock(solidHead); // first block
+  solidBlock *next = readFirstBlock(solidHead); // first block
   solidBlock *last = NULL;
   
   for (k = 0; k < g->mergeLen; ) { 
     assert(next==NULL || k <= next->beginsAt);  // we did not pass next block
     assert(last==NULL || last->nextBlock == next); // last is the immediately preceeding block
     // read newblock & color
-    int currentColor = fread_color(g->fmergeColor);// read color and new block bit 
+    int currentColor = zreader_get_color(g->fmergeColor);// read color and new block bit 
     bool new_block = ((currentColor & 0x80)!=0);   // extract new block bit, it is set if a block starts here
     currentColor &= 0x7F;                          // delete new block bit from color
     // read the old block bit: it is set if the block is at least 2 iterations old
@@ -139,11 +139,9 @@ static bool addCharToPrefix128ext(solidBlockFile *solidHead, liquidBlock *liquid
       cblock.beginsAt = k; 
     }   // end if(new_block || old_block)
     // processing a char in a relevant block
-    assert(ftell(g->fmergeColor)==(k+1)*sizeof(palette));   // we already have currentColor but we check the file pointer is at the right position  
-    assert(ftell(g->bwf[currentColor])==(g->inCnt[currentColor]+(g->bws[currentColor]-g->bws[0])+g->symb_offset)*sizeof(symbol)); 
-    int currentChar=0;
-    int e = fread(&currentChar,sizeof(symbol),1,g->bwf[currentColor]);
-    if(e!=1) die("mergegap:addCharToPrefix:bwt[color]Read"); 
+    assert(zreader_tell(g->fmergeColor)==(k+1)*sizeof(palette));   // we already have currentColor but we check the file pointer is at the right position  
+    assert(breader_tell(&g->bwf[currentColor])==(g->inCnt[currentColor]+(g->bws[currentColor]-g->bws[0])+g->symb_offset)*sizeof(symbol)); 
+    int currentChar = breader_getc(&g->bwf[currentColor]);
     g->inCnt[currentColor]++;
     // add currentChar/Color to proto block 
     cblock.lastChar =  currentChar;   // save lastchar, only useful for singleton blocks
@@ -186,7 +184,7 @@ static bool addCharToPrefix128ext(solidBlockFile *solidHead, liquidBlock *liquid
     assert(g->inCnt[i]==g->bwtLen[i]);
 
   // swap merge and newMerge
-  assert(ftell(g->fmergeColor)==g->mergeLen*sizeof(palette));
+  assert(zreader_tell(g->fmergeColor)==g->mergeLen*sizeof(palette));
   assert(g->F[g->sizeOfAlpha-1]==g->mergeLen);
   assert(cwriter_tell(&g->fnewMergeColor[g->sizeOfAlpha-1])==g->mergeLen*sizeof(palette));
   close_merge_files(g);
@@ -272,7 +270,7 @@ void gap128ext(g_data *g, bool lastRound) {
   // create 0 initialized bitfile (reading and writing using bitfile_* functions)
   bitfile b;
   // if it is the last round and g->dbOrder>0 and !lcp_compute the bitfile must be preserved, see comment at start of file
-  bitfile_create(&b,g->mergeLen,g->outPath, (!lastRound || g->lcpCompute) ? 0 : g->dbOrder  );
+  bitfile_create(&b,g->mergeLen,g->outPath, (!lastRound || g->lcpCompute) ? 0 : g->dbOrder, g->buf.bitfile);
   // allocate Z (merge) Znew (reading only Z, writing only newZ) 
   alloc_merge_arrays(g);
   
@@ -289,37 +287,42 @@ void gap128ext(g_data *g, bool lastRound) {
   // init list (on disk) of irrelevant blocks, initially empty 
   solidBlockFile *ibList = ibHead_new(g);
   uint64_t maxSolid = 0;   // maximum space used by a pair of solid block files 
+  uint64_t solidBytes = 0, solidRaw = 0; // solid block list bytes written, and with the fixed size format
+  size_t maxCached = 0;    // peak page cache footprint of the temporary files 
 
   // main loop
   uint32_t prefixLength = 1;                      
-  int lcpSize = POS_SIZE + BSIZE;   // number of bytes for each pos,lcp pair, see writeLcp()
   bool merge_completed;
   do {
     prefixLength+= 1;
     if(g->lcpCompute && prefixLength-2>MAX_LCP_SIZE) {fprintf(stderr,"LCP too large: %u\n", prefixLength-2);die(__func__);}
-    ibList->fout = gap_tmpfile(g->outPath);
+    ibHead_open_out(ibList);
     merge_completed=addCharToPrefix128ext(ibList,liquid,prefixLength,&b,g);
     if (g->verbose>1 && lastRound) {
       #if MALLOC_COUNT_FLAG
         // at this iteration we are discovering suffixes with LCP=prefixLength-1
-        printf("Lcp: %u. Memory peak/current: %.2lf/%.2lf bytes/symbol. ibList: %ju\n", 
+        printf("Lcp: %u. Memory peak/current: %.2lf/%.2lf bytes/symbol. ibList: %ju (%ju uncompressed)\n", 
            prefixLength-1, (double)malloc_count_peak()/g->mergeLen,
-           (double)malloc_count_current()/g->mergeLen, (uintmax_t) ftello(ibList->fout));
+           (double)malloc_count_current()/g->mergeLen, (uintmax_t) ibHead_out_size(ibList), (uintmax_t) ibList->rawBytes);
       #endif
       // also EOF are written to unsortedLcp file so percentages are not accurate     
       if(g->unsortedLcp) printf("   unsorted lcp values: %ju (%.2lf%%)\n",  
-      (uintmax_t) ftello(g->unsortedLcp)/lcpSize, (double) 100*ftello(g->unsortedLcp)/(lcpSize*g->mergeLen));
+      (uintmax_t) countLcp(g), (double) 100*countLcp(g)/g->mergeLen);
+    }
+    if(g->verbose>1 && tmp_uncached_active()) { // scans all the temporary files: only with -U and -vv
+      size_t cached = tmp_footprint(g,ibList->fin,ibList->fout,b.fd);
+      if(cached>maxCached) maxCached = cached;
     }
     // compute current space usage for the gap files 
-    uint64_t totSolid = ftell(ibList->fout);
-    if(ibList->fin!=NULL) {totSolid += ftell(ibList->fin); fclose(ibList->fin);}
+    uint64_t totSolid = ibHead_out_size(ibList);
+    solidBytes += totSolid; solidRaw += ibList->rawBytes;
+    if(ibList->fin!=NULL) totSolid += ftell(ibList->fin);
     if(totSolid>maxSolid) maxSolid = totSolid;
     // update solid block files:
-    rewind(ibList->fout);
-    ibList->fin = ibList->fout;
+    ibHead_rotate(ibList);
   } while(!merge_completed && (prefixLength!=g->dbOrder+(g->lcpCompute?1:0)));  // end main loop
   // stop at iteration g->dbOrder or,if interested in trucated LCP, g->dbOrder+1
-  if(ibList->fin!=NULL) fclose(ibList->fin);
+  ibHead_close_in(ibList);
 
   if (g->verbose>0) {
     #if MALLOC_COUNT_FLAG
@@ -335,7 +338,11 @@ void gap128ext(g_data *g, bool lastRound) {
     #else
       printf("Merge128ext completed (%d bwts).\n", g->numBwt);
     #endif
-           
+    if(g->verbose>1 && tmp_uncached_active())
+      printf("Peak page cache footprint of temporary files: %zu, %.2lf bytes/symbol\n", maxCached, (double)maxCached/g->mergeLen);
+    if(lastRound || g->verbose>1)
+      printf("Solid block lists written: %ju bytes, %ju uncompressed (%.2lf%%)\n", (uintmax_t) solidBytes, (uintmax_t) solidRaw, 
+             solidRaw ? 100.0*solidBytes/solidRaw : 100.0);
   }
   liquid_free(liquid);
   ibHead_free(ibList);
@@ -343,6 +350,8 @@ void gap128ext(g_data *g, bool lastRound) {
   bitfile_destroy(&b);
   close_bw_files(g);
   
+  // the merge array is accessed raw from now on
+  zrle_expand(g->zrle,g->merge_fname);
   // for dbGraph info we need to extract the hi bit from the merge array
   if(lastRound && g->dbOrder>0 && !g->lcpCompute) 
     extract_bitfile(g->merge_fname, g->mergeLen, g->outPath, g->dbOrder);
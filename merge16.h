@@ -43,7 +43,7 @@ static void init_arrays16(g_data *g)
   assert(i==g->mergeLen);
   // extra check on mergeColor, can be commented out
   #ifndef NDEBUG
-  customInt cnt[MAX_NUMBER_OF_BWTS] = {0};
+  customInt cnt[MAX_NARROW_BWTS] = {0};
   for(i=0;i<g->mergeLen;i++) cnt[g->mergeColor[i]&0xF]++;
   bool stop=false;
   for(int i=0; i<g->numBwt; i++)
@@ -81,8 +81,18 @@ static void init_arrays16_largealpha(g_data *g)
 #define set_mergeColor(k,c,round) (g->mergeColor[(k)] = (round)? \
         ( (g->mergeColor[(k)]&0xF0) | (c)) : ((g->mergeColor[(k)]&0x0F) | ((c)<<4))  )
 
+// flush for gap16: newZ shares its bytes with Z, so the buffered colors
+// are merged in place (no non-temporal stores)
+static void cbuffer_flush16(cbuffer *b, g_data *g, const int round)
+{
+  // positions in the segment are [begin,end) so the buffer is read from index begin%COLOR_WC_SIZE
+  customInt base = b->begin - b->begin%COLOR_WC_SIZE;
+  int i0 = b->begin-base, i1 = b->end-base; 
+  if(round) for(int i=i0; i<i1; i++) set_mergeColor(base+i,b->buffer[i],1);
+  else      for(int i=i0; i<i1; i++) set_mergeColor(base+i,b->buffer[i],0);
+}
 
-static bool addCharToPrefix16(solidBlockFile *solidHead, liquidBlock *liquid, customInt prefixLength, bool *mergeChanged, const int round, g_data *g) {
+GAP_KERNEL bool addCharToPrefix16(solidBlockFile *solidHead, liquidBlock *liquid, customInt prefixLength, bool *mergeChanged, const int round, g_data *g, const bool bwtOnly, const bool wc) {
   assert(prefixLength <= MAX_LCP_SIZE);
   assert(liquid->empty);
   liquid->beginsAt = liquid->endsAt = 0;  
@@ -94,11 +104,16 @@ static bool addCharToPrefix16(solidBlockFile *solidHead, liquidBlock *liquid, cu
   // id for each character, init with an invalid id
   customInt blockID[g->sizeOfAlpha];
   array_clear(blockID,g->sizeOfAlpha, g->mergeLen);  // mergeLen is an invalid id
+  // write-combining buffer for each character
+  cbuffer cbuf[wc ? g->sizeOfAlpha : 1];
+  if(wc) cbuffer_start(cbuf,g);
   customInt id = 0, k; 
   int m = (round%2==1) ? 1 : 2;  // mask for the bitB array
+  customInt nextStart = 0;  // next position where B is tested (see tba_next_block)
+  customInt blockStart = 0; // last position where a block starts
 
   protoBlock cblock = {.mono = false};
-  solidBlock *next = readBlock(solidHead); // first block
+  solidBlock *next = readFirstBlock(solidHead); // first block
   solidBlock *last = NULL;
   
   for (k = 0; k < g->mergeLen; ) { 
@@ -107,13 +122,17 @@ static bool addCharToPrefix16(solidBlockFile *solidHead, liquidBlock *liquid, cu
 
     // check if we are entering a block, and if the block is at least 2 iterations old
     bool start_block, last_block_recent=true; // for k=0 a new block starts, so last id properly initialized
-    if(!g->bwtOnly) {
+    if(!bwtOnly) {
       start_block = (g->blockBeginsAt[k]>0) && (g->blockBeginsAt[k] < prefixLength);
       if(start_block) last_block_recent = g->blockBeginsAt[k]>=prefixLength-1;
     }
-    else {
-      start_block = tba_block_test_set(g->bitB,k,m,&last_block_recent);    
+    else if(k>=nextStart) {
+      start_block = tba_block_test_set(g->bitB,k,m,&last_block_recent);
+      if(start_block) blockStart = k;
+      // B is tested at each position of short blocks, for long blocks we look for the next start
+      nextStart = (start_block || k-blockStart<Block_search_min) ? k+1 : tba_next_block(g->bitB,k+1,g->mergeLen,m);
     }
+    else start_block = false;
     if (start_block) {
       // check if the block we just left is not recent and monochrome 
       if(cblock.mono==true && !last_block_recent) {
@@ -163,12 +182,13 @@ static bool addCharToPrefix16(solidBlockFile *solidHead, liquidBlock *liquid, cu
     // write color in new Z array, except 0 chars
     if(currentChar!=0) {
       customInt positionToUpdate = g->F[currentChar]++;
-      set_mergeColor(positionToUpdate,currentColor,round); // g->newMergeColor[positionToUpdate] = currentColor;
-      if(g->bwtOnly && !*mergeChanged && get_mergeColor(positionToUpdate,round)!=currentColor)
+      if(wc) cbuffer_put(&cbuf[currentChar],positionToUpdate,currentColor,g,round,cbuffer_flush16);
+      else set_mergeColor(positionToUpdate,currentColor,round); // g->newMergeColor[positionToUpdate] = currentColor;
+      if(bwtOnly && !*mergeChanged && get_mergeColor(positionToUpdate,round)!=currentColor)
         *mergeChanged=true;  // remember there is a difference from the previous ieration 
       // create new block?
       if (blockID[currentChar] != id) {
-        if(g->bwtOnly) { // no lcp just mark B array 
+        if(bwtOnly) { // no lcp just mark B array 
           if(last_block_recent) tba_mark_if0(g->bitB,positionToUpdate,m);
         } else    // update lcp
           if(last_block_recent && g->blockBeginsAt[positionToUpdate]==0) // only 0 values in B are overwritten
@@ -179,6 +199,7 @@ static bool addCharToPrefix16(solidBlockFile *solidHead, liquidBlock *liquid, cu
     k++;
   } // end main loop
   assert(next==NULL); 
+  if(wc) cbuffer_flush_all(cbuf,g,round,cbuffer_flush16);
   if(cblock.mono==true) { // final mono block can be created 
     cblock.endsAt = k;
     add_proto2liquid(&cblock,liquid);  // add proto to liquid that remains active
@@ -200,6 +221,17 @@ static bool addCharToPrefix16(solidBlockFile *solidHead, liquidBlock *liquid, cu
   return everything_irrelevant;
 }
 
+// kernels for gap16 (see GAP_KERNEL in mergegap.c)
+typedef bool (*gapKernel16)(solidBlockFile *, liquidBlock *, customInt, bool *, const int, g_data *);
+#define GAP_KERNEL16(name,bwt,wc) \
+  static bool name(solidBlockFile *s, liquidBlock *l, customInt p, bool *c, const int round, g_data *g) { \
+    if(round) return addCharToPrefix16(s,l,p,c,1,g,bwt,wc); \
+    return addCharToPrefix16(s,l,p,c,0,g,bwt,wc); }
+GAP_KERNEL16(kernel16_bwt,true,false)
+GAP_KERNEL16(kernel16_lcpmerge,false,false)
+GAP_KERNEL16(kernel16_wc_bwt,true,true)
+GAP_KERNEL16(kernel16_wc_lcpmerge,false,true)
+
 
 // entry point for the gap bwt/lcp merging procedure with at most 16 input sequences 
 // if lcpMerge==false blockBeginsAt is replaced by a bit array 
@@ -237,33 +269,36 @@ void gap16(g_data *g, bool lastRound) {
 
   // main loop
   int round=0;
+  uint64_t solidBytes = 0, solidRaw = 0; // solid block list bytes written, and with the fixed size format
   if(g->numBwt>1) {
     bool merge_completed; 
+    gapKernel16 kernel;
+    if(g->wcColors) kernel = g->bwtOnly ? kernel16_wc_bwt : kernel16_wc_lcpmerge;
+    else kernel = g->bwtOnly ? kernel16_bwt : kernel16_lcpmerge;
     do {
       prefixLength+= 1;
       if(prefixLength>MAX_LCP_SIZE && !g->bwtOnly) {fprintf(stderr,"LCP too large\n");die(__func__);}
       bool mergeChanged = false; // the Z vector has changed in this iteration (used when g->bwtOnly)
-      ibList->fout = gap_tmpfile(g->outPath);
-      merge_completed=addCharToPrefix16(ibList,liquid,prefixLength,&mergeChanged,round,g);
+      ibHead_open_out(ibList);
+      merge_completed=kernel(ibList,liquid,prefixLength,&mergeChanged,round,g);
+      solidBytes += ibHead_out_size(ibList); solidRaw += ibList->rawBytes;
       #if MALLOC_COUNT_FLAG
         if (g->verbose>1 && lastRound) {
-          printf("Lcp: "CUSTOM_FORMAT". Memory: %zu peak, %zu current, %.4lf/%.4lf bytes/symbol\n", 
+          printf("Lcp: "CUSTOM_FORMAT". Memory: %zu peak, %zu current, %.4lf/%.4lf bytes/symbol. ibList: %ju (%ju uncompressed)\n", 
                prefixLength-1, malloc_count_peak(),
                malloc_count_current(), (double)malloc_count_peak()/g->mergeLen,
-               (double)malloc_count_current()/g->mergeLen);
+               (double)malloc_count_current()/g->mergeLen, (uintmax_t) ibHead_out_size(ibList), (uintmax_t) ibList->rawBytes);
         }
       #endif
       if(g->bwtOnly && !mergeChanged) {
         if(g->verbose>1) puts("Gap bwt-only early termination");
-        fclose(ibList->fout);
+        ibHead_close_out(ibList);
         break;
       }
       round  = 1 - round; // change round parity
-      if(ibList->fin!=NULL) fclose(ibList->fin);
-      rewind(ibList->fout);
-      ibList->fin = ibList->fout;
+      ibHead_rotate(ibList);
     } while(!merge_completed);  // end main loop
-    if(ibList->fin!=NULL) fclose(ibList->fin);
+    ibHead_close_in(ibList);
   }
   if (g->verbose>0) {
     #if MALLOC_COUNT_FLAG
@@ -278,6 +313,9 @@ void gap16(g_data *g, bool lastRound) {
         printf("Merge16 completed (%d bwts).\n", g->numBwt);
       #endif
   }
+  if(g->verbose>0 && (lastRound || g->verbose>1))
+    printf("Solid block lists written: %ju bytes, %ju uncompressed (%.2lf%%)\n", (uintmax_t) solidBytes, (uintmax_t) solidRaw, 
+           solidRaw ? 100.0*solidBytes/solidRaw : 100.0);
   liquid_free(liquid);
   ibHead_free(ibList);  
 
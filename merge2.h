@@ -0,0 +1,482 @@
+// mergegap with numBwt <= 2 and B represented as a 2bit array (lcpMerge==false)
+// since there are only two colors Z and newZ are bit arrays stored together in g->bitZ
+// so that Z+newZ+B use 1+1+2 = 4 bits per symbol
+// supports bwtOnly & lcpCompute NOT lcpMerge and NOT extMem
+// With only two colors inCnt[0]+inCnt[1] is always equal to the current position k
+// so we only maintain inCnt[1] which is the number of 1's in Z[0,k) (rank1(Z,k))
+
+// Z and newZ are interleaved in g->bitZ: the color of position i in the array used as Z
+// in even rounds is bit 2i, the one used in odd rounds is bit 2i+1, so that the
+// update of newZ and the test on Z for the same position access the same word.
+// g->bitZ has the same layout of the two bit arrays used for B and it is allocated with tba_alloc()
+#define bz_get(a,i,r) (((a)[(i)/32] >> (2*((i)%32)+(r))) & 1)
+
+// set bit r of a[i] to b  (b is 0 or 1)
+static inline void bz_set(uint64_t *a, customInt i, int r, int b)
+{
+  int s = 2*(i%32)+r;
+  a[i/32] = (a[i/32] & ~((uint64_t) 1 << s)) | ((uint64_t) b << s);
+}
+
+// colors of positions [32q,32q+32) in the array used as Z in round r, as bits 0..31
+static inline uint64_t bz_word(const uint64_t *a, customInt q, int r)
+{
+  uint64_t x = (a[q] >> r) & 0x5555555555555555ULL;  // gather the even bits
+  x = (x | (x >> 1)) & 0x3333333333333333ULL;
+  x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+  x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+  x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+  return (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+}
+
+// update of F, newZ, B and blockID for the symbol c of color b inside a block
+// (last_block_recent is true), as done in addCharToPrefix2
+static inline __attribute__((always_inline)) void interior_char2(symbol c, int b, customInt *blockID, customInt id,
+              bool *mergeChanged, const int round, int m, g_data *g, const bool lcpCompute)
+{
+  if(c==0) return;   // 0 chars are not written to newZ
+  customInt positionToUpdate = g->F[c]++;
+  if(!lcpCompute && !*mergeChanged && bz_get(g->bitZ,positionToUpdate,round)!=b)
+    *mergeChanged=true;
+  bz_set(g->bitZ,positionToUpdate,1-round,b);
+  if (blockID[c] != id) {
+    tba_mark_if0(g->bitB,positionToUpdate,m);
+    blockID[c] = id;
+  }
+}
+
+// process the positions [k,e) that are inside a block, so that B is not tested
+// (see tba_next_block). Z does not change during an iteration, so its colors are
+// extracted 64 at a time and rank1 advances by the popcount of each group.
+// If the 64 colors are equal the symbols are read consecutively from the
+// corresponding BWT, otherwise each color is taken from the extracted word.
+// Return the value of rank1 at position e
+static inline __attribute__((always_inline)) customInt block_interior2(customInt k, customInt e, customInt r1,
+              protoBlock *cblock, symbol *bws[2], customInt *blockID, customInt id, bool *mergeChanged,
+              const int round, int m, g_data *g, const bool lcpCompute)
+{
+  int b = 0;
+  symbol c = 0;
+  while(k<e) {
+    // colors of the (at most) 64 positions starting at k
+    customInt q = k/32;
+    uint64_t w = bz_word(g->bitZ,q,round);
+    if((q+1)*32<e) w |= bz_word(g->bitZ,q+1,round)<<32;
+    int n = 64 - k%32;
+    if(e-k<n) n = e-k;
+    uint64_t ones = (n<64) ? ((uint64_t) 1 << n) - 1 : ~(uint64_t)0;
+    w = (w >> k%32) & ones;
+    int pop = __builtin_popcountll(w);
+    if(cblock->mono && w != (cblock->color ? ones : 0))
+      cblock->mono = false;  // a color different from the one of the block
+    if(pop==0 || pop==n) {   // monochrome stretch
+      b = pop>0;
+      symbol *s = b ? &bws[1][r1] : &bws[0][k-r1];
+      for(int j=0; j<n; j++)
+        interior_char2(s[j],b,blockID,id,mergeChanged,round,m,g,lcpCompute);
+      c = s[n-1];
+    }
+    else {
+      customInt r = r1;
+      for(int j=0; j<n; j++) {
+        b = (w>>j)&1;
+        c = b ? bws[1][r] : bws[0][k+j-r];
+        r += b;
+        interior_char2(c,b,blockID,id,mergeChanged,round,m,g,lcpCompute);
+      }
+      assert(r==r1+pop);
+    }
+    r1 += pop;
+    k += n;
+  }
+  cblock->lastChar = c;
+  cblock->lastColor = b;
+  return r1;
+}
+
+
+/**
+ * Using the number of occs of each symbol in each bwt (stored in bwtOcc)
+ * init the arrays Z and newZ (bitZ) and B (bitB) at the value
+ * they should have after the first iteration of the Gap algorithm
+ * exactly as done by init_arrays() in mergegap.c
+ * Since for 1 bits we write both Z and newZ, the region corresponding
+ * to 0 is also initialized in newZ and never modified in the algorithm.
+ * The array firstColumn (compact representation of F) is also initialized
+ * */
+static void init_arrays2(g_data *g)
+{
+  assert(g->numBwt<=2);
+  customInt i=0; // position inside Z newZ and B
+
+  for(int j=0;j<g->sizeOfAlpha;j++) {
+    tba_or_m(g->bitB,i,1);
+    g->firstColumn[j] = i;  // symbol j starts at position i
+    for(int b=0;b<g->numBwt;b++) {
+      for(customInt t=0;t<g->bwtOcc[b][j];t++) {
+        if(j==0)   // zero chars are all different, Z are newZ do not change
+          tba_or_m(g->bitB,i,1);
+        if(b==1) {bz_set(g->bitZ,i,0,1); bz_set(g->bitZ,i,1,1);} // write b in both Z and newZ
+        i++;
+      } // end for t
+    } // end for b
+  } // end for j
+  assert(i==g->mergeLen);
+  // extra check on Z, can be commented out
+  #ifndef NDEBUG
+  customInt ones=0;
+  for(i=0;i<(g->mergeLen+31)/32;i++) ones += __builtin_popcountll(g->bitZ[i] & 0x5555555555555555ULL);
+  assert(ones == (g->numBwt==2 ? g->bwtLen[1] : 0));
+  #endif
+}
+
+
+// init Z, newZ and B array without using g->bwtOcc[i][j]
+static void init_arrays2_largealpha(g_data *g)
+{
+  // compute bwtOcc on the spot with a complete scan of input BWTs
+  assert(g->bwtOcc==NULL);
+  g->bwtOcc = malloc(g->numBwt*sizeof(customInt *));
+  if(!g->bwtOcc) die(__func__);
+  for(int i=0;i<g->numBwt;i++) {
+    g->bwtOcc[i] = calloc(g->sizeOfAlpha,sizeof(customInt));
+    if(!g->bwtOcc[i]) die(__func__);
+    init_freq_no0(g->bws[i],g->bwtLen[i],g->bwtOcc[i]);
+  }
+  init_arrays2(g);
+  for(int i=0;i<g->numBwt;i++)
+    free(g->bwtOcc[i]);
+  free(g->bwtOcc);
+  g->bwtOcc=NULL;
+}
+
+// single iteration of the Gap algorithm
+// input is head of the irrelevant lists (fin and fout) and an empty liquid block
+// return true if the whole sequence has become irrelevant.
+GAP_KERNEL bool addCharToPrefix2(solidBlockFile *solidHead, liquidBlock *liquid, uint32_t prefixLength, bool *mergeChanged, const int round, g_data *g, const bool lcpCompute) {
+  assert(liquid->empty);
+  liquid->beginsAt = liquid->endsAt = 0;
+  for(int i=0;i<liquid->occ_size;i++) assert(liquid->occ[i]==0);
+  // copy first column to F
+  array_copy(g->F, g->firstColumn, g->sizeOfAlpha); //initialize char positions
+  // inCnt[0] is k-rank1 and inCnt[1] is rank1, g->inCnt is only updated when skipping a block
+  customInt rank1 = 0;
+  array_clear(g->inCnt,2,0);
+  uint64_t *z = g->bitZ;          // Z is bit round of each entry, newZ is bit 1-round
+  symbol *bws[2] = {g->bws[0], g->numBwt>1 ? g->bws[1] : g->bws[0]};
+  // id for each character, init with an invalid id
+  customInt blockID[g->sizeOfAlpha];
+  array_clear(blockID,g->sizeOfAlpha, g->mergeLen);  // mergeLen is an invalid id
+  customInt id = 0, k;
+  int m = (round%2==1) ? 1 : 2; // mask for the bitB array
+  customInt nextStart = 0;  // next position where B is tested (see tba_next_block)
+  customInt blockStart = 0; // last position where a block starts
+  uint64_t lcpWritten =0;
+
+  protoBlock cblock = {.mono = false};
+  solidBlock *next = readFirstBlock(solidHead); // first block
+  solidBlock *last = NULL;
+
+  for (k = 0; k < g->mergeLen; ) {
+    assert(next==NULL || k <= next->beginsAt);  // we did not pass next block
+    assert(last==NULL || last->nextBlock == next); // last is the immediately preceeding block
+
+    if(k<nextStart) { // no block starts in [k,nextStart): process the block interior in bulk
+      assert(next==NULL || next->beginsAt>=nextStart);
+      rank1 = block_interior2(k,nextStart,rank1,&cblock,bws,blockID,id,mergeChanged,round,m,g,lcpCompute);
+      k = nextStart;
+      continue;
+    }
+    // check if we are entering a block, and if the block is at least 2 iterations old
+    bool last_block_recent=true; // for k=0 a new block starts, so last id properly initialized
+    bool start_block = tba_block_test_set(g->bitB,k,m,&last_block_recent);
+    if(start_block) blockStart = k;
+    // B is tested at each position of short blocks, for long blocks we look for the next start
+    nextStart = (start_block || k-blockStart<Block_search_min) ? k+1 : tba_next_block(g->bitB,k+1,g->mergeLen,m);
+    if(start_block && last_block_recent && lcpCompute)
+      {writeLcp(k,prefixLength-2,g); lcpWritten++;} // save lcp value found in previous iteration
+    if (start_block) {
+      // if the block we just left is a singleton we add it to liquid that remains active
+      if(!last_block_recent && cblock.mono==true && (cblock.beginsAt==k-1)) {
+        cblock.endsAt = k;           // solidifiable singleton block just ended
+        add_singleton2liquid(&cblock, liquid);
+      }
+      // if the block we left is not recent, monochrome, we are only computing BWTs add it
+      else if(!last_block_recent && cblock.mono==true && !lcpCompute) {
+        cblock.endsAt = k;           // solidifiable monochorome block just ended
+        add_proto2liquid(&cblock,liquid);  // add proto to liquid that remains active
+      }
+      else { // proto block cannot be added, close current liquid
+        if(!liquid->empty)
+          last = finalize_liquid(last,liquid,next,solidHead); // this is the only point where a new block is created
+        assert(liquid->empty);
+        liquid->beginsAt=liquid->endsAt=k; // start empty liquid block
+      }
+      assert(liquid->endsAt==k);
+      // block ending at k considered, now look forward
+      if(next!=NULL && next->beginsAt==k) { // entering an irrelevant block
+        g->inCnt[1] = rank1;                // make inCnt[1] available to skip
+        skip(next, g);                      // skip block
+        rank1 = g->inCnt[1];
+        k = next->endsAt;                   // update k
+        // merge liquid with next block and possibly previous
+        if(last==NULL || last->endsAt!=liquid->beginsAt) {
+            if(!liquid->empty) merge_liquid(liquid,next,solidHead); // simple merge
+            if(last!=NULL) writeBlock(last,solidHead);  // save current last
+            last = next;   // advance last
+        }
+        else  //three way merge, next is freed last does not change
+          merge_sls(last,liquid,next,solidHead); // only point where a solid block can be destroyed
+        assert(liquid->empty);
+        liquid->beginsAt=liquid->endsAt=k; // start empty liquid block
+        next = readBlock(solidHead);       // next has become last, update next (was: next = last->nextBlock; )
+        last->nextBlock = next;
+        assert(k==last->endsAt);
+        cblock.mono = false;        // prevent re-adding the just skipped block
+        continue;                   // resume from the end of the block
+      }
+      // we are entering a relevant block, unless it is a recent one make it a candidate for solidification
+      if( !last_block_recent ) {
+        cblock.beginsAt = k; cblock.mono=true;
+        cblock.color = bz_get(z,k,round);
+        cblock.start = &bws[cblock.color][cblock.color ? rank1 : k-rank1]; // bwt-position of first char in block
+      }
+      else cblock.mono = false; // not a candidate for solid block, wait next iteration
+      if(last_block_recent)
+         id = k;    // id of the new block
+    }
+    // processing a char in a relevant block
+    int currentColor = bz_get(z,k,round);   // Z[k] b in pseudocode
+    int currentChar = bws[currentColor][currentColor ? rank1 : k-rank1]; // c in pseudocode
+    rank1 += currentColor;
+    // add currentChar/Color to proto block
+    cblock.lastChar =  currentChar;   // save lastchar, only useful for singleton blocks
+    cblock.lastColor =  currentColor; // save lastcolor, only useful for singleton blocks
+    if(currentColor != cblock.color) cblock.mono = false;       // block is not monochrome
+    // write color in new Z array, except 0 chars
+    if(currentChar!=0) {
+      customInt positionToUpdate = g->F[currentChar]++;
+      if(!lcpCompute && !*mergeChanged && bz_get(z,positionToUpdate,round)!=currentColor)
+        *mergeChanged=true;  // remember there is a difference from the previous iteration
+      bz_set(z,positionToUpdate,1-round,currentColor);
+      // create new block?
+      if (blockID[currentChar] != id) {
+        if(last_block_recent) tba_mark_if0(g->bitB,positionToUpdate,m);
+        blockID[currentChar] = id; // update block id, always!
+      }
+    }
+    k++;
+  } // end main loop, check block that just ended
+  assert(k==g->mergeLen);
+  assert(next==NULL);
+  if(cblock.mono==true && cblock.beginsAt==k-1) {
+    cblock.endsAt = k;           // solidifiable singleton block just ended
+    add_singleton2liquid(&cblock, liquid);
+    assert(!liquid->empty);
+  }
+  else if(cblock.mono==true && !lcpCompute) {
+    cblock.endsAt = k;
+    add_proto2liquid(&cblock,liquid);  // add proto to liquid that remains active
+    assert(!liquid->empty);
+  }
+  if(!liquid->empty)
+    last = finalize_liquid(last,liquid,NULL,solidHead); // a new block could be created
+  assert(liquid->empty);
+  // add EOF value to lcp file and entry to .size file
+  if(lcpCompute && lcpWritten>0)
+    writeLcp_EOF(++lcpWritten, g);
+  // check if all sequence has become irrelevant
+  bool everything_irrelevant = false;
+  if(last!=NULL && last->beginsAt==0 && last->endsAt==g->mergeLen)
+    everything_irrelevant = true;
+  // save last block
+  if(last!=NULL) writeBlock(last,solidHead);
+  // check we have read all chars from all BWT's
+  g->inCnt[0] = g->mergeLen - rank1; g->inCnt[1] = rank1;
+  for(int i=0; i<g->numBwt; i++)
+    assert(g->inCnt[i]==g->bwtLen[i]);
+
+  return everything_irrelevant;
+}
+
+// kernels for gap2 (see GAP_KERNEL in mergegap.c)
+typedef bool (*gapKernel2)(solidBlockFile *, liquidBlock *, uint32_t, bool *, const int, g_data *);
+#define GAP_KERNEL2(name,lcp) \
+  static bool name(solidBlockFile *s, liquidBlock *l, uint32_t p, bool *c, const int round, g_data *g) { \
+    if(round) return addCharToPrefix2(s,l,p,c,1,g,lcp); \
+    return addCharToPrefix2(s,l,p,c,0,g,lcp); }
+GAP_KERNEL2(kernel2_bwt,false)
+GAP_KERNEL2(kernel2_lcpcompute,true)
+
+
+// merge the two BWTs using the colors in the final Z (which is equal to newZ)
+// without the n bytes buffer used by mergeBWT8(): the two BWTs are consecutive in memory
+// and the merged BWT overwrites them. The shortest BWT is copied to a buffer and the merge
+// proceeds forward if the copied BWT is bws[0] and backward otherwise,
+// so that no symbol is overwritten before it has been read
+// return false if the BWTs are not consecutive or the DA/SA/QS arrays must be output
+// (these cases are handled by mergeBWT8)
+static bool mergeBWT2(g_data *g, int round, bool lastRound)
+{
+  if(g->numBwt!=2 || g->bws[1]!=g->bws[0]+g->bwtLen[0]) return false;
+  if(lastRound && (g->outputDA || g->outputSA || g->outputQS)) return false;
+  symbol *bwtout = g->bws[0];
+  int c = g->bwtLen[0] <= g->bwtLen[1] ? 0 : 1;  // BWT copied to the buffer
+  symbol *buffer = malloc(g->bwtLen[c]*sizeof(symbol));
+  if(!buffer) die(__func__);
+  memcpy(buffer,g->bws[c],g->bwtLen[c]*sizeof(symbol));
+  symbol *bws[2] = {g->bws[0], g->bws[1]};
+  bws[c] = buffer;
+  if(c==0) { // bws[1][inCnt[1]] is at position bwtLen[0]+inCnt[1] >= i
+    array_clear(g->inCnt,2,0);
+    for(customInt i=0;i<g->mergeLen;i++) {
+      int b = bz_get(g->bitZ,i,round);
+      symbol s = bws[b][g->inCnt[b]++];
+      bwtout[i] = lastRound ? alpha_enlarge(s) : s; // if last round remap while copying
+    }
+  }
+  else {    // bws[0][inCnt[0]-1] is at position inCnt[0]-1 <= i
+    array_copy(g->inCnt,g->bwtLen,2);
+    for(customInt i=g->mergeLen;i>0;i--) {
+      int b = bz_get(g->bitZ,i-1,round);
+      symbol s = bws[b][--g->inCnt[b]];
+      bwtout[i-1] = lastRound ? alpha_enlarge(s) : s;
+    }
+    g->inCnt[0] = g->bwtLen[0]; g->inCnt[1] = g->bwtLen[1]; // for the final check
+  }
+  free(buffer);
+  // final check on the merging
+  for(int i=0;i<g->numBwt;i++) assert(g->inCnt[i]==g->bwtLen[i]);
+  return true;
+}
+
+// expand the final Z to the format used by gap8 (B is 11 for all entries)
+// so that the merged BWT and the DA/SA/QS arrays are produced by mergeBWT8()
+static void expand_arrays2(g_data *g, int round)
+{
+  alloc_merge_array(g);
+  for(customInt i=0;i<g->mergeLen;i++)
+    g->mergeColor[i] = (palette) (bz_get(g->bitZ,i,round)*9 | 3<<6);
+}
+
+
+// entry point for the gap bwt/lcp merging procedure with at most 2 input sequences
+// we assume lcpMerge==false so blockBeginsAt is replaced by a bit array
+void gap2(g_data *g, bool lastRound) {
+  // check we can really use 1 bit colors
+  assert(g->numBwt<=2 && g->lcpMerge==false && !g->extMem);
+  if(g->verbose>0) puts("BWT merging with gap2");
+  if(g->lcpCompute) {       // we compute LCP values only if we are at the last round
+    assert(!g->bwtOnly && lastRound);
+    open_unsortedLCP_files(g);
+    if(g->verbose>0) puts("Computing LCP values");
+  }
+  else assert(g->bwtOnly);
+
+  // init local global vars
+  check_g_data(g);
+  // allocate the bit arrays Z and newZ and the 2 bit array B
+  g->bitB = tba_alloc(g->mergeLen, g->mmapB);
+  g->bitZ = tba_alloc(g->mergeLen, g->mmapZ);
+  g->mergeColor = g->newMergeColor = NULL; // make sure these are not used
+  g->mergeColor16=NULL;
+  g->array32 = NULL;
+
+  // allocate other useful arrays, inCnt has always two entries (see addCharToPrefix2)
+  g->inCnt = malloc(2*sizeof(customInt));
+  g->firstColumn = malloc(g->sizeOfAlpha*sizeof(customInt));
+  g->F = malloc(g->sizeOfAlpha*sizeof(customInt));
+  if(!g->inCnt || !g->firstColumn || !g->F) die(__func__);
+  // init the above arrays
+  if(g->smallAlpha) init_arrays2(g);
+  else init_arrays2_largealpha(g);
+
+  // init liquid block (containing list of allocated mem)
+  liquidBlock *liquid = liquid_new(g);
+  // init list (on disk) of irrelevant blocks, initially empty
+  solidBlockFile *ibList = ibHead_new(g);
+
+  // main loop
+  uint32_t prefixLength = 1;
+  int round=0;
+  uint64_t solidBytes = 0, solidRaw = 0; // solid block list bytes written, and with the fixed size format
+  bool merge_completed;
+  gapKernel2 kernel = g->lcpCompute ? kernel2_lcpcompute : kernel2_bwt;
+  do {
+    prefixLength+= 1;
+    if(g->lcpCompute && prefixLength-2>MAX_LCP_SIZE) {fprintf(stderr,"LCP too large: %u\n", prefixLength-2);die(__func__);}
+    bool mergeChanged = false; // the Z vector has changed in this iteration (used when g->bwtOnly)
+    ibHead_open_out(ibList);
+    merge_completed=kernel(ibList,liquid,prefixLength,&mergeChanged,round,g);
+    solidBytes += ibHead_out_size(ibList); solidRaw += ibList->rawBytes;
+    if (g->verbose>1 && lastRound) {
+      #if MALLOC_COUNT_FLAG
+        printf("Lcp: %u. Memory peak/current: %.2lf/%.2lf bytes/symbol. ibList: %ju (%ju uncompressed)\n",
+           prefixLength-1, (double)malloc_count_peak()/g->mergeLen,
+           (double)malloc_count_current()/g->mergeLen, (uintmax_t) ibHead_out_size(ibList), (uintmax_t) ibList->rawBytes);
+      // also EOF are written to unsortedLcp file so percentages are not accurate
+      #endif
+      if(g->unsortedLcp) printf("   unsorted lcp values: %ju (%.2lf%%)\n",
+      (uintmax_t) countLcp(g), (double) 100*countLcp(g)/g->mergeLen);
+    }
+    round  = 1 - round; // change round parity
+    if(g->bwtOnly && !mergeChanged) {
+      if(g->verbose>1) puts("Gap bwt-only early termination");
+      ibHead_close_out(ibList);
+      break;
+    }
+    ibHead_rotate(ibList);
+  } while(!merge_completed);  // end main loop
+  ibHead_close_in(ibList);
+
+  #if MALLOC_COUNT_FLAG
+    if (g->verbose>0) {
+      if(lastRound)
+        printf("Merge2 completed (%d bwts). Mem: %zu peak, %zu current, %.2lf/%.2lf bytes/symbol\n", g->numBwt, malloc_count_peak(),
+             malloc_count_current(), (double)malloc_count_peak()/g->mergeLen,
+             (double)malloc_count_current()/g->mergeLen);
+      else if(g->verbose>1)
+        printf("Merge2 completed (%d bwts). Mem: %zu peak, %zu current\n", g->numBwt, malloc_count_peak(),
+             malloc_count_current());
+    }
+  #else
+    if (g->verbose>0) {
+        printf("Merge2 completed (%d bwts).\n", g->numBwt);
+    }
+  #endif
+  if(g->verbose>0 && (lastRound || g->verbose>1))
+    printf("Solid block lists written: %ju bytes, %ju uncompressed (%.2lf%%)\n", (uintmax_t) solidBytes, (uintmax_t) solidRaw, 
+           solidRaw ? 100.0*solidBytes/solidRaw : 100.0);
+  liquid_free(liquid);
+  ibHead_free(ibList);
+
+  // B is no longer needed: at the end all its entries are 11
+  #ifndef NDEBUG
+  if(g->lcpCompute)
+    for(customInt i=0;i<g->mergeLen;i++) assert(tba_get(g->bitB,i)==3);
+  #endif
+  tba_free(g->bitB, g->mergeLen, g->mmapB);
+  g->bitB = NULL;
+  // computation complete, do the merging using the last newZ (now Z)
+  // The following calls write the merged BWT back to g->bws[0]
+  bool merged = mergeBWT2(g,round,lastRound);
+  if(!merged) {
+    expand_arrays2(g,round);
+    mergeBWT8(g,lastRound);
+  }
+  if(g->lcpCompute) {
+    assert(lastRound);
+    // close lcp file (and merge them?)
+    close_unsortedLCP_files(g);
+    if(g->verbose>0) printf("Remind to run lcpmerge to obtain the final LCP array\n");
+  }
+
+  free(g->F); // last four arrays deallocated
+  free(g->firstColumn);
+  free(g->inCnt);
+  tba_free(g->bitZ, g->mergeLen, g->mmapZ);
+  g->bitZ = NULL;
+  if(!merged) free_merge_array(g);
+}
+
+#undef bz_get
@@ -43,6 +43,17 @@
 #define set_blockBeginsAt(k,c) (g->array32[(k)] = \
         ( (g->array32[(k)]& 0xFFFF) | ((c)<<16) ))
 
+// flush for gap256: newZ is a byte inside each array32 entry, so the buffered
+// colors are merged in place (no non-temporal stores)
+static void cbuffer_flush256(cbuffer *b, g_data *g, const int round)
+{
+  // positions in the segment are [begin,end) so the buffer is read from index begin%COLOR_WC_SIZE
+  customInt base = b->begin - b->begin%COLOR_WC_SIZE;
+  int i0 = b->begin-base, i1 = b->end-base; 
+  if(round) for(int i=i0; i<i1; i++) set_mergeColor(base+i,b->buffer[i],1);
+  else      for(int i=i0; i<i1; i++) set_mergeColor(base+i,b->buffer[i],0);
+}
+
 
 // init Z, newZ B, and first Column array using g->bwtOcc[i][j]
 static void init_arrays256(g_data *g)
@@ -64,7 +75,7 @@ static void init_arrays256(g_data *g)
   assert(i==g->mergeLen);
   // extra check on mergeColor, can be commented out
   #ifndef NDEBUG
-  customInt cnt[MAX_NUMBER_OF_BWTS] = {0};
+  customInt cnt[MAX_NARROW_BWTS] = {0};
   for(i=0;i<g->mergeLen;i++) cnt[g->array32[i]&0xFF]++;
   bool stop=false;
   for(int i=0; i<g->numBwt; i++)
@@ -101,7 +112,7 @@ static void init_arrays256_largealpha(g_data *g)
 // single iteration of the Gap algorithm
 // input is head of the irrelevant lists (fin and fout) and an empty liquid block
 // return true if the whole sequence has become irrelevant.
-static bool addCharToPrefix256(solidBlockFile *solidHead, liquidBlock *liquid, uint32_t prefixLength, bool *mergeChanged, const int round, g_data *g) {
+GAP_KERNEL bool addCharToPrefix256(solidBlockFile *solidHead, liquidBlock *liquid, uint32_t prefixLength, bool *mergeChanged, const int round, g_data *g, const bool bwtOnly, const bool wc) {
   assert(prefixLength <= 65535);// lengths are stored in 16 bits in g->array32
   assert(liquid->empty);
   liquid->beginsAt = liquid->endsAt = 0;  
@@ -113,10 +124,13 @@ static bool addCharToPrefix256(solidBlockFile *solidHead, liquidBlock *liquid, u
   // id for each character, init with an invalid id
   customInt blockID[g->sizeOfAlpha];
   array_clear(blockID,g->sizeOfAlpha, g->mergeLen);  // mergeLen is an invalid id
+  // write-combining buffer for each character
+  cbuffer cbuf[wc ? g->sizeOfAlpha : 1];
+  if(wc) cbuffer_start(cbuf,g);
   customInt id = 0, k; 
 
   protoBlock cblock = {.mono = false};
-  solidBlock *next = readBlock(solidHead); // first block
+  solidBlock *next = readFirstBlock(solidHead); // first block
   solidBlock *last = NULL;
   
   for (k = 0; k < g->mergeLen; ) { 
@@ -130,7 +144,7 @@ static bool addCharToPrefix256(solidBlockFile *solidHead, liquidBlock *liquid, u
     if(start_block) last_block_recent = (bk >=prefixLength-1);
     if (start_block) {
       // check if the block we just left is not recent and monochrome and if(unsortedLcp) singleton  
-      if( !last_block_recent && cblock.mono && ((cblock.beginsAt==k-1)||g->bwtOnly)) {
+      if( !last_block_recent && cblock.mono && ((cblock.beginsAt==k-1)||bwtOnly)) {
         cblock.endsAt = k;           // solidifiable monochorome block just ended
         add_proto2liquid(&cblock,liquid);  // add proto to liquid that remains active 
       }
@@ -177,8 +191,9 @@ static bool addCharToPrefix256(solidBlockFile *solidHead, liquidBlock *liquid, u
     // write color in new Z array, except 0 chars
     if(currentChar!=0) {
       customInt positionToUpdate = g->F[currentChar]++;
-      set_mergeColor(positionToUpdate,currentColor,round); // g->newMergeColor[positionToUpdate] = currentColor;
-      if(g->bwtOnly && !*mergeChanged && get_mergeColor(positionToUpdate,round)!=currentColor)
+      if(wc) cbuffer_put(&cbuf[currentChar],positionToUpdate,currentColor,g,round,cbuffer_flush256);
+      else set_mergeColor(positionToUpdate,currentColor,round); // g->newMergeColor[positionToUpdate] = currentColor;
+      if(bwtOnly && !*mergeChanged && get_mergeColor(positionToUpdate,round)!=currentColor)
         *mergeChanged=true;  // remember there is a difference from the previous iteration 
       // create new block?
       if (blockID[currentChar] != id) {
@@ -190,6 +205,7 @@ static bool addCharToPrefix256(solidBlockFile *solidHead, liquidBlock *liquid, u
     k++;
   } // end main loop
   assert(next==NULL); 
+  if(wc) cbuffer_flush_all(cbuf,g,round,cbuffer_flush256);
   if(cblock.mono==true) { // final mono block can be created 
     cblock.endsAt = k;
     add_proto2liquid(&cblock,liquid);  // add proto to liquid that remains active
@@ -211,6 +227,17 @@ static bool addCharToPrefix256(solidBlockFile *solidHead, liquidBlock *liquid, u
   return everything_irrelevant;
 }
 
+// kernels for gap256 (see GAP_KERNEL in mergegap.c)
+typedef bool (*gapKernel256)(solidBlockFile *, liquidBlock *, uint32_t, bool *, const int, g_data *);
+#define GAP_KERNEL256(name,bwt,wc) \
+  static bool name(solidBlockFile *s, liquidBlock *l, uint32_t p, bool *c, const int round, g_data *g) { \
+    if(round) return addCharToPrefix256(s,l,p,c,1,g,bwt,wc); \
+    return addCharToPrefix256(s,l,p,c,0,g,bwt,wc); }
+GAP_KERNEL256(kernel256_bwt,true,false)
+GAP_KERNEL256(kernel256_lcpcompute,false,false)
+GAP_KERNEL256(kernel256_wc_bwt,true,true)
+GAP_KERNEL256(kernel256_wc_lcpcompute,false,true)
+
 
 // entry point for the gap bwt/lcp merging procedure
 // even when we are only interested in the BWT we use blockBeginsAt (here embedded in array32) 
@@ -261,32 +288,35 @@ void gap256(g_data *g, bool lastRound)
   solidBlockFile *ibList = ibHead_new(g);
   // main loop
   int round=0;
+  uint64_t solidBytes = 0, solidRaw = 0; // solid block list bytes written, and with the fixed size format
   if(g->numBwt>1) {
     bool merge_completed; 
+    gapKernel256 kernel;
+    if(g->wcColors) kernel = g->bwtOnly ? kernel256_wc_bwt : kernel256_wc_lcpcompute;
+    else kernel = g->bwtOnly ? kernel256_bwt : kernel256_lcpcompute;
     do {
       prefixLength+= 1;
       if(prefixLength> 0xFFFF ) {fprintf(stderr,"prefixLength too large: %u\n", prefixLength);die(__func__);}
       bool mergeChanged = false; // the Z vector has changed in this iteration (used when g->bwtOnly)
-      ibList->fout = gap_tmpfile(g->outPath);
-      merge_completed=addCharToPrefix256(ibList,liquid,prefixLength,&mergeChanged,round,g);
+      ibHead_open_out(ibList);
+      merge_completed=kernel(ibList,liquid,prefixLength,&mergeChanged,round,g);
+      solidBytes += ibHead_out_size(ibList); solidRaw += ibList->rawBytes;
       #if MALLOC_COUNT_FLAG
         if (g->verbose>1 && lastRound) {
-          printf("Lcp: %u. Memory peak/current: %.2lf/%.2lf bytes/symbol. ibList: %ju\n", 
+          printf("Lcp: %u. Memory peak/current: %.2lf/%.2lf bytes/symbol. ibList: %ju (%ju uncompressed)\n", 
                prefixLength-1, (double)malloc_count_peak()/g->mergeLen,
-               (double)malloc_count_current()/g->mergeLen, (uintmax_t) ftello(ibList->fout));
+               (double)malloc_count_current()/g->mergeLen, (uintmax_t) ibHead_out_size(ibList), (uintmax_t) ibList->rawBytes);
         }
       #endif
       round  = 1 - round; // change round parity
       if(g->bwtOnly && !mergeChanged) {
         if(g->verbose>1) puts("Gap bwt-only early termination");
-        fclose(ibList->fout);
+        ibHead_close_out(ibList);
         break;
       }
-      if(ibList->fin!=NULL) fclose(ibList->fin);
-      rewind(ibList->fout);
-      ibList->fin = ibList->fout;
+      ibHead_rotate(ibList);
     } while(!merge_completed);  // end main loop
-    if(ibList->fin!=NULL) fclose(ibList->fin);
+    ibHead_close_in(ibList);
   }
   if (g->verbose>0) {
     #if MALLOC_COUNT_FLAG
@@ -301,6 +331,9 @@ void gap256(g_data *g, bool lastRound)
       printf("Merge256 completed (%d bwts).\n", g->numBwt);
     #endif
   }
+  if(g->verbose>0 && (lastRound || g->verbose>1))
+    printf("Solid block lists written: %ju bytes, %ju uncompressed (%.2lf%%)\n", (uintmax_t) solidBytes, (uintmax_t) solidRaw, 
+           solidRaw ? 100.0*solidBytes/solidRaw : 100.0);
   liquid_free(liquid);
   ibHead_free(ibList);
 
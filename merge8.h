@@ -44,7 +44,7 @@ static void init_arrays8(g_data *g)
   assert(i==g->mergeLen); 
   // extra check on mergeColor, can be commented out
   #ifndef NDEBUG
-  customInt cnt[MAX_NUMBER_OF_BWTS] = {0};
+  customInt cnt[MAX_NARROW_BWTS] = {0};
   for(i=0;i<g->mergeLen;i++) cnt[g->mergeColor[i]&0x7]++;
   bool stop=false;
   for(int i=0; i<g->numBwt; i++)
@@ -86,7 +86,7 @@ static void init_arrays8_largealpha(g_data *g)
 #define set_mergeColor8(k,c,round) (g->mergeColor[(k)] = (round)? \
         ( (g->mergeColor[(k)]&0xF8) | (c)) : ((g->mergeColor[(k)]&0xC7) | ((c)<<3))  )
 
-static bool addCharToPrefix8(solidBlockFile *solidHead, liquidBlock *liquid, uint32_t prefixLength, bool *mergeChanged, const int round, g_data *g) {
+GAP_KERNEL bool addCharToPrefix8(solidBlockFile *solidHead, liquidBlock *liquid, uint32_t prefixLength, bool *mergeChanged, const int round, g_data *g, const bool extMem, const bool lcpCompute) {
   assert(liquid->empty);
   liquid->beginsAt = liquid->endsAt = 0;  
   for(int i=0;i<liquid->occ_size;i++) assert(liquid->occ[i]==0);
@@ -94,16 +94,18 @@ static bool addCharToPrefix8(solidBlockFile *solidHead, liquidBlock *liquid, uin
   array_copy(g->F, g->firstColumn, g->sizeOfAlpha); //initialize char positions
   // pointer inside each BWT (k_0 & k_1 in the pseudocode)
   array_clear(g->inCnt,g->numBwt,0);
-  if(g->extMem) rewind_bw_files(g); // set file pointers at the beginning of each BWT 
+  if(extMem) rewind_bw_files(g); // set file pointers at the beginning of each BWT 
   // id for each character, init with an invalid id
   customInt blockID[g->sizeOfAlpha];
   array_clear(blockID,g->sizeOfAlpha, g->mergeLen);  // mergeLen is an invalid id
   customInt id = 0, k; 
   int m = (round%2==1) ? 1 : 2; // mask for the bitB array (now inside mergeColor)
+  customInt nextStart = 0;  // next position where B is tested (see tba_next_block)
+  customInt blockStart = 0; // last position where a block starts
   uint64_t lcpWritten =0;
 
   protoBlock cblock = {.mono = false};
-  solidBlock *next = readBlock(solidHead); // first block
+  solidBlock *next = readFirstBlock(solidHead); // first block
   solidBlock *last = NULL;
   
   for (k = 0; k < g->mergeLen; ) { 
@@ -111,9 +113,14 @@ static bool addCharToPrefix8(solidBlockFile *solidHead, liquidBlock *liquid, uin
     assert(last==NULL || last->nextBlock == next); // last is the immediately preceeding block
 
     // check if we are entering a block, and if the block is at least 2 iterations old
-    bool start_block, last_block_recent=true; // for k=0 a new block starts, so last id properly initialized
-    start_block = tba_block_test_set8(g->mergeColor,k,m,&last_block_recent);    
-    if(start_block && last_block_recent && g->lcpCompute)
+    bool start_block=false, last_block_recent=true; // for k=0 a new block starts, so last id properly initialized
+    if(k>=nextStart) {
+      start_block = tba_block_test_set8(g->mergeColor,k,m,&last_block_recent);
+      if(start_block) blockStart = k;
+      // B is tested at each position of short blocks, for long blocks we look for the next start
+      nextStart = (start_block || k-blockStart<Block_search_min) ? k+1 : tba_next_block8(g->mergeColor,k+1,g->mergeLen,m);
+    }
+    if(start_block && last_block_recent && lcpCompute)
       {writeLcp(k,prefixLength-2,g); lcpWritten++;} // save lcp value found in previous iteration
     if (start_block) {
       // if the block we just left is a singleton we add it to liquid that remains active
@@ -122,7 +129,7 @@ static bool addCharToPrefix8(solidBlockFile *solidHead, liquidBlock *liquid, uin
         add_singleton2liquid(&cblock, liquid);
       }
       // if the block we left is not recent, monochrome, we are only computing BWTs and not using extMem add it  
-      else if(!last_block_recent && cblock.mono==true && !g->lcpCompute && !g->extMem) {
+      else if(!last_block_recent && cblock.mono==true && !lcpCompute && !extMem) {
         cblock.endsAt = k;           // solidifiable monochorome block just ended
         add_proto2liquid(&cblock,liquid);  // add proto to liquid that remains active 
       }
@@ -156,7 +163,7 @@ static bool addCharToPrefix8(solidBlockFile *solidHead, liquidBlock *liquid, uin
       // we are entering a relevant block, unless it is a recent one make it a candidate for solidification  
       if( !last_block_recent ) {
         cblock.beginsAt = k; cblock.mono=true; 
-        if(!g->extMem) {
+        if(!extMem) {
           cblock.color =  get_mergeColor8(k,round);
           cblock.start = &g->bws[cblock.color][g->inCnt[cblock.color]]; // bwt-position of first char in block
         }
@@ -168,22 +175,22 @@ static bool addCharToPrefix8(solidBlockFile *solidHead, liquidBlock *liquid, uin
     // processing a char in a relevant block
     int currentColor = get_mergeColor8(k,round);   // g->mergeColor[k] b in pseudocode
     int currentChar=0;  // c in pseudocode: next char in current BWT 
-    if(g->extMem) {
-      int e = fread(&currentChar,sizeof(symbol),1,g->bwf[currentColor]);
-      if(e!=1) {die(__func__);} g->inCnt[currentColor]++;
+    if(extMem) {
+      currentChar = breader_getc(&g->bwf[currentColor]);
+      g->inCnt[currentColor]++;
     }
     else 
       currentChar =  g->bws[currentColor][g->inCnt[currentColor]++]; // c in pseudocode
     // add currentChar/Color to proto block  
     cblock.lastChar =  currentChar;   // save lastchar, only useful for singleton blocks
     cblock.lastColor =  currentColor; // save lastcolor, only useful for singleton blocks
-    if(!g->extMem)
+    if(!extMem)
       if(currentColor != cblock.color) cblock.mono = false;       // block is not monochrome
     // write color in new Z array, except 0 chars
     if(currentChar!=0) {
       customInt positionToUpdate = g->F[currentChar]++;
       set_mergeColor8(positionToUpdate,currentColor,round); // g->newMergeColor[positionToUpdate] = currentColor;
-      if(g->bwtOnly && !*mergeChanged && get_mergeColor8(positionToUpdate,round)!=currentColor)
+      if(!lcpCompute && !*mergeChanged && get_mergeColor8(positionToUpdate,round)!=currentColor)
         *mergeChanged=true;  // remember there is a difference from the previous iteration 
       // create new block?
       if (blockID[currentChar] != id) {
@@ -200,7 +207,7 @@ static bool addCharToPrefix8(solidBlockFile *solidHead, liquidBlock *liquid, uin
     add_singleton2liquid(&cblock, liquid);
     assert(!liquid->empty);
   }
-  else if(cblock.mono==true && !g->lcpCompute && !g->extMem) {
+  else if(cblock.mono==true && !lcpCompute && !extMem) {
     cblock.endsAt = k;
     add_proto2liquid(&cblock,liquid);  // add proto to liquid that remains active
     assert(!liquid->empty);
@@ -209,7 +216,7 @@ static bool addCharToPrefix8(solidBlockFile *solidHead, liquidBlock *liquid, uin
     last = finalize_liquid(last,liquid,NULL,solidHead); // a new block could be created 
   assert(liquid->empty);
   // add EOF value to lcp file and entry to .size file 
-  if(!g->bwtOnly && lcpWritten>0)
+  if(lcpCompute && lcpWritten>0)
     writeLcp_EOF(++lcpWritten, g);
   // check if all sequence has become irrelevant
   bool everything_irrelevant = false;
@@ -224,6 +231,17 @@ static bool addCharToPrefix8(solidBlockFile *solidHead, liquidBlock *liquid, uin
   return everything_irrelevant;
 }
 
+// kernels for gap8 (see GAP_KERNEL in mergegap.c)
+typedef bool (*gapKernel8)(solidBlockFile *, liquidBlock *, uint32_t, bool *, const int, g_data *);
+#define GAP_KERNEL8(name,ext,lcp) \
+  static bool name(solidBlockFile *s, liquidBlock *l, uint32_t p, bool *c, const int round, g_data *g) { \
+    if(round) return addCharToPrefix8(s,l,p,c,1,g,ext,lcp); \
+    return addCharToPrefix8(s,l,p,c,0,g,ext,lcp); }
+GAP_KERNEL8(kernel8_bwt,false,false)
+GAP_KERNEL8(kernel8_lcpcompute,false,true)
+GAP_KERNEL8(kernel8_ext_bwt,true,false)
+GAP_KERNEL8(kernel8_ext_lcpcompute,true,true)
+
 
 // entry point for the gap bwt/lcp merging procedure with at most 8 input sequences 
 // we assume lcpMerge==false so blockBeginsAt is replaced by a bit array 
@@ -270,36 +288,37 @@ void gap8(g_data *g, bool lastRound) {
 
   // main loop
   uint32_t prefixLength = 1;
-  int lcpSize = POS_SIZE + BSIZE;   // number of bytes for each pos,lcp pair, see writeLcp()
   int round=0;
+  uint64_t solidBytes = 0, solidRaw = 0; // solid block list bytes written, and with the fixed size format
   bool merge_completed;
+  gapKernel8 kernel = g->extMem ? (g->lcpCompute ? kernel8_ext_lcpcompute : kernel8_ext_bwt)
+                                : (g->lcpCompute ? kernel8_lcpcompute : kernel8_bwt);
   do {
     prefixLength+= 1;
     if(g->lcpCompute && prefixLength-2>MAX_LCP_SIZE) {fprintf(stderr,"LCP too large: %u\n", prefixLength-2);die(__func__);}
     bool mergeChanged = false; // the Z vector has changed in this iteration (used when g->bwtOnly)
-    ibList->fout = gap_tmpfile(g->outPath);
-    merge_completed=addCharToPrefix8(ibList,liquid,prefixLength,&mergeChanged,round,g);
+    ibHead_open_out(ibList);
+    merge_completed=kernel(ibList,liquid,prefixLength,&mergeChanged,round,g);
+    solidBytes += ibHead_out_size(ibList); solidRaw += ibList->rawBytes;
     if (g->verbose>1 && lastRound) {
       #if MALLOC_COUNT_FLAG
-        printf("Lcp: %u. Memory peak/current: %.2lf/%.2lf bytes/symbol. ibList: %ju\n", 
+        printf("Lcp: %u. Memory peak/current: %.2lf/%.2lf bytes/symbol. ibList: %ju (%ju uncompressed)\n", 
            prefixLength-1, (double)malloc_count_peak()/g->mergeLen,
-           (double)malloc_count_current()/g->mergeLen, (uintmax_t) ftello(ibList->fout));
+           (double)malloc_count_current()/g->mergeLen, (uintmax_t) ibHead_out_size(ibList), (uintmax_t) ibList->rawBytes);
       // also EOF are written to unsortedLcp file so percentages are not accurate     
       #endif
       if(g->unsortedLcp) printf("   unsorted lcp values: %ju (%.2lf%%)\n",  
-      (uintmax_t) ftello(g->unsortedLcp)/lcpSize, (double) 100*ftello(g->unsortedLcp)/(lcpSize*g->mergeLen));
+      (uintmax_t) countLcp(g), (double) 100*countLcp(g)/g->mergeLen);
     }
     round  = 1 - round; // change round parity
     if(g->bwtOnly && !mergeChanged) {
       if(g->verbose>1) puts("Gap bwt-only early termination");
-      fclose(ibList->fout);
+      ibHead_close_out(ibList);
       break;
     }
-    if(ibList->fin!=NULL) fclose(ibList->fin);
-    rewind(ibList->fout);
-    ibList->fin = ibList->fout;
+    ibHead_rotate(ibList);
   } while(!merge_completed);  // end main loop
-  if(ibList->fin!=NULL) fclose(ibList->fin);
+  ibHead_close_in(ibList);
 
   #if MALLOC_COUNT_FLAG
     if (g->verbose>0) {
@@ -316,6 +335,9 @@ void gap8(g_data *g, bool lastRound) {
         printf("Merge8 completed (%d bwts).\n", g->numBwt);
     }
   #endif
+  if(g->verbose>0 && (lastRound || g->verbose>1))
+    printf("Solid block lists written: %ju bytes, %ju uncompressed (%.2lf%%)\n", (uintmax_t) solidBytes, (uintmax_t) solidRaw, 
+           solidRaw ? 100.0*solidBytes/solidRaw : 100.0);
   liquid_free(liquid);
   ibHead_free(ibList);  
   if(g->extMem) close_bw_files(g);
@@ -0,0 +1,340 @@
+// mergegap with prefix doubling (gapdbl): alternative to gap for collections with very long LCPs
+// supports bwtOnly & lcpCompute NOT lcpMerge and NOT extMem
+//
+// Gap extends by one the length h of the prefixes defining the blocks at each iteration,
+// hence it needs maxLCP+2 iterations. gapdbl uses the same blocks but doubles h at
+// each iteration as in prefix doubling (Manber-Myers, Larsson-Sadakane): two rows in the
+// same block at level h are in the same block at level 2h iff the suffixes starting h
+// characters later are in the same block at level h. Inside a block rows keep the Gap
+// order (color, local rank) so the final Z is the one computed by gap.
+// The suffix starting h characters later is given by psi^h computed inside each BWT
+// (psi is the inverse of LF) and psi^2h = psi^h o psi^h; since the 0 chars are all
+// different (see init_arrays) psi^h is undefined if the first h chars contain a 0,
+// but then the row is already a singleton block. Only blocks with more than one row
+// are sorted, but psi^2h must be recomputed for all suffixes at each iteration.
+// The LCP of a new block boundary found at level 2h is h plus the LCP of the two
+// suffixes h characters later, that is the minimum of the LCP values at level h
+// between their blocks, obtained with a sparse table over chunks of Dbl_chunk rows.
+// The space is large: n (BWTs) 32n (rows, ranks, psi, keys) n/8 (block starts)
+// plus 2n (LCP) n/16 (sparse table) if lcpCompute, so gapdbl is useful only when
+// the number of Gap iterations (maxLCP) is much larger than log(maxLCP)
+
+// suffixes are identified by their global position in the concatenation of the BWTs
+// id = bwtLen[0] + ... + bwtLen[b-1] + (local row of the suffix in BWT b)
+#define Dbl_none (~(customInt) 0)    // psi^h undefined: a 0 among the first h chars
+#define Dbl_chunk 64                 // rows for each entry of the LCP sparse table
+#define Dbl_sort_min 16              // blocks smaller than this are sorted by insertion
+
+typedef struct {
+  customInt n;        // number of rows (mergeLen)
+  customInt *off;     // off[b] is the id of the first suffix of BWT b, off[numBwt]=n
+  customInt *sa;      // sa[i] is the id of the suffix in row i
+  customInt *rank;    // rank[id] is the first row of the block containing id
+  customInt *psi;     // psi[id] is the suffix starting h chars later or Dbl_none
+  customInt *tmp;     // keys of the rows being sorted, then the new psi
+  uint64_t *bstart;   // bit i is set iff row i is the first one of a block
+  lcpInt *lcp;        // lcp[i] = LCP of rows i-1 and i; MAX_LCP_SIZE inside blocks
+  lcpInt *rmq;        // sparse table: rmq[k*chunks+c] = min LCP of chunks c..c+2^k-1
+  customInt chunks;   // number of chunks in the sparse table
+} dblArrays;
+
+#define dbl_setstart(d,i) ((d)->bstart[(i)/64] |= (uint64_t) 1 << ((i)%64))
+
+// return the first block start >=i or n if there is none
+static inline customInt dbl_next_start(dblArrays *d, customInt i)
+{
+  if(i>=d->n) return d->n;
+  uint64_t w = d->bstart[i/64] >> (i%64);
+  if(w) return min(i + __builtin_ctzll(w), d->n);
+  customInt wn = (d->n+63)/64;
+  for(customInt j=i/64+1;j<wn;j++)
+    if(d->bstart[j]) return min(64*j + __builtin_ctzll(d->bstart[j]), d->n);
+  return d->n;
+}
+
+// color of suffix id
+static inline int dbl_color(dblArrays *d, customInt id, int numBwt)
+{
+  int lo=0, hi=numBwt-1;
+  while(lo<hi) { // find the last b such that off[b]<=id
+    int mid = (lo+hi+1)/2;
+    if(d->off[mid]<=id) lo=mid; else hi=mid-1;
+  }
+  return lo;
+}
+
+// init the rows to the blocks of level 1 (see init_arrays in mergegap.c) and psi to psi^1
+static void dbl_init(dblArrays *d, g_data *g)
+{
+  int sigma = g->sizeOfAlpha;
+  customInt *occ = calloc(g->numBwt*sigma,sizeof(customInt)); // occ[b*sigma+c] = #c in BWT b
+  customInt *cnt = malloc(sigma*sizeof(customInt));
+  if(!occ || !cnt) die(__func__);
+  for(int b=0;b<g->numBwt;b++) {
+    d->off[b+1] = d->off[b] + g->bwtLen[b];
+    for(customInt r=0;r<g->bwtLen[b];r++)
+      occ[b*sigma+g->bws[b][r]]++;
+  }
+  assert(d->off[g->numBwt]==d->n);
+  // psi^1: the suffix in local row LF(r) is followed by the one in row r
+  for(int b=0;b<g->numBwt;b++) {
+    customInt c0 = 0;
+    for(int c=0;c<sigma;c++) {cnt[c]=c0; c0 += occ[b*sigma+c];}
+    for(customInt r=0;r<occ[b*sigma];r++)
+      d->psi[d->off[b]+r] = Dbl_none;  // suffixes starting with 0
+    for(customInt r=0;r<g->bwtLen[b];r++) {
+      symbol c = g->bws[b][r];
+      if(c!=0) d->psi[d->off[b]+cnt[c]++] = d->off[b]+r;
+    }
+  }
+  // rows sorted by first char, color, local rank: each 0 is a block
+  memset(d->bstart,0,((d->n+63)/64)*sizeof(uint64_t));
+  customInt i=0;
+  for(int c=0;c<sigma;c++) {
+    customInt start = i;  // first row of the block of c
+    for(int b=0;b<g->numBwt;b++) {
+      customInt first = 0; // first local row of char c in BWT b
+      for(int x=0;x<c;x++) first += occ[b*sigma+x];
+      for(customInt t=0;t<occ[b*sigma+c];t++) {
+        d->sa[i] = d->off[b] + first + t;
+        d->rank[d->sa[i]] = c==0 ? i : start;
+        if(i==start || c==0) dbl_setstart(d,i);
+        if(d->lcp) d->lcp[i] = (i==start || c==0) ? 0 : MAX_LCP_SIZE;
+        i++;
+      }
+    }
+  }
+  assert(i==d->n);
+  free(cnt);
+  free(occ);
+}
+
+// build the sparse table over the chunk minima of the current lcp values
+static void dbl_rmq_build(dblArrays *d)
+{
+  customInt c = d->chunks;
+  for(customInt j=0;j<c;j++) {
+    lcpInt m = MAX_LCP_SIZE;
+    for(customInt i=j*Dbl_chunk; i<min((j+1)*Dbl_chunk,d->n); i++)
+      m = min(m,d->lcp[i]);
+    d->rmq[j] = m;
+  }
+  for(int k=1; ((customInt) 1<<k) <= c; k++) {
+    lcpInt *prev = d->rmq + (k-1)*c, *cur = d->rmq + k*c;
+    for(customInt j=0; j + ((customInt) 1<<k) <= c; j++)
+      cur[j] = min(prev[j],prev[j+((customInt)1<<(k-1))]);
+  }
+}
+
+// minimum of lcp[l..r]
+static lcpInt dbl_rmq(dblArrays *d, customInt l, customInt r)
+{
+  assert(l<=r && r<d->n);
+  lcpInt m = MAX_LCP_SIZE;
+  customInt cl = l/Dbl_chunk, cr = r/Dbl_chunk;
+  if(cr-cl<2) {
+    for(customInt i=l;i<=r;i++) m = min(m,d->lcp[i]);
+    return m;
+  }
+  for(customInt i=l;i<(cl+1)*Dbl_chunk;i++) m = min(m,d->lcp[i]);
+  for(customInt i=cr*Dbl_chunk;i<=r;i++) m = min(m,d->lcp[i]);
+  // whole chunks cl+1..cr-1
+  int k = 63 - __builtin_clzll(cr-cl-1);
+  lcpInt *t = d->rmq + k*d->chunks;
+  m = min(m,t[cl+1]);
+  return min(m,t[cr-((customInt)1<<k)]);
+}
+
+// sort rows [b,e) according to the pair (key,id) stored in (tmp[i],sa[i])
+static void dbl_sort(customInt *key, customInt *id, customInt b, customInt e)
+{
+  #define dbl_less(i,j) (key[i]<key[j] || (key[i]==key[j] && id[i]<id[j]))
+  #define dbl_swap(i,j) {customInt t=key[i]; key[i]=key[j]; key[j]=t; t=id[i]; id[i]=id[j]; id[j]=t;}
+  while(e-b>=Dbl_sort_min) {
+    // median of three moved to b then Hoare partition
+    customInt m = b+(e-b)/2, l = e-1;
+    if(dbl_less(m,b)) dbl_swap(m,b);
+    if(dbl_less(l,m)) {dbl_swap(l,m); if(dbl_less(m,b)) dbl_swap(m,b);}
+    dbl_swap(b,m);
+    customInt pk = key[b], pid = id[b];
+    customInt i=b, j=e;
+    while(true) {
+      do i++; while(key[i]<pk || (key[i]==pk && id[i]<pid));
+      do j--; while(key[j]>pk || (key[j]==pk && id[j]>pid));
+      if(i>=j) break;
+      dbl_swap(i,j);
+    }
+    dbl_swap(b,j);
+    // recurse on the smaller part
+    if(j-b < e-j-1) {dbl_sort(key,id,b,j); b = j+1;}
+    else {dbl_sort(key,id,j+1,e); e = j;}
+  }
+  for(customInt i=b+1;i<e;i++)
+    for(customInt j=i; j>b && dbl_less(j,j-1); j--) dbl_swap(j,j-1);
+  #undef dbl_less
+  #undef dbl_swap
+}
+
+// single doubling iteration from h to 2h, return the number of rows still in
+// blocks of size >1 or 0 if nothing was done (bwtOnly and all blocks have a single color)
+static customInt dbl_iteration(dblArrays *d, customInt h, g_data *g)
+{
+  customInt n = d->n, unresolved = 0;
+  bool mixed = false;  // some block contains more than one color
+  // compute the keys of all rows in blocks of size >1 before changing rank[]
+  for(customInt i=0; i<n; ) {
+    customInt e = dbl_next_start(d,i+1);
+    if(e-i>1) {
+      // inside a block rows are sorted by id, hence by color
+      if(dbl_color(d,d->sa[i],g->numBwt)!=dbl_color(d,d->sa[e-1],g->numBwt)) mixed = true;
+      for(customInt r=i;r<e;r++) {
+        assert(d->psi[d->sa[r]]!=Dbl_none);
+        d->tmp[r] = d->rank[d->psi[d->sa[r]]];
+      }
+      unresolved += e-i;
+    }
+    i = e;
+  }
+  if(unresolved==0) return 0;
+  // the final Z is the current one: same as the early termination of gap
+  if(g->bwtOnly && !mixed) return 0;
+  if(g->lcpCompute) dbl_rmq_build(d);
+  unresolved = 0;
+  for(customInt i=0; i<n; ) {
+    customInt e = dbl_next_start(d,i+1);
+    if(e-i>1) {
+      dbl_sort(d->tmp,d->sa,i,e);
+      customInt start = i;
+      for(customInt r=i;r<e;r++) {
+        if(r>i && d->tmp[r]!=d->tmp[r-1]) { // new block boundary
+          if(r-start>1) unresolved += r-start;
+          start = r;
+          dbl_setstart(d,r);
+          if(g->lcpCompute) { // the suffixes h chars later are in different blocks: lcp<h
+            customInt lcp = h + dbl_rmq(d,d->tmp[r-1]+1,d->tmp[r]);
+            assert(lcp<2*h);
+            if(lcp>MAX_LCP_SIZE) {fprintf(stderr,"LCP too large (2) (use --lbytes=4)\n");exit(EXIT_FAILURE);}
+            d->lcp[r] = lcp;
+          }
+        }
+        d->rank[d->sa[r]] = start;
+      }
+      if(e-start>1) unresolved += e-start;
+    }
+    i = e;
+  }
+  // psi^2h = psi^h o psi^h
+  if(unresolved>0) {
+    for(customInt id=0;id<n;id++)
+      d->tmp[id] = d->psi[id]==Dbl_none ? Dbl_none : d->psi[d->psi[id]];
+    customInt *t = d->psi; d->psi = d->tmp; d->tmp = t;
+  }
+  return unresolved;
+}
+
+
+void gapdbl(g_data *g, bool lastRound) {
+  assert(!g->lcpMerge && !g->extMem);
+  if(g->verbose>0) puts("BWT merging with gapdbl (prefix doubling)");
+  if(g->lcpCompute) {       // we compute LCP values only if we are at the last round
+    assert(!g->bwtOnly && lastRound);
+    open_unsortedLCP_files(g);
+    if(g->verbose>0) puts("Computing LCP values");
+  }
+  else assert(g->bwtOnly);
+
+  // init local global vars
+  check_g_data(g);
+  g->bitB = NULL;  // there is no B array, blocks are in d.bstart
+  g->mergeColor = g->newMergeColor = NULL;
+  g->mergeColor16 = NULL;
+  g->array32 = NULL;
+  g->inCnt = malloc(g->numBwt*sizeof(customInt));
+  if(!g->inCnt) die(__func__);
+
+  dblArrays d;
+  d.n = g->mergeLen;
+  d.off = malloc((g->numBwt+1)*sizeof(customInt));
+  d.sa = malloc(d.n*sizeof(customInt));
+  d.rank = malloc(d.n*sizeof(customInt));
+  d.psi = malloc(d.n*sizeof(customInt));
+  d.tmp = malloc(d.n*sizeof(customInt));
+  d.bstart = malloc(((d.n+63)/64)*sizeof(uint64_t));
+  if(!d.off || !d.sa || !d.rank || !d.psi || !d.tmp || !d.bstart) die(__func__);
+  d.off[0] = 0;
+  d.lcp = NULL; d.rmq = NULL; d.chunks = 0;
+  if(g->lcpCompute) {
+    d.chunks = (d.n+Dbl_chunk-1)/Dbl_chunk;
+    int levels = 1;
+    while(((customInt) 1<<levels) <= d.chunks) levels++;
+    d.lcp = malloc(d.n*sizeof(lcpInt));
+    d.rmq = malloc(levels*d.chunks*sizeof(lcpInt));
+    if(!d.lcp || !d.rmq) die(__func__);
+  }
+  dbl_init(&d,g);
+
+  // main loop: blocks at level h become blocks at level 2h
+  customInt h = 1;
+  while(true) {
+    customInt unresolved = dbl_iteration(&d,h,g);
+    if(unresolved==0) break;
+    h *= 2;
+    if(g->verbose>1 && lastRound) {
+      #if MALLOC_COUNT_FLAG
+        printf("Prefix: "CUSTOM_FORMAT". Memory peak/current: %.2lf/%.2lf bytes/symbol. Unresolved rows: "CUSTOM_FORMAT"\n",
+           h, (double)malloc_count_peak()/g->mergeLen, (double)malloc_count_current()/g->mergeLen, unresolved);
+      #else
+        printf("Prefix: "CUSTOM_FORMAT". Unresolved rows: "CUSTOM_FORMAT"\n", h, unresolved);
+      #endif
+    }
+  }
+
+  #if MALLOC_COUNT_FLAG
+    if (g->verbose>0) {
+      if(lastRound)
+        printf("Mergedbl completed (%d bwts). Mem: %zu peak, %zu current, %.2lf/%.2lf bytes/symbol\n", g->numBwt, malloc_count_peak(),
+             malloc_count_current(), (double)malloc_count_peak()/g->mergeLen,
+             (double)malloc_count_current()/g->mergeLen);
+      else if(g->verbose>1)
+        printf("Mergedbl completed (%d bwts). Mem: %zu peak, %zu current\n", g->numBwt, malloc_count_peak(),
+             malloc_count_current());
+    }
+  #else
+    if (g->verbose>0) {
+        printf("Mergedbl completed (%d bwts).\n", g->numBwt);
+    }
+  #endif
+
+  // the lcp values are already sorted by position: write them as a single block
+  if(g->lcpCompute) {
+    for(customInt i=0;i<d.n;i++)
+      writeLcp(i,d.lcp[i],g);
+    writeLcp_EOF(d.n+1, g);
+    free(d.rmq);
+    free(d.lcp);
+  }
+  free(d.bstart);
+  free(d.tmp);
+  free(d.psi);
+  free(d.rank);
+  // Z is the sequence of the colors of the rows
+  g->mergeColor = malloc(d.n*sizeof(palette));
+  if(!g->mergeColor) die(__func__);
+  for(customInt i=0;i<d.n;i++)
+    g->mergeColor[i] = dbl_color(&d,d.sa[i],g->numBwt);
+  free(d.sa);
+  free(d.off);
+
+  // The following call writes the merged BWT back to g->bws[0]
+  mergeBWTandLCP(g,lastRound);
+  if(g->lcpCompute) {
+    assert(lastRound);
+    close_unsortedLCP_files(g);
+    if(g->verbose>0) printf("Remind to run mergelcp to obtain the final LCP array\n");
+  }
+  free(g->mergeColor);
+  g->mergeColor = NULL;
+  free(g->inCnt);
+}
+
+#undef dbl_setstart
@@ -27,6 +27,8 @@
 //   gap128:    n (BWTs) 2n (Z+B)       = 3 n    [extMem 3n could be reduced to 2n]
 //   gap16:     n (BWTs) n (Z) n/4 (B)  = 2.25 n [extMem idem, could be reduced to 1.25 n]
 //   gap8:      n (BWTs) n (Z+B)        = 2 n    [extMem n]
+//   gap2:      n (BWTs) n/4 (Z) n/4 (B) = 1.5 n  [only 2 BWTs, output phase 2 n]
+//   gapdbl:    n (BWTs) 32n (rows, ranks, psi, keys) n/8 (blocks) = 33.1 n
 
 // for merging the BWT and the LCP (external memory not supported) 
 //   gap:       n (BWTs) 2n (Z) 2n (BlockB) = 5 n
@@ -36,6 +38,7 @@
 // for merging the BWT and computing the LCP with the compute from scratch procedure 
 //   gap:       3.25 n [extMem: n/4]
 //   gap8:      2 n    [extMem n]
+//   gap2:      1.5 n  [only 2 BWTs]
 //   gap128:    3 n    [extMem 3n could be reduced to 2n]
 //   gap256:    n (BWTs) 4n (Z+BlockB)  = 5 n    [extMem 5n, could be reduced to 4n]
 //              Note: gap256 is used only to avoid the lcp merge step (option -x)
@@ -45,10 +48,12 @@
 
 
 // meaning of the g->algorithm parameter:
-// N = 8,16,256 --> use gapN algorithm if possible
+// N = 2,8,16,256 --> use gapN algorithm if possible
 // N=128 --> use gap128ext if g->extMem of gap128 otherwise (again if possible)
+// N=3   --> use gapdbl (prefix doubling) if possible 
 // N=0   --> use the old best fit strategy minimizing the amount of RAM 
 // any other value --> use gap (to force the use of gap use -A 256 without -x) 
+// if g->gapThreads>1 the last round in internal memory uses gap with multithread iterations
 
 
 // input from variables stored in g 
@@ -65,18 +70,106 @@
 // used to access BWTs in external memory 
 static void open_merge_files(g_data *g);
 static void close_merge_files(g_data *g);
-static void fwrite_color(int b, FILE *f);
-static  int fread_color(FILE *f);
+static void fwrite_color(int b, int zb, FILE *f);
+static size_t tmp_footprint(g_data *g, FILE *fin, FILE *fout, int bfd);
 
 
 
+// the functions executing a single iteration are always inlined inside small wrappers
+// (the kernels) receiving the mode flags and the round parity as constants: the compiler
+// generates a specialized main loop for each combination with the mode tests removed.
+// Each merge procedure chooses its kernel once before the first iteration
+#define GAP_KERNEL static inline __attribute__((always_inline))
+
+
+// write-combining buffers for newZ in internal memory (option -W)
+// In an iteration the colors following symbol c are written at consecutive positions
+// F[c], F[c]+1, ... of newZ: for large alphabets these are sizeOfAlpha scattered write
+// streams. With -W each symbol collects its colors in a cbuffer covering an aligned segment
+// of COLOR_WC_SIZE entries of newZ, which is copied to newZ when the segment is complete,
+// when F[c] jumps over a solid block, and at the end of the scan.
+// Each merge procedure provides the function copying a buffer to its representation of newZ
+typedef void (*cbufferFlush)(cbuffer *, g_data *, const int round);
+
+// init the buffers at the positions F[] where the scan starts
+static inline void cbuffer_start(cbuffer *b, g_data *g)
+{
+  for(int c=0;c<g->sizeOfAlpha;c++)
+    b[c].begin = b[c].end = g->F[c];
+}
+
+// write color x for position p in b (the buffer of the symbol preceding p)
+static inline __attribute__((always_inline)) void cbuffer_put(cbuffer *b, customInt p, int x, g_data *g, const int round, cbufferFlush flush)
+{
+  if(p!=b->end) {  // a solid block has been skipped
+    if(b->end>b->begin) flush(b,g,round);
+    b->begin = p;
+  }
+  b->buffer[p%COLOR_WC_SIZE] = x;
+  b->end = p+1;
+  if(b->end%COLOR_WC_SIZE==0) { // segment completed
+    flush(b,g,round);
+    b->begin = b->end;
+  }
+}
+
+// copy to newZ the content of all buffers at the end of the scan
+static inline void cbuffer_flush_all(cbuffer *b, g_data *g, const int round, cbufferFlush flush)
+{
+  for(int c=0;c<g->sizeOfAlpha;c++)
+    if(b[c].end>b[c].begin) flush(&b[c],g,round);
+  #ifdef __SSE2__
+  _mm_sfence(); // make non-temporal stores visible before newZ is swapped with Z
+  #endif
+}
+
+// flush for gap: newZ is the array g->newMergeColor, complete segments are written
+// with non-temporal stores since they will not be read before the next iteration
+static void cbuffer_flush_gap(cbuffer *b, g_data *g, const int round)
+{
+  (void) round;
+  assert(g->zBytes==sizeof(palette)); // -W is not used for more than MAX_NARROW_BWTS BWTs
+  palette *dest = g->newMergeColor + b->begin;
+  palette *src = b->buffer + b->begin%COLOR_WC_SIZE;
+  #ifdef __SSE2__
+  if(b->end-b->begin==COLOR_WC_SIZE && ((uintptr_t) dest)%16==0) {
+    for(size_t i=0; i<sizeof(b->buffer); i+=16)
+      _mm_stream_si128((__m128i *) ((char *) dest+i), _mm_loadu_si128((__m128i *) ((char *) src+i)));
+    return;
+  }
+  #endif
+  memcpy(dest,src,(b->end-b->begin)*sizeof(palette));
+}
 
 #include "blocks.h"
+#include "merge2.h"        // numBwt<=2 lcpCompute !lcpMerge !ext
 #include "merge8.h"        // ext:BWTs lcpCompute !lcpMerge
 #include "merge16.h"       // !lcpCompute lcpMerge !ext
 #include "merge128.h"      // lcpCompute !lcpMerge !ext
 #include "merge128ext.h"   // lcpCompute !lcpMerge ext:BWTs:Z:B
 #include "merge256.h"      // lcpCompute (without mergesort) !lcpMerge !ext: do not use for bwtOnly
+#include "mergedbl.h"      // lcpCompute !lcpMerge !ext: prefix doubling, for very long LCPs
+
+
+// k-tuples (option -k, see alphabet.c)
+// Each BWT symbol is a tuple of K=g->ktuple symbols and the prefixes grow by K symbols
+// per iteration; tuples containing a 0 are never propagated (g->ktuple0) and their
+// regions of Z are fixed by init_arrays_ktuple. When computing the LCP the length of a
+// block boundary is no longer a function of the iteration where it was created, but
+// it is prefixLength-K+d with 0<=d<K: the offset d is stored in 4 bits in g->ktupleLcp.
+// When a recent block starts with offset d at position k, lastStart[d]=k; if the
+// symbol c emitted at k creates a new block boundary, the corresponding suffixes 
+// differ for the first time inside the recent blocks starting between the previous 
+// emission of c (lastEmit[c]) and k: the new offset is the minimum d of these blocks
+static inline int tlcp_get(uint8_t *a, customInt i)
+{
+  return (a[i/2] >> (4*(i%2))) & 0xF;
+}
+static inline void tlcp_set(uint8_t *a, customInt i, int d)
+{
+  assert(d>=0 && d<=Ktuple_max);
+  a[i/2] = (a[i/2] & (0xF0 >> (4*(i%2)))) | (d << (4*(i%2)));
+}
 
 
 /**
@@ -121,12 +214,12 @@ static void init_arrays(g_data *g)
           if(!g->lcpMerge) tba_or_m(g->bitB,i,1);
           else g->blockBeginsAt[i]=1;
            //for 0-chars write b also to newmerge aka newZ 
-          if(g->extMem)  fwrite_color(b,fnewmerge);
-          else           g->newMergeColor[i]=b;          
+          if(g->extMem)  fwrite_color(b,g->zBytes,fnewmerge);
+          else           z_set(g->newMergeColor,i,b,g->zBytes);          
         }
         // all colors are written to merge aka Z
-        if(g->extMem) fwrite_color(b,fmerge);
-        else g->mergeColor[i] = b;
+        if(g->extMem) fwrite_color(b,g->zBytes,fmerge);
+        else z_set(g->mergeColor,i,b,g->zBytes);
         i++;
       } // end for t
     } // end for b 
@@ -134,14 +227,15 @@ static void init_arrays(g_data *g)
   assert(i==g->mergeLen); 
   // extra check on mergeColor, can be commented out
   if(g->extMem) {
-    assert(ftell(fmerge)==g->mergeLen*sizeof(palette));
+    assert(ftell(fmerge)==g->mergeLen*g->zBytes);
     if(fclose(fmerge)!=0) die("init_arrays:fmerge close"); 
     if(fclose(fnewmerge)!=0) die("mergegap:init_arrays:fnewmerge close"); 
   }
   else {
     #ifndef NDEBUG
-    customInt cnt[MAX_NUMBER_OF_BWTS] = {0};
-    for(i=0;i<g->mergeLen;i++) cnt[g->mergeColor[i]]++;
+    customInt cnt[g->numBwt];
+    array_clear(cnt,g->numBwt,0);
+    for(i=0;i<g->mergeLen;i++) cnt[z_get(g->mergeColor,i,g->zBytes)]++;
     for(int i=0; i<g->numBwt; i++)
       assert(cnt[i]==g->bwtLen[i]);
     #endif
@@ -149,6 +243,53 @@ static void init_arrays(g_data *g)
 }
 
 
+// init Z, newZ, B, and first Column array for k-tuples (see alphabet.c): g->bwtOcc[i][j]
+// is the number of suffixes of bws[i] with k-prefix j. The regions whose k-prefix 
+// contains a 0 (g->ktuple0) have each position in a block by itself and, as
+// the region of 0, are initialized also in newZ and never modified. 
+// If lcpCompute the lcp offset of each block start (see tlcp_get) is the lcp of the tuples  
+static void init_arrays_ktuple(g_data *g)
+{
+  customInt i=0; // position inside Z newZ and B  
+  int prev = 0;  // last tuple with a nonempty region
+  FILE *fnewmerge=NULL, *fmerge=NULL;
+  assert(!g->lcpMerge);
+  if(g->extMem) {
+    fnewmerge = fopen(g->newmerge_fname,"wb");
+    if(!fnewmerge) die("mergegap:init_arrays_ktuple:fnewmerge open");
+    fmerge = fopen(g->merge_fname,"wb");
+    if(!fmerge) die("mergegap:init_arrays_ktuple:fmerge open");
+  }
+  for(int j=0;j<g->sizeOfAlpha;j++) {
+    g->firstColumn[j] = i;  // tuple j starts at position i
+    tba_or_m(g->bitB,i,1);
+    if(g->lcpCompute && i<g->mergeLen)
+      tlcp_set(g->ktupleLcp,i,i==0 ? 0 : ktuple_lcp(prev,j));
+    customInt start = i;
+    for(int b=0;b<g->numBwt;b++) {
+      for(customInt t=0;t<g->bwtOcc[b][j];t++) { 
+        if(g->ktuple0[j]) { // suffixes are all different, Z, Znew never change 
+          tba_or_m(g->bitB,i,1);
+          if(g->lcpCompute && i>start) tlcp_set(g->ktupleLcp,i,ktuple_lcp(j,j));
+          if(!g->extMem) z_set(g->newMergeColor,i,b,g->zBytes);          
+        }
+        // all colors are written to merge aka Z, and since these regions are 
+        // scattered in external memory also to newmerge aka newZ
+        if(g->extMem) {fwrite_color(b,g->zBytes,fmerge); fwrite_color(b,g->zBytes,fnewmerge);}
+        else z_set(g->mergeColor,i,b,g->zBytes);
+        i++;
+      } 
+    }
+    if(i>start) prev = j;
+  }
+  assert(i==g->mergeLen); 
+  if(g->extMem) {
+    assert(ftell(fmerge)==g->mergeLen*g->zBytes && ftell(fnewmerge)==ftell(fmerge));
+    if(fclose(fmerge)!=0) die("init_arrays_ktuple:fmerge close"); 
+    if(fclose(fnewmerge)!=0) die("mergegap:init_arrays_ktuple:fnewmerge close"); 
+  }
+}
+
 // init Z, newZ and B array computing g->bwtOcc[i][j] and then discarding it
 static void init_arrays_largealpha(g_data *g)
 {
@@ -169,52 +310,79 @@ static void init_arrays_largealpha(g_data *g)
 }
 
 
-// single iteration of the Gap algorithm
+// scan of the range [begin,end) of Z within a single iteration of the Gap algorithm
 // input is head of the irrelevant lists (fin and fout) and an empty liquid block
-// return true if all sequences have become irrelevant.  
-// when working in external memory assumes that g->merge_fname and g->newmerge_fname 
-// hold the name of the files containing the merge and newmerge array
-// during the iteration colors are read from merge sequentially and written to newmerge 
-// in positions corresponding to the nonzero characters. At the end of the iteration, 
-// the file names for merge and newmerge are swapped so that the one with name merge points to
-// the current merge array 
-static bool addCharToPrefix(solidBlockFile *solidHead, liquidBlock *liquid, customInt prefixLength, bool *mergeChanged, const int round, g_data *g) {
+// g->inCnt and g->F must contain the values they have at position begin of the scan
+// the range must start and end at a block boundary; lcp values are written to g->unsortedLcp
+// and their number added to *lcpWritten; if mt is true several threads are
+// working on the B array simultaneously (and they must access it with atomic operations)
+// if wc is true the writes to newZ go through write-combining buffers (see cbuffer_put)
+// if sq is true the BWT symbols are k-tuples (see tlcp_get)
+// if wz is true the entries of Z and newZ are palette2 (see g->zBytes)
+// return true if all sequences in the range have become irrelevant.
+GAP_KERNEL bool addCharToRange(solidBlockFile *solidHead, liquidBlock *liquid, customInt begin, customInt end,
+                           customInt prefixLength, bool *mergeChanged, const int round, uint64_t *lcpWritten, const bool mt, g_data *g, const bool extMem, const bool lcpMerge, const bool lcpCompute, const bool wc, const bool sq, const bool wz) {
   assert(liquid->empty);
-  liquid->beginsAt = liquid->endsAt = 0;  
+  liquid->beginsAt = liquid->endsAt = begin;
   for(int i=0;i<liquid->occ_size;i++) assert(liquid->occ[i]==0);
-  // copy first column to F 
-  array_copy(g->F, g->firstColumn, g->sizeOfAlpha); //initialize char positions
-  // pointer inside each BWT (k_0 & k_1 in the pseudocode)
-  array_clear(g->inCnt,g->numBwt,0);
-  if(g->extMem) {
-    rewind_bw_files(g);  // set file pointers at the beginning of each BWT 
-    open_merge_files(g); // open merge file for reading and newmerge files for writing
-  }
   // id for each character, init with an invalid id
   customInt blockID[g->sizeOfAlpha];
   array_clear(blockID,g->sizeOfAlpha, g->mergeLen);  // mergeLen is an invalid id
+  // write-combining buffer for each character
+  cbuffer cbuf[wc ? g->sizeOfAlpha : 1];
+  if(wc) cbuffer_start(cbuf,g);
   customInt id = 0, k; 
   int m = (round%2==1) ? 1 : 2;  // mask for the bitB array
-  uint64_t lcpWritten =0;
+  customInt nextStart = begin;  // next position where B is tested (see tba_next_block)
+  customInt blockStart = begin; // last position where a block starts
+  const customInt K = sq ? g->ktuple : 1; // symbols per tuple
+  const int zb = wz ? sizeof(palette2) : sizeof(palette); // bytes per entry of Z
+  assert(zb==g->zBytes && !(wz && wc));
+  // for k-tuples: last recent block start with each lcp offset, last emission of each tuple
+  customInt lastStart[sq && lcpCompute ? K : 1];
+  customInt lastEmit[sq && lcpCompute ? g->sizeOfAlpha : 1];
+  if(sq && lcpCompute) {
+    array_clear(lastStart,K,0);
+    array_clear(lastEmit,g->sizeOfAlpha,0);
+  }
 
   protoBlock cblock = {.mono = false};
-  solidBlock *next = readBlock(solidHead); // first block
+  solidBlock *next = readFirstBlock(solidHead); // first block
   solidBlock *last = NULL;                 // previous block
 
-  for (k = 0; k < g->mergeLen; ) { 
+  for (k = begin; k < end; ) { 
     assert(next==NULL || k <= next->beginsAt);  // we did not pass next block
     assert(last==NULL || last->nextBlock == next); // last is the immediately preceeding block
 
     // check if we are entering a block, and if the block is at least 2 iterations old
     bool start_block, last_block_recent=true; // for k=0 a new block starts, so last is properly initialized
-    if(g->lcpMerge) {
+    if(lcpMerge) {
       start_block = (g->blockBeginsAt[k]>0) && (g->blockBeginsAt[k] < prefixLength);
       if(start_block) last_block_recent = g->blockBeginsAt[k]>=prefixLength-1;
     }
-    else 
-      start_block = tba_block_test_set(g->bitB,k,m,&last_block_recent);    
-    if(start_block && last_block_recent && g->lcpCompute)
-      {writeLcp(k,prefixLength-2,g); lcpWritten++;} // save lcp value found in previous iteration
+    else if(k<nextStart)
+      start_block = false;   // inside a block: B need not be tested
+    else if(mt) {
+      start_block = tba_block_test_set_mt(g->bitB,k,m,&last_block_recent);
+      if(start_block) blockStart = k;
+      // B is tested at each position of short blocks, for long blocks we look for the next start
+      nextStart = (start_block || k-blockStart<Block_search_min) ? k+1 : tba_next_block_mt(g->bitB,k+1,end,m);
+    }
+    else {
+      start_block = tba_block_test_set(g->bitB,k,m,&last_block_recent);
+      if(start_block) blockStart = k;
+      // B is tested at each position of short blocks, for long blocks we look for the next start
+      nextStart = (start_block || k-blockStart<Block_search_min) ? k+1 : tba_next_block(g->bitB,k+1,end,m);
+    }
+    if(start_block && last_block_recent && lcpCompute) { // save lcp value found in previous iteration
+      if(sq) {
+        int d = tlcp_get(g->ktupleLcp,k);
+        writeLcp(k,prefixLength-2*K+d,g);
+        lastStart[d] = k;
+      }
+      else writeLcp(k,prefixLength-2,g); 
+      (*lcpWritten)++;
+    } 
     if (start_block) {
       // if the block we just left is a singleton we add it to liquid that remains active
       if(!last_block_recent && cblock.mono==true && (cblock.beginsAt==k-1)) {
@@ -222,7 +390,7 @@ static bool addCharToPrefix(solidBlockFile *solidHead, liquidBlock *liquid, cust
         add_singleton2liquid(&cblock, liquid);
       }
       // if the block we left is not recent, monochrome, we are not computing LCPs and not using extMem add it  
-      else if(!last_block_recent && cblock.mono==true && !g->lcpCompute && !g->extMem) {
+      else if(!last_block_recent && cblock.mono==true && !lcpCompute && !extMem) {
         cblock.endsAt = k;           // solidifiable monochorome block just ended
         add_proto2liquid(&cblock,liquid);  // add proto to liquid that remains active 
       }
@@ -236,6 +404,9 @@ static bool addCharToPrefix(solidBlockFile *solidHead, liquidBlock *liquid, cust
       // block ending at k considered, now look forward 
       if(next!=NULL && next->beginsAt==k) { // entering an irrelevant block
         skip(next, g);                      // skip block
+        if(sq && lcpCompute)                // the tuples in the block have been emitted
+          for(int c=0;c<g->sizeOfAlpha;c++)
+            if(block_occ(next,g->numBwt+c)>0) lastEmit[c] = next->endsAt-1;
         k = next->endsAt;                   // update k
         // merge liquid with next block and possibly previous 
         if(last==NULL || last->endsAt!=liquid->beginsAt) {
@@ -256,8 +427,8 @@ static bool addCharToPrefix(solidBlockFile *solidHead, liquidBlock *liquid, cust
       // we are entering a relevant block, unless it is a recent one make it a candidate for solidification  
       if( !last_block_recent ) {
         cblock.beginsAt = k; cblock.mono=true; 
-        if(!g->extMem) { // monochrome blocks of length>1 are not used in external memory  
-          cblock.color = g->mergeColor[k];
+        if(!extMem) { // monochrome blocks of length>1 are not used in external memory  
+          cblock.color = z_get(g->mergeColor,k,zb);
           cblock.start = &g->bws[cblock.color][g->inCnt[cblock.color]]; // bwt-position of first char in block
         }
       }
@@ -268,57 +439,67 @@ static bool addCharToPrefix(solidBlockFile *solidHead, liquidBlock *liquid, cust
     // processing a char in a relevant block
     int currentColor=0;   // b in pseudocode
     int currentChar=0;  // c in pseudocode: next char in current BWT 
-    if(g->extMem) {
-      assert(ftell(g->fmergeColor)==k*sizeof(palette));
-      currentColor = fread_color(g->fmergeColor);
-      assert(ftell(g->bwf[currentColor])==(g->inCnt[currentColor]+(g->bws[currentColor]-g->bws[0])+g->symb_offset)*sizeof(symbol)); 
-      int e = fread(&currentChar,sizeof(symbol),1,g->bwf[currentColor]);
-      if(e!=1) die("mergegap:addCharToPrefix:bwt[color]Read"); 
+    if(extMem) {
+      assert(zreader_tell(g->fmergeColor)==k*zb);
+      currentColor = zreader_get_color(g->fmergeColor);
+      assert(breader_tell(&g->bwf[currentColor])==(g->inCnt[currentColor]+(g->bws[currentColor]-g->bws[0])+g->symb_offset)*sizeof(symbol)); 
+      currentChar = breader_getc(&g->bwf[currentColor]);
       g->inCnt[currentColor]++;
     }
     else {
-      currentColor = g->mergeColor[k];
+      currentColor = z_get(g->mergeColor,k,zb);
       currentChar  = g->bws[currentColor][g->inCnt[currentColor]++]; // c in pseudocode
     }
     // add currentChar/Color to proto block  
     cblock.lastChar =  currentChar;   // save lastchar, only useful for singleton blocks
     cblock.lastColor =  currentColor; // save lastcolor, only useful for singleton blocks
-    if(!g->extMem)
+    if(!extMem)
       if(currentColor != cblock.color) cblock.mono = false;       // block is not monochrome
-    // write color in new Z array, except 0 chars
-    if(currentChar!=0) {
+    // write color in new Z array, except 0 chars (or tuples containing 0)
+    if(sq ? !g->ktuple0[currentChar] : currentChar!=0) {
       customInt positionToUpdate = g->F[currentChar]++;
-      if(g->extMem) {
+      if(extMem) {
         cwriter_put(&g->fnewMergeColor[currentChar],currentColor);
-        assert(cwriter_tell(&g->fnewMergeColor[currentChar])==g->F[currentChar]*sizeof(palette));
+        assert(cwriter_tell(&g->fnewMergeColor[currentChar])==g->F[currentChar]*zb);
         *mergeChanged=true; // this could be a problem....
       }
       else {
-        g->newMergeColor[positionToUpdate] = currentColor;
-        if(g->bwtOnly && !*mergeChanged && g->mergeColor[positionToUpdate]!=currentColor)
+        if(wc) cbuffer_put(&cbuf[currentChar],positionToUpdate,currentColor,g,round,cbuffer_flush_gap);
+        else z_set(g->newMergeColor,positionToUpdate,currentColor,zb);
+        if(!lcpMerge && !lcpCompute && !*mergeChanged && z_get(g->mergeColor,positionToUpdate,zb)!=currentColor)
           *mergeChanged=true;  // remember there is a difference from the previous iteration
       }
       // create new block?
       if (blockID[currentChar] != id) {
-        if(!g->lcpMerge) { // no lcp just mark B array 
-          if(last_block_recent) tba_mark_if0(g->bitB,positionToUpdate,m);
+        if(!lcpMerge) { // no lcp just mark B array 
+          if(last_block_recent) {
+            if(mt) tba_mark_if0_mt(g->bitB,positionToUpdate,m);
+            else if(tba_mark_if0(g->bitB,positionToUpdate,m) && sq && lcpCompute) { // new boundary: find its offset
+              int d = 0;
+              while(d<K && lastStart[d]<=lastEmit[currentChar]) d++;
+              assert(d<K);
+              tlcp_set(g->ktupleLcp,positionToUpdate,d);
+            }
+          }
         }
         else  // update lcp
           if(last_block_recent && g->blockBeginsAt[positionToUpdate]==0) // only 0 values in B are overwritten
             g->blockBeginsAt[positionToUpdate] = prefixLength;
         blockID[currentChar] = id; // update block id, always!
       }
+      if(sq && lcpCompute) lastEmit[currentChar] = k;
     }
     k++;
   } // end main loop
-  assert(k==g->mergeLen);
+  assert(k==end);
+  if(wc) cbuffer_flush_all(cbuf,g,round,cbuffer_flush_gap);
   assert(next==NULL); 
   if(cblock.mono==true && cblock.beginsAt==k-1) {
     cblock.endsAt = k;           // solidifiable singleton block just ended
     add_singleton2liquid(&cblock, liquid);
     assert(!liquid->empty);
   }
-  else if(cblock.mono==true && !g->lcpCompute && !g->extMem) {
+  else if(cblock.mono==true && !lcpCompute && !extMem) {
     cblock.endsAt = k;
     add_proto2liquid(&cblock,liquid);  // add proto to liquid that remains active
     assert(!liquid->empty);
@@ -326,24 +507,115 @@ static bool addCharToPrefix(solidBlockFile *solidHead, liquidBlock *liquid, cust
   if(!liquid->empty) 
     last = finalize_liquid(last,liquid,NULL,solidHead); // a new block could be created 
   assert(liquid->empty);
-  // add EOF value to lcp file and entry to .size file 
-  if(g->lcpCompute && lcpWritten>0)
-    writeLcp_EOF(++lcpWritten, g);
   // check if all sequence has become irrelevant
   bool everything_irrelevant = false;
-  if(last!=NULL && last->beginsAt==0 && last->endsAt==g->mergeLen)
+  if(last!=NULL && last->beginsAt==begin && last->endsAt==end)
     everything_irrelevant = true;
   // save last block   
   if(last!=NULL) writeBlock(last,solidHead);
+  return everything_irrelevant;
+}
+
+// kernels for gap: one for each combination of memory/thread mode, lcp mode, write-combining,
+// k-tuples and width of Z
+typedef bool (*gapKernel)(solidBlockFile *, liquidBlock *, customInt, customInt, customInt, bool *, const int, uint64_t *, g_data *);
+#define GAP_RANGE_KERNEL(name,mt,ext,lcpm,lcpc,wc,sq,wz) \
+  static bool name(solidBlockFile *s, liquidBlock *l, customInt b, customInt e, customInt p, bool *c, const int round, uint64_t *w, g_data *g) { \
+    if(round) return addCharToRange(s,l,b,e,p,c,1,w,mt,g,ext,lcpm,lcpc,wc,sq,wz); \
+    return addCharToRange(s,l,b,e,p,c,0,w,mt,g,ext,lcpm,lcpc,wc,sq,wz); }
+GAP_RANGE_KERNEL(kernel_bwt,false,false,false,false,false,false,false)
+GAP_RANGE_KERNEL(kernel_lcpmerge,false,false,true,false,false,false,false)
+GAP_RANGE_KERNEL(kernel_lcpcompute,false,false,false,true,false,false,false)
+GAP_RANGE_KERNEL(kernel_ext_bwt,false,true,false,false,false,false,false)
+GAP_RANGE_KERNEL(kernel_ext_lcpmerge,false,true,true,false,false,false,false)
+GAP_RANGE_KERNEL(kernel_ext_lcpcompute,false,true,false,true,false,false,false)
+GAP_RANGE_KERNEL(kernel_mt_bwt,true,false,false,false,false,false,false)
+GAP_RANGE_KERNEL(kernel_mt_lcpmerge,true,false,true,false,false,false,false)
+GAP_RANGE_KERNEL(kernel_mt_lcpcompute,true,false,false,true,false,false,false)
+GAP_RANGE_KERNEL(kernel_wc_bwt,false,false,false,false,true,false,false)
+GAP_RANGE_KERNEL(kernel_wc_lcpmerge,false,false,true,false,true,false,false)
+GAP_RANGE_KERNEL(kernel_wc_lcpcompute,false,false,false,true,true,false,false)
+GAP_RANGE_KERNEL(kernel_mt_wc_bwt,true,false,false,false,true,false,false)
+GAP_RANGE_KERNEL(kernel_mt_wc_lcpmerge,true,false,true,false,true,false,false)
+GAP_RANGE_KERNEL(kernel_mt_wc_lcpcompute,true,false,false,true,true,false,false)
+GAP_RANGE_KERNEL(kernel_sq_bwt,false,false,false,false,false,true,false)
+GAP_RANGE_KERNEL(kernel_sq_lcpcompute,false,false,false,true,false,true,false)
+GAP_RANGE_KERNEL(kernel_ext_sq_bwt,false,true,false,false,false,true,false)
+GAP_RANGE_KERNEL(kernel_ext_sq_lcpcompute,false,true,false,true,false,true,false)
+GAP_RANGE_KERNEL(kernel_wz_bwt,false,false,false,false,false,false,true)
+GAP_RANGE_KERNEL(kernel_wz_lcpmerge,false,false,true,false,false,false,true)
+GAP_RANGE_KERNEL(kernel_wz_lcpcompute,false,false,false,true,false,false,true)
+GAP_RANGE_KERNEL(kernel_ext_wz_bwt,false,true,false,false,false,false,true)
+GAP_RANGE_KERNEL(kernel_ext_wz_lcpmerge,false,true,true,false,false,false,true)
+GAP_RANGE_KERNEL(kernel_ext_wz_lcpcompute,false,true,false,true,false,false,true)
+GAP_RANGE_KERNEL(kernel_mt_wz_bwt,true,false,false,false,false,false,true)
+GAP_RANGE_KERNEL(kernel_mt_wz_lcpmerge,true,false,true,false,false,false,true)
+GAP_RANGE_KERNEL(kernel_mt_wz_lcpcompute,true,false,false,true,false,false,true)
+
+// choose the kernel for the current merge: mt is true for multithread iterations
+static gapKernel range_kernel(g_data *g, bool mt)
+{
+  static const gapKernel kernels[3][3] = {
+    {kernel_bwt, kernel_lcpmerge, kernel_lcpcompute},
+    {kernel_ext_bwt, kernel_ext_lcpmerge, kernel_ext_lcpcompute},
+    {kernel_mt_bwt, kernel_mt_lcpmerge, kernel_mt_lcpcompute}};
+  static const gapKernel wc_kernels[2][3] = {
+    {kernel_wc_bwt, kernel_wc_lcpmerge, kernel_wc_lcpcompute},
+    {kernel_mt_wc_bwt, kernel_mt_wc_lcpmerge, kernel_mt_wc_lcpcompute}};
+  static const gapKernel wz_kernels[3][3] = {
+    {kernel_wz_bwt, kernel_wz_lcpmerge, kernel_wz_lcpcompute},
+    {kernel_ext_wz_bwt, kernel_ext_wz_lcpmerge, kernel_ext_wz_lcpcompute},
+    {kernel_mt_wz_bwt, kernel_mt_wz_lcpmerge, kernel_mt_wz_lcpcompute}};
+  assert(g->bwtOnly == (!g->lcpMerge && !g->lcpCompute));
+  assert(!(mt && g->extMem));
+  int lcpMode = g->lcpMerge ? 1 : (g->lcpCompute ? 2 : 0);
+  if(g->zBytes==sizeof(palette2)) { // wide Z is not used with k-tuples, -W is ignored
+    assert(g->ktuple==1);
+    return wz_kernels[mt ? 2 : (g->extMem ? 1 : 0)][lcpMode];
+  }
+  if(g->ktuple>1) { // k-tuples are supported only by single thread iterations without -W
+    assert(!mt && !g->lcpMerge && !g->wcColors);
+    if(g->extMem) return g->lcpCompute ? kernel_ext_sq_lcpcompute : kernel_ext_sq_bwt;
+    return g->lcpCompute ? kernel_sq_lcpcompute : kernel_sq_bwt;
+  }
+  if(g->wcColors && !g->extMem) // write-combining is only for newZ in internal memory
+    return wc_kernels[mt ? 1 : 0][lcpMode];
+  return kernels[mt ? 2 : (g->extMem ? 1 : 0)][lcpMode];
+}
+
+
+// single iteration of the Gap algorithm
+// input is head of the irrelevant lists (fin and fout) and an empty liquid block
+// return true if all sequences have become irrelevant.  
+// when working in external memory assumes that g->merge_fname and g->newmerge_fname 
+// hold the name of the files containing the merge and newmerge array
+// during the iteration colors are read from merge sequentially and written to newmerge 
+// in positions corresponding to the nonzero characters. At the end of the iteration, 
+// the file names for merge and newmerge are swapped so that the one with name merge points to
+// the current merge array 
+static bool addCharToPrefix(gapKernel kernel, solidBlockFile *solidHead, liquidBlock *liquid, customInt prefixLength, bool *mergeChanged, const int round, g_data *g) {
+  // copy first column to F 
+  array_copy(g->F, g->firstColumn, g->sizeOfAlpha); //initialize char positions
+  // pointer inside each BWT (k_0 & k_1 in the pseudocode)
+  array_clear(g->inCnt,g->numBwt,0);
+  if(g->extMem) {
+    rewind_bw_files(g);  // set file pointers at the beginning of each BWT 
+    open_merge_files(g); // open merge file for reading and newmerge files for writing
+  }
+  uint64_t lcpWritten =0;
+  bool everything_irrelevant = kernel(solidHead,liquid,0,g->mergeLen,prefixLength,mergeChanged,round,&lcpWritten,g);
+  // add EOF value to lcp file and entry to .size file 
+  if(g->lcpCompute && lcpWritten>0)
+    writeLcp_EOF(++lcpWritten, g);
   // check we have read all chars from all BWT's 
   for(int i=0; i<g->numBwt; i++)
     assert(g->inCnt[i]==g->bwtLen[i]);
     
   // swap merge and newMerge
   if(g->extMem) { // close merge files and swap file names 
-    assert(ftell(g->fmergeColor)==g->mergeLen*sizeof(palette));
+    assert(zreader_tell(g->fmergeColor)==g->mergeLen*g->zBytes);
     assert(g->F[g->sizeOfAlpha-1]==g->mergeLen);
-    assert(cwriter_tell(&g->fnewMergeColor[g->sizeOfAlpha-1])==g->mergeLen*sizeof(palette));
+    assert(cwriter_tell(&g->fnewMergeColor[g->sizeOfAlpha-1])==g->mergeLen*g->zBytes);
     close_merge_files(g);
     char *tmp=g->merge_fname; g->merge_fname = g->newmerge_fname; g->newmerge_fname = tmp;
   } else { // swap arrays 
@@ -353,6 +625,217 @@ static bool addCharToPrefix(solidBlockFile *solidHead, liquidBlock *liquid, cust
 }
 
 
+// ----- multithread iterations
+// Z is partitioned in segments starting at block boundaries. Since a block boundary
+// is never removed, the set of suffixes preceding a segment never changes and
+// neither do the values of inCnt[] and F[] at the beginning of the segment:
+// they are computed once and then all segments can be scanned independently.
+// Each segment has its own list of solid blocks and its own liquid block; lcp values
+// found in a segment are saved to a private file and then copied in order to g->unsortedLcp
+// so that the output is exactly the same of the single thread iteration.
+// Segments are assigned to threads dynamically to balance the work.
+
+typedef struct {
+  customInt beginsAt;
+  customInt endsAt;
+  customInt *inCnt;        // value of g->inCnt at beginsAt
+  customInt *F;            // value of g->F at beginsAt
+  solidBlockFile *ibList;  // solid blocks inside the segment
+  liquidBlock *liquid;
+  FILE *lcpf;              // lcp values found in the current iteration
+  uint64_t lcpWritten;     // number of lcp values in lcpf
+  off_t solidBytes;        // size of the solid block file written in the current iteration
+  bool mergeChanged;
+  bool irrelevant;
+} gapSegment;
+
+typedef struct {
+  gapSegment *seg;
+  int num;                 // number of segments
+  int threads;             // number of threads scanning the segments
+  int next;                // next segment to be scanned
+  pthread_mutex_t mutex;   // mutex for access to next
+  gapKernel kernel;        // kernel used to scan each segment
+  customInt prefixLength;  // parameters of the current iteration
+  int round;
+  g_data *g;
+} gapSegments;
+
+
+// at the beginning of an iteration an entry of B is nonzero iff it is a block boundary
+static bool is_block_start(g_data *g, customInt k)
+{
+  if(g->lcpMerge) return g->blockBeginsAt[k]!=0;
+  return tba_get(g->bitB,k)!=0;
+}
+
+// partition Z in segments of similar size starting at block boundaries and
+// compute inCnt[] and F[] at the beginning of each segment with a complete scan of Z
+// return NULL if boundaries are still too sparse to obtain balanced segments
+static gapSegments *segments_new(g_data *g, int threads)
+{
+  assert(!g->extMem && threads>1);
+  int num = threads*Gap_segments_per_thread;
+  // each segment keeps up to three files open
+  long maxfiles = sysconf(_SC_OPEN_MAX);
+  if(maxfiles>0) num = min(num,(maxfiles-64)/3);
+  // segments smaller than a solid block are pointless
+  if(g->mergeLen/num < (customInt) g->solid_limit) num = g->mergeLen/g->solid_limit;
+  if(num<2) return NULL;
+  customInt len = g->mergeLen/num;
+  customInt begins[num+1];
+  begins[0]=0; begins[num]=g->mergeLen;
+  for(int s=1;s<num;s++) {
+    customInt k = max(s*len,begins[s-1]+1);
+    customInt limit = s*len + len/2;     // no segment can be longer than 2*len
+    while(k<limit && !is_block_start(g,k)) k++;
+    if(k==limit) return NULL;
+    begins[s]=k;
+  }
+  gapSegments *p = malloc(sizeof(*p));
+  gapSegment *seg = malloc(num*sizeof(*seg));
+  if(p==NULL || seg==NULL) die(__func__);
+  for(int s=0;s<num;s++) {
+    seg[s].beginsAt = begins[s];
+    seg[s].endsAt = begins[s+1];
+    seg[s].inCnt = malloc(g->numBwt*sizeof(customInt));
+    seg[s].F = malloc(g->sizeOfAlpha*sizeof(customInt));
+    if(seg[s].inCnt==NULL || seg[s].F==NULL) die(__func__);
+    seg[s].ibList = ibHead_new(g);
+    seg[s].ibList->memCap /= num;   // the segments share the memory for the solid block lists
+    seg[s].liquid = liquid_new(g);
+    // otherwise an irrelevant segment could never become solid
+    seg[s].liquid->solid_limit = min(seg[s].liquid->solid_limit,seg[s].endsAt-seg[s].beginsAt);
+    seg[s].lcpf = (g->lcpCompute && g->lcpOut==NULL) ? gap_tmpfile(g->outPath) : NULL; // with lcpDirect values go to g->lcpOut
+  }
+  // scan Z to compute the counters at the beginning of each segment
+  array_copy(g->F, g->firstColumn, g->sizeOfAlpha);
+  array_clear(g->inCnt,g->numBwt,0);
+  int s=0;
+  for(customInt k=0; k<g->mergeLen; k++) {
+    if(k==begins[s]) {
+      array_copy(seg[s].inCnt,g->inCnt,g->numBwt);
+      array_copy(seg[s].F,g->F,g->sizeOfAlpha);
+      s++;
+    }
+    int currentColor = z_get(g->mergeColor,k,g->zBytes);
+    int currentChar  = g->bws[currentColor][g->inCnt[currentColor]++];
+    if(currentChar!=0) g->F[currentChar]++;
+  }
+  assert(s==num);
+  p->seg = seg;
+  p->num = num;
+  p->threads = threads;
+  p->kernel = range_kernel(g,true);
+  p->g = g;
+  int e = pthread_mutex_init(&p->mutex,NULL);
+  if(e) die("segments_new mutex init");
+  if(g->verbose>0) printf("Gap iterations split in %d segments scanned by %d threads\n",num,threads);
+  return p;
+}
+
+static void segments_free(gapSegments *p)
+{
+  for(int s=0;s<p->num;s++) {
+    gapSegment *x = &p->seg[s];
+    ibHead_close_in(x->ibList);
+    ibHead_free(x->ibList);
+    liquid_free(x->liquid);
+    if(x->lcpf!=NULL) fclose(x->lcpf);
+    free(x->F);
+    free(x->inCnt);
+  }
+  int e = pthread_mutex_destroy(&p->mutex);
+  if(e) die("segments_free mutex destroy");
+  free(p->seg);
+  free(p);
+}
+
+// body of the threads executing a multithread iteration: get the next
+// segment to be scanned until they are all done
+static void *segment_worker(void *v)
+{
+  gapSegments *p = (gapSegments *) v;
+  g_data g = *(p->g); // local copy with private counters and lcp file
+  customInt inCnt[g.numBwt], F[g.sizeOfAlpha];
+  g.inCnt = inCnt;
+  g.F = F;
+  while(true) {
+    int e = pthread_mutex_lock(&p->mutex);
+    if(e) die("segment_worker lock");
+    int s = p->next++;
+    e = pthread_mutex_unlock(&p->mutex);
+    if(e) die("segment_worker unlock");
+    if(s>=p->num) break;
+    gapSegment *x = &p->seg[s];
+    array_copy(g.inCnt,x->inCnt,g.numBwt);
+    array_copy(g.F,x->F,g.sizeOfAlpha);
+    if(x->lcpf!=NULL) {
+      rewind(x->lcpf);
+      g.unsortedLcp = x->lcpf;
+      g.lcpRuns = NULL; // the pairs go straight to the private file
+    }
+    x->lcpWritten = 0;
+    x->mergeChanged = false;
+    ibHead_open_out(x->ibList);
+    x->irrelevant = p->kernel(x->ibList,x->liquid,x->beginsAt,x->endsAt,p->prefixLength,
+                              &x->mergeChanged,p->round,&x->lcpWritten,&g);
+    // same handling of the solid block files done in gap() for a single thread iteration
+    x->solidBytes = ibHead_out_size(x->ibList);
+    ibHead_rotate(x->ibList);
+  }
+  return NULL;
+}
+
+// copy the first n lcp/position pairs in f to the current lcp run 
+static void copy_lcp_pairs(FILE *f, uint64_t n, g_data *g)
+{
+  char buffer[BUFSIZ*(POS_SIZE+BSIZE)];
+  rewind(f);
+  while(n>0) {
+    size_t r = min(n,BUFSIZ);
+    if(fread(buffer,POS_SIZE+BSIZE,r,f)!=r) die(__func__);
+    writeLcp_pairs(buffer,r,g);
+    n -= r;
+  }
+}
+
+// single iteration of the Gap algorithm executed by p->threads threads
+// produce the same output of addCharToPrefix() (internal memory only)
+static bool addCharToSegments(gapSegments *p, customInt prefixLength, bool *mergeChanged, const int round, g_data *g) {
+  assert(!g->extMem);
+  p->prefixLength = prefixLength;
+  p->round = round;
+  p->next = 0;
+  pthread_t t[p->threads];
+  for(int i=0;i<p->threads;i++) {
+    int e = pthread_create(&t[i],NULL,segment_worker,p);
+    if(e) die("addCharToSegments create");
+  }
+  for(int i=0;i<p->threads;i++) {
+    int e = pthread_join(t[i],NULL);
+    if(e) die("addCharToSegments join");
+  }
+  // collect results: lcp values are copied in position order forming a single sorted block
+  bool everything_irrelevant = true;
+  uint64_t lcpWritten = 0;
+  for(int s=0;s<p->num;s++) {
+    gapSegment *x = &p->seg[s];
+    if(!x->irrelevant) everything_irrelevant = false;
+    if(x->mergeChanged) *mergeChanged = true;
+    if(x->lcpf!=NULL && x->lcpWritten>0) {
+      copy_lcp_pairs(x->lcpf,x->lcpWritten,g);
+      lcpWritten += x->lcpWritten;
+    }
+  }
+  if(g->lcpCompute && lcpWritten>0)
+    writeLcp_EOF(++lcpWritten, g);
+  // swap arrays
+  palette *tmp=g->mergeColor; g->mergeColor=g->newMergeColor; g->newMergeColor=tmp;
+  return everything_irrelevant;
+}
+
+
 // entry point for the gap bwt/lcp merging procedures (including gap8 gap16 etc)
 // if we are only interested in BWT merge, blockBeginsAt is replaced by a bit array 
 void gap(g_data *g, bool lastRound) {
@@ -363,8 +846,17 @@ void gap(g_data *g, bool lastRound) {
     if(g->verbose>0) puts("Single BWT/LCP merging: nothing to do!");
     return;
   }
+  // Z entries are palette2 only when more than MAX_NARROW_BWTS BWTs are merged, and then gap is used
+  g->zBytes = g->numBwt<=MAX_NARROW_BWTS ? sizeof(palette) : sizeof(palette2);
+  mem_plan(g,lastRound);  // sizes of the I/O buffers 
+  // multithread iterations are supported only by gap: if requested use it for the last round
+  bool multithread = lastRound && g->gapThreads>1 && !g->extMem && g->mwXMerge;
   // try preferred algorithm
-  if(g->algorithm==8 && g->numBwt <=8 && !g->lcpMerge)
+  if(multithread || g->ktuple>1)
+    ; // skip to gap
+  else if(g->algorithm==2 && g->numBwt <=2 && !g->lcpMerge && !g->extMem)
+    return gap2(g,lastRound);
+  else if(g->algorithm==8 && g->numBwt <=8 && !g->lcpMerge)
     return gap8(g,lastRound);
   else if(g->algorithm==16 && g->numBwt <=16 && !g->extMem &&!g->lcpCompute)
     return gap16(g,lastRound);    
@@ -372,10 +864,15 @@ void gap(g_data *g, bool lastRound) {
     return g->extMem ? gap128ext(g,lastRound) : gap128(g,lastRound);    
   else if(g->algorithm==256 && g->numBwt <=256 && g->lcpCompute && !g->mwXMerge)
     return gap256(g,lastRound);
+  else if(g->algorithm==3 && g->numBwt<=MAX_NARROW_BWTS && !g->lcpMerge && !g->extMem)
+    return gapdbl(g,lastRound);
   else if(!g->algorithm) {      
     // use a best fit strategy
     if(g->numBwt<=128 && g->extMem)
       return gap128ext(g,lastRound); // gap128ext is the best extMem also since uses o(n) RAM 
+    // case of lcpCompute or bwtOnly not in external memory for at most 2 bwts
+    if(!g->lcpMerge && g->numBwt <= 2 && !g->extMem)
+      return gap2(g,lastRound);
     // case of lcpCompute or bwtOnly not in external memory for at most 128 bwts
     if(!g->lcpMerge && g->numBwt <= 128 && !g->extMem) 
       return gap128(g,lastRound);  // possibly use gap8 or gap16      
@@ -411,14 +908,22 @@ void gap(g_data *g, bool lastRound) {
   g->F = malloc(g->sizeOfAlpha*sizeof(customInt));
   if(!g->inCnt || !g->firstColumn || !g->F)  die(__func__);
   // init the above arrays
-  if(g->smallAlpha) init_arrays(g);
+  if(g->ktuple>1) {
+    assert(g->smallAlpha && !multithread);
+    if(g->lcpCompute) {
+      g->ktupleLcp = calloc((g->mergeLen+1)/2,sizeof(uint8_t));
+      if(!g->ktupleLcp) die(__func__);
+    }
+    init_arrays_ktuple(g);
+  }
+  else if(g->smallAlpha) init_arrays(g);
   else init_arrays_largealpha(g);
   // we are now ready to give mmap advise
   #ifdef USE_MMAP_ADVISE
   if(g->mmapZ) { // advise on g->mergeColor
     for (int i = 0; i < g->sizeOfAlpha-1; ++i)
-      madvise(g->mergeColor + g->firstColumn[i], (g->firstColumn[i+1]-g->firstColumn[i])*sizeof(palette), MADV_SEQUENTIAL);
-    madvise(g->mergeColor + g->firstColumn[g->sizeOfAlpha-1], (g->mergeLen-g->firstColumn[g->sizeOfAlpha-1])*sizeof(palette), MADV_SEQUENTIAL);
+      madvise(g->mergeColor + g->firstColumn[i]*g->zBytes, (g->firstColumn[i+1]-g->firstColumn[i])*g->zBytes, MADV_SEQUENTIAL);
+    madvise(g->mergeColor + g->firstColumn[g->sizeOfAlpha-1]*g->zBytes, (g->mergeLen-g->firstColumn[g->sizeOfAlpha-1])*g->zBytes, MADV_SEQUENTIAL);
   }
   #endif
 
@@ -428,38 +933,68 @@ void gap(g_data *g, bool lastRound) {
   solidBlockFile *ibList = ibHead_new(g);
 
   // main loop
-  customInt prefixLength = 1;      
-  int lcpSize = POS_SIZE + BSIZE;   // number of bytes for each pos,lcp pair: see writeLcp()
+  const customInt K = g->ktuple;    // symbols added to the prefixes in each iteration 
+  customInt prefixLength = K;      
   int round=0;
   bool merge_completed; 
+  gapSegments *segments = NULL;     // partition of Z for multithread iterations
+  gapKernel kernel = range_kernel(g,false);
+  size_t maxCached = 0;             // peak page cache footprint of the temporary files 
+  uint64_t solidBytes = 0, solidRaw = 0; // solid block list bytes written, and with the fixed size format
   do {
-    prefixLength+= 1;
+    prefixLength+= K;
     if(prefixLength>MAX_LCP_SIZE && g->lcpMerge) {fprintf(stderr,"LCP too large (use --lbytes=4)\n");exit(EXIT_FAILURE);}
-    if(g->lcpCompute && prefixLength-2>MAX_LCP_SIZE) {fprintf(stderr,"LCP too large (2) (use --lbytes=4)\n");exit(EXIT_FAILURE);}
+    if(g->lcpCompute && prefixLength-K-1>MAX_LCP_SIZE) {fprintf(stderr,"LCP too large (2) (use --lbytes=4)\n");exit(EXIT_FAILURE);}
     bool mergeChanged = false; // the Z vector has changed in this iteration (used when g->bwtOnly)
-    ibList->fout = gap_tmpfile(g->outPath);
-    merge_completed=addCharToPrefix(ibList,liquid,prefixLength,&mergeChanged,round,g);
+    // switch to multithread iterations as soon as block boundaries are dense enough
+    if(multithread && segments==NULL) {
+      segments = segments_new(g,g->gapThreads);
+      if(segments!=NULL) // solid blocks are recomputed inside each segment 
+        ibHead_close_in(ibList);
+    }
+    off_t ibSize = 0;
+    uint64_t ibRaw = 0;  // size of the solid block file(s) with the fixed size format 
+    if(segments!=NULL) {
+      merge_completed=addCharToSegments(segments,prefixLength,&mergeChanged,round,g);
+      for(int s=0;s<segments->num;s++) {
+        ibSize += segments->seg[s].solidBytes; 
+        ibRaw += segments->seg[s].ibList->rawBytes;
+      }
+    }
+    else {
+      ibHead_open_out(ibList);
+      merge_completed=addCharToPrefix(kernel,ibList,liquid,prefixLength,&mergeChanged,round,g);
+      ibSize = ibHead_out_size(ibList);
+      ibRaw = ibList->rawBytes;
+    }
+    solidBytes += ibSize; solidRaw += ibRaw;
+    if(g->verbose>1 && tmp_uncached_active()) { // scans all the temporary files: only with -U and -vv
+      size_t cached = tmp_footprint(g,ibList->fin,ibList->fout,-1);
+      if(cached>maxCached) maxCached = cached;
+    }
     if (g->verbose>1 && lastRound) {
       #if MALLOC_COUNT_FLAG
-        printf("Lcp: "CUSTOM_FORMAT". Memory peak/current: %.2lf/%.2lf bytes/symbol. ibList: %ju\n", prefixLength-1, (double)malloc_count_peak()/g->mergeLen, (double)malloc_count_current()/g->mergeLen, (uintmax_t) ftello(ibList->fout));
+        printf("Lcp: "CUSTOM_FORMAT". Memory peak/current: %.2lf/%.2lf bytes/symbol. ibList: %ju (%ju uncompressed)\n", prefixLength-1, (double)malloc_count_peak()/g->mergeLen, (double)malloc_count_current()/g->mergeLen, (uintmax_t) ibSize, (uintmax_t) ibRaw);
       #else
-        printf("Lcp: "CUSTOM_FORMAT". ibList: %ju\n", prefixLength-1, (uintmax_t) ftello(ibList->fout));
+        printf("Lcp: "CUSTOM_FORMAT". ibList: %ju (%ju uncompressed)\n", prefixLength-1, (uintmax_t) ibSize, (uintmax_t) ibRaw);
       #endif
       // also EOF are written to unsortedLcp file so percentages are not accurate     
       if(g->unsortedLcp) printf("   unsorted lcp values: %ju (%.2lf%%)\n",  
-      (uintmax_t) ftello(g->unsortedLcp)/lcpSize, (double) 100*ftello(g->unsortedLcp)/(lcpSize*g->mergeLen));
+      (uintmax_t) countLcp(g), (double) 100*countLcp(g)/g->mergeLen);
     }
     round  = 1 - round; // change round parity
     if(g->bwtOnly && !mergeChanged) {
       if(g->verbose>1) puts("Gap bwt-only early termination");
-      fclose(ibList->fout);
+      if(segments==NULL) ibHead_close_out(ibList);
       break;
     }
-    if(ibList->fin!=NULL) fclose(ibList->fin);
-    rewind(ibList->fout);
-    ibList->fin = ibList->fout;
+    if(segments==NULL) {  // for multithread iterations this is done inside segment_worker()
+      ibHead_rotate(ibList);
+    }
   } while(!merge_completed);  // end main loop
-  if(ibList->fin!=NULL) fclose(ibList->fin);
+  ibHead_close_in(ibList);
+  if(segments!=NULL) segments_free(segments);
+  if(g->ktupleLcp!=NULL) {free(g->ktupleLcp); g->ktupleLcp=NULL;}
 
   #if MALLOC_COUNT_FLAG
     if (g->verbose>0) {
@@ -476,12 +1011,18 @@ void gap(g_data *g, bool lastRound) {
         printf("Merge completed (%d bwts).\n", g->numBwt);
     }
   #endif
+  if(g->verbose>1 && tmp_uncached_active())
+    printf("Peak page cache footprint of temporary files: %zu, %.2lf bytes/symbol\n", maxCached, (double)maxCached/g->mergeLen);
+  if(g->verbose>0 && (lastRound || g->verbose>1))
+    printf("Solid block lists written: %ju bytes, %ju uncompressed (%.2lf%%)\n", (uintmax_t) solidBytes, (uintmax_t) solidRaw, 
+           solidRaw ? 100.0*solidBytes/solidRaw : 100.0);
   liquid_free(liquid);
   ibHead_free(ibList);
   if(g->extMem) close_bw_files(g);
 
   // computation complete, do the merging. The following call writes the
   // (possibly remapped) merged BWT back to g->bws[0]; and if lcpMerge==true the merged LCP to g->lcps[0] 
+  if(g->extMem) zrle_expand(g->zrle,g->merge_fname);
   mergeBWTandLCP(g,lastRound);
   if(g->lcpCompute) {
     assert(lastRound);
@@ -508,28 +1049,36 @@ void gap(g_data *g, bool lastRound) {
 static void open_merge_files(g_data *g) {
   assert(g->extMem);
   // mergeColor file for reading (Z in pseudocode)
-  g->fmergeColor = fopen(g->merge_fname,"rb");
-  if(!g->fmergeColor) die("merge_open");
+  int mfd = open(g->merge_fname,O_RDONLY);
+  if(mfd == -1) die("merge_open");
+  if(g->zrle==NULL) // chunks of the merge files, all raw before the first iteration
+    g->zrle = zrle_new(g->mergeLen,g->zBytes,g->firstColumn,g->sizeOfAlpha);
+  g->fmergeColor = malloc(sizeof(zreader));
+  if(g->fmergeColor==NULL) die("merge_alloc");
+  zreader_init(g->fmergeColor,mfd,g->buf.colorRead,g->zBytes,g->zrle);
   #ifndef NDEBUG
-  customInt c[256] = {0}; // init to zero
+  customInt c[g->numBwt];
+  array_clear(c,g->numBwt,0);
   for(customInt i = 0; i < g->mergeLen; i++) {
-    int col=fread_color(g->fmergeColor);
-    col &= 0x7F;
+    int col=zreader_get_color(g->fmergeColor);
+    if(g->numBwt<=128) col &= 0x7F; // gap128ext stores a bit in the msb
     assert(col>=0 && col<g->numBwt);
     c[col]++;
   }
   for(int i=0;i<g->numBwt;i++) 
     assert(c[i]==g->bwtLen[i]);
-  rewind(g->fmergeColor);
+  zreader_rewind(g->fmergeColor);
   #endif
   // alphaSize-1 newMergeColor cwriters for writing (newZ in pseudocode)
-  int fd = open(g->newmerge_fname,O_WRONLY);
+  int fd = open(g->newmerge_fname,O_RDWR); // coded chunks written in part are read and updated 
   if(fd == -1) die("new_merge_open");
   g->fnewMergeColor = malloc(g->sizeOfAlpha*sizeof(cwriter));
   if(g->fnewMergeColor==NULL) die("new_merge_alloc");
   g->fnewMergeColor[0].fd = -1; // invalid file descriptor
-  for(int i=1; i< g->sizeOfAlpha; i++)
-    cwriter_init(&g->fnewMergeColor[i],fd,COLOR_WBUFFER_SIZE, g->firstColumn[i]*sizeof(palette));
+  for(int i=1; i< g->sizeOfAlpha; i++) { // tuples containing 0 are never written 
+    size_t size = (g->ktuple>1 && g->ktuple0[i]) ? 1 : g->buf.colorWrite;
+    cwriter_init(&g->fnewMergeColor[i],fd,size, g->firstColumn[i]*g->zBytes, g->zBytes, g->zrle);
+  }
 }
 
 // use bws[] to make bwf[i] point at the beginning of bws[i]  
@@ -538,22 +1087,44 @@ static void close_merge_files(g_data *g) {
   // close new merge files
   for(int i=1; i< g->sizeOfAlpha; i++) 
     cwriter_close(&g->fnewMergeColor[i]);
+  tmp_dontneed(g->fnewMergeColor[1].fd,0,0,true); // complete the writeback started by the cwriters 
   close(g->fnewMergeColor[1].fd); // close file   
   free(g->fnewMergeColor);
   // close merge file
-  int e = fclose(g->fmergeColor);
+  zreader_close(g->fmergeColor); // wait for the prefetch before closing the file 
+  int e = close(g->fmergeColor->fd);
   if(e!=0) die("merge_close");
+  free(g->fmergeColor);
+  g->fmergeColor = NULL;
+  // newmerge becomes merge 
+  zrle_swap(g->zrle);
+  if(g->verbose>1 && g->zrle->coded[0]>0)
+    printf("Merge file: %ju bytes (%.2lf%%), %ju/%zu chunks run-length coded\n", (uintmax_t) g->zrle->bytes[0],
+           100.0*g->zrle->bytes[0]/(g->mergeLen*g->zBytes), (uintmax_t) g->zrle->coded[0], g->zrle->chunks);
 }
 
-// write a single color to f (that should be merge or newmerge)
-static void fwrite_color(int b, FILE *f) {
-  int e = fwrite(&b,sizeof(palette),1,f);
-  if(e!=1) die(__func__);
+// bytes in the page cache of the temporary files of the current merge: 
+// solid block lists fin/fout, merge files, lcp runs, and bitfile bfd (if bfd>=0)
+static size_t tmp_footprint(g_data *g, FILE *fin, FILE *fout, int bfd)
+{
+  size_t tot = 0;
+  if(fin!=NULL) tot += tmp_cached(fileno(fin));
+  if(fout!=NULL) tot += tmp_cached(fileno(fout));
+  if(g->unsortedLcp!=NULL) tot += tmp_cached(fileno(g->unsortedLcp));
+  if(bfd>=0) tot += tmp_cached(bfd);
+  if(g->extMem && g->merge_fname!=NULL) 
+    for(int i=0;i<2;i++) {
+      int fd = open(i==0 ? g->merge_fname : g->newmerge_fname,O_RDONLY);
+      if(fd==-1) die(__func__);
+      tot += tmp_cached(fd);
+      if(close(fd)!=0) die(__func__);
+    }
+  return tot;
 }
 
-static int fread_color(FILE *f) {
-  int b=0;
-  int e = fread(&b,sizeof(palette),1,f);
+// write a single color of zb bytes to f (that should be merge or newmerge)
+static void fwrite_color(int b, int zb, FILE *f) {
+  int e = fwrite(&b,zb,1,f);
   if(e!=1) die(__func__);
-  return b;
 }
+
@@ -4,6 +4,7 @@
 #include "config.h"
 
 void gap(g_data *, bool lastRound);
+void gap2(g_data *, bool lastRound);
 void gap8(g_data *, bool lastRound);
 void gap16(g_data *, bool lastRound);
 
@@ -32,7 +32,7 @@ static void init_arrays(g_data *g)
   assert(i==g->mergeLen);
   // extra check on mergeColor, can be commented out
   #ifndef NDEBUG
-  customInt cnt[MAX_NUMBER_OF_BWTS] = {0};
+  customInt cnt[MAX_NARROW_BWTS] = {0};
   for(i=0;i<g->mergeLen;i++) cnt[g->mergeColor[i]]++;
   bool stop=false;
   for(int i=0; i<g->numBwt; i++)
@@ -64,7 +64,7 @@ static void init_arrays_largealpha(g_data *g)
     
   #ifndef NDEBUG
   // extra check on mergeColor
-  customInt cnx[MAX_NUMBER_OF_BWTS] = {0};
+  customInt cnx[MAX_NARROW_BWTS] = {0};
   for(int i=0;i<g->mergeLen;i++) cnx[g->mergeColor[i]]++;
   bool stop=false;
   for(int i=0; i<g->numBwt; i++)
@@ -174,7 +174,7 @@ static int addCharToPrefix_HM(customInt prefixLength, g_data *g)
   // extra check on newMergeColor
   #ifndef NDEBUG
   bool stop=false;
-  customInt cnt[MAX_NUMBER_OF_BWTS] = {0};
+  customInt cnt[MAX_NARROW_BWTS] = {0};
   for(customInt i=0;i<g->mergeLen;i++) 
     cnt[g->newMergeColor[i]]++;
   for(int i=0; i<g->numBwt; i++)
@@ -207,7 +207,8 @@ static int addCharToPrefix_HM(customInt prefixLength, g_data *g)
 void holtMcMillan(g_data *g, bool lastRound) {
   // init local global vars
   check_g_data(g);
-  assert(g->numBwt <= MAX_NUMBER_OF_BWTS); 
+  assert(g->numBwt <= MAX_NARROW_BWTS); 
+  g->zBytes = sizeof(palette); // H&M uses the narrow Z 
   int stop = 0; 
   
   // clear array B if necessary
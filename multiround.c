@@ -8,178 +8,157 @@
 #define min(a,b) ((a)<(b) ? (a) : (b))
 
 
+// ------ planning of the merges done before the last round
+
+// a (possibly merged) BWT in the current round of the plan
+typedef struct {
+  int first;            // index of its first input BWT
+  customInt len;        // total length 
+  mergeTask *task;      // merge producing it, NULL for an input BWT
+} segment;
+
+// add to the plan the merge of the segments seg[0..n-1] whose first symbol is at position offset
+// and return the resulting segment. The bwt[] array of the new merge is taken from *pool  
+static segment plan_merge(segment *seg, int n, customInt offset, int round, mergeTask *t, int **pool)
+{
+  segment res = seg[0];
+  if(n==1) return res; // nothing to merge, segment goes to the next round unchanged
+  t->round = round;
+  t->numBwt = n;
+  t->bwt = *pool; *pool += n;
+  t->offset = offset;
+  t->len = 0;
+  t->waiting = 0;
+  t->parent = NULL;
+  t->started = false;
+  t->secs = 0;
+  for(int i=0;i<n;i++) {
+    t->bwt[i] = seg[i].first;
+    t->len += seg[i].len;
+    if(seg[i].task) {
+      assert(seg[i].task->parent==NULL);
+      seg[i].task->parent = t;
+      t->waiting++;
+    }
+  }
+  res.len = t->len;
+  res.task = t;
+  return res;
+}
+
+// plan the merges of a round reducing the n>group_size segments in seg[]
+// to ceil(n/group_size) segments of similar length, or to group_size segments 
+// merging the shortest window of consecutive segments if n < 2*group_size 
+// the new segments are written to seg[], the new merges to task[], return the number of segments
+static int plan_round(segment *seg, int n, int group_size, int round, mergeTask *task, int *ntask, int **pool)
+{
+  customInt offset = 0, tot = 0;
+  for(int i=0;i<n;i++) tot += seg[i].len;
+  if(n <= 2*group_size-1) {
+    int w = n-group_size+1, best = 0;  // merge w consecutive segments 
+    customInt len = 0, minlen;
+    for(int i=0;i<w;i++) len += seg[i].len;
+    minlen = len;
+    for(int i=w;i<n;i++) {
+      len += seg[i].len - seg[i-w].len;
+      if(len<minlen) {minlen = len; best = i-w+1;}
+    }
+    for(int i=0;i<best;i++) offset += seg[i].len;
+    seg[best] = plan_merge(seg+best,w,offset,round,&task[*ntask],pool);
+    if(w>1) (*ntask)++;
+    memmove(seg+best+1,seg+best+w,(n-best-w)*sizeof(segment));
+    return group_size;
+  }
+  // split in k groups of consecutive segments each one of size as close as possible to tot/k 
+  int k = (n+group_size-1)/group_size, i=0;
+  for(int j=0;j<k;j++) {
+    int left = k-j;                  // groups still to be formed, including this one 
+    int minc = n-i-(left-1)*group_size; // the remaining groups can take at most (left-1)*group_size segments
+    int maxc = min(group_size, n-i-(left-1));
+    if(minc<1) minc = 1;
+    customInt target = tot/left, len=0;
+    int c=0;
+    while(c<minc || (c<maxc && len+seg[i+c].len/2 <= target))
+      len += seg[i+c++].len;
+    seg[j] = plan_merge(seg+i,c,offset,round,&task[*ntask],pool);
+    if(c>1) (*ntask)++;
+    i += c; offset += len; tot -= len;
+  }
+  assert(i==n && tot==0);
+  return k;
+}
+
+
 // ------ merge of multiple BWTs possibly in parallel
 // the number of BWTs to be merged is in input->numBWT
-// in each round at most group_size BWTs can be merged this number
-// is limited by the size of the elements used to store IDs for BWTs (ZSIZE)
-// The merging is done in rounds; at each round the total number of active BWTs decrease
-// by a factor group_size. Each round must be completed before we can start the next one
-// A round may consist of several parallel merges, and in this cases they can be computed
-// in parallel using multiple threads. 
-// A producer/consumers system and the relative threads are setup for each
-// invocation of multiround, but all rounds share the the same system and threads
-// Since consumer threads do not termiate at the end of a round, the main thread 
-// uses a condition variable to wait for all thread computations to be completed 
+// in each round at most group_size BWTs can be merged: this number
+// is limited by the size of the elements used to store IDs for BWTs (see g->zBytes)
+// The merges done before the last round are planned in advance: at each round 
+// consecutive BWTs are grouped so that all merges have a similar total length,
+// and the last but one round merges only the shortest window of BWTs necessary 
+// to reduce their number to group_size. 
+// Merges are executed by num_threads threads (by the main thread if num_threads==0): 
+// a merge is started as soon as the merges producing its input have been completed,
+// so there is no barrier between rounds, and among the available merges the
+// longest one is started first (see merger() in threads.c)
 void multiround(bool hm, int group_size,char *path, g_data *input, int num_threads)
 {
-  customInt offset, tot_symb=0;
-  // threads related
-  pc_system merge;
-  pthread_t t[num_threads];
-  g_data buffer[Threads_buf_size];
-  int e;
-  
-  // init threads
-  if(num_threads>0) {
-    pc_system_init(&merge,Threads_buf_size);
-    merge.buffer = (void *) buffer;
-    merge.hm = hm;
-    for(int i=0;i<num_threads;i++) {
-      e = pthread_create(&t[i], NULL, merger, &merge);
-      if(e) die("multiround create");
-    }
-    if(input->verbose>0) printf("%d merger threads created\n",num_threads);
+  int n = input->numBwt, ntask=0, round=0;
+  // each merge reduces the number of segments by at least one, so we have
+  // less than numBwt merges involving less than 2*numBwt segments
+  segment *seg = malloc(n*sizeof(segment));
+  mergeTask *task = malloc(n*sizeof(mergeTask));
+  int *bwt = malloc(2*n*sizeof(int)), *pool=bwt;
+  if(seg==NULL || task==NULL || bwt==NULL) die(__func__);
+  for(int i=0;i<n;i++) {
+    seg[i].first = i; seg[i].len = input->bwtLen[i]; seg[i].task = NULL;
+  }
+  while(n>group_size) {
+    int nt = ntask;
+    n = plan_round(seg,n,group_size,round,task,&ntask,&pool);
+    if(input->verbose>0) printf("Round %d: %d merges, %d bwts left\n",round,ntask-nt,n);
+    round++;
   }
+  assert(pool<=bwt+2*input->numBwt && ntask<input->numBwt);
   
-  // multiround merging  
-  for(int r=0; ;r++) {     // do as many rounds as necessary
-    
-    if(input->numBwt<= 2*group_size-1 ) 
-       break;  // we have reached the last round (or almost)
-       
-    // main loop to be executed by parallel threads
-    // offset is within the number of bwt
-    if(num_threads>0) {
-      e = pthread_mutex_lock(&merge.remutex);
-      if(e) die("remaining lock 1");
-      merge.remaining = (input->numBwt+group_size-1)/group_size; // parallel merges in this round
-      e= pthread_mutex_unlock(&merge.remutex);
-      if(e) die("remaining unlock 1");
-    }
-    tot_symb = 0; 
-    for(offset=0; offset < input->numBwt; offset += group_size) {
-      g_data g=*input; // copy current status
-      if(g.verbose>2) printf("Round %d, NumBwt offset "CUSTOM_FORMAT"\n",r,offset);
-      g.bws = input->bws+offset;
-      g.bwtLen = input->bwtLen+offset;
-      if(input->smallAlpha) g.bwtOcc = input->bwtOcc+offset;
-      g.numBwt = min(group_size, input->numBwt - offset);
-      g.symb_offset = tot_symb;
-      g.mergeLen=0;
-      for(int i=0;i<g.numBwt;i++) g.mergeLen += g.bwtLen[i];
-      if(input->lcpCompute) {
-        assert(!input->bwtOnly && !input->lcpMerge);
-        g.bwtOnly = true;      // since this is not the last round we can only
-        g.lcpCompute = false;  // compute the BWT and ignore LCP  
-      }
-      // prepare access to lcp values
-      if(g.lcpMerge) g.lcps = input->lcps+offset;
-      // execute merge, possibly using threads 
-      if(num_threads>0) {
-        e = sem_wait(merge.free_slots); if(e) die("multiround producer wait");
-        check_g_data(&g);
-        buffer[merge.pindex++ % merge.buf_size]=g; // copy g_data to buffer
-        e = sem_post(merge.ready);  if(e) die("multiround producer post");
-      }
-      else { // no helper threads
-        if (hm) holtMcMillan(&g, false);
-        else gap(&g, false);
-        // update input via g
-        for(int i=1;i<g.numBwt;i++) {
-          g.bwtLen[0] += g.bwtLen[i];
-          if(g.smallAlpha)
-            for(int j=0;j<g.sizeOfAlpha;j++)
-              g.bwtOcc[0][j] += g.bwtOcc[i][j];
-        }
-        assert(g.bwtLen[0]==g.mergeLen);
+  // execute the merges before the last round 
+  if(ntask>0) {
+    mergeSchedule s;
+    pthread_t t[num_threads];
+    schedule_init(&s,task,ntask,hm,input);
+    time_t start_wc = time(NULL);
+    if(num_threads==0) merger(&s);
+    else {
+      for(int i=0;i<num_threads;i++) {
+        int e = pthread_create(&t[i], NULL, merger, &s);
+        if(e) die("multiround create");
       }
-      // update tot_symb seen so far
-      tot_symb += g.mergeLen;
-    } // end of inner parallelizable loop
-    assert(input->mergeLen==tot_symb);
-    // --- wait till all merges for this round have been completed 
-    if(num_threads>0) {
-      e = pthread_mutex_lock(&merge.remutex); if(e) die("remaining lock 2");
-      while(merge.remaining>0) {
-        e = pthread_cond_wait(&merge.recond,&merge.remutex);
-        if(e) die("remaining wait");
+      if(input->verbose>0) printf("%d merger threads created\n",num_threads);
+      for(int i=0;i<num_threads;i++) {
+        int e = pthread_join(t[i], NULL);
+        if(e) die("multiround join");
       }
-      e = pthread_mutex_unlock(&merge.remutex); if(e) die("remaining unlock 2");
-      assert(merge.pindex==merge.cindex);
-      if(input->verbose>1) puts("Threads syncronized, round completed");
+      if(input->verbose>1) printf("%d merger threads destroyed\n",num_threads);
     }
-    // merged done for all segments. merged bwt/lcp are in g.bws[0][] and g.lcps[0] (if g.lcpMerge==true)
-
-    // update input so that it consists of fewer, larger segments. move Len and Occ real entries to the left
-    for(offset=0; offset < input->numBwt; offset += group_size) {
-      input->bwtLen[offset/group_size] = input->bwtLen[offset];
-      input->bws[offset/group_size] = input->bws[offset];
-      if(input->lcpMerge) input->lcps[offset/group_size] = input->lcps[offset];;
-      // replace with a swap ??? 
-      if(input->smallAlpha)
-        for(int j=0;j<input->sizeOfAlpha;j++)
-          input->bwtOcc[offset/group_size][j] = input->bwtOcc[offset][j];
-    }
-    input->numBwt = (input->numBwt+group_size-1)/group_size;
-    check_g_data(input);
-    if(input->verbose>0)  printf("Round %d complete: %d merged bwt/lcp saved\n",r,input->numBwt);
-  } // end of all rounds except last
-  if(num_threads>0) {  // last round does not use threads, kill consumers
-    g_data g; // dummy task
-    g.numBwt = 0;
-    g.verbose = input->verbose;
-    for(int i=0;i<num_threads;i++) {
-        e = sem_wait(merge.free_slots); if(e) die("cleaning producer wait");
-        buffer[merge.pindex++ % merge.buf_size]=g; // copy g_data to buffer
-        e = sem_post(merge.ready);  if(e) die("cleaning producer post");
-    }
-    for(int i=0;i<num_threads;i++) {
-      e = pthread_join(t[i], NULL);
-      if(e) die("multiround join");
-    }
-    pc_system_destroy(&merge);
-    if(input->verbose>1) printf("%d merge threads destroyed\n",num_threads);
+    schedule_destroy(&s);
+    if(input->verbose>0)  
+      printf("%d merges completed in %.0lf wall clock secs: %d merged bwt/lcp saved\n",ntask,difftime(time(NULL),start_wc),n);
   }
-  // here maybe there is an additional round to go from n<2g, to g;
-  // there is some code duplication, but it is an important special case 
-  if(input->numBwt > group_size) { 
-    offset = group_size-1; // first BWT to consider 
-    tot_symb = 0;          // total number of symbols to skip
-    for(int i=0;i<offset;i++)
-      tot_symb += input->bwtLen[i];
-    // prepare merge task  
-    g_data g=*input; // copy current status
-    if(g.verbose>2) printf("Special round, NumBwt offset "CUSTOM_FORMAT"\n",offset);
-    g.bws = input->bws+offset;
-    g.bwtLen = input->bwtLen+offset;
-    if(input->smallAlpha) g.bwtOcc = input->bwtOcc+offset;
-    g.numBwt = input->numBwt - offset;
-    assert(g.numBwt <= group_size);
-    g.symb_offset = tot_symb;
-    g.mergeLen=0;
-    for(int i=0;i<g.numBwt;i++) g.mergeLen += g.bwtLen[i];
-    if(input->lcpCompute) {
-      assert(!input->bwtOnly && !input->lcpMerge);
-      g.bwtOnly = true;      // since this is not the last round we can only
-      g.lcpCompute = false;  // compute the BWT and ignore LCP  
-    }
-    if(g.lcpMerge) g.lcps = input->lcps+offset;
-    // execute merge 
-    if (hm) holtMcMillan(&g, false);
-    else gap(&g, false);
-    // update input via g
-    for(int i=1;i<g.numBwt;i++) {
-      g.bwtLen[0] += g.bwtLen[i];
-      if(g.smallAlpha)
-        for(int j=0;j<g.sizeOfAlpha;j++)
-          g.bwtOcc[0][j] += g.bwtOcc[i][j];
-    }
-    assert(g.bwtLen[0]==g.mergeLen);
-    // update input so that it consists of fewer, larger segments. move Len and Occ real entries to the left
-    input->numBwt = (input->numBwt-g.numBwt+1);
-    assert(input->numBwt==group_size);
-    check_g_data(input);
+  // update input so that it consists of the final segments: move Len and Occ real entries to the left
+  for(int i=0;i<n;i++) {
+    int f = seg[i].first;
+    assert(f>=i && input->bwtLen[f]==seg[i].len);
+    if(f==i) continue;
+    input->bwtLen[i] = input->bwtLen[f];
+    input->bws[i] = input->bws[f];
+    if(input->lcpMerge) input->lcps[i] = input->lcps[f];
+    if(input->smallAlpha)
+      for(int j=0;j<input->sizeOfAlpha;j++)
+        input->bwtOcc[i][j] = input->bwtOcc[f][j];
   }
+  input->numBwt = n;
+  check_g_data(input);
+  free(bwt); free(task); free(seg);
   assert(input->numBwt <= group_size);
   // execute last round (only point where gap/hm with lastRound==true is called) 
   if (hm) holtMcMillan(input, true);
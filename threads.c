@@ -7,190 +7,133 @@
 #include "mergehm.h"
 
 
-#define min(a,b) ((a)<(b) ? (a) : (b))
-
-// force named semaphores for MacOS
-#if defined(__APPLE__) && defined(__MACH__) 
-#define USE_NAMED_SEMAPHORES
-#endif
-
-#ifdef USE_NAMED_SEMAPHORES /* OS X */
-  #pragma message "Compiling using named semaphores for MacOS systems"
-#endif
-
-// ---- semaphores
-
-// creation and destruction of semaphores using named for MacOS and unnamed for Linux
-// for named semaphores 
-//   if s==NULL a new semaphore is created using the static num to ensure distinct names 
-//   if s!=NULL the last created semaphore is destroyed (unlinked)
-// for unnamed semaphores
-//   if s==NULL a new sem is allocated initialized and a pointer to it returned  
-//   if s!=NULL the passed semaphore is destroyed 
-// also check the error message from sem_unlink or sem_destroy functions 
-// return a pointer to the newly created semaphore or NULL if ti was s!=NULL
-static int Thread_error_wait=3;
-static sem_t *xsem_create_destroy(sem_t *s, unsigned int value, int line, const char *file)
+// wall clock time in seconds 
+static double wall_time(void)
 {
-#ifdef USE_NAMED_SEMAPHORES
-  // -----------------------------------------------
-  // MacOS: close/open a named semaphore
-  // static variables containing pid and # created semaphores 
-  char tmp[NAME_MAX+1];
-  static int num=0;
-  static intmax_t pid;
-  // save pid once
-  if(num==0) pid = (intmax_t) getpid();
-
-  if(s!=NULL) {
-    // check there is a named semaphore still around 
-    if(num==0) {
-      perror("Error deleting non-existing named semaphore");
-      fprintf(stderr,"== %d == Line: %d, File: %s\n",getpid(),line,file);
-      sleep(Thread_error_wait);  // give some extra time to other threads 
-      exit(1);
-    }
-    // delete last created named semaphore
-    int e = snprintf(tmp,NAME_MAX,"%jd.%d",pid,--num);
-    if(e<0 || e>NAME_MAX) {
-      perror("Error creating semaphore name");
-      fprintf(stderr,"== %d == Line: %d, File: %s\n",getpid(),line,file);
-      sleep(Thread_error_wait);  // give some extra time to other threads 
-      exit(1);
-    }
-    e = sem_unlink(tmp);
-    if(e!=0) {
-      perror("Error deleting named semaphore");
-      fprintf(stderr,"== %d == Line: %d, File: %s\n",getpid(),line,file);
-      sleep(Thread_error_wait);  // give some extra time to other threads 
-      exit(1);
-    }
-    return NULL;
-  }
-  // create a new named semphore; create unique name 
-  int e = snprintf(tmp,NAME_MAX,"%jd.%d",pid,num++);
-  if(e<0 || e>NAME_MAX) {
-    perror("Error creating semaphore name");
-    fprintf(stderr,"== %d == Line: %d, File: %s\n",getpid(),line,file);
-    sleep(Thread_error_wait);  // give some extra time to other threads 
-    exit(1);
-  }
-  // open and init semaphore 
-  s = sem_open(tmp,O_CREAT| O_EXCL, S_IRUSR | S_IWUSR ,value);
-  if(s==SEM_FAILED) {
-    perror("Error opening named semaphore"); 
-    fprintf(stderr,"== %d == Line: %d, File: %s\n",getpid(),line,file);
-    sleep(Thread_error_wait);  // give some extra time to other threads 
-    exit(1);
-  }
-  return s;
-#else
-  // ---------------------------------------------- 
-  // linux destroy/init an unnamed semaphore
-  if(s!=NULL) {
-    if(sem_destroy(s) !=0) {
-      perror("Error destroying unnamed semaphore");
-      fprintf(stderr,"== %d == Line: %d, File: %s\n",getpid(),line,file);
-      sleep(Thread_error_wait);  // give some extra time to other threads 
-      exit(1);
-    }
-    free(s);
-    return NULL;
-  }
-  // allocate init/ and return an unnamed sem_t
-  s = malloc(sizeof(sem_t));
-  if(s==NULL) {
-    perror("malloc error");
-    fprintf(stderr,"== %d == Line: %d, File: %s\n",getpid(),line,file);
-    sleep(Thread_error_wait);  // give some extra time to other threads 
-    exit(1);
-  }
-  // init with value and no sharing 
-  if(sem_init(s,0,value)!=0) {
-    perror("sem_init error");
-    fprintf(stderr,"== %d == Line: %d, File: %s\n",getpid(),line,file);
-    sleep(Thread_error_wait);  // give some extra time to other threads 
-    exit(1);
-  }
-  return s;
-#endif
+  struct timespec t;
+  if(clock_gettime(CLOCK_MONOTONIC,&t)!=0) die(__func__);
+  return t.tv_sec + t.tv_nsec/1e9;
 }
 
-
-
-// init a producer/consumers system
-void pc_system_init(pc_system *pc, int buf_size)
+// init a schedule for the merges in task[0..num-1]
+void schedule_init(mergeSchedule *s, mergeTask *task, int num, bool hm, g_data *input)
 {
-  pc->buf_size = buf_size; 
-  pc->pindex=0;
-  pc->cindex=0;
-  pc->free_slots = xsem_create_destroy(NULL,buf_size,__LINE__,__FILE__);
-  pc->ready = xsem_create_destroy(NULL,0,__LINE__,__FILE__);
-  int e = pthread_mutex_init(&(pc->cmutex),NULL);
+  s->task = task;
+  s->num = num;
+  s->started = s->completed = 0;
+  s->hm = hm;
+  s->input = input;
+  int e = pthread_mutex_init(&(s->mutex),NULL);
   if(e) die(__func__);
-  // re condition variable and related mutex
-  e = pthread_mutex_init(&(pc->remutex),NULL);
-  if(e) die(__func__);
-  e = pthread_cond_init(&(pc->recond),NULL);
+  e = pthread_cond_init(&(s->ready),NULL);
   if(e) die(__func__);
 }
 
-// destroy a producer/consumers system
-void pc_system_destroy(pc_system *pc)
+// destroy a schedule whose merges have been completed
+void schedule_destroy(mergeSchedule *s)
 {
-  assert(pc->pindex==pc->cindex);  
-  int e = pthread_cond_destroy(&(pc->recond));
-  if(e) die(__func__);
-  e = pthread_mutex_destroy(&(pc->remutex));
+  assert(s->completed==s->num);  
+  int e = pthread_cond_destroy(&(s->ready));
   if(e) die(__func__);
-  e = pthread_mutex_destroy(&(pc->cmutex));
+  e = pthread_mutex_destroy(&(s->mutex));
   if(e) die(__func__);
-  xsem_create_destroy(pc->ready,0,__LINE__,__FILE__);
-  xsem_create_destroy(pc->free_slots,0,__LINE__,__FILE__);
 }
 
-// execute a single call to HM or Gap
+// return the longest merge whose input is available, NULL if there is none
+// call with s->mutex locked
+static mergeTask *schedule_next(mergeSchedule *s)
+{
+  mergeTask *best = NULL;
+  for(int i=0;i<s->num;i++) {
+    mergeTask *t = &s->task[i];
+    if(!t->started && t->waiting==0 && (best==NULL || t->len>best->len))
+      best = t;
+  }
+  return best;
+}
+
+// execute a single call to HM or Gap merging the BWTs of t
+// the merged BWT replaces the first one in s->input
+static void merge_task(mergeSchedule *s, mergeTask *t)
+{
+  g_data *input = s->input;
+  g_data g = *input; // copy current status
+  symbol *bws[t->numBwt];
+  customInt bwtLen[t->numBwt];
+  customInt *bwtOcc[t->numBwt];
+  lcpInt *lcps[t->numBwt];
+  g.numBwt = t->numBwt;
+  g.bws = bws; g.bwtLen = bwtLen;
+  if(input->smallAlpha) g.bwtOcc = bwtOcc;
+  if(input->lcpMerge) g.lcps = lcps;
+  g.mergeLen = 0;
+  for(int i=0;i<t->numBwt;i++) {
+    int b = t->bwt[i];
+    bws[i] = input->bws[b];
+    bwtLen[i] = input->bwtLen[b];
+    if(input->smallAlpha) bwtOcc[i] = input->bwtOcc[b];
+    if(input->lcpMerge) lcps[i] = input->lcps[b];
+    g.mergeLen += bwtLen[i];
+  }
+  assert(g.mergeLen==t->len);
+  g.symb_offset = t->offset;
+  if(input->lcpCompute) {
+    assert(!input->bwtOnly && !input->lcpMerge);
+    g.bwtOnly = true;      // since this is not the last round we can only
+    g.lcpCompute = false;  // compute the BWT and ignore LCP  
+  }
+  check_g_data(&g);
+  if(g.verbose>2) printf("Round %d, working on range ["CUSTOM_FORMAT","CUSTOM_FORMAT")\n", t->round, g.symb_offset,g.symb_offset+g.mergeLen);
+  double start = wall_time();
+  if(s->hm)  holtMcMillan(&g, false);
+  else gap(&g, false);
+  t->secs = wall_time()-start;
+  // merge statistics: the merged BWT takes the place of the first one 
+  for(int i=1;i<g.numBwt;i++) {
+    g.bwtLen[0] += g.bwtLen[i];
+    if(g.smallAlpha)
+      for(int j=0;j<g.sizeOfAlpha;j++)
+        g.bwtOcc[0][j] += g.bwtOcc[i][j];
+  }
+  assert(g.bwtLen[0]==g.mergeLen);
+  input->bwtLen[t->bwt[0]] = g.bwtLen[0];
+  if(g.verbose>1) 
+    printf("Round %d, merge of %d bwts starting at %d, length "CUSTOM_FORMAT": %.3lf secs\n",
+            t->round, t->numBwt, t->bwt[0], t->len, t->secs);
+}
+
+// execute the merges of a schedule until all of them have been started
 void *merger(void *v)
 {
-  pc_system *pc = (pc_system *) v;
-  g_data g, *buffer= (g_data *)pc->buffer;
-  
+  mergeSchedule *s = (mergeSchedule *) v;
   int tot=0;
-  while(1) {
-    int e=sem_wait(pc->ready); // wait there is something to do
-    if(e) die("consumer wait");
-    e = pthread_mutex_lock(&pc->cmutex); // get esclusive access to queue
-    if(e) die("consumer lock");
-    g = buffer[(pc->cindex)++ % pc->buf_size];
-    e = pthread_mutex_unlock(&pc->cmutex); // fine accesso a zona comune
-    if(e) die("consumer unlock");
-    e = sem_post(pc->free_slots);
-    if(e) die("consumer post");
-    if(g.numBwt==0) break;
-    else {
-      if(g.verbose>2) printf("Working on range ["CUSTOM_FORMAT","CUSTOM_FORMAT")\n", g.symb_offset,g.symb_offset+g.mergeLen-1);
-      if(pc->hm)  holtMcMillan(&g, false);
-      else gap(&g, false);
-      // merge statistics 
-      for(int i=1;i<g.numBwt;i++) {
-        g.bwtLen[0] += g.bwtLen[i];
-        if(g.smallAlpha)
-          for(int j=0;j<g.sizeOfAlpha;j++)
-            g.bwtOcc[0][j] += g.bwtOcc[i][j];
-      }
-      assert(g.bwtLen[0]==g.mergeLen);
-      tot++;
-      // update # remaining segments when we reach 0 round is completed
-      e = pthread_mutex_lock(&pc->remutex); 
-      if(e) die("remaining locking in thread");
-      if(--pc->remaining==0) {
-        e = pthread_cond_signal(&pc->recond);
-        if(e) die("remaining signaling in thread");
-      }
-      e = pthread_mutex_unlock(&pc->remutex); 
-      if(e) die("remaining unlocking in thread");
-    }    
+  double busy=0;
+  int e = pthread_mutex_lock(&s->mutex); 
+  if(e) die("merger lock");
+  while(s->started<s->num) {
+    mergeTask *t = schedule_next(s);
+    if(t==NULL) { // wait for the completion of some merge 
+      e = pthread_cond_wait(&s->ready,&s->mutex);
+      if(e) die("merger wait");
+      continue;
+    }
+    t->started = true;
+    s->started++;
+    e = pthread_mutex_unlock(&s->mutex); 
+    if(e) die("merger unlock");
+    merge_task(s,t);
+    tot++; busy += t->secs;
+    e = pthread_mutex_lock(&s->mutex); 
+    if(e) die("merger lock");
+    s->completed++;
+    // the parent merge may have become ready, and other threads may have to exit 
+    if((t->parent!=NULL && --t->parent->waiting==0) || s->started==s->num) {
+      e = pthread_cond_broadcast(&s->ready);
+      if(e) die("merger broadcast");
+    }
   }
-  if(g.verbose>1)  printf("Thread terminated. %d merges processed\n",tot);
-  pthread_exit(NULL); 
+  e = pthread_mutex_unlock(&s->mutex); 
+  if(e) die("merger unlock");
+  if(s->input->verbose>1)  printf("Merger terminated. %d merges processed in %.3lf secs\n",tot,busy);
+  return NULL;
 }
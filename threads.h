@@ -2,8 +2,7 @@
 #define THREADS_H_INCLUDED
 
 #include "config.h"
-void pc_system_init(pc_system *pc, int);
-void pc_system_destroy(pc_system *pc);
+void schedule_init(mergeSchedule *s, mergeTask *task, int num, bool hm, g_data *input);
+void schedule_destroy(mergeSchedule *s);
 void *merger(void *v);
-void *squeezer(void *v);
 #endif
@@ -1,57 +1,92 @@
 #include <errno.h>
 #include <math.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "heap.h"
 
+static void *prefetch(void *arg);
+
 /********************************************************************************
-  Allocates an empty heap for at most n nodes.
+  Returns the number of runs that can be merged at once using RAM bytes, so
+  that each run gets two input buffers of at least MIN_INPUT_SIZE pairs.
+********************************************************************************/
+int heap_fanin(size_t runs, size_t RAM) {
+
+  size_t in = RAM - RAM/8; // see heap_alloc
+  size_t fanin = in/(2*MIN_INPUT_SIZE*sizeof(pair));
+
+  if(fanin>runs) fanin = runs;
+  if(fanin>INT_MAX/2) fanin = INT_MAX/2;
+  if(fanin<2) fanin = 2;
+
+  return (int) fanin;
+}
+
+/********************************************************************************
+  Allocates an empty tournament tree for at most n runs.
 
   Returns a pointer to the heap on success.  Returns null if no space is left in
   memory and sets errno to ENOMEM.
 ********************************************************************************/
 heap* heap_alloc(int heap_size, char* file_name, int level, int pos_size, int lcp_size, size_t RAM) {
-   
+
   heap* h = (heap*) malloc(sizeof(heap));
 
   if (!h) {
     errno = ENOMEM;
     return 0;
   }
-  
+
   h->heap = (heap_node**) malloc((heap_size+2)*sizeof(heap_node*));
-  if (!h->heap) {
+  h->keys = (pair*) malloc(heap_size*sizeof(pair));
+  h->tree = (int*) malloc(2*heap_size*sizeof(int));
+  h->queue = (int*) malloc(heap_size*sizeof(int));
+  if (!h->heap || !h->keys || !h->tree || !h->queue) {
+    free(h->heap); free(h->keys); free(h->tree); free(h->queue);
     free(h);
     errno = ENOMEM;
     return 0;
   }
-  
+
   int i;
   for(i=0; i<heap_size; i++)
     h->heap[i] = NULL;
-   
+
   h->size = 0;
-  
+  h->n = heap_size;
+  h->built = 0;
+
   //input file for all heap nodes
   strcpy(h->file_name, file_name);
- 
-  h->f_in = fopen(h->file_name, "rb"); 
-  if (!h->f_in) {perror ("fopen(heap_alloc)");  exit(EXIT_FAILURE);}
 
-//h->output_size = OUTPUT_SIZE;
-  h->output_size = 0.3*RAM/sizeof(pair);
+  h->fd = open(h->file_name, O_RDONLY);
+  if (h->fd<0) {perror ("open(heap_alloc)");  exit(EXIT_FAILURE);}
 
+  h->pos_size = pos_size;
+  h->lcp_size = lcp_size;
+
+  // with a RAM limit 1/8 goes to the output buffer and the rest to the two input
+  // buffers of each run, otherwise use the default buffer sizes
   #if OUTPUT_BUFFER
-    h->out_buffer = (pair*) malloc((h->output_size+1)*sizeof(pair));
+    h->output_size = RAM ? RAM/8 : OUTPUT_SIZE;
+    if(h->output_size<sizeof(pair)) h->output_size = sizeof(pair);
+    h->out_buffer = (uint8_t*) malloc(h->output_size);
     if(!h->out_buffer) {perror("malloc(heap_alloc)");   exit(EXIT_FAILURE);}
     h->out_idx = 0;
   #endif
+  h->out_fd = -1;
 
-  h->pos_size = pos_size;
-  h->lcp_size = lcp_size;
+  h->input_size = RAM ? ((RAM-RAM/8)/heap_size)/(2*sizeof(pair)) : INPUT_SIZE;
+  if(h->input_size<1) h->input_size = 1;
 
-  h->input_size = 0.7*(RAM/heap_size)/sizeof(pair);
-//h->input_size = INPUT_SIZE;
+  h->qhead = h->qcount = 0;
+  h->stop = 0;
+  pthread_mutex_init(&h->mutex, NULL);
+  pthread_cond_init(&h->request, NULL);
+  pthread_cond_init(&h->loaded, NULL);
+  if(pthread_create(&h->reader, NULL, prefetch, h)!=0) {perror("pthread_create(heap_alloc)"); exit(EXIT_FAILURE);}
 
   return h;
 }
@@ -60,180 +95,280 @@ heap* heap_alloc(int heap_size, char* file_name, int level, int pos_size, int lc
 
 void write_buffer(heap *h, FILE *f_out, int level) {
 
-  int i;
-  if(level){
-    for(i=0; i<h->out_idx; i++){
-      fwrite(&h->out_buffer[i], h->pos_size+h->lcp_size, 1, f_out);
-    }
-  }
-  else{
-    for(i=0; i<h->out_idx; i++){
-      uint64_t lcp = lcp(h->out_buffer[i]);
-      fwrite(&lcp, h->lcp_size, 1, f_out);
+  if(h->out_fd>=0){
+    size_t done = 0;
+    while(done<h->out_idx){
+      ssize_t e = pwrite(h->out_fd, h->out_buffer+done, h->out_idx-done, h->out_off+done);
+      if(e<=0) {perror(__func__); exit(1);}
+      done += e;
     }
+    h->out_off += done;
   }
+  else if(h->out_idx && fwrite(h->out_buffer, 1, h->out_idx, f_out)!=h->out_idx) {perror(__func__); exit(1);}
   h->out_idx = 0;
 }
 
 #endif
 
+/********************************************************************************
+  Writes the output with pwrite to fd starting at offset, instead of f_out.
+  Used to write disjoint parts of the same file from several threads.
+********************************************************************************/
+void heap_output(heap *h, int fd, off_t offset) {
+
+  h->out_fd = fd;
+  h->out_off = offset;
+}
+
 /********************************************************************************
   Releases a heap from memory.
 ********************************************************************************/
 void heap_free(heap *h, FILE *f_out, int level) {
 
+  pthread_mutex_lock(&h->mutex);
+  h->stop = 1;
+  pthread_cond_signal(&h->request);
+  pthread_mutex_unlock(&h->mutex);
+  pthread_join(h->reader, NULL);
+  pthread_mutex_destroy(&h->mutex);
+  pthread_cond_destroy(&h->request);
+  pthread_cond_destroy(&h->loaded);
+
   int i;
   for (i=0; i<h->size; i++){
-    //fclose(h->heap[i]->f_in);
-    free(h->heap[i]->buffer);
+    free(h->heap[i]->buffer[0]);
+    free(h->heap[i]->buffer[1]);
     free(h->heap[i]);
   }
 
-  #if OUTPUT_BUFFER 
-    if(h->out_idx) write_buffer(h, f_out, level);
+  #if OUTPUT_BUFFER
+    write_buffer(h, f_out, level);
     free(h->out_buffer);
   #endif
-  
-  fclose(h->f_in);
-      
+
+  close(h->fd);
+
+  free(h->queue);
+  free(h->tree);
+  free(h->keys);
   free(h->heap);
   free(h);
 }
 
 /********************************************************************************
-   Moves the node at position i up in the heap.
+  Plays the matches from the leaf of run i up to the root.
 ********************************************************************************/
-void heapfy_up(heap *h, int i) {
-
-  int p = (int) floor((i-1)/2);
-
-  while (i>0 && key(i) < key(p)) {  
-      
-    heap_node *auxn = h->heap[i];
-    h->heap[i] = h->heap[p];
-    h->heap[p] = auxn;
+static void replay(heap *h, int i) {
+
+  int w = i;
+  pair k = h->keys[w];
+  int t;
+
+  // the loser stays, the winner goes up (without branches, the outcome
+  // of the matches is unpredictable)
+  for(t=(i+h->size)/2; t>0; t/=2){
+    int l = h->tree[t];
+    pair kl = h->keys[l];
+    int up = kl < k;
+    h->tree[t] = up ? w : l;
+    w = up ? l : w;
+    k = up ? kl : k;
+  }
+  h->tree[0] = w;
+}
 
-    i = p;
-    p = (int) floor((i-1)/2);
+/********************************************************************************
+  Builds the tree bottom up: win[] holds the winners of the matches and
+  tree[] keeps the losers.
+********************************************************************************/
+static void build(heap *h) {
+
+  int n = h->size, t;
+  int *win = (int*) malloc((2*n+1)*sizeof(int));
+  if(!win) {perror(__func__); exit(EXIT_FAILURE);}
+
+  if(n==0) h->keys[0] = MAX_KEY; // no runs
+  for(t=0; t<n; t++) win[n+t] = t;
+  for(t=n-1; t>0; t--){
+    int a = win[2*t], b = win[2*t+1];
+    if(h->keys[b] < h->keys[a]) {win[t] = b; h->tree[t] = a;}
+    else {win[t] = a; h->tree[t] = b;}
   }
+  h->tree[0] = n>1 ? win[1] : 0;
+
+  free(win);
+  h->built = 1;
 }
 
 /********************************************************************************
-  Moves the node at position i down in the heap.
+  Reads the next block of the run into buffer b. The pairs are read packed
+  at the end of the buffer and expanded in place from the first one, which
+  never overwrites a packed pair not yet expanded.
+
 ********************************************************************************/
-void heapfy_down(heap *h, int i) {
-
-  int last = h->size-1;
-
-  // Selects the child s of i with smaller cost:
-  int l = 2*i+1;
-  int r = l+1;
-  int s;
-  if (r <= last)
-    s = key(l) < key(r) ? l : r;    
-  else if (l == last)
-    s = l;
-  else
-    return;
-
-  // Swaps down:
-  while (key(i) > key(s)) {   
-    
-    heap_node *aux = h->heap[i];
-    h->heap[i] = h->heap[s];
-    h->heap[s] = aux;
-
-    i = s;
-    l = 2*i+1;
-    r = l+1;
-
-    if (r <= last)
-      s = key(l) < key(r) ? l : r;      
-    else if (l == last)
-      s = l;
-    else
-      return;
+
+static void read_buffer(heap *h, heap_node *node, int b){
+
+  size_t w = h->pos_size+h->lcp_size;
+  size_t n = node->end-node->seek;
+  if(n>h->input_size) n = h->input_size;
+
+  uint8_t *raw = (uint8_t*) (node->buffer[b]+h->input_size) - n*w;
+  size_t done = 0;
+  while(done<n*w){
+    ssize_t e = pread(h->fd, raw+done, n*w-done, (off_t) ((node->seek*w)+done));
+    if(e<=0) {perror(__func__); exit(1);}
+    done += e;
   }
+
+  size_t i;
+  for(i=0; i<n; i++){
+    pair p = 0;
+    memcpy(&p, raw+i*w, w);
+    node->buffer[b][i] = p;
+  }
+
+  node->len[b] = n;
+  node->seek += n;
 }
+
 /********************************************************************************
-  Reads the file into the buffer.
+  Prefetch thread: loads the idle buffer of the runs in the queue.
 
 ********************************************************************************/
 
-void  read_buffer(heap *h, heap_node *node){
+static void *prefetch(void *arg){
 
-//  fseek(h->f_in, node->seek*sizeof(pair), SEEK_SET);
-    fseek(h->f_in, node->seek*(h->pos_size+h->lcp_size), SEEK_SET);
+  heap *h = (heap*) arg;
 
-    int i;
-    for(i=0; i<h->input_size; i++){
-      node->buffer[i]=0;
-      int e = fread(&node->buffer[i], h->pos_size+h->lcp_size, 1, h->f_in);
-      if(e!=1) {perror(__func__); exit(1);}
-      if(node->buffer[i]==MAX_KEY) break; 
-    }
+  pthread_mutex_lock(&h->mutex);
+  while(1){
+    while(h->qcount==0 && !h->stop)
+      pthread_cond_wait(&h->request, &h->mutex);
+    if(h->qcount==0) break;
+    heap_node *node = h->heap[h->queue[h->qhead]];
+    h->qhead = (h->qhead+1)%h->n;
+    h->qcount--;
+    pthread_mutex_unlock(&h->mutex);
+
+    read_buffer(h, node, !node->cur);
 
-    node->seek += h->input_size;
+    pthread_mutex_lock(&h->mutex);
+    node->ready = 1;
+    pthread_cond_signal(&h->loaded);
+  }
+  pthread_mutex_unlock(&h->mutex);
+
+  return NULL;
+}
+
+// asks the prefetch thread to load the idle buffer of run i
+static void request_buffer(heap *h, int i){
+
+  pthread_mutex_lock(&h->mutex);
+  h->heap[i]->ready = 0;
+  h->queue[(h->qhead+h->qcount)%h->n] = i;
+  h->qcount++;
+  pthread_cond_signal(&h->request);
+  pthread_mutex_unlock(&h->mutex);
 }
 
 /********************************************************************************
-  Inserts a node in the heap. Open the file and load the buffer.
+  Inserts a run of size pairs starting at pair pos. Loads the first buffer and
+  starts the prefetch of the second one. The run ends with MAX_KEY, or is
+  a range of a run, which is exhausted after size pairs.
 
   Returns 0 on success.  If no space is left in memory then returns ENOMEM and
   sets errno to ENOMEM.
 
 ********************************************************************************/
-int heap_insert(heap *h, size_t pos) {
+int heap_insert(heap *h, size_t pos, size_t size) {
 
   if (!h->heap[h->size])
     h->heap[h->size] = malloc(sizeof(heap_node));
 
-  if (!h->heap[h->size]) 
+  if (!h->heap[h->size])
     return errno = ENOMEM;
 
   heap_node *node = h->heap[h->size];
 
-  //alloc buffer <pos, lcp>
-  node->buffer = (pair*) malloc(h->input_size*sizeof(pair));
-  if (!node->buffer) 
+  //alloc buffers <pos, lcp>
+  node->buffer[0] = (pair*) malloc(h->input_size*sizeof(pair));
+  node->buffer[1] = (pair*) malloc(h->input_size*sizeof(pair));
+  if (!node->buffer[0] || !node->buffer[1])
     return errno = ENOMEM;
   node->idx = 0;
-  
+  node->cur = 0;
+  node->len[1] = 0;
+
   //load buffer
   node->seek = pos;
-  read_buffer(h, node);
+  node->end = pos+size;
+  read_buffer(h, node, 0);
+  h->keys[h->size] = node->len[0] ? node->buffer[0][0] : MAX_KEY;
 
   #if DEBUG
-    int i;
-    for(i=0; i<h->input_size; i++) 
-      printf("<%lu, %lu (%lu)> ", lcp(node->buffer[i]), pos(node->buffer[i]), node->buffer[i]);
+    size_t i;
+    for(i=0; i<node->len[0]; i++)
+      printf("<%lu, %lu> ", lcp(node->buffer[0][i]), pos(node->buffer[0][i]));
     printf("**\n");
   #endif
-  
-  heapfy_up(h,h->size++);
+
+  node->ready = 1;
+  if(node->seek<node->end) request_buffer(h, h->size);
+  h->size++;
 
   return 0;
 }
 
+/********************************************************************************
+  Returns the key with minimum cost <pos, lcp>, MAX_KEY if all runs are
+  exhausted.
+********************************************************************************/
+pair heap_min(heap *h) {
+
+  if(!h->built) build(h);
+
+  return h->keys[h->tree[0]];
+}
+
 /********************************************************************************
   Removes the key with minimum cost <pos, lcp> and returns it.
 
-  The caller must ensure that the heap is not empty.
+  The caller must ensure that the heap is not empty, and should stop when the
+  minimum is MAX_KEY (all runs exhausted).
 ********************************************************************************/
 pair heap_delete_min(heap *h) {
 
-  heap_node *node = h->heap[0];
+  if(!h->built) build(h);
 
-  pair tmp=0;
-  tmp= node->buffer[node->idx];
+  int i = h->tree[0];
+  heap_node *node = h->heap[i];
 
-  if(++node->idx == h->input_size){ //load from disk
-    node->idx = 0; 
-    read_buffer(h, node);
+  pair tmp = h->keys[i];
+
+  if(++node->idx == node->len[node->cur]){ //switch to the prefetched buffer
+    pthread_mutex_lock(&h->mutex);
+    while(!node->ready)
+      pthread_cond_wait(&h->loaded, &h->mutex);
+    pthread_mutex_unlock(&h->mutex);
+    if(node->len[!node->cur]==0){ //end of a range of a run, see heap_insert
+      h->keys[i] = MAX_KEY;
+      replay(h, i);
+      return tmp;
+    }
+    node->cur = !node->cur;
+    node->idx = 0;
+    node->len[!node->cur] = 0;
+    if(node->seek<node->end) request_buffer(h, i);
   }
+  h->keys[i] = node->buffer[node->cur][node->idx];
+  // the runs are consumed in an unpredictable order: fetch the next lines of
+  // this one in cache, the hardware prefetcher does not follow so many streams
+  __builtin_prefetch(&node->buffer[node->cur][node->idx+16]);
+
+  replay(h, i);
 
-  heapfy_down(h,0);
-  
   return tmp;
 }
 
@@ -242,34 +377,19 @@ pair heap_delete_min(heap *h) {
 
 ********************************************************************************/
 void heap_write(heap *h, FILE* f_out, pair value, int level){
-  
-  if(level){
-    #if OUTPUT_BUFFER
-      h->out_buffer[h->out_idx++]= value;
-      if(h->out_idx==h->output_size){
-        write_buffer(h, f_out, level);
-        //fwrite(h->out_pair_buffer, sizeof(pair), h->out_idx, f_out);  
-        //h->out_idx=0;
-      }   
-    #else
-      //uint64_t pos = pos(value);
-      //uint64_t lcp = lcp(value);
-      //fwrite(&lcp, h->lcp_size, 1, f_out);
-      //fwrite(&pos, h->pos_size, 1, f_out);
-      fwrite(&value, h->pos_size+h->lcp_size, 1, f_out);
-    #endif
-  }
-  else{
-    #if OUTPUT_BUFFER   
-      //h->out_lcp_buffer[h->out_idx] = value.lcp;
-      h->out_buffer[h->out_idx++] = value;
-      if(h->out_idx==h->output_size){
-        write_buffer(h, f_out, level);
-      }
-    #else
-      uint64_t lcp = lcp(value);
-      fwrite(&lcp, h->lcp_size, 1, f_out);  
-    #endif
-  }
-  
+
+  size_t w = level ? h->pos_size+h->lcp_size : h->lcp_size;
+
+  #if OUTPUT_BUFFER
+    if(h->out_idx+w>h->output_size)
+      write_buffer(h, f_out, level);
+    memcpy(h->out_buffer+h->out_idx, &value, w);
+    h->out_idx += w;
+  #else
+    if(h->out_fd>=0){
+      if(pwrite(h->out_fd, &value, w, h->out_off)!=w) {perror(__func__); exit(1);}
+      h->out_off += w;
+    }
+    else fwrite(&value, w, 1, f_out);
+  #endif
 }
@@ -7,18 +7,20 @@
 #include <limits.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/types.h>
 
 
 typedef __uint128_t uint128_t;
 
-static const uint128_t mask[9] = { 
+static const uint128_t mask[9] = {
 0,
 0xFF,             // 1 byte
 0xFFFF,           // 2 bytes
 0xFFFFFF,         // 3 bytes
-0xFFFFFFFF,       // 4 ... 
-0xFFFFFFFFFF,     // 5 
-0xFFFFFFFFFFFF,   // 6  
+0xFFFFFFFF,       // 4 ...
+0xFFFFFFFFFF,     // 5
+0xFFFFFFFFFFFF,   // 6
 0xFFFFFFFFFFFFFF, // 7
 0xFFFFFFFFFFFFFFFF// 8
 };
@@ -26,8 +28,8 @@ static const uint128_t mask[9] = {
 #define pos(i) ((uint64_t)(i>>((h->lcp_size)*8)))
 #define lcp(i) ((uint64_t)(i&mask[h->lcp_size]))
 
-//sorting key is <pos>
-#define key(i) ((uint128_t)((h->heap[i]->buffer[h->heap[i]->idx])))
+//sorting key is <pos>, the winner of the tournament is h->tree[0]
+#define key(i) (heap_min(h))
 //#define MAX_KEY ((uint128_t)(~0ULL)&mask[h->pos_size])
 #define MAX_KEY ((uint128_t)(((mask[8]<<64)|(~0ULL))>>((16-(h->pos_size+h->lcp_size))*8)))
 
@@ -37,16 +39,22 @@ static const uint128_t mask[9] = {
 #define DEBUG 1
 #endif
 
+// pairs in each of the two input buffers of a run without a RAM limit
 #ifndef INPUT_SIZE
-#define INPUT_SIZE 1024/sizeof(pair) //1K
+#define INPUT_SIZE (1<<14) //256K
+#endif
+
+// smallest input buffer (in pairs) when the fan-in is derived from the RAM
+#ifndef MIN_INPUT_SIZE
+#define MIN_INPUT_SIZE (1<<12) //64K
 #endif
 
 #ifndef OUTPUT_BUFFER
-#define OUTPUT_BUFFER 1 
+#define OUTPUT_BUFFER 1
 #endif
 
 #if OUTPUT_BUFFER
-#define OUTPUT_SIZE 4096/sizeof(pair) //4K
+#define OUTPUT_SIZE (1<<20) // bytes
 #endif
 
 //typedef struct pair{
@@ -56,47 +64,67 @@ static const uint128_t mask[9] = {
 //typedef uint64_t pair;
 typedef uint128_t pair;
 
-// struct representing a file of [position|lcpValue] pairs
+// a sorted run of [position|lcpValue] pairs ending with MAX_KEY (or a range of it).
+// The pairs are merged from buffer[cur] while buffer[!cur] is
+// loaded by the prefetch thread
 typedef struct heap_node{
-  //uint64_t key;         // next key to be sorted
-  //FILE *f_in;           // file containing the other pairs
-  //size_t  seek;
-  //uint64_t tot_size;    // total number of lcp values in file
-  						// useful only for an extra check
-  pair *buffer;	
-  int idx; 
-  size_t seek;
-  
+  pair *buffer[2];
+  size_t len[2];  // pairs loaded in each buffer
+  int cur;        // buffer being merged
+  int ready;      // buffer[!cur] has been loaded
+  size_t idx;
+  size_t seek;    // next pair to be read from the input file
+  size_t end;     // end of the run in the input file
 } heap_node;
 
 
+// tournament (loser) tree over at most n runs: tree[0] is the run
+// with the smallest key, tree[1..size-1] the losers of the matches
 typedef struct heap {
   heap_node** heap;
-  
-  int size;  
+  pair *keys;     // current key of each run
+  int *tree;
+  int built;
+
+  int size;
+  int n;
   char file_name[500];
-  
-  FILE* f_in;
-  
+
+  int fd;
+
   #if OUTPUT_BUFFER
-    pair *out_buffer;
-    int out_idx;
+    uint8_t *out_buffer;
+    size_t out_idx;
   #endif
-  
+  int out_fd;     // see heap_output
+  off_t out_off;
+
   int pos_size;
   int lcp_size;
 
 	size_t input_size;
 	size_t output_size;
 
+  // prefetch of the input buffers
+  pthread_t reader;
+  pthread_mutex_t mutex;
+  pthread_cond_t request, loaded;
+  int *queue;
+  int qhead, qcount;
+  int stop;
+
 } heap;
 
 /**********************************************************************/
 
+int heap_fanin(size_t runs, size_t RAM);
+
 heap* heap_alloc(int n, char* file_name, int level, int pos_size, int lcp_size, size_t RAM);
 void heap_free(heap* h, FILE *f_out, int level);
+void heap_output(heap *h, int fd, off_t offset);
 
-int heap_insert(heap *h, size_t pos);
+int heap_insert(heap *h, size_t pos, size_t size);
+pair heap_min(heap *h);
 pair heap_delete_min(heap *h);
 
 void heap_write(heap *h, FILE* f_out, pair tmp, int level);
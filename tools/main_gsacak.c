@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
 #include "lib/file.h"
 #include "lib/suffix_array.h"
 #include "lib/lcp_array.h"
@@ -42,6 +43,7 @@ void usage(char *name){
   puts("Available options:");
   puts("\t-h      this help message");
   puts("\t-m RAM  available memory in MB (def: no limit)");
+  puts("\t-t N    process N chunks at the same time sharing the available memory (def: 1)");
   puts("\t-o OUT  base name for output files (def: FILE)");
   puts("\t-l      compute LCP array as well (use only with option -s)");
   puts("\t-c      check SA and LCP");
@@ -49,6 +51,9 @@ void usage(char *name){
   puts("\t-q      output QS sequences permuted according to the BWT (ext: .qs)");
   puts("\t-b      output BWT (ext: .bwt)");
   puts("\t-r      output RLE(BWT) (ext: .rle.bwt)");
+  puts("\t-P G    output the BWTs of each group of G chunks in a separate part");
+  puts("\t        (ext: .part<j>.bwt .part<j>.size), the .size file of a part is");
+  puts("\t        created only when all its chunks have been written");
   puts("\t-g D    output LCP in gap format D bytes per entry (ext: .D.lcp)");
   puts("\t-x      extract individual input files and stop");
   puts("\t-X      convert input to raw+len format (ext: .cat .len) and stop");
@@ -62,187 +67,79 @@ void usage(char *name){
 
 /*******************************************************************/
 
-int main(int argc, char** argv){
-  extern char *optarg;
-  extern int optind, opterr, optopt;
-  
-  // parse command line
-  int VALIDATE=0, OutputSA=0, LCP_COMPUTE=0, DA_COMPUTE=0, ComputeQS=0;
-  int_t k=0;
-  int Verbose=0, OutputGapLcp=0, OutputBwt=0, OutputDA=0, Extract=0, Reversed=0, c; // len_file=0;
-  char *c_file=NULL, *outfile=NULL;
-  size_t RAM=0;
-
-  while ((c=getopt(argc, argv, "cs:lvXbrg:hm:o:Rd:q")) != -1) {
-    switch (c) 
-      {
-      case 'c':
-        VALIDATE=1; break;          // validate output
-      case 's':
-        OutputSA=atoi(optarg); break;   // output SA 
-      case 'q':
-        ComputeQS=1; break;         // output QS
-      case 'l':
-        LCP_COMPUTE=1;  break;      // compute LCP 
-      case 'v':
-        Verbose++; break;
-      case 'X':                     // TO BE TESTED (not sure if useful)
-        Extract+=2; break;          // extract input sequences and concatenate them into a single file   
-      case 'b':
-        OutputBwt+=1; break;        // output BWT  
-      case 'r':
-        OutputBwt+=2; break;        // output RLE(BWT)
-      case 'g':
-        OutputGapLcp=atoi(optarg); LCP_COMPUTE=1; break;  // compute LCP and output in Gap format 
-      case 'h':
-        usage(argv[0]); break;       // show usage and stop
-      case 'm':
-        RAM=(size_t)atoi(optarg)*MB; break;
-      case 'o':
-        outfile = optarg; break;     // output file base name  
-      case 'R':
-        Reversed++; break;
-      case 'd':
-        OutputDA=atoi(optarg); DA_COMPUTE=1; break;
-      case '?':
-        exit(EXIT_FAILURE);
-      }
-  }
-
-  if(optind+2==argc) {
-    c_file=argv[optind++];
-    k = (int_t) atoi(argv[optind++]);
-  }
-  else  usage(argv[0]);
-  // if no outfile base name was givem use the input file name 
-  if(outfile==NULL)
-    outfile= c_file; 
-
-  if(OutputGapLcp!=0 && OutputGapLcp!=1 && OutputGapLcp!=2 && OutputGapLcp!=4) {
-    puts("Invalid lcp size!! Must be 1, 2 or 4\n");
-    usage(argv[0]);
-  }
-  
-  if(Verbose>0) {
-    puts("Command line:");
-    int i;
-    for(i=0;i<argc;i++)
-      printf(" %s",argv[i]);
-    puts("");
-  }
-
-  // inits 
-  time_t t_start=0, t_total=0;
-  clock_t c_start=0, c_total=0;
-  int_t i;
-
-  printf("##\n");
-  if(RAM){
-    if(RAM<pow(2,20)) printf("RAM = %.2lf KB\n", RAM/pow(2,10));
-    else if (RAM>=pow(2,20) && RAM<pow(2,30)) printf("RAM = %.2lf MB\n", RAM/pow(2,20));
-    else printf("RAM = %.2lf GB\n", (double)RAM/pow(2,30));
-    //fprintf(stderr,"RAM = %.2lf GB\n", (double)RAM/pow(2,30));
-  }
-  else printf("RAM = unlimited\n");
-
-  // number of arrays used by the algorithm  
-  int arrays = 1;
-  if(LCP_COMPUTE) arrays++;
-  if(DA_COMPUTE) arrays++;
-  
-  printf("==> RAM = %zu\n", RAM);
-
-  // compute chuck size as a function of RAM 
-  size_t chunk_size;
-  if(RAM) chunk_size = RAM/(sizeof(int_t)*arrays+1.0+ComputeQS);
-  else chunk_size = WORD-1;
-  printf("max(chunk) = %lu symbols\n", chunk_size);
-  if(chunk_size>=WORD){
-    fprintf(stderr, "ERROR: Requested subcollection larger than %.1lf GB (%.1lf GB)\n", WORD/pow(2,30), (double)chunk_size/pow(2,30));
-    if(sizeof(int_t)<8) fprintf(stderr, "Please use %s-64\n", argv[0]);
-    exit(EXIT_FAILURE);
-  }
-
-  size_t n=0;
-  FILE* f_in = file_open(c_file, "rb");
-  if(!f_in) return 0;
-
-
-  //number of chunks
-  int_t chunks = 0;
-  //pos[i] stores the position of chunk C_i in the file
-  ssize_t* pos = NULL; 
-  //K[i] stores the number of strings into chunk C_i
-  int_t* K = file_count_multiple(c_file, &k, chunk_size, &chunks, &n, f_in, &pos);
-
-  printf("K = %" PRIdN "\n", k);
-  printf("N = %zu\n", n+1);
-
-  printf("CHUNKS = %" PRIdN "\n", chunks);
-  printf("sizeof(int_t) = %zu bytes\n", sizeof(int_t));
-  printf("##\n");
-  //for(i=0; i<chunks; i++) printf("K[%" PRIdN "] = %" PRIdN "\t %zu\n", i, K[i], pos[i]);
-/**/
-
-  int_t b=0;
-  time_start(&t_total, &c_total);
-
-  if(Verbose){
-    printf("CHUNK\tSTRINGS\tLENGHT\n");
-  }
-
-  // files used for multi BWT, LCP and their lengths 
-  FILE *f_cat = NULL, *f_len = NULL, *f_bwt = NULL, *f_lcp = NULL, *f_da = NULL, *f_sa = NULL, *f_qs = NULL;
-  FILE *f_size = NULL; //size of each chunk
-  FILE *f_docs = NULL; //number of documents in each chunk
-
-  if(Extract>1){
-    char s[500]; 
-    snprintf(s,500,"%s.%" PRIdN ".cat",outfile,k);
-    f_cat=fopen(s,"wb");
-    snprintf(s,500,"%s.%" PRIdN ".cat.len",outfile,k);
-    f_len=fopen(s,"wb");
-  }
-  
-  if(OutputBwt) {
-    char s[500]; 
-    if(OutputBwt==1) snprintf(s,500,"%s.bwt",outfile); 
-    else snprintf(s,500,"%s.rle.bwt",outfile);
-    f_bwt = file_open(s, "wb");
-    snprintf(s,500,"%s.size",outfile);
-    f_size = file_open(s, "wb");
-  }
+// open the bwt and size files of part j: the size file is written
+// with extension .size.tmp and renamed by part_close()
+static void part_open(char *outfile, int j, int rle, FILE **f_bwt, FILE **f_size){
+  char s[500];
+  snprintf(s,500,"%s.part%d.%s",outfile,j,rle?"rle.bwt":"bwt");
+  *f_bwt = file_open(s, "wb");
+  snprintf(s,500,"%s.part%d.size.tmp",outfile,j);
+  *f_size = file_open(s, "wb");
+}
 
-  if(OutputGapLcp){
-    char s[500]; 
-    snprintf(s,500,"%s.%d.lcp",outfile,OutputGapLcp);
-    f_lcp = file_open(s, "wb");
-  }
+// close the files of part j: the appearance of its .size file signals
+// to other processes that the part is complete
+static void part_close(char *outfile, int j, FILE *f_bwt, FILE *f_size){
+  char s[500], t[500];
+  if(fclose(f_bwt)!=0 || fclose(f_size)!=0) die(__func__);
+  snprintf(s,500,"%s.part%d.size.tmp",outfile,j);
+  snprintf(t,500,"%s.part%d.size",outfile,j);
+  if(rename(s,t)!=0) die(__func__);
+}
 
-  if(DA_COMPUTE) {
-    char s[500]; 
-    snprintf(s,500,"%s.%d.da_bl",outfile,OutputDA); 
-    f_da = file_open(s, "wb");
-    snprintf(s,500,"%s.docs",outfile);
-    f_docs = file_open(s, "wb");
-  }
+/*******************************************************************/
 
-  if(OutputSA) {
-    char s[500]; 
-    snprintf(s,500,"%s.%d.sa_bl",outfile,OutputSA); 
-    f_sa = file_open(s, "wb");
-  }
+// data shared by the threads computing the chunks (option -t):
+// each thread loads a chunk and runs gsacak on it, then waits
+// until the previous chunks have been written and writes its output
+typedef struct {
+  char *c_file, *outfile;
+  int VALIDATE, OutputSA, LCP_COMPUTE, DA_COMPUTE, ComputeQS;
+  int Verbose, OutputGapLcp, OutputBwt, OutputDA, Extract, Reversed, Parts;
+  int_t chunks;
+  int_t *K;         // K[i] stores the number of strings into chunk C_i
+  ssize_t *pos;     // pos[i] stores the position of chunk C_i in the file
+  FILE *f_cat, *f_len, *f_bwt, *f_lcp, *f_da, *f_sa, *f_qs, *f_size, *f_docs;
+  pthread_mutex_t mutex;
+  pthread_cond_t turn;
+  int_t next;       // next chunk to be computed
+  int_t written;    // chunks whose output has been written
+  size_t curr;      // documents in the chunks written
+  size_t sum;       // symbols in the chunks written
+} chunk_data;
+
+// wait until chunks 0..b-1 have been written
+static void wait_turn(chunk_data *d, int_t b){
+  if(pthread_mutex_lock(&d->mutex)) die(__func__);
+  while(d->written!=b)
+    if(pthread_cond_wait(&d->turn,&d->mutex)) die(__func__);
+  if(pthread_mutex_unlock(&d->mutex)) die(__func__);
+}
 
-  if(ComputeQS) {
-    char s[500]; 
-    snprintf(s,500,"%s.bwt.qs_bl",outfile); 
-    f_qs = file_open(s, "wb");
-  }
+// chunk b has been written: wake up the thread waiting to write chunk b+1
+static void end_turn(chunk_data *d, int_t b){
+  if(pthread_mutex_lock(&d->mutex)) die(__func__);
+  assert(d->written==b);
+  d->written++;
+  if(pthread_cond_broadcast(&d->turn)) die(__func__);
+  if(pthread_mutex_unlock(&d->mutex)) die(__func__);
+}
 
-  size_t curr=0;
-  size_t sum=0;
-  // processing of individual chunks 
-  for(b=0; b<chunks; b++){
+// processing of individual chunks 
+static void *chunk_worker(void *v){
+  chunk_data *d = (chunk_data *) v;
+  int_t i;
+  time_t t_start=0;
+  clock_t c_start=0;
+  // each thread reads the input file with its own FILE
+  FILE* f_in = file_open(d->c_file, "rb");
+  if(!f_in) die(__func__);
+
+  for(;;){
+    if(pthread_mutex_lock(&d->mutex)) die(__func__);
+    int_t b = d->next++;
+    if(pthread_mutex_unlock(&d->mutex)) die(__func__);
+    if(b>=d->chunks) break;
 
     unsigned char **R;
     size_t len=0;
@@ -251,37 +148,39 @@ int main(int argc, char** argv){
     //if(len_file==0)
     int_t bl = b;
     #if REVERSE_SCHEME==2
-      if(Reversed) bl = chunks-(b+1);
+      if(d->Reversed) bl = d->chunks-(b+1);
     #endif
-    fseek(f_in, pos[bl], SEEK_SET);
+    fseek(f_in, d->pos[bl], SEEK_SET);
 
-    R = (unsigned char**) file_load_multiple_chunks(c_file, K[bl], &len, f_in);
+    R = (unsigned char**) file_load_multiple_chunks(d->c_file, d->K[bl], &len, f_in);
     if(!R){
-      fprintf(stderr, "Error: less than %" PRIdN " strings in %s\n", K[bl], c_file);
-      return 0;
+      fprintf(stderr, "Error: less than %" PRIdN " strings in %s\n", d->K[bl], d->c_file);
+      exit(EXIT_FAILURE);
     }
 
     // now R[0] ... R[K[bl]-1] contains the input documents  
-    if(Verbose)
-      printf("%" PRIdN "\t%" PRIdN "\t(%lu)\t%zu\n", bl, K[bl], len, pos[bl]);
+    if(d->Verbose)
+      printf("%" PRIdN "\t%" PRIdN "\t(%lu)\t%zu\n", bl, d->K[bl], len, d->pos[bl]);
         
-    if(Extract>1) {   // save documents in chunk bl in raw cat+len forma
-      for(i=0;i<K[bl];i++) {
+    if(d->Extract>1) {   // save documents in chunk bl in raw cat+len forma
+      wait_turn(d,b);
+      for(i=0;i<d->K[bl];i++) {
         uint64_t j = 1 + strlen((char *)R[i]);
         #if  __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-          size_t z = fwrite(&j,4,1,f_len);
+          size_t z = fwrite(&j,4,1,d->f_len);
           assert(z==1); 
         #else
-          fputc(j,f_len); fputc(j>>8,f_len); fputc(j>>16,f_len); fputc(j>>24,f_len);
+          fputc(j,d->f_len); fputc(j>>8,d->f_len); fputc(j>>16,d->f_len); fputc(j>>24,d->f_len);
         #endif
-        size_t r = fwrite((char *)R[i],1,strlen((char *)R[i]),f_cat);
+        size_t r = fwrite((char *)R[i],1,strlen((char *)R[i]),d->f_cat);
         if(r!=strlen((char *)R[i])) die(__func__);
-        if(fputc(0,f_cat)!=0) {
+        if(fputc(0,d->f_cat)!=0) {
           perror("Error writing EOS char"); die(__func__);
         }
       }
+      end_turn(d,b);
       //free memory
-      for(i=0; i<K[bl]; i++) free(R[i]);
+      for(i=0; i<d->K[bl]; i++) free(R[i]);
       free(R);
       continue; // go to next chunk
     }
@@ -290,20 +189,19 @@ int main(int argc, char** argv){
     //concatenate strings R[i] to str
     unsigned char *str = NULL;
 
-    if(!Reversed) str = cat_char(R, K[bl], &len);
-    else  str = cat_char_rev(R, K[bl], &len);
+    if(!d->Reversed) str = cat_char(R, d->K[bl], &len);
+    else  str = cat_char_rev(R, d->K[bl], &len);
 
     #if DEBUG
-      int_t i;
       for(i=0;i<min(10,len); i++)
          printf("%" PRIdN ") %d\n", i, str[i]);
       printf("\n");
 
       printf("R:\n");
-      for(i=0; i<min(5,K[bl]); i++){
+      for(i=0; i<min(5,d->K[bl]); i++){
         printf("%" PRIdN ") %s (%zu)\n", i, R[i], strlen((char*)R[i]));
       }
-      if(Reversed){
+      if(d->Reversed){
        printf("Reverse scheme: %d\n", REVERSE_SCHEME);
        int count=0;
         printf("T^rev = ");
@@ -317,7 +215,7 @@ int main(int argc, char** argv){
     #endif
   
     //free memory
-    for(i=0; i<K[bl]; i++) free(R[i]);
+    for(i=0; i<d->K[bl]; i++) free(R[i]);
     free(R);
 
     // alloc and init SA 
@@ -326,36 +224,40 @@ int main(int argc, char** argv){
     int_t depth=0;
     // alloc and init LCP if necessary  
     int_t *LCP = NULL;  
-    if(LCP_COMPUTE){
+    if(d->LCP_COMPUTE){
       LCP = (int_t*) malloc(len*sizeof(int_t));
       for(i=0; i<len; i++) LCP[i]=0;
     }
     int_t *DA = NULL;
-    if(DA_COMPUTE){
+    if(d->DA_COMPUTE){
       DA = (int_t*) malloc(len*sizeof(int_t));
       for(i=0; i<len; i++) DA[i]=0;
     }
     
-    if(Verbose)
+    if(d->Verbose)
       time_start(&t_start, &c_start);
   
     // computation of SA, DA and possibly LCP
     depth = gsacak((unsigned char*)str, (uint_t*)SA, LCP, DA, len);
 
-    if(Verbose) {
+    if(d->Verbose) {
       fprintf(stderr,"gsacak returned depth: %"PRIdN"\n", depth);
       fprintf(stderr,"%.6lf\n", time_stop(t_start, c_start));
     }
+
+    // the output of the chunks is written in the order of the chunks
+    wait_turn(d,b);
   
     // output BWT  
-    if(OutputBwt) {
+    if(d->OutputBwt) {
       int c; int_t i;
+      if(d->Parts && b%d->Parts==0) part_open(d->outfile,b/d->Parts,d->OutputBwt>1,&d->f_bwt,&d->f_size);
       for(i=0; i<len; i++) {
         if(i==0)
           assert(SA[i]==len-1);
         else {
           c = bwt(SA[i],str);
-          if(OutputBwt>1){ //RLE for DNA sequences        
+          if(d->OutputBwt>1){ //RLE for DNA sequences        
           unsigned char run=1;
           while(i+1<len && bwt(SA[i+1],str)==c && run<32){
             run++;i++;
@@ -368,34 +270,35 @@ int main(int argc, char** argv){
             printf("%d\n", c);
           #endif
           }
-          int err = fputc(c,f_bwt);
+          int err = fputc(c,d->f_bwt);
           if(err==EOF) die(__func__);
         }
       }
       // write BWT size to file 
       size_t len1 = len-1;
-      fwrite(&len1,sizeof(size_t), 1, f_size);
+      fwrite(&len1,sizeof(size_t), 1, d->f_size);
+      if(d->Parts && (b%d->Parts==d->Parts-1 || b==d->chunks-1)) part_close(d->outfile,b/d->Parts,d->f_bwt,d->f_size);
     }
 
     // output DA alone
-    if(DA_COMPUTE){
+    if(d->DA_COMPUTE){
       //for(i=0; i<len; i++) DA[i]+=curr;
-      size_t docs = K[bl];
-      fwrite(&docs, sizeof(size_t), 1, f_docs);
+      size_t docs = d->K[bl];
+      fwrite(&docs, sizeof(size_t), 1, d->f_docs);
       //printf("curr = %" PRIdN "\n", K[bl]);
-      file_write_array(f_da, DA+1, len-1, OutputDA);//ignore the first DA-value
+      file_write_array(d->f_da, DA+1, len-1, d->OutputDA);//ignore the first DA-value
     }
 
-    if(Verbose>2) {
-      if(LCP_COMPUTE) lcp_array_print((unsigned char*)str, SA, LCP, min(20,len), sizeof(char)); 
+    if(d->Verbose>2) {
+      if(d->LCP_COMPUTE) lcp_array_print((unsigned char*)str, SA, LCP, min(20,len), sizeof(char)); 
       else suffix_array_print((unsigned char*)str, SA, min(10,len), sizeof(char));
     }
   
     // validate 
-    if(VALIDATE){
+    if(d->VALIDATE){
       if(!suffix_array_check((unsigned char*)str, SA, len, sizeof(char), 1)) printf("isNotSorted!!\n");//compares until the separator=1
       else printf("isSorted!!\ndepth = %" PRIdN "\n", depth);
-      if(LCP_COMPUTE){
+      if(d->LCP_COMPUTE){
         if(!lcp_array_check_phi((unsigned char*)str, SA, LCP, len, sizeof(char), 1)) printf("isNotLCP!!\n");
         else printf("isLCP!!\n");
       }
@@ -403,32 +306,32 @@ int main(int argc, char** argv){
   
     free(str);
 
-    if(ComputeQS){
-      fseek(f_in, pos[bl], SEEK_SET);
-      unsigned char **QS = (unsigned char**) file_load_multiple_qs_chunks(c_file, K[bl], f_in);
+    if(d->ComputeQS){
+      fseek(f_in, d->pos[bl], SEEK_SET);
+      unsigned char **QS = (unsigned char**) file_load_multiple_qs_chunks(d->c_file, d->K[bl], f_in);
 
       len--;
-      str = cat_char(QS, K[bl], &len);
+      str = cat_char(QS, d->K[bl], &len);
 
       int c; int_t i;
       for(i=1; i<len; i++) {
         //if(i==0) assert(SA[i]==len-1);
         //else {
           c = (!SA[i])?0:((str[SA[i]-1]>1)?str[SA[i]-1]-1:0);
-          int err = fputc(c,f_qs);
+          int err = fputc(c,d->f_qs);
           if(err==EOF) die(__func__);
         //}
       }
 
       //free memory
-      for(i=0; i<K[bl]; i++) free(QS[i]);
+      for(i=0; i<d->K[bl]; i++) free(QS[i]);
       free(QS);
     }
    
     // output SA alone
-    if(OutputSA){
-      for(i=0; i<len; i++) SA[i]+=sum;
-      file_write_array(f_sa, SA+1, len-1, OutputSA);//ignore the first SA-value
+    if(d->OutputSA){
+      for(i=0; i<len; i++) SA[i]+=d->sum;
+      file_write_array(d->f_sa, SA+1, len-1, d->OutputSA);//ignore the first SA-value
     }
 
     // output SA alone or SA&LCP together
@@ -443,9 +346,9 @@ int main(int argc, char** argv){
     }
     */
 
-    if(OutputGapLcp){
+    if(d->OutputGapLcp){
       uint64_t c; int_t i;
-      uint64_t lcp_limit = (1LL << (8*OutputGapLcp))-1;
+      uint64_t lcp_limit = (1LL << (8*d->OutputGapLcp))-1;
       for(i=1;i<len;i++) {  
         c = LCP[i];
         if(c>lcp_limit) {
@@ -453,20 +356,238 @@ int main(int argc, char** argv){
           fprintf(stderr,"   !!! Re-run using more bytes per LCP entry. Exiting...\n");
           exit(EXIT_FAILURE);
         }
-        fwrite(&c,OutputGapLcp, 1, f_lcp);
+        fwrite(&c,d->OutputGapLcp, 1, d->f_lcp);
       }
     }
 
+    d->curr+=d->K[bl];
+    d->sum+=len-1;
+    end_turn(d,b);
+
     // free SA (LCP) and concatenated input collection  
     free(SA);
-    if(LCP_COMPUTE) free(LCP);
-    if(DA_COMPUTE) free(DA);
-    
-    curr+=K[bl];
-    sum+=len-1;
+    if(d->LCP_COMPUTE) free(LCP);
+    if(d->DA_COMPUTE) free(DA);
 
   } // end chunks loop 
 
+  fclose(f_in);
+  return NULL;
+}
+
+/*******************************************************************/
+
+int main(int argc, char** argv){
+  extern char *optarg;
+  extern int optind, opterr, optopt;
+  
+  // parse command line
+  int VALIDATE=0, OutputSA=0, LCP_COMPUTE=0, DA_COMPUTE=0, ComputeQS=0;
+  int_t k=0;
+  int Verbose=0, OutputGapLcp=0, OutputBwt=0, OutputDA=0, Extract=0, Reversed=0, Parts=0, Threads=1, c; // len_file=0;
+  char *c_file=NULL, *outfile=NULL;
+  size_t RAM=0;
+
+  while ((c=getopt(argc, argv, "cs:lvXbrg:hm:o:Rd:qP:t:")) != -1) {
+    switch (c) 
+      {
+      case 'c':
+        VALIDATE=1; break;          // validate output
+      case 's':
+        OutputSA=atoi(optarg); break;   // output SA 
+      case 'q':
+        ComputeQS=1; break;         // output QS
+      case 'l':
+        LCP_COMPUTE=1;  break;      // compute LCP 
+      case 'v':
+        Verbose++; break;
+      case 'X':                     // TO BE TESTED (not sure if useful)
+        Extract+=2; break;          // extract input sequences and concatenate them into a single file   
+      case 'b':
+        OutputBwt+=1; break;        // output BWT  
+      case 'r':
+        OutputBwt+=2; break;        // output RLE(BWT)
+      case 'g':
+        OutputGapLcp=atoi(optarg); LCP_COMPUTE=1; break;  // compute LCP and output in Gap format 
+      case 'h':
+        usage(argv[0]); break;       // show usage and stop
+      case 'm':
+        RAM=(size_t)atoi(optarg)*MB; break;
+      case 'o':
+        outfile = optarg; break;     // output file base name  
+      case 't':
+        Threads=atoi(optarg); break; // chunks processed in parallel
+      case 'R':
+        Reversed++; break;
+      case 'd':
+        OutputDA=atoi(optarg); DA_COMPUTE=1; break;
+      case 'P':
+        Parts=atoi(optarg); break;  // output BWT in parts of Parts chunks
+      case '?':
+        exit(EXIT_FAILURE);
+      }
+  }
+
+  if(optind+2==argc) {
+    c_file=argv[optind++];
+    k = (int_t) atoi(argv[optind++]);
+  }
+  else  usage(argv[0]);
+  // if no outfile base name was givem use the input file name 
+  if(outfile==NULL)
+    outfile= c_file; 
+
+  if(OutputGapLcp!=0 && OutputGapLcp!=1 && OutputGapLcp!=2 && OutputGapLcp!=4) {
+    puts("Invalid lcp size!! Must be 1, 2 or 4\n");
+    usage(argv[0]);
+  }
+
+  if(Parts<0 || (Parts>0 && !OutputBwt)) {
+    puts("Option -P requires a positive number of chunks and option -b or -r\n");
+    usage(argv[0]);
+  }
+
+  if(Threads<1) {
+    puts("Option -t requires a positive number of threads\n");
+    usage(argv[0]);
+  }
+  
+  if(Verbose>0) {
+    puts("Command line:");
+    int i;
+    for(i=0;i<argc;i++)
+      printf(" %s",argv[i]);
+    puts("");
+  }
+
+  // inits 
+  time_t t_total=0;
+  clock_t c_total=0;
+  int_t i;
+
+  printf("##\n");
+  if(RAM){
+    if(RAM<pow(2,20)) printf("RAM = %.2lf KB\n", RAM/pow(2,10));
+    else if (RAM>=pow(2,20) && RAM<pow(2,30)) printf("RAM = %.2lf MB\n", RAM/pow(2,20));
+    else printf("RAM = %.2lf GB\n", (double)RAM/pow(2,30));
+    //fprintf(stderr,"RAM = %.2lf GB\n", (double)RAM/pow(2,30));
+  }
+  else printf("RAM = unlimited\n");
+
+  // number of arrays used by the algorithm  
+  int arrays = 1;
+  if(LCP_COMPUTE) arrays++;
+  if(DA_COMPUTE) arrays++;
+  
+  printf("==> RAM = %zu\n", RAM);
+
+  // compute chuck size as a function of RAM shared by the threads
+  size_t chunk_size;
+  if(RAM) chunk_size = RAM/(sizeof(int_t)*arrays+1.0+ComputeQS)/Threads;
+  else chunk_size = WORD-1;
+  printf("max(chunk) = %lu symbols\n", chunk_size);
+  if(chunk_size>=WORD){
+    fprintf(stderr, "ERROR: Requested subcollection larger than %.1lf GB (%.1lf GB)\n", WORD/pow(2,30), (double)chunk_size/pow(2,30));
+    if(sizeof(int_t)<8) fprintf(stderr, "Please use %s-64\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  size_t n=0;
+  FILE* f_in = file_open(c_file, "rb");
+  if(!f_in) return 0;
+
+
+  //number of chunks
+  int_t chunks = 0;
+  //pos[i] stores the position of chunk C_i in the file
+  ssize_t* pos = NULL; 
+  //K[i] stores the number of strings into chunk C_i
+  int_t* K = file_count_multiple(c_file, &k, chunk_size, &chunks, &n, f_in, &pos);
+
+  printf("K = %" PRIdN "\n", k);
+  printf("N = %zu\n", n+1);
+
+  printf("CHUNKS = %" PRIdN "\n", chunks);
+  printf("sizeof(int_t) = %zu bytes\n", sizeof(int_t));
+  printf("##\n");
+  //for(i=0; i<chunks; i++) printf("K[%" PRIdN "] = %" PRIdN "\t %zu\n", i, K[i], pos[i]);
+/**/
+
+  time_start(&t_total, &c_total);
+
+  if(Verbose){
+    printf("CHUNK\tSTRINGS\tLENGHT\n");
+  }
+
+  // files used for multi BWT, LCP and their lengths 
+  FILE *f_cat = NULL, *f_len = NULL, *f_bwt = NULL, *f_lcp = NULL, *f_da = NULL, *f_sa = NULL, *f_qs = NULL;
+  FILE *f_size = NULL; //size of each chunk
+  FILE *f_docs = NULL; //number of documents in each chunk
+
+  if(Extract>1){
+    char s[500]; 
+    snprintf(s,500,"%s.%" PRIdN ".cat",outfile,k);
+    f_cat=fopen(s,"wb");
+    snprintf(s,500,"%s.%" PRIdN ".cat.len",outfile,k);
+    f_len=fopen(s,"wb");
+  }
+  
+  if(OutputBwt && !Parts) {
+    char s[500]; 
+    if(OutputBwt==1) snprintf(s,500,"%s.bwt",outfile); 
+    else snprintf(s,500,"%s.rle.bwt",outfile);
+    f_bwt = file_open(s, "wb");
+    snprintf(s,500,"%s.size",outfile);
+    f_size = file_open(s, "wb");
+  }
+
+  if(OutputGapLcp){
+    char s[500]; 
+    snprintf(s,500,"%s.%d.lcp",outfile,OutputGapLcp);
+    f_lcp = file_open(s, "wb");
+  }
+
+  if(DA_COMPUTE) {
+    char s[500]; 
+    snprintf(s,500,"%s.%d.da_bl",outfile,OutputDA); 
+    f_da = file_open(s, "wb");
+    snprintf(s,500,"%s.docs",outfile);
+    f_docs = file_open(s, "wb");
+  }
+
+  if(OutputSA) {
+    char s[500]; 
+    snprintf(s,500,"%s.%d.sa_bl",outfile,OutputSA); 
+    f_sa = file_open(s, "wb");
+  }
+
+  if(ComputeQS) {
+    char s[500]; 
+    snprintf(s,500,"%s.bwt.qs_bl",outfile); 
+    f_qs = file_open(s, "wb");
+  }
+
+  chunk_data d = {
+    .c_file=c_file, .outfile=outfile,
+    .VALIDATE=VALIDATE, .OutputSA=OutputSA, .LCP_COMPUTE=LCP_COMPUTE, .DA_COMPUTE=DA_COMPUTE, .ComputeQS=ComputeQS,
+    .Verbose=Verbose, .OutputGapLcp=OutputGapLcp, .OutputBwt=OutputBwt, .OutputDA=OutputDA,
+    .Extract=Extract, .Reversed=Reversed, .Parts=Parts,
+    .chunks=chunks, .K=K, .pos=pos,
+    .f_cat=f_cat, .f_len=f_len, .f_bwt=f_bwt, .f_lcp=f_lcp, .f_da=f_da, .f_sa=f_sa, .f_qs=f_qs,
+    .f_size=f_size, .f_docs=f_docs,
+    .next=0, .written=0, .curr=0, .sum=0
+  };
+  if(pthread_mutex_init(&d.mutex,NULL) || pthread_cond_init(&d.turn,NULL)) die(__func__);
+  if(Threads>chunks) Threads = chunks;
+  pthread_t t[Threads];
+  for(i=0;i<Threads;i++)
+    if(pthread_create(&t[i],NULL,chunk_worker,&d)) die(__func__);
+  for(i=0;i<Threads;i++)
+    if(pthread_join(t[i],NULL)) die(__func__);
+  assert(d.written==chunks);
+  pthread_mutex_destroy(&d.mutex);
+  pthread_cond_destroy(&d.turn);
+
   fclose(f_in);
   free(K);
   free(pos);
@@ -479,7 +600,7 @@ int main(int argc, char** argv){
     fclose(f_cat);
   }
 
-  if(OutputBwt){
+  if(OutputBwt && !Parts){
    fclose(f_bwt);
    fclose(f_size);
   }
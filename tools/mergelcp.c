@@ -3,6 +3,10 @@
 #include <string.h>   
 #include <getopt.h>
 #include <limits.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
                     
 #include "heap.h"
 #if MALLOC_COUNT_FLAG
@@ -20,7 +24,7 @@
 #endif
 
 #ifndef HEAP_SIZE
-#define HEAP_SIZE 256 //must be larger than 1
+#define HEAP_SIZE 256 //must be larger than 1, used without -s and -m
 #endif
 
 #define MB 1048576
@@ -41,7 +45,31 @@ return f_in;
 
 /**********************************************************************/
 
-int heap_sort_level(heap *h, FILE *f_lcp, size_t *sum, char* c_file, int level, int k){
+//prefix for the files of a merge level: with scratch directories (option -X)
+//consecutive levels use different directories, so that each level reads
+//from one device and writes to another
+void level_prefix(char *prefix, char *c_file, char *dirs[], int ndirs, int level){
+
+  if(ndirs==0) {strcpy(prefix, c_file); return;}
+  char *base = strrchr(c_file, '/');
+  sprintf(prefix, "%s/%s", dirs[(level-1)%ndirs], base ? base+1 : c_file);
+}
+
+/**********************************************************************/
+
+//number of runs listed in a size file (the input one starts with n)
+size_t count_runs(char *c_size, int header){
+
+  struct stat st;
+  if(stat(c_size, &st)!=0) {perror(__func__); exit(EXIT_FAILURE);}
+
+return st.st_size/sizeof(size_t) - header;
+}
+
+/**********************************************************************/
+
+//first is the position of the first LCP entry written at level 0
+int heap_sort_level(heap *h, FILE *f_lcp, size_t *sum, char* c_file, int level, int k, size_t first){
   
   #if CHECK == 2
     char c_pos[PATH_MAX];
@@ -58,7 +86,7 @@ int heap_sort_level(heap *h, FILE *f_lcp, size_t *sum, char* c_file, int level,
   
   //pair sentinel; sentinel.pos=I_MAX; sentinel.lcp=I_MAX;
   pair sentinel; sentinel=MAX_KEY; //sentinel.lcp=I_MAX;
-  int64_t pos, curr=0;
+  int64_t pos, curr=first;
 
   while(key(0)!=sentinel){
   
@@ -70,14 +98,13 @@ int heap_sort_level(heap *h, FILE *f_lcp, size_t *sum, char* c_file, int level,
       pos=pos(tmp);
       if(k){
         pair aux=lcp(k); //k-truncated LCP-values
-        for(;curr<pos-1;curr++){
+        for(;curr<pos;curr++){ //curr is the next position to be written
           #if CHECK == 1
             fprintf(stderr,"%lu, %lu (lcp = %lu)\n", pos, curr, lcp(aux));
           #endif
           heap_write(h, f_lcp, aux, level);
           (*sum)++;
         }
-        curr=pos;
       }
     }
     /**/
@@ -96,9 +123,9 @@ int heap_sort_level(heap *h, FILE *f_lcp, size_t *sum, char* c_file, int level,
           printf("isNotSorted!!\n");
           return 0;
         }
-        curr++;
       }
     #endif
+    if(!level) curr++;
     
     #if DEBUG
       if(level) printf("<%lu, %lu [%llu]> ", lcp(tmp), pos(tmp), tmp);
@@ -124,6 +151,65 @@ return 1;
 
 /**********************************************************************/
 
+// final level with several threads: each one merges the pairs with positions
+// in [first,last) and writes their lcp values at their place in the output file
+typedef struct{
+  char *c_lcp;          // input pairs
+  size_t *start, *size; // runs in c_lcp, size includes MAX_KEY
+  size_t runs;
+  int pos_size, lcp_size, k;
+  size_t RAM;
+  int fd;               // output file
+  uint64_t first, last;
+  size_t total;         // lcp values written
+} range_t;
+
+//first pair of the run [lo,hi) with position >= p (binary search on the file)
+size_t run_lower_bound(int fd, size_t lo, size_t hi, uint64_t p, int pos_size, int lcp_size){
+
+  size_t w=pos_size+lcp_size;
+  while(lo<hi){
+    size_t mid=lo+(hi-lo)/2;
+    uint128_t x=0;
+    if(pread(fd, &x, w, (off_t)(mid*w))!=w) {perror(__func__); exit(EXIT_FAILURE);}
+    if((uint64_t)(x>>(lcp_size*8)) < p) lo=mid+1;
+    else hi=mid;
+  }
+return lo;
+}
+
+void *range_merge(void *arg){
+
+  range_t *r = (range_t*) arg;
+  heap *h = heap_alloc(r->runs>0?r->runs:1, r->c_lcp, 0, r->pos_size, r->lcp_size, r->RAM);
+  heap_output(h, r->fd, (off_t)r->first*r->lcp_size);
+
+  size_t i;
+  for(i=0; i<r->runs; i++){
+    size_t end=r->start[i]+r->size[i]-1; // skip MAX_KEY
+    size_t lo=run_lower_bound(h->fd, r->start[i], end, r->first, r->pos_size, r->lcp_size);
+    size_t hi=run_lower_bound(h->fd, lo, end, r->last, r->pos_size, r->lcp_size);
+    heap_insert(h, lo, hi-lo);
+  }
+
+  r->total=0;
+  heap_sort_level(h, NULL, &r->total, r->c_lcp, 0, r->k, r->first);
+
+  if(r->k){//complete LCP empty entries up to the end of the range
+    size_t curr=r->first+r->total;
+    pair aux=lcp(r->k);
+    for(;curr<r->last;curr++){
+      heap_write(h, NULL, aux, 0);
+      r->total++;
+    }
+  }
+
+  heap_free(h, NULL, 0);
+return NULL;
+}
+
+/**********************************************************************/
+
 void usage(char *name){
   printf("\n\tUsage: %s [options] FILE POS_SIZE LCP_SIZE \n\n",name);
   puts("Multiway k-merge sort for the lists of pairs <pos, lcp>.");
@@ -132,9 +218,12 @@ void usage(char *name){
   puts("Output:\tFILE.lcp contains <lcp> sorted by <pos>.\n");
   puts("Available options:");
   puts("\t-h\tthis help message");
-  puts("\t-s\tHEAP_SIZE");
+  puts("\t-s\tHEAP_SIZE (def. from -m, otherwise 256)");
   puts("\t-t\ttime");
   puts("\t-k\tk-truncated LCP merging");
+  puts("\t-m\tRAM in MBs for the merge buffers");
+  puts("\t-X\tcolon separated list of scratch directories for the intermediate levels");
+  puts("\t-p\tnumber of threads for the last level (def. 1)");
   puts("\t-v\tverbose\n");
   exit(EXIT_FAILURE);
 }
@@ -148,12 +237,15 @@ int main(int argc, char **argv) {
   
   int c=0, time=0, verbose=0;
   char *c_file=NULL;
-  int heap_size=HEAP_SIZE;
+  int heap_size=0;
   int pos_size=4, lcp_size=4;
   size_t RAM=0;
   int k=0, e;
+  char *dirs[64], *scratch=NULL;
+  int ndirs=0;
+  int threads=1;
   
-  while ((c=getopt(argc, argv, "s:vthk:m:")) != -1) {
+  while ((c=getopt(argc, argv, "s:vthk:m:X:p:")) != -1) {
     switch (c)
     {
       case 's':
@@ -168,6 +260,11 @@ int main(int argc, char **argv) {
         k=atoi(optarg); break;       // k-truncated LCP merging
       case 'm':
         RAM=(size_t)atoi(optarg)*MB; break;
+      case 'X':
+        scratch=optarg; break;       // scratch directories
+      case 'p':
+        threads=atoi(optarg); break; // threads for the last level
+
       case '?':
         exit(EXIT_FAILURE);
     }
@@ -199,15 +296,25 @@ int main(int argc, char **argv) {
     usage(argv[0]);
   }
   
-  if(heap_size<2){
+  if(heap_size!=0 && heap_size<2){
     puts("ERROR: s must be larger than 1");
     exit(EXIT_FAILURE);
   }
+  if(threads<1){
+    puts("ERROR: p must be at least 1");
+    exit(EXIT_FAILURE);
+  }
+
+  if(scratch){
+    for(char *d=strtok(scratch, ":"); d!=NULL && ndirs<64; d=strtok(NULL, ":"))
+      dirs[ndirs++]=d;
+  }
 
   
   //config
   char c_lcp[PATH_MAX], c_size[PATH_MAX];
   char c_lcp_multi[PATH_MAX], c_size_multi[PATH_MAX]; //multilevel
+  char c_prefix[PATH_MAX];
   
   sprintf(c_lcp, "%s.pair.lcp",  c_file);
   sprintf(c_size, "%s.size.lcp", c_file);
@@ -237,7 +344,7 @@ int main(int argc, char **argv) {
   
   //alloc heap
   int level=0, onelevel=0;
-  size_t i, blocks;
+  size_t i, blocks, runs;
   FILE *f_size, *f_lcp;
   heap *h;
   size_t size, seek=0;
@@ -248,42 +355,48 @@ int main(int argc, char **argv) {
   e = fread(&n, sizeof(size_t), 1, f_size);
   if(e!=1) {perror (__func__); exit(EXIT_FAILURE);}
   printf("Number of LCP entries in output file: = %zu\n", n);
+
+  //fan-in: as many runs as fit in RAM, so that usually one level is enough
+  runs = count_runs(c_size, 1);
+  if(!heap_size) heap_size = RAM ? heap_fanin(runs, RAM) : HEAP_SIZE;
+  if(verbose)
+    printf("Runs: %zu, fan-in: %d\n", runs, heap_size);
+  
+  if(runs<=heap_size){
+    onelevel=1;
+    if(verbose)
+      printf("%dx%zu\t\n", 1, runs);
+  }
+  else do{ // multilevel merging
   
-  //LEVEL 1 
-  do{ // multilevel merging
-  
-    //printf("INPUT: %s\t%s\n", c_lcp, c_size);
     seek=0;
-    
-    blocks=1; i=0; sum=0;
+    blocks=0; i=0; sum=0;
     level++;
-    h = heap_alloc(heap_size, c_lcp, level, pos_size, lcp_size, RAM);
-    
     
     //output
-    sprintf(c_lcp_multi, "%s.pair.%d.lcp", c_file, level);  
+    level_prefix(c_prefix, c_file, dirs, ndirs, level);
+    sprintf(c_lcp_multi, "%s.pair.%d.lcp", c_prefix, level);  
     f_lcp = file_open(c_lcp_multi, "wb");//lists file
     
-    sprintf(c_size_multi, "%s.size.%d.lcp", c_file, level);
+    sprintf(c_size_multi, "%s.size.%d.lcp", c_prefix, level);
     FILE* f_size_multi = file_open(c_size_multi, "wb");
     
-    /**/
+    size_t left=runs;
     while(fread(&size, sizeof(size_t), 1, f_size)){
-      //init heap
+      //new heap, the last one with the remaining runs
+      if(i==0)
+        h = heap_alloc(left<heap_size?left:heap_size, c_lcp, level, pos_size, lcp_size, RAM);
       #if DEBUG
         printf("%zu (%zu): ", size, seek);
       #endif
-      heap_insert(h, seek); //size == seek
+      heap_insert(h, seek, size);
       seek+=size;
+      left--;
       
-      if(++i == heap_size){
-            
-        heap_sort_level(h, f_lcp, &sum, c_file, level, k);     
+      if(++i == h->n){
+        heap_sort_level(h, f_lcp, &sum, c_file, level, k, 0);     
         fwrite(&sum, sizeof(size_t), 1, f_size_multi);
-      
-        //new heap
         heap_free(h, f_lcp, level);
-        h = heap_alloc(heap_size, c_lcp, level, pos_size, lcp_size, RAM);
         
         blocks++;
         i=0;
@@ -291,26 +404,10 @@ int main(int argc, char **argv) {
       }
     }
     
-    if(i){//last block
-      
-      if(blocks==1 && level==1){
-        onelevel=1;
-        fclose(f_lcp); fclose(f_size); fclose(f_size_multi);
-        //empty files
-        remove(c_size_multi);
-        remove(c_lcp_multi);
-        break;
-      }
-      
-      heap_sort_level(h, f_lcp, &sum, c_file, level, k);
-      fwrite(&sum, sizeof(size_t), 1, f_size_multi);    
-    }
-        
-    heap_free(h, f_lcp, level);
     fclose(f_lcp); fclose(f_size); fclose(f_size_multi);
     
     if(verbose)
-      printf("%zux%d+%zu\t\n", blocks-1, heap_size, i);
+      printf("%zux%d+%zu\t\n", runs/heap_size, heap_size, runs%heap_size);
     
     if(level>1){//do not remove the original inputs
       remove(c_lcp);
@@ -318,18 +415,15 @@ int main(int argc, char **argv) {
     }
     
     //input for the next level
-    sprintf(c_lcp, "%s.pair.%d.lcp", c_file, level);
-    sprintf(c_size, "%s.size.%d.lcp", c_file, level);
+    strcpy(c_lcp, c_lcp_multi);
+    strcpy(c_size, c_size_multi);
+    runs=blocks;
 
     f_size = fopen(c_size, "rb");//header file
   }
-  while(blocks>heap_size);
+  while(runs>heap_size);
   
-  if(onelevel){
-    if(verbose)
-      printf("%zux%d+%zu\t\n", blocks-1, heap_size, i);
-  }
-  else{
+  if(!onelevel){
     /**/
     if(time){
       printf("## LEVEL 1 ##\n");
@@ -340,59 +434,96 @@ int main(int argc, char **argv) {
     /**/
     
     //LEVEL 2
-    
-    //printf("INPUT: %s\t%s\n", c_lcp_multi, c_size_multi);
     if(verbose)
-      printf("%dx%zu\t\n", 1, blocks);
-    
-    f_size = file_open(c_size_multi, "rb");//header file
+      printf("%dx%zu\t\n", 1, runs);
+  }
+  
+  size_t total=0;
+
+  if(threads>1){
+    //the output is sorted by position: split [0,n) in equal ranges
+    size_t *start=malloc((runs+1)*sizeof(size_t)), *len=malloc((runs+1)*sizeof(size_t));
+    range_t *r=malloc(threads*sizeof(range_t));
+    pthread_t *t=malloc(threads*sizeof(pthread_t));
+    if(!start || !len || !r || !t) {perror("malloc"); exit(EXIT_FAILURE);}
+
+    seek=0; 
+    for(i=0; fread(&size, sizeof(size_t), 1, f_size); i++){
+      start[i]=seek; len[i]=size;
+      seek+=size;
+    }
+    fclose(f_size);
+
+    char c_out[PATH_MAX];
+    sprintf(c_out, "%s.%d.lcp", c_file, lcp_size);//final
+    int fd=open(c_out, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd<0 || ftruncate(fd, (off_t)n*lcp_size)!=0) {perror(c_out); exit(EXIT_FAILURE);}
 
-    h = heap_alloc(blocks, c_lcp_multi, 0, pos_size, lcp_size, RAM);
+    int j;
+    for(j=0; j<threads; j++){
+      r[j].c_lcp=c_lcp; r[j].start=start; r[j].size=len; r[j].runs=i;
+      r[j].pos_size=pos_size; r[j].lcp_size=lcp_size; r[j].k=k;
+      r[j].RAM=RAM/threads; r[j].fd=fd;
+      r[j].first=(uint64_t)n*j/threads; r[j].last=(uint64_t)n*(j+1)/threads;
+      if(pthread_create(&t[j], NULL, range_merge, &r[j])!=0) {perror("pthread_create"); exit(EXIT_FAILURE);}
+    }
+    for(j=0; j<threads; j++){
+      pthread_join(t[j], NULL);
+      total+=r[j].total;
+    }
+    if(close(fd)!=0) {perror(c_out); exit(EXIT_FAILURE);}
+    if(verbose)
+      printf("%d threads\n", threads);
+    printf("N = %zu (%zu)\n", total, n);
+    strcpy(c_lcp, c_out);
+
+    free(start); free(len); free(r); free(t);
+  }
+  else{
+    h = heap_alloc(runs>0?runs:1, c_lcp, 0, pos_size, lcp_size, RAM);
     seek=0;
     
     while(fread(&size, sizeof(size_t), 1, f_size)){
       #if DEBUG
         printf("%zu (%zu): ", size, seek);
       #endif
-      heap_insert(h, seek); //size == seek
+      heap_insert(h, seek, size);
       seek+=size;
     }
     
     fclose(f_size);
-  }
   
-  sprintf(c_lcp, "%s.%d.lcp", c_file, lcp_size);//linal
-  f_lcp = file_open(c_lcp, "wb");
+    sprintf(c_lcp, "%s.%d.lcp", c_file, lcp_size);//linal
+    f_lcp = file_open(c_lcp, "wb");
     
-  size_t total=0;
-  
-  #if CHECK == 1
-    if(heap_sort_level(h, f_lcp, &total, c_file, 0, k)) printf("isSorted!!\n");
-    else printf("isNotSorted!!\n");
-  #else
-    heap_sort_level(h, f_lcp, &total, c_file, 0, k);
-  #endif
+    #if CHECK == 1
+      if(heap_sort_level(h, f_lcp, &total, c_file, 0, k, 0)) printf("isSorted!!\n");
+      else printf("isNotSorted!!\n");
+    #else
+      heap_sort_level(h, f_lcp, &total, c_file, 0, k, 0);
+    #endif
   
-  printf("N = %zu (%zu)\n", total, n);
+    printf("N = %zu (%zu)\n", total, n);
 
-  if(k){
-    //complete LCP empty entries
-    /**/
-    int64_t curr=total;
-    int64_t pos=n;
+    if(k){
+      //complete LCP empty entries
+      /**/
+      int64_t curr=total;
+      int64_t pos=n;
 
-    pair aux=lcp(k); //k-truncated LCP-values
-    for(;curr<pos;curr++){
-      #if CHECK == 1
-        fprintf(stderr,"** %lu, %lu (lcp = %lu)\n", pos, curr, lcp(aux));
-      #endif
-      heap_write(h, f_lcp, aux, level);
+      pair aux=lcp(k); //k-truncated LCP-values
+      for(;curr<pos;curr++){
+        #if CHECK == 1
+          fprintf(stderr,"** %lu, %lu (lcp = %lu)\n", pos, curr, lcp(aux));
+        #endif
+        heap_write(h, f_lcp, aux, 0);
+      }
+      /**/
     }
-    /**/
-  }
   
-  heap_free(h, f_lcp, 0);
-  fclose(f_lcp);
+    heap_free(h, f_lcp, 0);
+    fclose(f_lcp);
+  }
   
   /**/
   if(time){
@@ -408,8 +539,10 @@ int main(int argc, char **argv) {
   
   printf("OUTPUT:\t%s\n", c_lcp);
   
-  remove(c_lcp_multi);
-  remove(c_size_multi);
+  if(!onelevel){
+    remove(c_lcp_multi);
+    remove(c_size_multi);
+  }
   
   //checking
   #if CHECK == 2
@@ -152,6 +152,7 @@ bool readBWTsingle(char *path, g_data *g)
     
   // remap BWTs and also init g->sizeOfAlpha etc   
   remap_bwts(g);    
+  if(g->ktuple>1) ktuple_remap_bwts(g); // replace symbols with k-tuples (option -k)
   if(g->extMem) { // if we are working in external memory don't keep the BWTs mmaped 
     int e = munmap(g->bws[0],g->mergeLen*sizeof(symbol));
     if(e) die("main (unmap bws)");
@@ -185,9 +186,25 @@ void check_g_data(g_data *g)
 }
 
 
+// open the files for the lcp values computed by the last round: the pair files
+// for mergelcp, or with lcpDirect the output lcp file which is mmapped 
 void open_unsortedLCP_files(g_data *g)
 {
   char filename[Filename_size];
+  if(g->lcpDirect) {
+    snprintf(filename,Filename_size,"%s.%s",g->outPath,LCP_EXT);
+    int fd = open(filename,O_RDWR|O_CREAT|O_TRUNC,0644);
+    if(fd==-1) {perror(filename); die(__func__);}
+    size_t bytes = g->mergeLen*sizeof(lcpInt);
+    if(ftruncate(fd,bytes)!=0) die(__func__);
+    g->lcpOut = mmap(NULL,bytes,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    if(g->lcpOut==MAP_FAILED) die(__func__);
+    if(close(fd)!=0) die(__func__);
+    // truncated lcp (see mergelcp -k): the values not found by gap are dbOrder 
+    if(g->dbOrder>0)
+      for(customInt i=0;i<g->mergeLen;i++) g->lcpOut[i] = g->dbOrder;
+    return;
+  }
   snprintf(filename,Filename_size,"%s.pair.lcp",g->outPath);
   g->unsortedLcp = fopen(filename,"wb");
   if(g->unsortedLcp==NULL) {perror(filename); die(__func__);}
@@ -197,30 +214,199 @@ void open_unsortedLCP_files(g_data *g)
   // write total size of the LCP array to first position of .size.lcp file 
   size_t e = fwrite(&(g->mergeLen),sizeof(customInt),1,g->unsortedLcp_size);  
   if(e!=1) die(__func__);
+  // buffer for the runs, size chosen by mem_plan 
+  lcpArena *a = malloc(sizeof(*a));
+  if(a==NULL) die(__func__);
+  a->size = g->buf.lcpWrite/(POS_SIZE+BSIZE);
+  if(a->size==0) a->size = 1;
+  a->pairs = malloc(a->size*(POS_SIZE+BSIZE));
+  a->outSize = a->size<LCP_OUT_PAIRS ? a->size : LCP_OUT_PAIRS; // see mem_buffers in io.c
+  a->out = malloc(a->outSize*(POS_SIZE+BSIZE));
+  a->maxruns = 16;
+  a->runs = malloc(a->maxruns*sizeof(size_t));
+  if(a->pairs==NULL || a->out==NULL || a->runs==NULL) die(__func__);
+  a->used = a->start = 0;
+  a->nruns = 0;
+  a->flushed = a->written = a->open = 0;
+  g->lcpRuns = a;
+}
+
+// position of a pair stored in the .pair.lcp format
+static inline uint64_t pair_pos(const uint8_t *p)
+{
+  uint64_t k=0;
+  memcpy(&k,p+BSIZE,POS_SIZE);  // little endian only
+  return k;
+}
+
+// sift down the run at position i of the heap h[0..n-1] of runs, key[r] is the position of the next pair of run r  
+static void lcpheap_down(int *h, int n, uint64_t *key, int i)
+{
+  int r = h[i];
+  while(2*i+1<n) {
+    int c = 2*i+1;
+    if(c+1<n && key[h[c+1]]<key[h[c]]) c++;
+    if(key[r]<=key[h[c]]) break;
+    h[i] = h[c];
+    i = c;
+  }
+  h[i] = r;
+}
+
+// write eof to .pair.lcp file and the size of the run (including eof) to .size.lcp file 
+static void lcpRuns_eof(uint64_t size, g_data *g)
+{
+  uint64_t b = ~0ULL; // all 1's 
+  size_t e = fwrite(&b,BSIZE,1,g->unsortedLcp);  
+  if(e!=1) die(__func__);
+  e = fwrite(&b,POS_SIZE,1,g->unsortedLcp);  
+  if(e!=1) die(__func__);
+  e = fwrite(&size,8,1,g->unsortedLcp_size);  
+  if(e!=1) die(__func__);
+  tmp_fdontneed(g->unsortedLcp); // the runs are not read again before phase 3
+  g->lcpRuns->flushed += size;
+  g->lcpRuns->written++;
+}
+
+// write the complete runs in the buffer, which end at pair end, to g->unsortedLcp 
+// as a single sorted run: the runs are merged using a heap 
+static void lcpRuns_merge(size_t end, g_data *g)
+{
+  lcpArena *a = g->lcpRuns;
+  const size_t ps = POS_SIZE+BSIZE;
+  int n = a->nruns;
+  assert(n>0);
+  if(n==1) {
+    if(fwrite(a->pairs,ps,end,g->unsortedLcp)!=end) die(__func__);
+  }
+  else {
+    size_t *cur = malloc(n*sizeof(size_t)), *last = malloc(n*sizeof(size_t));
+    uint64_t *key = malloc(n*sizeof(uint64_t));
+    int *h = malloc(n*sizeof(int));
+    if(!cur || !last || !key || !h) die(__func__);
+    for(int r=0;r<n;r++) {
+      cur[r] = a->runs[r];
+      last[r] = r+1<n ? a->runs[r+1] : end;
+      key[r] = pair_pos(a->pairs+cur[r]*ps);
+      h[r] = r;
+    }
+    for(int i=n/2-1;i>=0;i--) lcpheap_down(h,n,key,i);
+    size_t o=0;
+    while(n>0) {
+      int r = h[0];
+      memcpy(a->out+o*ps,a->pairs+cur[r]*ps,ps);
+      if(++o==a->outSize) {
+        if(fwrite(a->out,ps,o,g->unsortedLcp)!=o) die(__func__);
+        o = 0;
+      }
+      if(++cur[r]<last[r]) key[r] = pair_pos(a->pairs+cur[r]*ps);
+      else h[0] = h[--n];
+      if(n>0) lcpheap_down(h,n,key,0);
+    }
+    if(o>0 && fwrite(a->out,ps,o,g->unsortedLcp)!=o) die(__func__);
+    free(h); free(key); free(last); free(cur);
+  }
+  lcpRuns_eof(end+1,g);
+  a->nruns = 0;
 }
 
-// write a lcp/position pair to g->unsortedLcp
+// make room in the full buffer: the complete runs are merged and written, 
+// and the current run moved to the beginning of the buffer. If the current 
+// run fills the buffer by itself it is written without closing it
+static void lcpRuns_full(g_data *g)
+{
+  lcpArena *a = g->lcpRuns;
+  const size_t ps = POS_SIZE+BSIZE;
+  if(a->nruns==0) {
+    if(fwrite(a->pairs,ps,a->used,g->unsortedLcp)!=a->used) die(__func__);
+    a->open += a->used;
+    a->used = 0;
+  }
+  else {
+    lcpRuns_merge(a->start,g);
+    memmove(a->pairs,a->pairs+a->start*ps,(a->used-a->start)*ps);
+    a->used -= a->start;
+  }
+  a->start = 0;
+}
+
+// write a lcp/position pair to g->lcpRuns, or to g->unsortedLcp if there is no buffer 
 // uses BSIZE bytes for the LCP value POS_SIZE bytes (currently 5) for the position
 // everything is valid for little endian only! 
 void writeLcp(customInt k, uint32_t lcp, g_data *g)
 {
-  assert(g->unsortedLcp!=NULL);
   assert(lcp <= MAX_LCP_SIZE);
+  if(g->lcpOut!=NULL) { // lcpDirect: store the value at its final position
+    assert(k<g->mergeLen);
+    g->lcpOut[k] = lcp;
+    return;
+  }
+  assert(g->unsortedLcp!=NULL);
   if(k>=(1ULL<<(8*POS_SIZE))) { // at most pos_size bytes for the position
     fprintf(stderr,"%d bytes per position are not enough. Increase POS_SIZE and recompile\n",POS_SIZE); 
     exit(EXIT_FAILURE);
   } 
-  size_t e = fwrite(&lcp,BSIZE,1,g->unsortedLcp);
-  if(e!=1) die(__func__);
-  e = fwrite(&k,POS_SIZE,1,g->unsortedLcp);
-  if(e!=1) die(__func__);
+  lcpArena *a = g->lcpRuns;
+  if(a==NULL) {
+    size_t e = fwrite(&lcp,BSIZE,1,g->unsortedLcp);
+    if(e!=1) die(__func__);
+    e = fwrite(&k,POS_SIZE,1,g->unsortedLcp);
+    if(e!=1) die(__func__);
+    return;
+  }
+  if(a->used==a->size) lcpRuns_full(g);
+  uint8_t *p = a->pairs+a->used++*(POS_SIZE+BSIZE);
+  memcpy(p,&lcp,BSIZE);
+  memcpy(p+BSIZE,&k,POS_SIZE);
+}
+
+// write n lcp/position pairs in the .pair.lcp format, see writeLcp()
+void writeLcp_pairs(const void *pairs, size_t n, g_data *g)
+{
+  const size_t ps = POS_SIZE+BSIZE;
+  lcpArena *a = g->lcpRuns;
+  if(a==NULL) {
+    if(fwrite(pairs,ps,n,g->unsortedLcp)!=n) die(__func__);
+    return;
+  }
+  const uint8_t *p = pairs;
+  while(n>0) {
+    if(a->used==a->size) lcpRuns_full(g);
+    size_t m = a->size-a->used < n ? a->size-a->used : n;
+    memcpy(a->pairs+a->used*ps,p,m*ps);
+    a->used += m;
+    p += m*ps;
+    n -= m;
+  }
 }
 
-// write a lcp/position EOF to g->unsortedLcp, and the size of the current sorted block to g->unsortedLcp_size
+// close the current sorted run of lcp/position pairs containing size-1 pairs.
+// Without a buffer write a lcp/position EOF to g->unsortedLcp, and the size of 
+// the run to g->unsortedLcp_size, otherwise the run stays in the buffer 
+// unless part of it has already been written (see lcpRuns_full)
 void writeLcp_EOF(uint64_t size, g_data *g)
 {
+  if(g->lcpOut!=NULL) return; // lcpDirect: no runs
   assert(g->unsortedLcp!=NULL && g->unsortedLcp_size!=NULL);
-
+  lcpArena *a = g->lcpRuns;
+  if(a!=NULL) {
+    if(a->open>0) {
+      assert(a->nruns==0 && a->start==0);
+      if(fwrite(a->pairs,POS_SIZE+BSIZE,a->used,g->unsortedLcp)!=a->used) die(__func__);
+      lcpRuns_eof(a->open+a->used+1,g);
+      a->open = a->used = 0;
+      return;
+    }
+    if(a->used==a->start) return;
+    if(a->nruns==a->maxruns) {
+      a->maxruns *= 2;
+      a->runs = realloc(a->runs,a->maxruns*sizeof(size_t));
+      if(a->runs==NULL) die(__func__);
+    }
+    a->runs[a->nruns++] = a->start;
+    a->start = a->used;
+    return;
+  }
   // write eof to .pair.lcp file
   uint64_t b = ~0ULL; // all 1's 
   size_t e = fwrite(&b,BSIZE,1,g->unsortedLcp);  
@@ -230,11 +416,36 @@ void writeLcp_EOF(uint64_t size, g_data *g)
   // write size of complete LCP segment to .size.lcp file 
   e = fwrite(&size,8,1,g->unsortedLcp_size);  
   if(e!=1) die(__func__);
+  tmp_fdontneed(g->unsortedLcp); // the runs are not read again before phase 3
+}
+
+// number of lcp/position pairs (and EOFs) output so far 
+uint64_t countLcp(g_data *g)
+{
+  if(g->lcpRuns==NULL) return ftello(g->unsortedLcp)/(POS_SIZE+BSIZE);
+  lcpArena *a = g->lcpRuns;
+  return a->flushed+a->open+a->used+a->nruns;
 }
 
 
 void close_unsortedLCP_files(g_data *g)
 {
+   if(g->lcpOut!=NULL) {
+     if(munmap(g->lcpOut,g->mergeLen*sizeof(lcpInt))!=0) die(__func__);
+     g->lcpOut = NULL;
+     if(g->verbose>0) printf("LCP values written to %s.%s\n",g->outPath,LCP_EXT);
+     return;
+   }
+   lcpArena *a = g->lcpRuns;
+   if(a!=NULL) {
+     assert(a->open==0 && a->start==a->used);
+     if(a->nruns>0) lcpRuns_merge(a->used,g);
+     if(g->verbose>0) 
+       printf("LCP pairs: %ju in %ju sorted runs\n",(uintmax_t) a->flushed-a->written,(uintmax_t) a->written);
+     free(a->pairs); free(a->out); free(a->runs);
+     free(a);
+     g->lcpRuns = NULL;
+   }
    fclose(g->unsortedLcp); 
    fclose(g->unsortedLcp_size);
 }
@@ -326,28 +537,27 @@ void mergeBWTandLCP(g_data *g, bool lastRound)
     // mmap merge values
     int fd = open(g->merge_fname,O_RDWR);
     if(fd == -1) die(__func__);
-    g->mergeColor = mmap(NULL,g->mergeLen*sizeof(palette),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    g->mergeColor = mmap(NULL,g->mergeLen*g->zBytes,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
     if(g->mergeColor == MAP_FAILED) die(__func__);
     #ifdef USE_MMAP_ADVISE
-    madvise(g->mergeColor, g->mergeLen*sizeof(palette), MADV_SEQUENTIAL);
+    madvise(g->mergeColor, g->mergeLen*g->zBytes, MADV_SEQUENTIAL);
     #endif
     if(close(fd)!=0) die(__func__);
   }
   symbol *bwtout = (symbol *) g->mergeColor;   // merged BWT stored in mergeColor
   for (customInt i = 0; i < g->mergeLen; ++i) {
-    int currentColor = g->mergeColor[i];
+    int currentColor = z_get(g->mergeColor,i,g->zBytes); // not yet overwritten by bwtout[]
     assert(currentColor < g->numBwt);
-    // check that all LCP values have been obtained
-    if(g->lcpCompute && lastRound)
+    // check that all LCP values have been obtained (gapdbl has no B array)
+    if(g->lcpCompute && lastRound && g->bitB!=NULL)
       assert( tba_get(g->bitB,i)==3 ); 
     // if requested output merge array
     if(g->outputDA && lastRound) 
-      if(fputc(currentColor, daOutFile)==EOF)
+      if(fwrite(&currentColor,g->zBytes,1,daOutFile)!=1)
         die("mergeBWTandLCP: Error writing to Document Array file");   
     // save new BWT char overwriting mergeColor[i]
     if(g->extMem) {
-      int e = fread(bwtout+i,sizeof(symbol),1,g->bwf[currentColor]);
-      if(e!=1) die(__func__);
+      bwtout[i] = breader_getc(&g->bwf[currentColor]);
     }      
     else bwtout[i] = g->bws[currentColor][g->inCnt[currentColor]];
     if(lastRound) bwtout[i] = alpha_enlarge(bwtout[i]); 
@@ -373,7 +583,7 @@ void mergeBWTandLCP(g_data *g, bool lastRound)
     huge_pwrite(fd, bwtout,sizeof(symbol)*g->mergeLen,sizeof(symbol)*g->symb_offset);
     if(close(fd)!=0) die(__func__);
     // unmap mergeColor
-    fd = munmap(g->mergeColor,g->mergeLen*sizeof(palette));
+    fd = munmap(g->mergeColor,g->mergeLen*g->zBytes);
     if(fd == -1) die(__func__);
     g->mergeColor=NULL;  
   }
@@ -468,8 +678,7 @@ void mergeBWT128ext(g_data *g, bool lastRound)
         die("mergeBWT128ext: Error writing to QS file");   
     } 
     // save new BWT char overwriting mergeColor[i]
-    int e = fread(bwtout+i,sizeof(symbol),1,g->bwf[currentColor]);
-    if(e!=1) die(__func__);
+    bwtout[i] = breader_getc(&g->bwf[currentColor]);
     if(lastRound) bwtout[i] = alpha_enlarge(bwtout[i]);     
     g->inCnt[currentColor]++; // one more char read from currentColor BWT
   }  
@@ -624,8 +833,7 @@ void mergeBWT8(g_data *g, bool lastRound)
     } 
     // save new BWT char overwriting mergeColor[i]
     if(g->extMem) {
-      int e = fread(bwtout+i,sizeof(symbol),1,g->bwf[currentColor]);
-      if(e!=1) die(__func__);
+      bwtout[i] = breader_getc(&g->bwf[currentColor]);
     }      
     else bwtout[i] = g->bws[currentColor][g->inCnt[currentColor]];
     if(lastRound) bwtout[i] = alpha_enlarge(bwtout[i]); 
@@ -731,32 +939,31 @@ void mergeBWTandLCP256(g_data *g, bool lastRound)
 }
 
 
-// allocate or mmap arrays Z and newZ
+// allocate or mmap arrays Z and newZ with entries of g->zBytes bytes
 // only used by mergegap and mergehm (the latter does not support extermnal memory)
 void alloc_merge_arrays(g_data *g) {
   if(g->extMem) { // notice extMem overrules mmap
-    int e,fd;
-    e = asprintf(&(g->merge_fname),"%s.mrg0_XXXXXX",g->outPath);
-    if(e<0) die("merge temp file name creation failed (1)");
+    int fd;
+    g->merge_fname = tmp_template(g->outPath,TMP_MERGE,".mrg0_XXXXXX");
     fd = mkstemp(g->merge_fname);
     if(fd == -1) die("merge temp file creation failed (1)");
     if(close(fd)!=0) die("merge temp file close failed (1)");  // we don't need it now
-    e = asprintf(&(g->newmerge_fname),"%s.mrg1_XXXXXX",g->outPath);
-    if(e<0) die("merge temp file name creation failed (2)");
+    g->newmerge_fname = tmp_template(g->outPath,TMP_NEWMERGE,".mrg1_XXXXXX");
     fd = mkstemp(g->newmerge_fname);
     if(fd == -1) die("merge temp file creation failed (2)");
     if(close(fd)!=0) die("merge temp file close failed (2)");  // we don't need it now
     g->mergeColor = g->newMergeColor = NULL;
+    g->zrle = NULL; // created by open_merge_files
   }
   else if(g->mmapZ) {
-    g->mergeColor = mmap(NULL,g->mergeLen*sizeof(palette),PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    g->mergeColor = mmap(NULL,g->mergeLen*g->zBytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
     if(g->mergeColor== MAP_FAILED) die(__func__);
-    g->newMergeColor =  mmap(NULL,g->mergeLen*sizeof(palette),PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    g->newMergeColor =  mmap(NULL,g->mergeLen*g->zBytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
     if(g->newMergeColor== MAP_FAILED) die(__func__);
   }
   else {
-    g->mergeColor =     malloc(g->mergeLen*sizeof(palette)); 
-    g->newMergeColor =  malloc(g->mergeLen*sizeof(palette));
+    g->mergeColor =     malloc(g->mergeLen*g->zBytes); 
+    g->newMergeColor =  malloc(g->mergeLen*g->zBytes);
      if(!g->mergeColor || !g->newMergeColor) die(__func__);
   }
   // make sure these are not used 
@@ -772,11 +979,13 @@ void free_merge_arrays(g_data *g) {
     if(e!=0) perror("Error deleting temporary merge file (2)");
     free(g->merge_fname); // deallocate file names 
     free(g->newmerge_fname);
+    if(g->zrle) zrle_free(g->zrle);
+    g->zrle = NULL;
   }
   else if(g->mmapZ) {
-    int e = munmap(g->mergeColor,g->mergeLen*sizeof(palette));
+    int e = munmap(g->mergeColor,g->mergeLen*g->zBytes);
     if(e!=0) die("gap (unmap mergeColor)");
-    e = munmap(g->newMergeColor,g->mergeLen*sizeof(palette));
+    e = munmap(g->newMergeColor,g->mergeLen*g->zBytes);
     if(e!=0) die("gap (unmap newMergeColor)");  }
   else {
     free(g->newMergeColor);
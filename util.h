@@ -4,6 +4,17 @@
 #include "config.h"
 #include "alphabet.h"
 
+// access to entry i of a Z array whose entries take zb bytes (see g->zBytes)
+static inline int z_get(const palette *z, customInt i, const int zb)
+{
+  return zb==sizeof(palette2) ? ((const palette2 *) z)[i] : z[i];
+}
+static inline void z_set(palette *z, customInt i, int c, const int zb)
+{
+  if(zb==sizeof(palette2)) ((palette2 *) z)[i] = c;
+  else z[i] = c;
+}
+
 void alloc0_B_array(g_data *g);
 void free_B_array(g_data *g);
 void alloc_merge_arrays(g_data *g);
@@ -22,6 +33,8 @@ void open_unsortedLCP_files(g_data *g);
 void close_unsortedLCP_files(g_data *g);
 void writeLcp(customInt k, uint32_t lcp, g_data *g);
 void writeLcp_EOF(uint64_t size, g_data *g);
+void writeLcp_pairs(const void *pairs, size_t n, g_data *g);
+uint64_t countLcp(g_data *g);
 
 void array_clear(customInt* array, customInt size, customInt value);
 void array_copy(customInt *dest, customInt *src, customInt size);